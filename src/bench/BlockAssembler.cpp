@@ -0,0 +1,64 @@
+// Copyright (c) 2016 The Bitcoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+// HFP0 PRF added file (entire file): ancestor feerate block assembly from a 300 MB mempool
+#include "bench.h"
+#include "miner.h"
+#include "random.h"
+#include "txmempool.h"
+
+static const size_t ASSEMBLE_BENCH_MEMPOOL_BYTES = 300 << 20;
+static const uint64_t ASSEMBLE_BENCH_BLOCK_SIZE = 4000000;
+
+static CMutableTransaction MakeTx(const COutPoint& prevout)
+{
+    CMutableTransaction tx;
+    tx.vin.resize(1);
+    tx.vin[0].prevout = prevout;
+    tx.vin[0].scriptSig = CScript() << std::vector<unsigned char>(72, 0x30) << std::vector<unsigned char>(33, 0x02);
+    tx.vout.resize(2);
+    for (unsigned int i = 0; i < tx.vout.size(); i++) {
+        tx.vout[i].scriptPubKey = CScript() << OP_DUP << OP_HASH160 << std::vector<unsigned char>(20, i) << OP_EQUALVERIFY << OP_CHECKSIG;
+        tx.vout[i].nValue = COIN;
+    }
+    return tx;
+}
+
+/**
+ * Fill pool with mostly independent transactions, and every fourth one
+ * heading a chain of up to four where a descendant may pay for its parents.
+ */
+static void FillMempool(CTxMemPool& pool)
+{
+    int64_t nTime = 0;
+    while (pool.DynamicMemoryUsage() < ASSEMBLE_BENCH_MEMPOOL_BYTES) {
+        for (int n = 0; n < 1000; n++) {
+            CMutableTransaction tx = MakeTx(COutPoint(GetRandHash(), 0));
+            unsigned int nChain = (insecure_rand() % 4 == 0) ? 1 + insecure_rand() % 3 : 0;
+            for (unsigned int i = 0; i <= nChain; i++) {
+                if (i > 0)
+                    tx = MakeTx(COutPoint(tx.GetHash(), 0));
+                CAmount nFee = 1000 + insecure_rand() % 50000;
+                CTxMemPoolEntry entry(tx, nFee, nTime++, 0.0, 1, i == 0, 0, false, 1, LockPoints());
+                pool.addUnchecked(tx.GetHash(), entry);
+            }
+        }
+    }
+}
+
+static void AssembleBlock(benchmark::State& state)
+{
+    CTxMemPool pool(CFeeRate(0));
+    FillMempool(pool);
+
+    LOCK(pool.cs);
+    while (state.KeepRunning()) {
+        CBlockTemplate blocktemplate;
+        blocktemplate.block.vtx.push_back(CTransaction());
+        BlockAssembler assembler(pool, blocktemplate, 1, 0, ASSEMBLE_BENCH_BLOCK_SIZE, 0, ASSEMBLE_BENCH_BLOCK_SIZE / 50);
+        assembler.AddPackageTxs();
+    }
+}
+
+BENCHMARK(AssembleBlock);
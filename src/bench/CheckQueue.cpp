@@ -0,0 +1,94 @@
+// Copyright (c) 2016 The Bitcoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+// HFP0 PRF added file (entire file): script check queue scaling, 1 to 32 threads
+#include "bench.h"
+#include "checkqueue.h"
+#include "main.h"
+#include "primitives/transaction.h"
+#include "script/script.h"
+#include "script/interpreter.h"
+
+#include <vector>
+
+#include <boost/bind.hpp>
+#include <boost/thread.hpp>
+
+// Checks per iteration, added per transaction as ConnectBlock does
+static const int CHECKQUEUE_BENCH_TXS = 1000;
+static const int CHECKQUEUE_BENCH_INPUTS_PER_TX = 2;
+
+// Each hashing input stands in for a signature check: 200 rounds of
+// OP_SHA256 take about as long as one ECDSA verification.
+static const int CHECKQUEUE_BENCH_HASH_ROUNDS = 200;
+
+static CTransaction MakeSpendingTx()
+{
+    CMutableTransaction tx;
+    tx.vin.resize(CHECKQUEUE_BENCH_INPUTS_PER_TX);
+    for (int i = 0; i < CHECKQUEUE_BENCH_INPUTS_PER_TX; i++) {
+        tx.vin[i].prevout.n = i;
+        tx.vin[i].scriptSig << std::vector<unsigned char>(32, i);
+    }
+    tx.vout.resize(1);
+    tx.vout[0].nValue = 1;
+    return tx;
+}
+
+static void RunCheckQueue(benchmark::State& state, int nThreads, int nHashRounds)
+{
+    CTransaction tx = MakeSpendingTx();
+    CTxOut prevout;
+    prevout.nValue = 1;
+    for (int i = 0; i < nHashRounds; i++)
+        prevout.scriptPubKey << OP_SHA256;
+    prevout.scriptPubKey << OP_DROP << OP_TRUE;
+
+    CCheckQueue<CScriptCheck> queue(128, nThreads);
+    boost::thread_group threads;
+    for (int i = 0; i < nThreads - 1; i++)
+        threads.create_thread(boost::bind(&CCheckQueue<CScriptCheck>::Thread, &queue));
+
+    while (state.KeepRunning()) {
+        CCheckQueueControl<CScriptCheck> control(&queue);
+        for (int n = 0; n < CHECKQUEUE_BENCH_TXS; n++) {
+            std::vector<CScriptCheck> vChecks;
+            vChecks.reserve(CHECKQUEUE_BENCH_INPUTS_PER_TX);
+            for (int i = 0; i < CHECKQUEUE_BENCH_INPUTS_PER_TX; i++) {
+                vChecks.push_back(CScriptCheck());
+                CScriptCheck check(NULL, prevout, tx, i, SCRIPT_VERIFY_NONE, false);
+                check.swap(vChecks.back());
+            }
+            control.Add(vChecks);
+        }
+        bool fOk = control.Wait();
+        assert(fOk);
+    }
+
+    queue.Quit();
+    threads.join_all();
+}
+
+// Script execution cost, spread over the threads
+static void CheckQueueScripts1Thread(benchmark::State& state) { RunCheckQueue(state, 1, CHECKQUEUE_BENCH_HASH_ROUNDS); }
+static void CheckQueueScripts2Threads(benchmark::State& state) { RunCheckQueue(state, 2, CHECKQUEUE_BENCH_HASH_ROUNDS); }
+static void CheckQueueScripts4Threads(benchmark::State& state) { RunCheckQueue(state, 4, CHECKQUEUE_BENCH_HASH_ROUNDS); }
+static void CheckQueueScripts8Threads(benchmark::State& state) { RunCheckQueue(state, 8, CHECKQUEUE_BENCH_HASH_ROUNDS); }
+static void CheckQueueScripts16Threads(benchmark::State& state) { RunCheckQueue(state, 16, CHECKQUEUE_BENCH_HASH_ROUNDS); }
+static void CheckQueueScripts32Threads(benchmark::State& state) { RunCheckQueue(state, 32, CHECKQUEUE_BENCH_HASH_ROUNDS); }
+
+// Near-empty scripts, so the queue's own overhead dominates
+static void CheckQueueOverhead1Thread(benchmark::State& state) { RunCheckQueue(state, 1, 0); }
+static void CheckQueueOverhead8Threads(benchmark::State& state) { RunCheckQueue(state, 8, 0); }
+static void CheckQueueOverhead32Threads(benchmark::State& state) { RunCheckQueue(state, 32, 0); }
+
+BENCHMARK(CheckQueueScripts1Thread);
+BENCHMARK(CheckQueueScripts2Threads);
+BENCHMARK(CheckQueueScripts4Threads);
+BENCHMARK(CheckQueueScripts8Threads);
+BENCHMARK(CheckQueueScripts16Threads);
+BENCHMARK(CheckQueueScripts32Threads);
+BENCHMARK(CheckQueueOverhead1Thread);
+BENCHMARK(CheckQueueOverhead8Threads);
+BENCHMARK(CheckQueueOverhead32Threads);
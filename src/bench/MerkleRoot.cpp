@@ -0,0 +1,31 @@
+// Copyright (c) 2016 The Bitcoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+// HFP0 PRF added file (entire file): merkle roots of 1k to 20k leaves
+#include "bench.h"
+#include "consensus/merkle.h"
+#include "random.h"
+#include "uint256.h"
+
+#include <vector>
+
+static void RunMerkleRoot(benchmark::State& state, size_t nLeaves)
+{
+    std::vector<uint256> leaves(nLeaves);
+    for (size_t i = 0; i < nLeaves; i++)
+        leaves[i] = GetRandHash();
+    while (state.KeepRunning()) {
+        bool mutated = false;
+        uint256 hash = ComputeMerkleRoot(leaves, &mutated);
+        leaves[0] = hash;
+    }
+}
+
+static void MerkleRoot1000(benchmark::State& state) { RunMerkleRoot(state, 1000); }
+static void MerkleRoot5000(benchmark::State& state) { RunMerkleRoot(state, 5000); }
+static void MerkleRoot20000(benchmark::State& state) { RunMerkleRoot(state, 20000); }
+
+BENCHMARK(MerkleRoot1000);
+BENCHMARK(MerkleRoot5000);
+BENCHMARK(MerkleRoot20000);
@@ -0,0 +1,55 @@
+// Copyright (c) 2016 The Bitcoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+// HFP0 DIF added file (entire file): MIDAS interval averages, walk vs. block index cache
+#include "bench.h"
+#include "chain.h"
+#include "chainparams.h"
+#include "pow.h"
+
+#include <vector>
+
+static const int MIDAS_BENCH_HEADERS = 100000;
+
+static void BuildHeaderChain(std::vector<CBlockIndex>& blocks, const Consensus::Params& params)
+{
+    blocks.resize(MIDAS_BENCH_HEADERS);
+    for (int i = 0; i < MIDAS_BENCH_HEADERS; i++) {
+        blocks[i].pprev = i ? &blocks[i - 1] : NULL;
+        blocks[i].nHeight = i;
+        blocks[i].nTime = 1269211443 + i * params.nPowTargetSpacing + (i * 7919) % params.nPowTargetSpacing;
+        blocks[i].nBits = 0x207fffff;
+    }
+}
+
+// Queries hit the same parents repeatedly, as header acceptance,
+// CheckBlockIndex and getblocktemplate polling do.
+static void MidasWalk(benchmark::State& state)
+{
+    const Consensus::Params& params = Params(CBaseChainParams::MAIN).GetConsensus();
+    std::vector<CBlockIndex> blocks;
+    BuildHeaderChain(blocks, params);
+    int64_t avgOf5, avgOf7, avgOf9, avgOf17;
+    int i = 0;
+    while (state.KeepRunning()) {
+        avgRecentTimestamps(&blocks[i], &avgOf5, &avgOf7, &avgOf9, &avgOf17, params);
+        i = (i + 4099) % MIDAS_BENCH_HEADERS;
+    }
+}
+
+static void MidasCached(benchmark::State& state)
+{
+    const Consensus::Params& params = Params(CBaseChainParams::MAIN).GetConsensus();
+    std::vector<CBlockIndex> blocks;
+    BuildHeaderChain(blocks, params);
+    int64_t avgOf5, avgOf7, avgOf9, avgOf17;
+    int i = 0;
+    while (state.KeepRunning()) {
+        avgRecentTimestampsCached(&blocks[i], &avgOf5, &avgOf7, &avgOf9, &avgOf17, params);
+        i = (i + 4099) % MIDAS_BENCH_HEADERS;
+    }
+}
+
+BENCHMARK(MidasWalk);
+BENCHMARK(MidasCached);
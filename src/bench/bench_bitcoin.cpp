@@ -4,6 +4,7 @@
 
 #include "bench.h"
 
+#include "crypto/sha256.h"  // HFP0 PRF added
 #include "key.h"
 #include "main.h"
 #include "util.h"
@@ -11,6 +12,7 @@
 int
 main(int argc, char** argv)
 {
+    SHA256AutoDetect();  // HFP0 PRF added
     ECC_Start();
     SetupEnvironment();
     fPrintToDebugLog = false; // don't want to write to debug.log file
@@ -0,0 +1,58 @@
+// Copyright (c) 2016 The Bitcoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+// HFP0 PRF added file (entire file): SHA-256 with the implementation SHA256AutoDetect() picked
+#include "bench.h"
+#include "crypto/sha256.h"
+#include "hash.h"
+#include "uint256.h"
+
+#include <vector>
+
+/* Number of bytes to hash per iteration */
+static const uint64_t BUFFER_SIZE = 1000*1000;
+
+// Long messages: the single-stream transform
+static void SHA256_1MB(benchmark::State& state)
+{
+    uint8_t hash[CSHA256::OUTPUT_SIZE];
+    std::vector<uint8_t> in(BUFFER_SIZE, 0);
+    while (state.KeepRunning())
+        CSHA256().Write(begin_ptr(in), in.size()).Finalize(hash);
+}
+
+// Short messages, as txids of small transactions
+static void SHA256_32b(benchmark::State& state)
+{
+    std::vector<uint8_t> in(32, 0);
+    while (state.KeepRunning()) {
+        for (int i = 0; i < 1000000; i++)
+            CSHA256().Write(begin_ptr(in), in.size()).Finalize(begin_ptr(in));
+    }
+}
+
+// 1024 double hashes of 64-byte inputs, as one level of a merkle tree: one at a time...
+static void DoubleSHA256_64b_1024(benchmark::State& state)
+{
+    std::vector<uint8_t> in(64 * 1024, 0);
+    std::vector<uint256> out(1024);
+    while (state.KeepRunning()) {
+        for (int i = 0; i < 1024; i++)
+            CHash256().Write(&in[64 * i], 64).Finalize(out[i].begin());
+    }
+}
+
+// ...and on as many lanes as the CPU has
+static void SHA256D64_1024(benchmark::State& state)
+{
+    std::vector<uint8_t> in(64 * 1024, 0);
+    std::vector<uint256> out(1024);
+    while (state.KeepRunning())
+        SHA256D64(out[0].begin(), begin_ptr(in), 1024);
+}
+
+BENCHMARK(SHA256_1MB);
+BENCHMARK(SHA256_32b);
+BENCHMARK(DoubleSHA256_64b_1024);
+BENCHMARK(SHA256D64_1024);
@@ -7,16 +7,112 @@
 #include "chainparams.h"
 #include "blocksizecalculator.h"
 
+#include <deque>    // HFP0 BSZ added
+
 using namespace BlockSizeCalculator;
 using namespace std;
 
-static std::vector<unsigned int> blocksizes;
-static bool sorted = false;
 // HFP0 BSZ begin
-// track the last height, in order to reset or not insert redundantly
-static unsigned int last_height_seen = 0;
-// cache last result if called on same height
+/**
+ * Sizes of the nWindowBlocks blocks ending at pindexWindowTip (fewer near genesis),
+ * oldest first. Moving the tip by one block costs one size lookup and an
+ * O(log n) median update; reorgs shallower than the window are unwound and
+ * replayed block by block instead of re-reading the whole window.
+ */
+static const CBlockIndex* pindexWindowTip = NULL;
+static unsigned int nWindowBlocks = 0;
+static std::deque<int> windowSizes;  // -1 for blocks whose size could not be read, these are left out of the median
+static BlockSizeCalculator::CSlidingMedian windowMedian;
+// cache last result if called on same tip
+static const CBlockIndex* pindexLastResult = NULL;
 static unsigned int last_result_returned = 0;
+
+static void WindowPushBack(int size)
+{
+    windowSizes.push_back(size);
+    if (size != -1)
+        windowMedian.Insert(size);
+}
+
+static void WindowPushFront(int size)
+{
+    windowSizes.push_front(size);
+    if (size != -1)
+        windowMedian.Insert(size);
+}
+
+static void WindowForget(int size)
+{
+    if (size != -1)
+        windowMedian.Erase(size);
+}
+
+/** Advance the window by one block, pindex->pprev must be the current tip */
+static void WindowConnect(const CBlockIndex* pindex)
+{
+    WindowPushBack(::GetBlockSize(pindex));
+    if (windowSizes.size() > nWindowBlocks) {
+        WindowForget(windowSizes.front());
+        windowSizes.pop_front();
+    }
+    pindexWindowTip = pindex;
+}
+
+/** Move the window back by one block */
+static void WindowDisconnect()
+{
+    WindowForget(windowSizes.back());
+    windowSizes.pop_back();
+    const CBlockIndex* pindexNewTip = pindexWindowTip->pprev;
+    // the block which slid out of the window when the old tip was connected slides back in
+    int nHeightFirst = pindexNewTip->nHeight - (int)nWindowBlocks + 1;
+    if (nHeightFirst >= 1)
+        WindowPushFront(::GetBlockSize(pindexNewTip->GetAncestor(nHeightFirst)));
+    pindexWindowTip = pindexNewTip;
+}
+
+static void WindowRebuild(const CBlockIndex* pindex, unsigned int pastblocks)
+{
+    BlockSizeCalculator::ClearBlockSizes();
+    nWindowBlocks = pastblocks;
+    std::vector<const CBlockIndex*> vWindow;
+    for (const CBlockIndex* pwalk = pindex; pwalk != NULL && pwalk->nHeight > 0 && vWindow.size() < pastblocks; pwalk = pwalk->pprev)
+        vWindow.push_back(pwalk);
+    for (std::vector<const CBlockIndex*>::reverse_iterator it = vWindow.rbegin(); it != vWindow.rend(); ++it)
+        WindowPushBack(::GetBlockSize(*it));
+    pindexWindowTip = pindex;
+}
+
+/** Slide the window to end at pindex, rebuilding it only if that is cheaper */
+static void WindowUpdate(const CBlockIndex* pindex, unsigned int pastblocks)
+{
+    if (pindexWindowTip == NULL || pastblocks != nWindowBlocks ||
+        abs(pindex->nHeight - pindexWindowTip->nHeight) > (int)pastblocks) {
+        WindowRebuild(pindex, pastblocks);
+        return;
+    }
+
+    // find the fork point, giving up if it is deeper than the window
+    const CBlockIndex* pfork = pindexWindowTip->GetAncestor(std::min(pindex->nHeight, pindexWindowTip->nHeight));
+    const CBlockIndex* pother = pindex->GetAncestor(pfork->nHeight);
+    while (pfork != pother) {
+        if (pindexWindowTip->nHeight - pfork->nHeight >= (int)pastblocks) {
+            WindowRebuild(pindex, pastblocks);
+            return;
+        }
+        pfork = pfork->pprev;
+        pother = pother->pprev;
+    }
+    if ((pindexWindowTip->nHeight - pfork->nHeight) + (pindex->nHeight - pfork->nHeight) > (int)pastblocks) {
+        WindowRebuild(pindex, pastblocks);
+        return;
+    }
+
+    while (pindexWindowTip != pfork)
+        WindowDisconnect();
+    for (int nHeight = pfork->nHeight + 1; nHeight <= pindex->nHeight; nHeight++)
+        WindowConnect(pindex->GetAncestor(nHeight));
+}
 // HFP0 BSZ end
 
 unsigned int BlockSizeCalculator::ComputeBlockSize(CBlockIndex *pblockindex, unsigned int pastblocks) {
@@ -25,14 +121,12 @@ unsigned int BlockSizeCalculator::ComputeBlockSize(CBlockIndex *pblockindex, uns
 	unsigned int result = OLD_MAX_BLOCK_SIZE;
     const Consensus::Params& params = Params().GetConsensus();
 
-	if (pblockindex->nHeight < (int)last_height_seen) {
-	    ::ClearBlockSizes();
-    }
-    else if (pblockindex->nHeight == (int)last_height_seen) {
-        return last_result_returned;
-    }
-
+	// HFP0 BSZ begin: the median window follows the chain incrementally, also across reorgs
 	LOCK(cs_main);
+	if (pblockindex == pindexLastResult && pastblocks == nWindowBlocks) {
+	    return last_result_returned;
+	}
+	// HFP0 BSZ end
 
 	proposedMaxBlockSize = ::GetMedianBlockSize(pblockindex, pastblocks);
 #if HFP0_DEBUG_BSZ
@@ -77,151 +171,95 @@ unsigned int BlockSizeCalculator::ComputeBlockSize(CBlockIndex *pblockindex, uns
     // HFP0 DBG end
 #endif
 
-    last_height_seen = pblockindex->nHeight;
+    pindexLastResult = pblockindex;
     last_result_returned = result;
 	return result;
 
 }
 
 inline unsigned int BlockSizeCalculator::GetMedianBlockSize(
-		CBlockIndex *pblockindex, unsigned int pastblocks) {
-
-	blocksizes = ::GetBlockSizes(pblockindex, pastblocks);
+		const CBlockIndex *pblockindex, unsigned int pastblocks) {
 
-	if(!sorted) {
-		std::sort(blocksizes.begin(), blocksizes.end());
-		sorted = true;
-	}
+	// HFP0 BSZ begin: O(log n) update of a sliding window instead of a sort per call
+	WindowUpdate(pblockindex, pastblocks);
 
-	unsigned int vsize = blocksizes.size();
+	unsigned int vsize = windowMedian.Size();
 #if HFP0_DEBUG_BSZ
     // HFP0 DBG begin
     LogPrintf("HFP0 BSZ: vsize = %u\n", vsize);
     // HFP0 DBG end
 #endif
 	if (vsize == pastblocks) {
-		double median = 0;
-		if ((vsize % 2) == 0) {
-			median = (blocksizes[vsize / 2] + blocksizes[(vsize / 2) - 1]) / 2.0;
-		} else {
-			median = blocksizes[vsize / 2];
-		}
+		unsigned int median = windowMedian.Median();
 #if HFP0_DEBUG_BSZ
         // HFP0 DBG begin
-        LogPrintf("HFP0 BSZ: GetMedianBlockSize = %u\n", static_cast<unsigned int>(floor(median)));
+        LogPrintf("HFP0 BSZ: GetMedianBlockSize = %u\n", median);
         // HFP0 DBG end
 #endif
-		return static_cast<unsigned int>(floor(median));
+		return median;
 	} else {
 		return 0;
 	}
+	// HFP0 BSZ end
 
 }
 
 void BlockSizeCalculator::ClearBlockSizes() {
-    blocksizes.clear();
-    sorted = false;
+    // HFP0 BSZ begin
+    pindexWindowTip = NULL;
+    windowSizes.clear();
+    windowMedian.Clear();
+    pindexLastResult = NULL;
+    // HFP0 BSZ end
 }
 
-inline std::vector<unsigned int> BlockSizeCalculator::GetBlockSizes(
-		CBlockIndex *pblockindex, unsigned int pastblocks) {
-
-	if (pblockindex->nHeight < (int)pastblocks) {
-#if HFP0_DEBUG_BSZ
-        // HFP0 DBG begin
-        LogPrintf("HFP0 BSZ: GetBlockSizes: nHeight (%u) < pastblocks, returning blocksizes unchanged\n", pblockindex->nHeight);
-        // HFP0 DBG end
-#endif
-		return blocksizes;
-	}
-
-	int firstBlock = pblockindex->nHeight - pastblocks;
-
-#if HFP0_DEBUG_BSZ
-    // HFP0 DBG begin
-    LogPrintf("HFP0 BSZ: GetBlockSizes: firstBlock = %u\n", firstBlock);
-    // HFP0 DBG end
-#endif
-
-	if (blocksizes.size() > 0) {
-
-#if HFP0_DEBUG_BSZ
-        // HFP0 DBG begin
-        LogPrintf("HFP0 BSZ: GetBlockSizes: blocksizes.size() > 0 (%u)\n", blocksizes.size());
-        // HFP0 DBG end
-#endif
-
-		int latestBlockSize = ::GetBlockSize(pblockindex);
-
-		if (latestBlockSize != -1) {
-
-			CBlockIndex *firstBlockIndex = chainActive[firstBlock];
-			int oldestBlockSize = ::GetBlockSize(firstBlockIndex);
-			if (oldestBlockSize != -1) {
-				std::vector<unsigned int>::iterator it;
-				it = std::find(blocksizes.begin(), blocksizes.end(),
-						oldestBlockSize);
-				if (it != blocksizes.end()) {
-					blocksizes.erase(it);
-					it = std::lower_bound(blocksizes.begin(), blocksizes.end(),
-							latestBlockSize);
-					blocksizes.insert(it, latestBlockSize);
-#if HFP0_DEBUG_BSZ
-                    // HFP0 DBG begin
-                    LogPrintf("HFP0 BSZ: GetBlockSizes: inserting latest size %u\n", latestBlockSize);
-                    // HFP0 DBG end
-#endif
-				}
-#if HFP0_DEBUG_BSZ
-                else {
-                    // HFP0 DBG begin
-                    LogPrintf("HFP0 BSZ: GetBlockSizes: find yielded end of vector, not inserting latest size %u\n", latestBlockSize);
-                    // HFP0 DBG end
-                }
-#endif
-			}
-
-		}
-
-	} else {
-
-#if HFP0_DEBUG_BSZ
-        // HFP0 DBG begin
-        LogPrintf("HFP0 BSZ: GetBlockSizes: blocksizes.size() == 0, pushing back\n");
-        // HFP0 DBG end
-#endif
-
-		while (pblockindex != NULL && pblockindex->nHeight > firstBlock) {
-
-			int blocksize = ::GetBlockSize(pblockindex);
-			if (blocksize != -1) {
-
-				blocksizes.push_back(blocksize);
-
-#if HFP0_DEBUG_BSZ
-                // HFP0 DBG begin
-                LogPrintf("HFP0 BSZ: pushback: %u\n", blocksize);
-                // HFP0 DBG end
-#endif
-			}
-#if HFP0_DEBUG_BSZ
-            else {
-                // HFP0 DBG begin
-                LogPrintf("HFP0 BSZ: GetBlockSizes: not pushing back block at height %u because GetBlockSize = -1 (strange)\n", pblockindex->nHeight);
-                // HFP0 DBG end
-            }
-#endif
-
-			pblockindex = pblockindex->pprev;
-		}
+// HFP0 BSZ begin
+void BlockSizeCalculator::CSlidingMedian::Rebalance()
+{
+    while (lower.size() > upper.size() + 1) {
+        std::multiset<unsigned int>::iterator it = --lower.end();
+        upper.insert(*it);
+        lower.erase(it);
+    }
+    while (upper.size() > lower.size()) {
+        std::multiset<unsigned int>::iterator it = upper.begin();
+        lower.insert(*it);
+        upper.erase(it);
+    }
+}
 
-	}
+void BlockSizeCalculator::CSlidingMedian::Insert(unsigned int n)
+{
+    if (lower.empty() || n <= *lower.rbegin())
+        lower.insert(n);
+    else
+        upper.insert(n);
+    Rebalance();
+}
 
-	return blocksizes;
+bool BlockSizeCalculator::CSlidingMedian::Erase(unsigned int n)
+{
+    // every element of upper is >= every element of lower
+    std::multiset<unsigned int>& half = (!lower.empty() && n <= *lower.rbegin()) ? lower : upper;
+    std::multiset<unsigned int>::iterator it = half.find(n);
+    if (it == half.end())
+        return false;
+    half.erase(it);
+    Rebalance();
+    return true;
+}
 
+unsigned int BlockSizeCalculator::CSlidingMedian::Median() const
+{
+    if (lower.empty())
+        return 0;
+    if (lower.size() > upper.size())
+        return *lower.rbegin();
+    return (unsigned int)(((uint64_t)*lower.rbegin() + *upper.begin()) / 2);
 }
+// HFP0 BSZ end
 
-inline int BlockSizeCalculator::GetBlockSize(CBlockIndex *pblockindex) {
+inline int BlockSizeCalculator::GetBlockSize(const CBlockIndex *pblockindex) {
 
 	if (pblockindex == NULL) {
 #if HFP0_DEBUG_BSZ
@@ -232,6 +270,12 @@ inline int BlockSizeCalculator::GetBlockSize(CBlockIndex *pblockindex) {
 		return -1;
 	}
 
+	// HFP0 BSZ begin: recorded in the block index, only indexes from older versions need a disk read
+	if (pblockindex->nStatus & BLOCK_HAVE_SIZE) {
+		return pblockindex->nSize;
+	}
+	// HFP0 BSZ end
+
 	const CDiskBlockPos& pos = pblockindex->GetBlockPos();
 
 	CAutoFile filein(OpenBlockFile(pos, true), SER_DISK, CLIENT_VERSION);
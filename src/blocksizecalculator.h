@@ -10,6 +10,7 @@
 #include <iostream>
 #include <vector>
 #include <map>
+#include <set>      // HFP0 BSZ added
 #include <algorithm>
 #include "streams.h"
 #include "main.h"
@@ -22,16 +23,37 @@ using namespace std;
 
 namespace BlockSizeCalculator {
     // HFP0 BSZ begin
+    /**
+     * Median of a multiset of block sizes, kept as a lower and an upper half
+     * so that inserting or erasing a size is O(log n) and the median is O(1).
+     * Used to slide the median window along the chain one block at a time.
+     */
+    class CSlidingMedian
+    {
+    private:
+        std::multiset<unsigned int> lower; //! smaller half, holds one element more than upper if the size is odd
+        std::multiset<unsigned int> upper;
+        void Rebalance();
+
+    public:
+        void Insert(unsigned int n);
+        //! Remove one occurrence of n, returns false if not present
+        bool Erase(unsigned int n);
+        void Clear() { lower.clear(); upper.clear(); }
+        size_t Size() const { return lower.size() + upper.size(); }
+        //! Median (rounded down for an even number of sizes), 0 if empty
+        unsigned int Median() const;
+    };
+
     // change from BitPay: got rid of default values, they interfere with unit test
     // where the lookback window needs to be set smaller sometimes.
     unsigned int ComputeBlockSize(CBlockIndex*, unsigned int pastblocks );
-    inline unsigned int GetMedianBlockSize(CBlockIndex*, unsigned int pastblocks );
-    inline std::vector<unsigned int> GetBlockSizes(CBlockIndex*, unsigned int pastblocks );
+    inline unsigned int GetMedianBlockSize(const CBlockIndex*, unsigned int pastblocks );
     // HFP0 BSZ end
-    inline int GetBlockSize(CBlockIndex*);
+    inline int GetBlockSize(const CBlockIndex*);
     // HFP0 BSZ begin: added
     uint32_t ComputeScaledBlockMaxSize(uint32_t nBlockSizeMax, unsigned int maxBlockSize);
-    void ClearBlockSizes(); // added for unit tests - have to clear out window sometimes
+    void ClearBlockSizes(); // added for unit tests - have to clear out window sometimes; also when the block index is unloaded
     // HFP0 BSZ end
 }
 #endif
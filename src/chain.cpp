@@ -5,8 +5,17 @@
 
 #include "chain.h"
 
+#include "streams.h"  // HFP0 BSZ added
+
 using namespace std;
 
+// HFP0 BSZ begin
+bool BlockIndexHasMore(CDataStream& s)
+{
+    return !s.empty();
+}
+// HFP0 BSZ end
+
 /**
  * CChain implementation
  */
@@ -92,6 +92,8 @@ enum BlockStatus {
     BLOCK_FAILED_VALID       =   32, //! stage after last reached validness failed
     BLOCK_FAILED_CHILD       =   64, //! descends from failed block
     BLOCK_FAILED_MASK        =   BLOCK_FAILED_VALID | BLOCK_FAILED_CHILD,
+
+    BLOCK_HAVE_SIZE          =  128, //! HFP0 BSZ: nSize and nSigOps are known (absent in indexes written before they were added, see CDiskBlockIndex)
 };
 
 /** The block chain is a tree shaped structure starting with the
@@ -130,6 +132,14 @@ public:
     //! Note: in a potential headers-first mode, this number cannot be relied upon
     unsigned int nTx;
 
+    // HFP0 BSZ begin
+    //! Serialized size of this block in bytes. Only valid if nStatus & BLOCK_HAVE_SIZE
+    unsigned int nSize;
+
+    //! Legacy sigop count of this block. Only valid if nStatus & BLOCK_HAVE_SIZE
+    unsigned int nSigOps;
+    // HFP0 BSZ end
+
     //! (memory only) Number of transactions in the chain up to and including this block.
     //! This value will be non-zero only if and only if transactions for this block and all its parents are available.
     //! Change to 64-bit type when necessary; won't happen before 2030
@@ -148,6 +158,15 @@ public:
     //! (memory only) Sequential id assigned to distinguish order in which blocks are received.
     uint32_t nSequenceId;
 
+    // HFP0 DIF begin
+    //! (memory only) MIDAS cache: sums of the last 5, 7, 9 and 17 block intervals ending at this block
+    mutable int64_t nMidasIntervalSums[4];
+    //! (memory only) MIDAS cache: nMidasIntervalSums is valid
+    mutable bool fMidasIntervalSumsCached;
+    //! (memory only) MIDAS testnet cache: last block at or before this one not using the min-difficulty rule
+    mutable const CBlockIndex* pindexMidasLastRegular;
+    // HFP0 DIF end
+
     void SetNull()
     {
         phashBlock = NULL;
@@ -159,9 +178,17 @@ public:
         nUndoPos = 0;
         nChainWork = arith_uint256();
         nTx = 0;
+        nSize = 0;      // HFP0 BSZ
+        nSigOps = 0;    // HFP0 BSZ
         nChainTx = 0;
         nStatus = 0;
         nSequenceId = 0;
+        // HFP0 DIF begin
+        for (unsigned int i = 0; i < 4; i++)
+            nMidasIntervalSums[i] = 0;
+        fMidasIntervalSumsCached = false;
+        pindexMidasLastRegular = NULL;
+        // HFP0 DIF end
 
         nVersion       = 0;
         hashMerkleRoot = uint256();
@@ -282,6 +309,14 @@ public:
     const CBlockIndex* GetAncestor(int height) const;
 };
 
+// HFP0 BSZ begin
+class CDataStream;
+/** Whether a block index record has data left after the header; streams other than CDataStream are assumed to */
+template <typename Stream>
+inline bool BlockIndexHasMore(Stream& s) { return true; }
+bool BlockIndexHasMore(CDataStream& s);
+// HFP0 BSZ end
+
 /** Used to marshal pointers into hashes for db storage. */
 class CDiskBlockIndex : public CBlockIndex
 {
@@ -320,6 +355,19 @@ public:
         READWRITE(nTime);
         READWRITE(nBits);
         READWRITE(nNonce);
+
+        // HFP0 BSZ begin: appended after the header, which older versions stop
+        // reading at. They keep BLOCK_HAVE_SIZE in nStatus but drop the fields
+        // when they rewrite an entry, so after a downgrade and upgrade the bit
+        // can be set on a record that ends here. It is cleared then, and
+        // LoadBlockIndexDB fills the fields in again where they are needed.
+        if (ser_action.ForRead() && (nStatus & BLOCK_HAVE_SIZE) && !BlockIndexHasMore(s))
+            nStatus &= ~BLOCK_HAVE_SIZE;
+        if (nStatus & BLOCK_HAVE_SIZE) {
+            READWRITE(VARINT(nSize));
+            READWRITE(VARINT(nSigOps));
+        }
+        // HFP0 BSZ end
     }
 
     uint256 GetBlockHash() const
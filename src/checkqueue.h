@@ -6,8 +6,11 @@
 #define BITCOIN_CHECKQUEUE_H
 
 #include <algorithm>
+#include <assert.h>
+#include <deque>
 #include <vector>
 
+#include <boost/atomic.hpp>
 #include <boost/foreach.hpp>
 #include <boost/thread/condition_variable.hpp>
 #include <boost/thread/locks.hpp>
@@ -16,7 +19,7 @@
 template <typename T>
 class CCheckQueueControl;
 
-/** 
+/**
  * Queue for verifications that have to be performed.
   * The verifications are represented by a type T, which must provide an
   * operator(), returning a bool.
@@ -25,12 +28,52 @@ class CCheckQueueControl;
   * onto the queue, where they are processed by N-1 worker threads. When
   * the master is done adding work, it temporarily joins the worker pool
   * as an N'th worker, until all jobs are done.
+  *
+  * HFP0 PRF: every thread owns a local queue, slot 0 being the master's.
+  * Add() spreads new checks over the local queues; a thread works off its
+  * own queue newest first and, once that is empty, steals the oldest half
+  * of another thread's queue. Each local queue has its own mutex, so
+  * threads only contend when they steal from the same victim. Progress is
+  * counted with atomics, and the shared mutex is only taken to go to sleep
+  * or to wake sleepers. The first failing check makes every thread drop
+  * the remaining checks unexecuted.
   */
 template <typename T>
 class CCheckQueue
 {
 private:
-    //! Mutex to protect the inner state
+    //! A thread's local queue of checks
+    struct WorkerQueue {
+        boost::mutex mutex;
+        std::deque<T> queue;
+    };
+
+    //! One local queue per thread that may work on this queue; slot 0 is the master's
+    std::vector<WorkerQueue*> vQueues;
+
+    //! One past the highest slot in use, by the master or a running worker
+    boost::atomic<unsigned int> nSlots;
+
+    //! Which slots a running thread holds; slot 0 always is the master's. Guarded by mutex.
+    std::vector<bool> vSlotTaken;
+
+    //! Number of checks sitting in a local queue, not yet picked up by any thread
+    boost::atomic<unsigned int> nQueued;
+
+    /**
+     * Number of verifications that haven't completed yet.
+     * This includes elements that are no longer queued, but still in a
+     * thread's own batch.
+     */
+    boost::atomic<unsigned int> nTodo;
+
+    //! The temporary evaluation result; cleared by the first failing check
+    boost::atomic<bool> fAllOk;
+
+    //! Slot that receives the next checks from Add(); only used by the master
+    unsigned int nNextSlot;
+
+    //! Mutex for sleeping and waking up only; the local queues have their own
     boost::mutex mutex;
 
     //! Worker threads block on this when out of work
@@ -39,137 +82,245 @@ private:
     //! Master thread blocks on this when out of work
     boost::condition_variable condMaster;
 
-    //! The queue of elements to be processed.
-    //! As the order of booleans doesn't matter, it is used as a LIFO (stack)
-    std::vector<T> queue;
-
-    //! The number of workers (including the master) that are idle.
+    //! The number of workers that are waiting on condWorker
     int nIdle;
 
-    //! The total number of workers (including the master).
-    int nTotal;
+    //! Whether we're shutting down.
+    bool fQuit;
 
-    //! The temporary evaluation result.
-    bool fAllOk;
+    //! The maximum number of elements to be processed in one batch
+    unsigned int nBatchSize;
 
     /**
-     * Number of verifications that haven't completed yet.
-     * This includes elements that are no longer queued, but still in the
-     * worker's own batches.
+     * Move a batch of checks from a local queue into vChecks: the newest
+     * ones from our own queue, or the oldest half (at most nBatchSize) when
+     * stealing from another thread's.
      */
-    unsigned int nTodo;
+    unsigned int TakeFrom(WorkerQueue& source, bool fSteal, std::vector<T>& vChecks)
+    {
+        boost::unique_lock<boost::mutex> lock(source.mutex);
+        unsigned int nSize = source.queue.size();
+        unsigned int nNow = std::min(nBatchSize, fSteal ? (nSize + 1) / 2 : nSize);
+        for (unsigned int i = 0; i < nNow; i++) {
+            // Swap jobs out instead of copying, to keep the lock short.
+            vChecks.push_back(T());
+            if (fSteal) {
+                vChecks.back().swap(source.queue.front());
+                source.queue.pop_front();
+            } else {
+                vChecks.back().swap(source.queue.back());
+                source.queue.pop_back();
+            }
+        }
+        return nNow;
+    }
 
-    //! Whether we're shutting down.
-    bool fQuit;
+    /** Fill vChecks with a batch from our own queue, or failing that, from another thread's. */
+    bool Take(unsigned int nSelf, std::vector<T>& vChecks)
+    {
+        if (nQueued == 0)
+            return false;
+        unsigned int nTaken = TakeFrom(*vQueues[nSelf], false, vChecks);
+        // Every slot, not just those in use: a worker may have left while checks were added for it
+        const unsigned int nAll = vQueues.size();
+        for (unsigned int i = 1; nTaken == 0 && i < nAll; i++)
+            nTaken = TakeFrom(*vQueues[(nSelf + i) % nAll], true, vChecks);
+        if (nTaken == 0)
+            return false;
+        nQueued -= nTaken;
+        return true;
+    }
 
-    //! The maximum number of elements to be processed in one batch
-    unsigned int nBatchSize;
+    /** Run a batch of checks and account for their completion. */
+    void Run(std::vector<T>& vChecks)
+    {
+        BOOST_FOREACH (T& check, vChecks) {
+            // Once any check has failed, the result is known; skip the rest.
+            if (!fAllOk.load(boost::memory_order_relaxed))
+                break;
+            if (!check())
+                fAllOk = false;
+        }
+        const unsigned int nNow = vChecks.size();
+        vChecks.clear();
+        if (nTodo.fetch_sub(nNow) == nNow) {
+            // We processed the last element; inform the master it can exit and return the result
+            boost::unique_lock<boost::mutex> lock(mutex);
+            condMaster.notify_one();
+        }
+    }
+
+    /** Give a worker thread the lowest free slot. */
+    unsigned int AcquireSlot()
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        unsigned int nSelf = 1;
+        while (nSelf < vSlotTaken.size() && vSlotTaken[nSelf])
+            nSelf++;
+        assert(nSelf < vSlotTaken.size());
+        vSlotTaken[nSelf] = true;
+        if (nSlots <= nSelf)
+            nSlots = nSelf + 1;
+        return nSelf;
+    }
+
+    /**
+     * Free the slot of a worker thread that returned or was interrupted, so
+     * that workers can be stopped and started again any number of times.
+     * Checks still in its local queue move to the master's.
+     */
+    void ReleaseSlot(unsigned int nSelf)
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        {
+            boost::unique_lock<boost::mutex> lockSelf(vQueues[nSelf]->mutex);
+            boost::unique_lock<boost::mutex> lockMaster(vQueues[0]->mutex);
+            std::deque<T>& queue = vQueues[nSelf]->queue;
+            while (!queue.empty()) {
+                vQueues[0]->queue.push_back(T());
+                vQueues[0]->queue.back().swap(queue.front());
+                queue.pop_front();
+            }
+        }
+        vSlotTaken[nSelf] = false;
+        unsigned int nUsed = vSlotTaken.size();
+        while (!vSlotTaken[nUsed - 1])
+            nUsed--;
+        nSlots = nUsed;
+    }
 
     /** Internal function that does bulk of the verification work. */
-    bool Loop(bool fMaster = false)
+    bool Loop(unsigned int nSelf, bool fMaster = false)
     {
-        boost::condition_variable& cond = fMaster ? condMaster : condWorker;
         std::vector<T> vChecks;
         vChecks.reserve(nBatchSize);
-        unsigned int nNow = 0;
-        bool fOk = true;
         do {
-            {
-                boost::unique_lock<boost::mutex> lock(mutex);
-                // first do the clean-up of the previous loop run (allowing us to do it in the same critsect)
-                if (nNow) {
-                    fAllOk &= fOk;
-                    nTodo -= nNow;
-                    if (nTodo == 0 && !fMaster)
-                        // We processed the last element; inform the master it can exit and return the result
-                        condMaster.notify_one();
-                } else {
-                    // first iteration
-                    nTotal++;
+            if (Take(nSelf, vChecks)) {
+                Run(vChecks);
+                continue;
+            }
+            boost::unique_lock<boost::mutex> lock(mutex);
+            if (fMaster) {
+                if (nTodo == 0) {
+                    bool fRet = fAllOk;
+                    // reset the status for new work later
+                    fAllOk = true;
+                    nNextSlot = 0;
+                    // return the current status
+                    return fRet;
                 }
-                // logically, the do loop starts here
-                while (queue.empty()) {
-                    if ((fMaster || fQuit) && nTodo == 0) {
-                        nTotal--;
-                        bool fRet = fAllOk;
-                        // reset the status for new work later
-                        if (fMaster)
-                            fAllOk = true;
-                        // return the current status
-                        return fRet;
-                    }
+                // Only the master adds work, so nothing new can be queued while it waits.
+                if (nQueued == 0)
+                    condMaster.wait(lock);
+            } else {
+                if (fQuit)
+                    return false;
+                if (nQueued == 0) {
                     nIdle++;
-                    cond.wait(lock); // wait
+                    condWorker.wait(lock); // wait
                     nIdle--;
                 }
-                // Decide how many work units to process now.
-                // * Do not try to do everything at once, but aim for increasingly smaller batches so
-                //   all workers finish approximately simultaneously.
-                // * Try to account for idle jobs which will instantly start helping.
-                // * Don't do batches smaller than 1 (duh), or larger than nBatchSize.
-                nNow = std::max(1U, std::min(nBatchSize, (unsigned int)queue.size() / (nTotal + nIdle + 1)));
-                vChecks.resize(nNow);
-                for (unsigned int i = 0; i < nNow; i++) {
-                    // We want the lock on the mutex to be as short as possible, so swap jobs from the global
-                    // queue to the local batch vector instead of copying.
-                    vChecks[i].swap(queue.back());
-                    queue.pop_back();
-                }
-                // Check whether we need to do work at all
-                fOk = fAllOk;
             }
-            // execute work
-            BOOST_FOREACH (T& check, vChecks)
-                if (fOk)
-                    fOk = check();
-            vChecks.clear();
         } while (true);
     }
 
 public:
-    //! Create a new check queue
-    CCheckQueue(unsigned int nBatchSizeIn) : nIdle(0), nTotal(0), fAllOk(true), nTodo(0), fQuit(false), nBatchSize(nBatchSizeIn) {}
+    //! Create a new check queue for up to nMaxThreadsIn threads, the master included
+    CCheckQueue(unsigned int nBatchSizeIn, unsigned int nMaxThreadsIn) :
+        nSlots(1), nQueued(0), nTodo(0), fAllOk(true), nNextSlot(0), nIdle(0), fQuit(false), nBatchSize(nBatchSizeIn)
+    {
+        assert(nMaxThreadsIn >= 1);
+        for (unsigned int i = 0; i < nMaxThreadsIn; i++)
+            vQueues.push_back(new WorkerQueue());
+        vSlotTaken.resize(nMaxThreadsIn, false);
+        vSlotTaken[0] = true;
+    }
 
     //! Worker thread
     void Thread()
     {
-        Loop();
+        unsigned int nSelf = AcquireSlot();
+        try {
+            Loop(nSelf);
+        } catch (...) {
+            // Interrupted (boost::thread_interrupted) while waiting for work
+            ReleaseSlot(nSelf);
+            throw;
+        }
+        ReleaseSlot(nSelf);
     }
 
     //! Wait until execution finishes, and return whether all evaluations were successful.
     bool Wait()
     {
-        return Loop(true);
+        return Loop(0, true);
     }
 
     //! Add a batch of checks to the queue
     void Add(std::vector<T>& vChecks)
     {
-        boost::unique_lock<boost::mutex> lock(mutex);
-        BOOST_FOREACH (T& check, vChecks) {
-            queue.push_back(T());
-            check.swap(queue.back());
-        }
+        if (vChecks.empty())
+            return;
+        // An earlier check failed already; these would never run.
+        if (!fAllOk)
+            return;
+        const unsigned int nUsed = std::min(nSlots.load(), (unsigned int)vQueues.size());
+        const unsigned int nPerSlot = (vChecks.size() + nUsed - 1) / nUsed;
         nTodo += vChecks.size();
-        if (vChecks.size() == 1)
-            condWorker.notify_one();
-        else if (vChecks.size() > 1)
-            condWorker.notify_all();
+        nQueued += vChecks.size();
+        for (unsigned int nFirst = 0; nFirst < vChecks.size(); nFirst += nPerSlot) {
+            WorkerQueue& target = *vQueues[nNextSlot % nUsed];
+            nNextSlot = (nNextSlot + 1) % nUsed;
+            const unsigned int nEnd = std::min(nFirst + nPerSlot, (unsigned int)vChecks.size());
+            boost::unique_lock<boost::mutex> lock(target.mutex);
+            for (unsigned int i = nFirst; i < nEnd; i++) {
+                target.queue.push_back(T());
+                vChecks[i].swap(target.queue.back());
+            }
+        }
+        {
+            boost::unique_lock<boost::mutex> lock(mutex);
+            if (nIdle > 0) {
+                if (vChecks.size() == 1)
+                    condWorker.notify_one();
+                else
+                    condWorker.notify_all();
+            }
+        }
+        // Join in while adding once there is more work queued than the
+        // workers can pick up in one batch each.
+        if (nQueued > nBatchSize * nUsed) {
+            std::vector<T> vBatch;
+            if (TakeFrom(*vQueues[0], false, vBatch) > 0) {
+                nQueued -= vBatch.size();
+                Run(vBatch);
+            }
+        }
     }
 
     ~CCheckQueue()
     {
+        BOOST_FOREACH (WorkerQueue* pqueue, vQueues)
+            delete pqueue;
+    }
+
+    //! Make idle and future worker threads return
+    void Quit()
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        fQuit = true;
+        condWorker.notify_all();
     }
 
     bool IsIdle()
     {
         boost::unique_lock<boost::mutex> lock(mutex);
-        return (nTotal == nIdle && nTodo == 0 && fAllOk == true);
+        return (nTodo == 0 && nQueued == 0 && fAllOk == true);
     }
 
 };
 
-/** 
+/**
  * RAII-style controller object for a CCheckQueue that guarantees the passed
  * queue is finished before continuing.
  */
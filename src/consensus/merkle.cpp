@@ -1,5 +1,6 @@
 #include "merkle.h"
 #include "hash.h"
+#include "crypto/sha256.h"  // HFP0 PRF added
 #include "utilstrencodings.h"
 
 /*     WARNING! If you're reading this because you're learning about crypto
@@ -126,11 +127,38 @@ static void MerkleComputation(const std::vector<uint256>& leaves, uint256* proot
     if (proot) *proot = h;
 }
 
+// HFP0 PRF begin
+/**
+ * Compute the merkle root level by level, overwriting hashes. Each level is
+ * hashed with one SHA256D64 call, which works on several node pairs at once
+ * where the CPU allows. The result, and whether the tree is mutated, are the
+ * same as MerkleComputation's.
+ */
+static uint256 ComputeMerkleRootInPlace(std::vector<uint256>& hashes, bool* mutated) {
+    bool mutation = false;
+    while (hashes.size() > 1) {
+        if (mutated) {
+            for (size_t pos = 0; pos + 1 < hashes.size(); pos += 2) {
+                if (hashes[pos] == hashes[pos + 1]) mutation = true;
+            }
+        }
+        if (hashes.size() & 1) {
+            hashes.push_back(hashes.back());
+        }
+        // The pairs are consecutive 64-byte inputs, hashed in place
+        SHA256D64(hashes[0].begin(), hashes[0].begin(), hashes.size() / 2);
+        hashes.resize(hashes.size() / 2);
+    }
+    if (mutated) *mutated = mutation;
+    if (hashes.size() == 0) return uint256();
+    return hashes[0];
+}
+
 uint256 ComputeMerkleRoot(const std::vector<uint256>& leaves, bool* mutated) {
-    uint256 hash;
-    MerkleComputation(leaves, &hash, mutated, -1, NULL);
-    return hash;
+    std::vector<uint256> hashes(leaves);
+    return ComputeMerkleRootInPlace(hashes, mutated);
 }
+// HFP0 PRF end
 
 std::vector<uint256> ComputeMerkleBranch(const std::vector<uint256>& leaves, uint32_t position) {
     std::vector<uint256> ret;
@@ -158,7 +186,7 @@ uint256 BlockMerkleRoot(const CBlock& block, bool* mutated)
     for (size_t s = 0; s < block.vtx.size(); s++) {
         leaves[s] = block.vtx[s].GetHash();
     }
-    return ComputeMerkleRoot(leaves, mutated);
+    return ComputeMerkleRootInPlace(leaves, mutated);  // HFP0 PRF changed
 }
 
 std::vector<uint256> BlockMerkleBranch(const CBlock& block, uint32_t position)
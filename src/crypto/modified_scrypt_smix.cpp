@@ -40,6 +40,16 @@
 #include "modified_scrypt_sha256.h"
 #include "modified_scrypt_smix.h"
 
+// HFP0 POW begin: SIMD salsa20/8 kernel
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#define HAVE_SCRYPT_SSE2 1
+#if defined(__GNUC__)
+#include <cpuid.h>
+#endif
+#endif
+// HFP0 POW end
+
 inline void blkcpy(void *, const void *, size_t);
 inline void blkxor(void *, const void *, size_t);
 inline void salsa20_8(uint32_t[16]);
@@ -163,6 +173,173 @@ integerify(const void * B)
 	return (((uint64_t)(X[1]) << 32) + X[0]);
 }
 
+// HFP0 POW begin: SIMD salsa20/8 kernel
+/** Portable kernel, the original C implementation above */
+struct smix_kernel_scalar
+{
+	static inline void blkcpy(void * dest, const void * src, size_t len)
+	{
+		::blkcpy(dest, src, len);
+	}
+
+	static inline void blkxor(void * dest, const void * src, size_t len)
+	{
+		::blkxor(dest, src, len);
+	}
+
+	static inline void blockmix_salsa8(const uint32_t * Bin, uint32_t * Bout, uint32_t * X)
+	{
+		::blockmix_salsa8(Bin, Bout, X);
+	}
+};
+
+#if HAVE_SCRYPT_SSE2
+/**
+ * SSE2 kernel. The memory layout of all blocks is left unchanged, since the
+ * random passes of the modified smix read and write V in that layout; only
+ * salsa20_8 internally works on the diagonals of the 4x4 matrix, so that each
+ * quarter-round step handles four words at once.
+ */
+struct smix_kernel_sse2
+{
+	static inline void blkcpy(void * dest, const void * src, size_t len)
+	{
+		__m128i * D = (__m128i *)dest;
+		const __m128i * S = (const __m128i *)src;
+		size_t L = len / 16;
+		size_t i;
+
+		for (i = 0; i < L; i++)
+			_mm_storeu_si128(&D[i], _mm_loadu_si128(&S[i]));
+	}
+
+	static inline void blkxor(void * dest, const void * src, size_t len)
+	{
+		__m128i * D = (__m128i *)dest;
+		const __m128i * S = (const __m128i *)src;
+		size_t L = len / 16;
+		size_t i;
+
+		for (i = 0; i < L; i++)
+			_mm_storeu_si128(&D[i], _mm_xor_si128(_mm_loadu_si128(&D[i]), _mm_loadu_si128(&S[i])));
+	}
+
+	static inline void salsa20_8(uint32_t B[16])
+	{
+		/* Diagonals: X0 = (0,5,10,15), X1 = (4,9,14,3), X2 = (8,13,2,7), X3 = (12,1,6,11) */
+		const __m128i B0 = _mm_setr_epi32(B[ 0], B[ 5], B[10], B[15]);
+		const __m128i B1 = _mm_setr_epi32(B[ 4], B[ 9], B[14], B[ 3]);
+		const __m128i B2 = _mm_setr_epi32(B[ 8], B[13], B[ 2], B[ 7]);
+		const __m128i B3 = _mm_setr_epi32(B[12], B[ 1], B[ 6], B[11]);
+		__m128i X0 = B0, X1 = B1, X2 = B2, X3 = B3;
+		__m128i T;
+		uint32_t x[16];
+		size_t i;
+
+		for (i = 0; i < 8; i += 2) {
+#define R(v,b) _mm_xor_si128(_mm_slli_epi32((v), (b)), _mm_srli_epi32((v), 32 - (b)))
+			/* Operate on columns. */
+			T = _mm_add_epi32(X0, X3);
+			X1 = _mm_xor_si128(X1, R(T, 7));
+			T = _mm_add_epi32(X1, X0);
+			X2 = _mm_xor_si128(X2, R(T, 9));
+			T = _mm_add_epi32(X2, X1);
+			X3 = _mm_xor_si128(X3, R(T, 13));
+			T = _mm_add_epi32(X3, X2);
+			X0 = _mm_xor_si128(X0, R(T, 18));
+
+			/* Rearrange data. */
+			X1 = _mm_shuffle_epi32(X1, 0x93);
+			X2 = _mm_shuffle_epi32(X2, 0x4E);
+			X3 = _mm_shuffle_epi32(X3, 0x39);
+
+			/* Operate on rows. */
+			T = _mm_add_epi32(X0, X1);
+			X3 = _mm_xor_si128(X3, R(T, 7));
+			T = _mm_add_epi32(X3, X0);
+			X2 = _mm_xor_si128(X2, R(T, 9));
+			T = _mm_add_epi32(X2, X3);
+			X1 = _mm_xor_si128(X1, R(T, 13));
+			T = _mm_add_epi32(X1, X2);
+			X0 = _mm_xor_si128(X0, R(T, 18));
+
+			/* Rearrange data. */
+			X1 = _mm_shuffle_epi32(X1, 0x39);
+			X2 = _mm_shuffle_epi32(X2, 0x4E);
+			X3 = _mm_shuffle_epi32(X3, 0x93);
+#undef R
+		}
+
+		_mm_storeu_si128((__m128i *)&x[ 0], _mm_add_epi32(X0, B0));
+		_mm_storeu_si128((__m128i *)&x[ 4], _mm_add_epi32(X1, B1));
+		_mm_storeu_si128((__m128i *)&x[ 8], _mm_add_epi32(X2, B2));
+		_mm_storeu_si128((__m128i *)&x[12], _mm_add_epi32(X3, B3));
+		B[ 0] = x[ 0]; B[ 5] = x[ 1]; B[10] = x[ 2]; B[15] = x[ 3];
+		B[ 4] = x[ 4]; B[ 9] = x[ 5]; B[14] = x[ 6]; B[ 3] = x[ 7];
+		B[ 8] = x[ 8]; B[13] = x[ 9]; B[ 2] = x[10]; B[ 7] = x[11];
+		B[12] = x[12]; B[ 1] = x[13]; B[ 6] = x[14]; B[11] = x[15];
+	}
+
+	/* Same as blockmix_salsa8() above, for r=1 */
+	static inline void blockmix_salsa8(const uint32_t * Bin, uint32_t * Bout, uint32_t * X)
+	{
+		blkcpy(X, &Bin[16], 64);
+
+		blkxor(X, &Bin[0], 64);
+		salsa20_8(X);
+		blkcpy(&Bout[0], X, 64);
+
+		blkxor(X, &Bin[16], 64);
+		salsa20_8(X);
+		blkcpy(&Bout[16], X, 64);
+	}
+};
+
+static bool
+smix_sse2_supported()
+{
+#if defined(__GNUC__)
+	unsigned int eax, ebx, ecx, edx;
+	if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx))
+		return false;
+	return (edx & bit_SSE2) != 0;
+#else
+	return true;
+#endif
+}
+#endif
+
+/** Whether the SIMD kernel is selected, decided once from CPUID */
+#if HAVE_SCRYPT_SSE2
+static bool fSmixUseSimd = smix_sse2_supported();
+#else
+static bool fSmixUseSimd = false;
+#endif
+
+bool
+crypto_scrypt_smix_simd_available()
+{
+#if HAVE_SCRYPT_SSE2
+	return smix_sse2_supported();
+#else
+	return false;
+#endif
+}
+
+bool
+crypto_scrypt_smix_use_simd(bool fUse)
+{
+	fSmixUseSimd = fUse && crypto_scrypt_smix_simd_available();
+	return fSmixUseSimd;
+}
+
+const char *
+crypto_scrypt_smix_kernel()
+{
+	return fSmixUseSimd ? "sse2" : "scalar";
+}
+// HFP0 POW end
+
 /**
  * crypto_scrypt_smix(B, N, V, XY):
  * Compute B = SMix_r(B, N).  The input B must be 128 bytes in length;
@@ -171,8 +348,9 @@ integerify(const void * B)
  * power of 2 greater than 1.  The arrays B, V, and XY must be aligned to a
  * multiple of 64 bytes.
  */
-void
-crypto_scrypt_smix(uint8_t * B, uint64_t N, void * _V, void * XY)
+template <typename Kernel>
+static void
+crypto_scrypt_smix_generic(uint8_t * B, uint64_t N, void * _V, void * XY)
 {
 	size_t r = 1; // Using r=1, let the compiler optimize r out rather than by hand
 
@@ -259,16 +437,16 @@ crypto_scrypt_smix(uint8_t * B, uint64_t N, void * _V, void * XY)
 	/* 2: for i = 0 to N - 1 do */
 	for (i = 0; i < N; i += 2) {
 		/* 3: V_i <-- X */
-		blkcpy(&V[i * (32 * r)], X, 128 * r);
+		Kernel::blkcpy(&V[i * (32 * r)], X, 128 * r);
 
 		/* 4: X <-- H(X) */
-		blockmix_salsa8(X, Y, Z);
+		Kernel::blockmix_salsa8(X, Y, Z);
 
 		/* 3: V_i <-- X */
-		blkcpy(&V[(i + 1) * (32 * r)], Y, 128 * r);
+		Kernel::blkcpy(&V[(i + 1) * (32 * r)], Y, 128 * r);
 
 		/* 4: X <-- H(X) */
-		blockmix_salsa8(Y, X, Z);
+		Kernel::blockmix_salsa8(Y, X, Z);
 	}
 
 	/*** Passes 2-3 - New random and simple operations over the dataset 2 times ***/
@@ -328,15 +506,15 @@ crypto_scrypt_smix(uint8_t * B, uint64_t N, void * _V, void * XY)
 		j = integerify(X) & (N - 1);
 
 		/* 8: X <-- H(X \xor V_j) */
-		blkxor(X, &V[j * (32 * r)], 128 * r);
-		blockmix_salsa8(X, Y, Z);
+		Kernel::blkxor(X, &V[j * (32 * r)], 128 * r);
+		Kernel::blockmix_salsa8(X, Y, Z);
 
 		/* 7: j <-- Integerify(X) mod N */
 		j = integerify(Y) & (N - 1);
 
 		/* 8: X <-- H(X \xor V_j) */
-		blkxor(Y, &V[j * (32 * r)], 128 * r);
-		blockmix_salsa8(Y, X, Z);
+		Kernel::blkxor(Y, &V[j * (32 * r)], 128 * r);
+		Kernel::blockmix_salsa8(Y, X, Z);
 	}
 
 	/* 10: B' <-- X */
@@ -344,6 +522,20 @@ crypto_scrypt_smix(uint8_t * B, uint64_t N, void * _V, void * XY)
 		le32enc(&B[4 * k], X[k]);
 }
 
+// HFP0 POW begin: SIMD salsa20/8 kernel
+void
+crypto_scrypt_smix(uint8_t * B, uint64_t N, void * V, void * XY)
+{
+#if HAVE_SCRYPT_SSE2
+	if (fSmixUseSimd) {
+		crypto_scrypt_smix_generic<smix_kernel_sse2>(B, N, V, XY);
+		return;
+	}
+#endif
+	crypto_scrypt_smix_generic<smix_kernel_scalar>(B, N, V, XY);
+}
+// HFP0 POW end
+
 int
 crypto_1M_1_1_256_scrypt(const uint8_t * passwd, size_t passwdlen,
               void * V0, uint8_t * buf, size_t buflen )
@@ -24,5 +24,28 @@ void crypto_scrypt_smix(uint8_t *, uint64_t, void *, void *);
  */
 int crypto_1M_1_1_256_scrypt(const uint8_t *, size_t, void *, uint8_t *, size_t);
 
+/* HFP0 POW begin: SIMD salsa20/8 kernel */
+/**
+ * crypto_scrypt_smix_simd_available():
+ * Return whether a SIMD (SSE2) salsa20/8 kernel is compiled in and supported
+ * by this CPU.  It is selected by default when available.
+ */
+bool crypto_scrypt_smix_simd_available();
+
+/**
+ * crypto_scrypt_smix_use_simd(fUse):
+ * Select the SIMD kernel (if available) or the portable one, for testing and
+ * benchmarking.  Both produce identical results.  Return whether the SIMD
+ * kernel is now in use.  Must not be called while hashes are computed.
+ */
+bool crypto_scrypt_smix_use_simd(bool);
+
+/**
+ * crypto_scrypt_smix_kernel():
+ * Return the name of the kernel in use.
+ */
+const char * crypto_scrypt_smix_kernel();
+/* HFP0 POW end */
+
 #endif /* !_CRYPTO_SCRYPT_SMIX_H_ */
 /* HFP0 POW end */
@@ -7,6 +7,7 @@
 
 #include <stdint.h>
 #include <stdlib.h>
+#include <string>  // HFP0 PRF added
 
 /** A hasher class for SHA-256. */
 class CSHA256
@@ -25,4 +26,21 @@ public:
     CSHA256& Reset();
 };
 
+// HFP0 PRF begin
+/**
+ * Select the fastest SHA-256 implementations this CPU supports, instead of the
+ * portable one, and return a description of them. Not thread-safe: call it at
+ * startup, before hashing on several threads.
+ */
+std::string SHA256AutoDetect();
+
+/**
+ * Compute the double SHA-256 of each of blocks 64-byte inputs in, writing the
+ * 32-byte hashes to out, as in one level of a merkle tree. Several inputs are
+ * hashed in parallel when SHA256AutoDetect() found vector instructions.
+ * out may be equal to in: every input is read before its hash is written.
+ */
+void SHA256D64(unsigned char* out, const unsigned char* in, size_t blocks);
+// HFP0 PRF end
+
 #endif // BITCOIN_CRYPTO_SHA256_H
@@ -67,6 +67,11 @@ public:
 
         batch.Delete(slKey);
     }
+
+    void Clear()
+    {
+        batch.Clear();
+    }
 };
 
 class CDBIterator
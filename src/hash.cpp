@@ -20,38 +20,274 @@
 #include "util.h"
 
 
-static void * V0 = NULL;
+#include "support/pagelocker.h"
 
+#include <algorithm>
 
-uint256 HashModifiedScrypt(const CBlockHeader *obj)
+#ifndef WIN32
+#include <sys/mman.h>
+#endif
+
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+
+/** Size of one modified scrypt scratchpad, including slack for 64-byte alignment */
+static const size_t SCRYPT_SCRATCHPAD_SIZE = 128 * 1024 * 1024 + 63;
+
+/** One scratchpad allocation and how it is backed */
+struct CScryptScratchpadMem
 {
-        uint256 returnBuffer;
+    void* p;
+    size_t nSize;
+    PowHugePagesMode backing;
+    bool fLocked;
 
-        static CCriticalSection csHashModifiedScrypt;    // Only one block hash at a time due to avoid out-of-memory on lighter nodes
-        LOCK( csHashModifiedScrypt );
+    CScryptScratchpadMem() : p(NULL), nSize(0), backing(POW_HUGEPAGES_NONE), fLocked(false) {}
+};
 
-        if( V0 == NULL ) {
-            LogPrintf("HashModifiedScrypt(): Allocating large memory region\n");
-            // Allocate buffer for scrypt to run if first run and not allocated
-            // Large memory requirement only allows for a single block hash to be performed at a time
-            V0 = malloc(128 * 1024 * 1024 + 63);
-#if HFP0_DEBUG_POW
-            // HFP0 DBG begin
-            LogPrintf("HFP0 POW: HashModifiedScrypt(): Allocated 128MB at %p\n", V0);
-            // HFP0 DBG end
+#ifndef WIN32
+/** Map an anonymous region of nSize bytes, rounded up to nPageSize, with the given extra mmap flags */
+static bool MapScratchpad(CScryptScratchpadMem& mem, size_t nPageSize, int nFlags)
+{
+    size_t nSize = (SCRYPT_SCRATCHPAD_SIZE + nPageSize - 1) / nPageSize * nPageSize;
+    void* p = mmap(NULL, nSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | nFlags, -1, 0);
+    if (p == MAP_FAILED)
+        return false;
+    mem.p = p;
+    mem.nSize = nSize;
+    return true;
+}
+#endif
+
+/**
+ * Allocate a scratchpad backed as requested by -powhugepages, falling back
+ * from explicit to transparent huge pages and then to plain malloc.
+ */
+static CScryptScratchpadMem AllocateScratchpad(PowHugePagesMode mode, bool fLock)
+{
+    CScryptScratchpadMem mem;
+#if !defined(WIN32) && defined(MAP_HUGETLB)
+#ifdef MAP_HUGE_SHIFT
+    if (mode == POW_HUGEPAGES_1G && MapScratchpad(mem, 1024 * 1024 * 1024, MAP_HUGETLB | (30 << MAP_HUGE_SHIFT))) {
+        mem.backing = POW_HUGEPAGES_1G;
+    } else
+#endif
+    if (mode >= POW_HUGEPAGES_2M && MapScratchpad(mem, 2 * 1024 * 1024, MAP_HUGETLB)) {
+        mem.backing = POW_HUGEPAGES_2M;
+    }
+#endif
+#if !defined(WIN32) && defined(MADV_HUGEPAGE)
+    if (mem.p == NULL && mode >= POW_HUGEPAGES_TRANSPARENT && MapScratchpad(mem, 2 * 1024 * 1024, 0)) {
+        // Advisory only: the kernel may still back (parts of) the region with normal pages
+        madvise(mem.p, mem.nSize, MADV_HUGEPAGE);
+        mem.backing = POW_HUGEPAGES_TRANSPARENT;
+    }
+#endif
+    if (mem.p == NULL) {
+        mem.p = malloc(SCRYPT_SCRATCHPAD_SIZE);
+        mem.nSize = SCRYPT_SCRATCHPAD_SIZE;
+        mem.backing = POW_HUGEPAGES_NONE;
+    }
+    if (mem.p != NULL && fLock) {
+        mem.fLocked = MemoryPageLocker().Lock(mem.p, mem.nSize);
+        if (!mem.fLocked)
+            LogPrintf("HashModifiedScrypt(): Could not lock scratchpad in memory\n");
+    }
+    if (mem.p != NULL && mode != mem.backing)
+        LogPrintf("HashModifiedScrypt(): %s pages not available, using %s pages\n", PowHugePagesModeName(mode), PowHugePagesModeName(mem.backing));
+    return mem;
+}
+
+static void FreeScratchpad(const CScryptScratchpadMem& mem)
+{
+    if (mem.fLocked)
+        MemoryPageLocker().Unlock(mem.p, mem.nSize);
+#ifndef WIN32
+    if (mem.backing != POW_HUGEPAGES_NONE) {
+        munmap(mem.p, mem.nSize);
+        return;
+    }
 #endif
+    free(mem.p);
+}
+
+const char* PowHugePagesModeName(PowHugePagesMode mode)
+{
+    switch (mode) {
+    case POW_HUGEPAGES_NONE:        return "normal";
+    case POW_HUGEPAGES_TRANSPARENT: return "transparent huge";
+    case POW_HUGEPAGES_2M:          return "2MB huge";
+    case POW_HUGEPAGES_1G:          return "1GB huge";
+    }
+    return "unknown";
+}
+
+/**
+ * Pool of modified scrypt scratchpads, one per concurrently running hash.
+ *
+ * Scratchpads are allocated lazily, only when all existing ones are in use and
+ * the configured maximum (-powhashthreads) has not been reached yet. A node
+ * which never hashes concurrently therefore still only allocates one 128MB
+ * buffer. If an allocation fails while at least one scratchpad exists, the pool
+ * stops growing and callers wait for a scratchpad to be released instead.
+ */
+class CScryptScratchpadPool
+{
+private:
+    boost::mutex cs;
+    boost::condition_variable cond;
+    std::vector<CScryptScratchpadMem> vFree;
+    int nAllocated;
+    int nMaxScratchpads;
+    PowHugePagesMode hugePagesMode;
+    bool fLockMemory;
+    /** Number of allocated scratchpads per backing, and how many of them are locked */
+    int nBacking[POW_HUGEPAGES_1G + 1];
+    int nLocked;
+
+    void Free(const CScryptScratchpadMem& mem)
+    {
+        FreeScratchpad(mem);
+        nAllocated--;
+        nBacking[mem.backing]--;
+        if (mem.fLocked)
+            nLocked--;
+    }
+
+public:
+    CScryptScratchpadPool() : nAllocated(0), nMaxScratchpads(DEFAULT_POWHASHTHREADS), hugePagesMode(POW_HUGEPAGES_NONE), fLockMemory(DEFAULT_POWMLOCK), nLocked(0)
+    {
+        std::fill(nBacking, nBacking + POW_HUGEPAGES_1G + 1, 0);
+    }
+
+    void SetMax(int nMax)
+    {
+        boost::unique_lock<boost::mutex> lock(cs);
+        nMaxScratchpads = std::max(1, std::min(nMax, MAX_POWHASHTHREADS));
+        // Drop idle scratchpads beyond the new limit, busy ones are freed on release
+        while (nAllocated > nMaxScratchpads && !vFree.empty()) {
+            Free(vFree.back());
+            vFree.pop_back();
+        }
+        cond.notify_all();
+    }
+
+    void SetAllocationMode(PowHugePagesMode mode, bool fLock)
+    {
+        boost::unique_lock<boost::mutex> lock(cs);
+        hugePagesMode = mode;
+        fLockMemory = fLock;
+    }
 
-            if( V0 == NULL ) {
+    CScryptScratchpadStats GetStats()
+    {
+        boost::unique_lock<boost::mutex> lock(cs);
+        CScryptScratchpadStats stats;
+        stats.nMax = nMaxScratchpads;
+        stats.nAllocated = nAllocated;
+        stats.nInUse = nAllocated - vFree.size();
+        stats.requestedMode = hugePagesMode;
+        stats.fLockRequested = fLockMemory;
+        for (int i = POW_HUGEPAGES_NONE; i <= POW_HUGEPAGES_1G; i++)
+            stats.nBacking[i] = nBacking[i];
+        stats.nLocked = nLocked;
+        return stats;
+    }
+
+    CScryptScratchpadMem Acquire()
+    {
+        boost::unique_lock<boost::mutex> lock(cs);
+        while (true) {
+            if (!vFree.empty()) {
+                CScryptScratchpadMem mem = vFree.back();
+                vFree.pop_back();
+                return mem;
+            }
+            if (nAllocated < nMaxScratchpads) {
+                LogPrintf("HashModifiedScrypt(): Allocating large memory region (%d of at most %d)\n", nAllocated + 1, nMaxScratchpads);
+                CScryptScratchpadMem mem = AllocateScratchpad(hugePagesMode, fLockMemory);
 #if HFP0_DEBUG_POW
                 // HFP0 DBG begin
-                LogPrintf("HFP0 POW: Error in HashModifiedScrypt: Out of memory, cannot not allocate 128MB for modified scrypte hashing\n");
+                LogPrintf("HFP0 POW: HashModifiedScrypt(): Allocated 128MB at %p\n", mem.p);
                 // HFP0 DBG end
 #endif
-                throw std::runtime_error("HashModifiedScrypt(): Out of memory");
+                if (mem.p != NULL) {
+                    nAllocated++;
+                    nBacking[mem.backing]++;
+                    if (mem.fLocked)
+                        nLocked++;
+                    return mem;
+                }
+                if (nAllocated == 0) {
+#if HFP0_DEBUG_POW
+                    // HFP0 DBG begin
+                    LogPrintf("HFP0 POW: Error in HashModifiedScrypt: Out of memory, cannot not allocate 128MB for modified scrypte hashing\n");
+                    // HFP0 DBG end
+#endif
+                    throw std::runtime_error("HashModifiedScrypt(): Out of memory");
+                }
+                // Not enough memory for another scratchpad, share the ones we have
+                LogPrintf("HashModifiedScrypt(): Out of memory, limiting to %d concurrent hashes\n", nAllocated);
+                nMaxScratchpads = nAllocated;
             }
+            cond.wait(lock);
         }
+    }
+
+    void Release(const CScryptScratchpadMem& mem)
+    {
+        boost::unique_lock<boost::mutex> lock(cs);
+        if (nAllocated > nMaxScratchpads) {
+            Free(mem);
+        } else {
+            vFree.push_back(mem);
+        }
+        cond.notify_one();
+    }
+};
+
+static CScryptScratchpadPool scratchpadPool;
+
+/** RAII helper which holds a scratchpad from the pool for the duration of one hash */
+class CScryptScratchpad
+{
+private:
+    CScryptScratchpadMem mem;
+
+public:
+    CScryptScratchpad() : mem(scratchpadPool.Acquire()) {}
+    ~CScryptScratchpad() { scratchpadPool.Release(mem); }
+    void* get() const { return mem.p; }
+};
+
+void SetModifiedScryptThreads(int nThreads)
+{
+    scratchpadPool.SetMax(nThreads);
+}
+
+int GetModifiedScryptThreads()
+{
+    return scratchpadPool.GetStats().nMax;
+}
+
+void SetModifiedScryptAllocation(PowHugePagesMode mode, bool fLock)
+{
+    scratchpadPool.SetAllocationMode(mode, fLock);
+}
+
+CScryptScratchpadStats GetModifiedScryptScratchpadStats()
+{
+    return scratchpadPool.GetStats();
+}
+
+uint256 HashModifiedScrypt(const CBlockHeader *obj)
+{
+        uint256 returnBuffer;
+
+        // Each concurrent hash needs its own 128MB scratchpad, the pool bounds how many can run at once
+        CScryptScratchpad scratchpad;
 
-        crypto_1M_1_1_256_scrypt( (uint8_t *)(BEGIN(obj->nVersion)), 80, V0, (uint8_t *)(BEGIN(returnBuffer)), 32 );
+        crypto_1M_1_1_256_scrypt( (uint8_t *)(BEGIN(obj->nVersion)), 80, scratchpad.get(), (uint8_t *)(BEGIN(returnBuffer)), 32 );
 
         return returnBuffer;
 }
@@ -190,6 +190,47 @@ uint256 SerializeHash(const T& obj, int nType=SER_GETHASH, int nVersion=PROTOCOL
 /** Compute the Modified Scrypt hash of a block header object */
 uint256 HashModifiedScrypt(const CBlockHeader *obj);
 // HFP0 POW end
+// HFP0 POW begin: per-thread scrypt scratchpads
+/** Default for -powhashthreads, the number of modified scrypt hashes which may run concurrently */
+static const int DEFAULT_POWHASHTHREADS = 1;
+/** Maximum for -powhashthreads, each concurrent hash needs its own 128MB scratchpad */
+static const int MAX_POWHASHTHREADS = 64;
+/** Set the maximum number of modified scrypt hashes (and scratchpads) in flight */
+void SetModifiedScryptThreads(int nThreads);
+/** Get the maximum number of modified scrypt hashes in flight */
+int GetModifiedScryptThreads();
+// HFP0 POW end
+// HFP0 POW begin: huge page / mlock backed scratchpads
+/** How modified scrypt scratchpads are backed (-powhugepages), in order of preference when falling back */
+enum PowHugePagesMode {
+    POW_HUGEPAGES_NONE = 0,         //! plain malloc
+    POW_HUGEPAGES_TRANSPARENT = 1,  //! anonymous mapping advised to use transparent huge pages
+    POW_HUGEPAGES_2M = 2,           //! explicit 2MB huge pages (hugetlbfs pool)
+    POW_HUGEPAGES_1G = 3            //! explicit 1GB huge pages, reserves a full 1GB page per scratchpad
+};
+static const int DEFAULT_POWHUGEPAGES = POW_HUGEPAGES_NONE;
+/** Default for -powmlock, lock scratchpads in memory */
+static const bool DEFAULT_POWMLOCK = false;
+
+struct CScryptScratchpadStats
+{
+    int nMax;
+    int nAllocated;
+    int nInUse;
+    PowHugePagesMode requestedMode;
+    bool fLockRequested;
+    /** Number of allocated scratchpads per PowHugePagesMode actually obtained */
+    int nBacking[POW_HUGEPAGES_1G + 1];
+    int nLocked;
+};
+
+/** Set how scratchpads allocated from now on are backed */
+void SetModifiedScryptAllocation(PowHugePagesMode mode, bool fLock);
+/** Get the scratchpad allocation statistics */
+CScryptScratchpadStats GetModifiedScryptScratchpadStats();
+/** Human readable page type */
+const char* PowHugePagesModeName(PowHugePagesMode mode);
+// HFP0 POW end
 #endif
 
 unsigned int MurmurHash3(unsigned int nHashSeed, const std::vector<unsigned char>& vDataToHash);
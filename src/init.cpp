@@ -16,6 +16,7 @@
 #include "checkpoints.h"
 #include "compat/sanity.h"
 #include "consensus/validation.h"
+#include "crypto/sha256.h"  // HFP0 PRF added
 #include "httpserver.h"
 #include "httprpc.h"
 #include "key.h"
@@ -59,6 +60,7 @@
 #include <boost/algorithm/string/predicate.hpp>
 #include <boost/algorithm/string/replace.hpp>
 #include <boost/algorithm/string/split.hpp>
+#include <boost/atomic.hpp>  // HFP0 PRF added
 #include <boost/bind.hpp>
 #include <boost/filesystem.hpp>
 #include <boost/function.hpp>
@@ -103,6 +105,16 @@ enum BindFlags {
 };
 
 static const char* FEE_ESTIMATES_FILENAME="fee_estimates.dat";
+// HFP0 PRF begin
+//! Set once the mempool of the last run is loaded, so that it is not overwritten before
+static boost::atomic<bool> fDumpMempoolLater(false);
+
+static void DumpMempoolIfLoaded()
+{
+    if (fDumpMempoolLater)
+        DumpMempool();
+}
+// HFP0 PRF end
 CClientUIInterface uiInterface; // Declared but not defined in ui_interface.h
 
 //////////////////////////////////////////////////////////////////////////////
@@ -150,9 +162,9 @@ class CCoinsViewErrorCatcher : public CCoinsViewBacked
 {
 public:
     CCoinsViewErrorCatcher(CCoinsView* view) : CCoinsViewBacked(view) {}
-    bool GetCoins(const uint256 &txid, CCoins &coins) const {
+    bool GetCoin(const COutPoint &outpoint, Coin &coin) const {
         try {
-            return CCoinsViewBacked::GetCoins(txid, coins);
+            return CCoinsViewBacked::GetCoin(outpoint, coin);
         } catch(const std::runtime_error& e) {
             uiInterface.ThreadSafeMessageBox(_("Error reading from database, shutting down."), "", CClientUIInterface::MSG_ERROR);
             LogPrintf("Error reading from database: %s\n", e.what());
@@ -208,6 +220,8 @@ void Shutdown()
     StopTorControl();
     UnregisterNodeSignals(GetNodeSignals());
 
+    DumpMempoolIfLoaded();  // HFP0 PRF added
+
     if (fFeeEstimatesInitialized)
     {
         boost::filesystem::path est_path = GetDataDir() / FEE_ESTIMATES_FILENAME;
@@ -238,6 +252,14 @@ void Shutdown()
         pwalletMain->Flush(true);
 #endif
 
+    // HFP0 PRF begin
+    if (pblocktemplateengine) {
+        UnregisterValidationInterface(pblocktemplateengine);
+        delete pblocktemplateengine;
+        pblocktemplateengine = NULL;
+    }
+    // HFP0 PRF end
+
 #if ENABLE_ZMQ
     if (pzmqNotificationInterface) {
         UnregisterValidationInterface(pzmqNotificationInterface);
@@ -350,8 +372,23 @@ std::string HelpMessage(HelpMessageMode mode)
     strUsage += HelpMessageOpt("-maxorphantx=<n>", strprintf(_("Keep at most <n> unconnectable transactions in memory (default: %u)"), DEFAULT_MAX_ORPHAN_TRANSACTIONS));
     strUsage += HelpMessageOpt("-maxmempool=<n>", strprintf(_("Keep the transaction memory pool below <n> megabytes (default: %u)"), DEFAULT_MAX_MEMPOOL_SIZE));
     strUsage += HelpMessageOpt("-mempoolexpiry=<n>", strprintf(_("Do not keep transactions in the mempool longer than <n> hours (default: %u)"), DEFAULT_MEMPOOL_EXPIRY));
+    strUsage += HelpMessageOpt("-persistmempool", strprintf(_("Whether to save the mempool on shutdown and load on restart (default: %u)"), DEFAULT_PERSIST_MEMPOOL));  // HFP0 PRF added
     strUsage += HelpMessageOpt("-par=<n>", strprintf(_("Set the number of script verification threads (%u to %d, 0 = auto, <0 = leave that many cores free, default: %d)"),
         -GetNumCores(), MAX_SCRIPTCHECK_THREADS, DEFAULT_SCRIPTCHECK_THREADS));
+    // HFP0 PRF begin
+    strUsage += HelpMessageOpt("-utxoprefetch=<n>", strprintf(_("Set the number of threads reading the inputs of a block from the UTXO database ahead of validation (0 to %d, 0 = disable, default: %d)"),
+        MAX_UTXO_PREFETCH_THREADS, DEFAULT_UTXO_PREFETCH_THREADS));
+    strUsage += HelpMessageOpt("-pipelineconnect", strprintf(_("Check the inputs of block transactions on the script verification threads while later inputs are still being resolved (default: %u)"),
+        DEFAULT_PIPELINE_CONNECT));
+    // HFP0 PRF end
+#if HFP0_POW
+    // HFP0 POW begin: per-thread scrypt scratchpads
+    strUsage += HelpMessageOpt("-powhashthreads=<n>", strprintf(_("Set the number of proof-of-work hashes computed in parallel, each using 128MB of memory (%u to %d, 0 = auto, <0 = leave that many cores free, default: %d)"),
+        -GetNumCores(), MAX_POWHASHTHREADS, DEFAULT_POWHASHTHREADS));
+    strUsage += HelpMessageOpt("-powhugepages=<n>", strprintf(_("Back proof-of-work hashing memory with huge pages, falling back to smaller pages if unavailable (0 = normal pages, 1 = transparent huge pages, 2 = 2MB huge pages, 3 = 1GB huge pages, default: %d)"), DEFAULT_POWHUGEPAGES));
+    strUsage += HelpMessageOpt("-powmlock", strprintf(_("Lock proof-of-work hashing memory so that it is not swapped out (default: %u)"), DEFAULT_POWMLOCK));
+    // HFP0 POW end
+#endif
 #ifndef WIN32
     strUsage += HelpMessageOpt("-pid=<file>", strprintf(_("Specify pid file (default: %s)"), BITCOIN_PID_FILENAME));
 #endif
@@ -445,6 +482,7 @@ std::string HelpMessage(HelpMessageMode mode)
     if (showDebug)
     {
         strUsage += HelpMessageOpt("-checkblockindex", strprintf("Do a full consistency check for mapBlockIndex, setBlockIndexCandidates, chainActive and mapBlocksUnlinked occasionally. Also sets -checkmempool (default: %u)", Params(CBaseChainParams::MAIN).DefaultConsistencyChecks()));
+        strUsage += HelpMessageOpt("-checkblocktemplate", strprintf("Connect every new block template to a copy of the UTXO set, instead of relying on the checks its transactions passed on entering the mempool (default: %u)", DEFAULT_CHECK_BLOCK_TEMPLATE));  // HFP0 PRF added
         strUsage += HelpMessageOpt("-checkmempool=<n>", strprintf("Run checks every <n> transactions (default: %u)", Params(CBaseChainParams::MAIN).DefaultConsistencyChecks()));
         strUsage += HelpMessageOpt("-checkpoints", strprintf("Disable expensive verification for known chain history (default: %u)", DEFAULT_CHECKPOINTS_ENABLED));
 #ifdef ENABLE_WALLET
@@ -484,6 +522,10 @@ std::string HelpMessage(HelpMessageMode mode)
         strUsage += HelpMessageOpt("-limitfreerelay=<n>", strprintf("Continuously rate-limit free transactions to <n>*1000 bytes per minute (default: %u)", DEFAULT_LIMITFREERELAY));
         strUsage += HelpMessageOpt("-relaypriority", strprintf("Require high priority for relaying free or low-fee transactions (default: %u)", DEFAULT_RELAYPRIORITY));
         strUsage += HelpMessageOpt("-maxsigcachesize=<n>", strprintf("Limit size of signature cache to <n> MiB (default: %u)", DEFAULT_MAX_SIG_CACHE_SIZE));
+        strUsage += HelpMessageOpt("-maxscriptcachesize=<n>", strprintf("Limit size of script execution cache to <n> MiB (default: %u)", DEFAULT_MAX_SCRIPT_CACHE_SIZE)); // HFP0 PRF added
+#if HFP0_POW
+        strUsage += HelpMessageOpt("-powhashcachesize=<n>", strprintf("Keep at most <n> proof-of-work hashes in the block header hash cache (default: %u)", DEFAULT_POWHASHCACHE_SIZE)); // HFP0 POW
+#endif
     }
     strUsage += HelpMessageOpt("-minrelaytxfee=<amt>", strprintf(_("Fees (in %s/kB) smaller than this are considered zero fee for relaying, mining and transaction creation (default: %s)"),
         CURRENCY_UNIT, FormatMoney(DEFAULT_MIN_RELAY_TX_FEE)));
@@ -679,6 +721,17 @@ void ThreadImport(std::vector<boost::filesystem::path> vImportFiles)
         LogPrintf("Stopping after block import\n");
         StartShutdown();
     }
+
+    // HFP0 PRF begin: with the best chain active, re-admit the mempool of the last run
+    if (GetBoolArg("-persistmempool", DEFAULT_PERSIST_MEMPOOL)) {
+        // Blocks imported or reindexed above, or left unconnected by an unclean shutdown
+        CValidationState state;
+        if (!ActivateBestChain(state, chainparams))
+            LogPrintf("Failed to connect best block: %s\n", FormatStateMessage(state));
+        LoadMempool();
+        fDumpMempoolLater = !ShutdownRequested();
+    }
+    // HFP0 PRF end
 }
 
 /** Sanity checks
@@ -944,6 +997,34 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
     else if (nScriptCheckThreads > MAX_SCRIPTCHECK_THREADS)
         nScriptCheckThreads = MAX_SCRIPTCHECK_THREADS;
 
+    // HFP0 PRF begin
+    nUtxoPrefetchThreads = GetArg("-utxoprefetch", DEFAULT_UTXO_PREFETCH_THREADS);
+    if (nUtxoPrefetchThreads < 0)
+        nUtxoPrefetchThreads = 0;
+    else if (nUtxoPrefetchThreads > MAX_UTXO_PREFETCH_THREADS)
+        nUtxoPrefetchThreads = MAX_UTXO_PREFETCH_THREADS;
+    fPipelineConnect = GetBoolArg("-pipelineconnect", DEFAULT_PIPELINE_CONNECT);
+    // HFP0 PRF end
+
+#if HFP0_POW
+    // HFP0 POW begin: per-thread scrypt scratchpads
+    // -powhashthreads=0 means autodetect
+    int nPowHashThreads = GetArg("-powhashthreads", DEFAULT_POWHASHTHREADS);
+    if (nPowHashThreads <= 0)
+        nPowHashThreads += GetNumCores();
+    if (nPowHashThreads < 1)
+        nPowHashThreads = 1;
+    else if (nPowHashThreads > MAX_POWHASHTHREADS)
+        nPowHashThreads = MAX_POWHASHTHREADS;
+    SetModifiedScryptThreads(nPowHashThreads);
+    int nPowHugePages = GetArg("-powhugepages", DEFAULT_POWHUGEPAGES);
+    if (nPowHugePages < POW_HUGEPAGES_NONE || nPowHugePages > POW_HUGEPAGES_1G)
+        return InitError(strprintf(_("Invalid -powhugepages value %d (must be %d to %d)"), nPowHugePages, POW_HUGEPAGES_NONE, POW_HUGEPAGES_1G));
+    SetModifiedScryptAllocation((PowHugePagesMode)nPowHugePages, GetBoolArg("-powmlock", DEFAULT_POWMLOCK));
+    SetPowHashCacheSize(std::max<int64_t>(GetArg("-powhashcachesize", DEFAULT_POWHASHCACHE_SIZE), 1));
+    // HFP0 POW end
+#endif
+
     fServer = GetBoolArg("-server", false);
 
     // block pruning; get the amount of disk space (in MiB) to allot for block & undo files
@@ -1070,6 +1151,9 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
 
     // ********************************************************* Step 4: application initialization: dir lock, daemonize, pidfile, debug log
 
+    // HFP0 PRF added: pick the SHA-256 implementation before any other thread hashes
+    std::string sha256_algo = SHA256AutoDetect();
+
     // Initialize elliptic curve code
     ECC_Start();
     globalVerifyHandle.reset(new ECCVerifyHandle());
@@ -1123,6 +1207,7 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
 #ifdef ENABLE_WALLET
     LogPrintf("Using BerkeleyDB version %s\n", DbEnv::version(0, 0, 0));
 #endif
+    LogPrintf("Using the '%s' SHA256 implementation\n", sha256_algo);  // HFP0 PRF added
     if (!fLogTimestamps)
         LogPrintf("Startup time: %s\n", DateTimeStrFormat("%Y-%m-%d %H:%M:%S", GetTime()));
     LogPrintf("Default data directory %s\n", GetDefaultDataDir().string());
@@ -1131,7 +1216,14 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
     LogPrintf("Using at most %i connections (%i file descriptors available)\n", nMaxConnections, nFD);
     std::ostringstream strErrors;
 
+    // HFP0 PRF begin
+    InitSignatureCache();
+    InitScriptExecutionCache();
+    // HFP0 PRF end
     LogPrintf("Using %u threads for script verification\n", nScriptCheckThreads);
+#if HFP0_POW
+    LogPrintf("Using at most %d concurrent proof-of-work hashes, %s salsa20/8 kernel\n", GetModifiedScryptThreads(), crypto_scrypt_smix_kernel()); // HFP0 POW
+#endif
     if (nScriptCheckThreads) {
         for (int i=0; i<nScriptCheckThreads-1; i++)
             threadGroup.create_thread(&ThreadScriptCheck);
@@ -1408,6 +1500,17 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
                     break;
                 }
 
+                // HFP0 PRF begin: convert a per-transaction UTXO database to per-output records
+                if (!pcoinsdbview->Upgrade()) {
+                    strLoadError = _("Error upgrading chainstate database");
+                    break;
+                }
+                if (fRequestShutdown) {
+                    LogPrintf("Shutdown requested. Exiting.\n");
+                    return false;
+                }
+                // HFP0 PRF end
+
                 uiInterface.InitMessage(_("Verifying blocks..."));
                 if (fHavePruned && GetArg("-checkblocks", DEFAULT_CHECKBLOCKS) > MIN_BLOCKS_TO_KEEP) {
                     LogPrintf("Prune: pruned datadir may not have more than %d blocks; -checkblocks=%d may fail\n",
@@ -1731,6 +1834,14 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
                                          boost::ref(cs_main), boost::cref(pindexBestHeader), nPowTargetSpacing);
     scheduler.scheduleEvery(f, nPowTargetSpacing);
 
+    // HFP0 PRF begin: block template for getblocktemplate, reassembled in the background
+    pblocktemplateengine = new CBlockTemplateEngine(chainparams, CScript() << OP_TRUE);
+    RegisterValidationInterface(pblocktemplateengine);
+    scheduler.scheduleEvery(boost::bind(&CBlockTemplateEngine::RebuildIfStale, pblocktemplateengine), BLOCK_TEMPLATE_REBUILD_INTERVAL);
+    // HFP0 PRF end
+
+    scheduler.scheduleEvery(&DumpMempoolIfLoaded, MEMPOOL_DUMP_INTERVAL);  // HFP0 PRF added: in case of a crash
+
     // Generate coins in the background
     GenerateBitcoins(GetBoolArg("-gen", DEFAULT_GENERATE), GetArg("-genproclimit", DEFAULT_GENERATE_THREADS), chainparams);
 
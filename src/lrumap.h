@@ -0,0 +1,104 @@
+// Copyright (c) 2016 The Bitcoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+// HFP0 POW added file (entire file): LRU container for the PoW hash cache
+#ifndef BITCOIN_LRUMAP_H
+#define BITCOIN_LRUMAP_H
+
+#include <assert.h>
+#include <list>
+#include <map>
+
+/** STL-like map container that only keeps the N most recently used elements. */
+template <typename K, typename V>
+class lrumap
+{
+public:
+    typedef K key_type;
+    typedef V mapped_type;
+    typedef std::pair<key_type, mapped_type> value_type;
+    typedef typename std::list<value_type>::size_type size_type;
+
+protected:
+    /** Elements, most recently used first */
+    std::list<value_type> list;
+    typedef typename std::list<value_type>::iterator list_iterator;
+    std::map<K, list_iterator> map;
+    typedef typename std::map<K, list_iterator>::iterator map_iterator;
+    size_type nMaxSize;
+
+    /** Evict least recently used elements until the size limit is met, return the number evicted */
+    size_type trim()
+    {
+        size_type nEvicted = 0;
+        while (list.size() > nMaxSize) {
+            map.erase(list.back().first);
+            list.pop_back();
+            nEvicted++;
+        }
+        return nEvicted;
+    }
+
+public:
+    lrumap(size_type nMaxSizeIn)
+    {
+        assert(nMaxSizeIn > 0);
+        nMaxSize = nMaxSizeIn;
+    }
+    size_type size() const { return list.size(); }
+    bool empty() const { return list.empty(); }
+    size_type count(const key_type& k) const { return map.count(k); }
+
+    /** Look up k, marking it as most recently used. Returns false if not present. */
+    bool get(const key_type& k, mapped_type& v)
+    {
+        map_iterator it = map.find(k);
+        if (it == map.end())
+            return false;
+        list.splice(list.begin(), list, it->second);
+        v = it->second->second;
+        return true;
+    }
+
+    /** Insert or update x as most recently used. Returns the number of elements evicted. */
+    size_type insert(const value_type& x)
+    {
+        map_iterator it = map.find(x.first);
+        if (it != map.end()) {
+            it->second->second = x.second;
+            list.splice(list.begin(), list, it->second);
+            return 0;
+        }
+        list.push_front(x);
+        map.insert(std::make_pair(x.first, list.begin()));
+        return trim();
+    }
+
+    void erase(const key_type& k)
+    {
+        map_iterator it = map.find(k);
+        if (it == map.end())
+            return;
+        list.erase(it->second);
+        map.erase(it);
+    }
+
+    void clear()
+    {
+        map.clear();
+        list.clear();
+    }
+
+    size_type max_size() const { return nMaxSize; }
+
+    /** Change the size limit. Returns the number of elements evicted. */
+    size_type max_size(size_type s)
+    {
+        assert(s > 0);
+        nMaxSize = s;
+        return trim();
+    }
+};
+
+#endif // BITCOIN_LRUMAP_H
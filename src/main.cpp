@@ -45,6 +45,7 @@
 //#include <algorithm>               // HFP0 XTB added
 #include <boost/algorithm/string/replace.hpp>
 #include <boost/atomic.hpp>
+#include <boost/bind.hpp>
 #include <boost/filesystem.hpp>
 #include <boost/filesystem/fstream.hpp>
 #include <boost/math/distributions/poisson.hpp>
@@ -85,6 +86,9 @@ int64_t nTimeBestReceived = 0;
 CWaitableCriticalSection csBestBlock;
 CConditionVariable cvBlockChange;
 int nScriptCheckThreads = 0;
+int nUtxoPrefetchThreads = DEFAULT_UTXO_PREFETCH_THREADS;  // HFP0 PRF added
+bool fPipelineConnect = DEFAULT_PIPELINE_CONNECT;           // HFP0 PRF added
+int nBlockLockTimeFlags = 0;                                // HFP0 RLT added
 bool fImporting = false;
 bool fReindex = false;
 bool fTxIndex = false;
@@ -877,15 +881,15 @@ bool CheckSequenceLocks(const CTransaction &tx, int flags, LockPoints* lp, bool
         prevheights.resize(tx.vin.size());
         for (size_t txinIndex = 0; txinIndex < tx.vin.size(); txinIndex++) {
             const CTxIn& txin = tx.vin[txinIndex];
-            CCoins coins;
-            if (!viewMemPool.GetCoins(txin.prevout.hash, coins)) {
+            Coin coin;
+            if (!viewMemPool.GetCoin(txin.prevout, coin)) {
                 return error("%s: Missing input", __func__);
             }
-            if (coins.nHeight == MEMPOOL_HEIGHT) {
+            if (coin.nHeight == MEMPOOL_HEIGHT) {
                 // Assume all mempool transaction confirm in the next block
                 prevheights[txinIndex] = tip->nHeight + 1;
             } else {
-                prevheights[txinIndex] = coins.nHeight;
+                prevheights[txinIndex] = coin.nHeight;
             }
         }
         lockPair = CalculateSequenceLocks(tx, flags, &prevheights, index);
@@ -1064,9 +1068,9 @@ void LimitMempoolSize(CTxMemPool& pool, size_t limit, unsigned long age) {
     if (expired != 0)
         LogPrint("mempool", "Expired %i transactions from the memory pool\n", expired);
 
-    std::vector<uint256> vNoSpendsRemaining;
+    std::vector<COutPoint> vNoSpendsRemaining;
     pool.TrimToSize(limit, &vNoSpendsRemaining);
-    BOOST_FOREACH(const uint256& removed, vNoSpendsRemaining)
+    BOOST_FOREACH(const COutPoint& removed, vNoSpendsRemaining)
         pcoinsTip->Uncache(removed);
 }
 
@@ -1079,9 +1083,68 @@ std::string FormatStateMessage(const CValidationState &state)
         state.GetRejectCode());
 }
 
-bool AcceptToMemoryPoolWorker(CTxMemPool& pool, CValidationState &state, const CTransaction &tx, bool fLimitFree,
-                              bool* pfMissingInputs, bool fOverrideMempoolLimit, bool fRejectAbsurdFee,
-                              std::vector<uint256>& vHashTxnToUncache)
+// HFP0 PRF begin
+/**
+ * The script verification flags of a block of version nVersion and time
+ * nTime on top of pindexPrev. Also used to check mempool transactions with the
+ * flags of the next block, so that the script execution cache can answer for
+ * them when that block arrives.
+ */
+static unsigned int GetBlockScriptFlags(int32_t nVersion, int64_t nTime, const CBlockIndex* pindexPrev, const Consensus::Params& consensusParams)
+{
+    // BIP16 didn't become active until Apr 1 2012
+    int64_t nBIP16SwitchTime = 1333238400;
+    bool fStrictPayToScriptHash = (nTime >= nBIP16SwitchTime);
+
+    unsigned int flags = fStrictPayToScriptHash ? SCRIPT_VERIFY_P2SH : SCRIPT_VERIFY_NONE;
+
+    // Start enforcing the DERSIG (BIP66) rules, for block.nVersion=3 blocks,
+    // when 75% of the network has upgraded:
+    if (nVersion >= 3 && IsSuperMajority(3, pindexPrev, consensusParams.nMajorityEnforceBlockUpgrade, consensusParams)) {
+        flags |= SCRIPT_VERIFY_DERSIG;
+    }
+
+    // Start enforcing CHECKLOCKTIMEVERIFY, (BIP65) for block.nVersion=4
+    // blocks, when 75% of the network has upgraded:
+    if (nVersion >= 4 && IsSuperMajority(4, pindexPrev, consensusParams.nMajorityEnforceBlockUpgrade, consensusParams)) {
+        flags |= SCRIPT_VERIFY_CHECKLOCKTIMEVERIFY;
+    }
+
+    return flags;
+}
+// HFP0 PRF end
+
+// HFP0 PRF begin
+/**
+ * What AcceptToMemoryPool works out about a transaction before checking its
+ * scripts, and needs to add it to the pool afterwards.
+ */
+struct CTxMemPoolAcceptWorkspace {
+    CCoinsView dummy;
+    //! The coins the transaction spends, fetched once
+    CCoinsViewCache view;
+    boost::scoped_ptr<CTxMemPoolEntry> pentry;
+    set<uint256> setConflicts;
+    CTxMemPool::setEntries setAncestors;
+    CTxMemPool::setEntries allConflicting;
+    CAmount nModifiedFees;
+    CAmount nConflictingFees;
+    size_t nConflictingSize;
+    //! Outcome of the script checks, when made on a script check thread
+    bool fScriptsValid;
+
+    CTxMemPoolAcceptWorkspace() : view(&dummy), nModifiedFees(0), nConflictingFees(0), nConflictingSize(0), fScriptsValid(false) {}
+};
+
+/**
+ * All the checks of AcceptToMemoryPool but the script checks: the inputs,
+ * the fees, the ancestor and descendant limits and replacement; fills ws
+ * with what AcceptToMemoryPoolFinalize needs.
+ */
+static bool AcceptToMemoryPoolPreChecks(CTxMemPool& pool, CValidationState &state, const CTransaction &tx, bool fLimitFree,
+                                        bool* pfMissingInputs, int64_t nAcceptTime, bool fRejectAbsurdFee,
+                                        std::vector<COutPoint>& vCoinsToUncache, CTxMemPoolAcceptWorkspace& ws)
+// HFP0 PRF end
 {
     AssertLockHeld(cs_main);
     if (pfMissingInputs)
@@ -1141,7 +1204,8 @@ bool AcceptToMemoryPoolWorker(CTxMemPool& pool, CValidationState &state, const C
     }
 
     // Check for conflicts with in-memory transactions
-    set<uint256> setConflicts;
+    set<uint256>& setConflicts = ws.setConflicts;  // HFP0 PRF changed
+    setConflicts.clear();  // HFP0 PRF added
     {
     LOCK(pool.cs); // protect pool.mapNextTx
     BOOST_FOREACH(const CTxIn &txin, tx.vin)
@@ -1191,8 +1255,7 @@ bool AcceptToMemoryPoolWorker(CTxMemPool& pool, CValidationState &state, const C
     }
 
     {
-        CCoinsView dummy;
-        CCoinsViewCache view(&dummy);
+        CCoinsViewCache& view = ws.view;  // HFP0 PRF changed
 
         CAmount nValueIn = 0;
         LockPoints lp;        // HFP0 CSV (BIP112) added
@@ -1201,26 +1264,25 @@ bool AcceptToMemoryPoolWorker(CTxMemPool& pool, CValidationState &state, const C
         CCoinsViewMemPool viewMemPool(pcoinsTip, pool);
         view.SetBackend(viewMemPool);
 
-        // do we already have it?
-        bool fHadTxInCache = pcoinsTip->HaveCoinsInCache(hash);
-        if (view.HaveCoins(hash)) {
-            if (!fHadTxInCache)
-                vHashTxnToUncache.push_back(hash);
-#if HFP0_DEBUG_BSZ
-            // HFP0 DBG begin
-            LogPrintf("HFP0 BSZ: AcceptToMemoryPoolWorker: already have it\n");
-            // HFP0 DBG end
-#endif
-            return state.Invalid(false, REJECT_ALREADY_KNOWN, "txn-already-known");
-        }
-
         // do all inputs exist?
-        // Note that this does not check for the presence of actual outputs (see the next check for that),
-        // and only helps with filling in pfMissingInputs (to determine missing vs spent).
         BOOST_FOREACH(const CTxIn txin, tx.vin) {
-            if (!pcoinsTip->HaveCoinsInCache(txin.prevout.hash))
-                vHashTxnToUncache.push_back(txin.prevout.hash);
-            if (!view.HaveCoins(txin.prevout.hash)) {
+            if (!pcoinsTip->HaveCoinInCache(txin.prevout))
+                vCoinsToUncache.push_back(txin.prevout);
+            if (!view.HaveCoin(txin.prevout)) {
+                // HFP0 PRF begin: are inputs missing because we already have the tx?
+                for (size_t out = 0; out < tx.vout.size(); out++) {
+                    // Optimistically just do efficient check of cache for outputs
+                    if (pcoinsTip->HaveCoinInCache(COutPoint(hash, out))) {
+#if HFP0_DEBUG_BSZ
+                        // HFP0 DBG begin
+                        LogPrintf("HFP0 BSZ: AcceptToMemoryPoolWorker: already have it\n");
+                        // HFP0 DBG end
+#endif
+                        return state.Invalid(false, REJECT_ALREADY_KNOWN, "txn-already-known");
+                    }
+                }
+                // Otherwise assume this might be an orphan tx for which we just haven't seen parents yet
+                // HFP0 PRF end
                 if (pfMissingInputs)
                     *pfMissingInputs = true;
 #if HFP0_DEBUG_BSZ
@@ -1248,7 +1310,7 @@ bool AcceptToMemoryPoolWorker(CTxMemPool& pool, CValidationState &state, const C
         nValueIn = view.GetValueIn(tx);
 
         // we have all inputs cached now, so switch back to dummy, so we don't need to keep lock on mempool
-        view.SetBackend(dummy);
+        view.SetBackend(ws.dummy);  // HFP0 PRF changed
 
         // HFP0 RLT (BIP68) begin
         // Only accept BIP68 sequence locked transactions that can be mined in the next
@@ -1277,7 +1339,8 @@ bool AcceptToMemoryPoolWorker(CTxMemPool& pool, CValidationState &state, const C
         CAmount nValueOut = tx.GetValueOut();
         CAmount nFees = nValueIn-nValueOut;
         // nModifiedFees includes any fee deltas from PrioritiseTransaction
-        CAmount nModifiedFees = nFees;
+        CAmount& nModifiedFees = ws.nModifiedFees;  // HFP0 PRF changed
+        nModifiedFees = nFees;  // HFP0 PRF added
         double nPriorityDummy = 0;
         pool.ApplyDeltas(hash, nPriorityDummy, nModifiedFees);
 
@@ -1288,15 +1351,17 @@ bool AcceptToMemoryPoolWorker(CTxMemPool& pool, CValidationState &state, const C
         // during reorgs to ensure COINBASE_MATURITY is still met.
         bool fSpendsCoinbase = false;
         BOOST_FOREACH(const CTxIn &txin, tx.vin) {
-            const CCoins *coins = view.AccessCoins(txin.prevout.hash);
-            if (coins->IsCoinBase()) {
+            const Coin &coin = view.AccessCoin(txin.prevout);
+            if (coin.IsCoinBase()) {
                 fSpendsCoinbase = true;
                 break;
             }
         }
 
         // HFP0 CSV (BIP112) begin: added lp argument
-        CTxMemPoolEntry entry(tx, nFees, GetTime(), dPriority, chainActive.Height(), pool.HasNoInputsOf(tx), inChainInputValue, fSpendsCoinbase, nSigOps, lp);
+        // HFP0 PRF changed: nAcceptTime, and kept for AcceptToMemoryPoolFinalize
+        ws.pentry.reset(new CTxMemPoolEntry(tx, nFees, nAcceptTime, dPriority, chainActive.Height(), pool.HasNoInputsOf(tx), inChainInputValue, fSpendsCoinbase, nSigOps, lp));
+        const CTxMemPoolEntry& entry = *ws.pentry;
         // HFP0 CSV (BIP112) end
         unsigned int nSize = entry.GetTxSize();
 
@@ -1370,7 +1435,8 @@ bool AcceptToMemoryPoolWorker(CTxMemPool& pool, CValidationState &state, const C
         }
 
         // Calculate in-mempool ancestors, up to a limit.
-        CTxMemPool::setEntries setAncestors;
+        CTxMemPool::setEntries& setAncestors = ws.setAncestors;  // HFP0 PRF changed
+        setAncestors.clear();  // HFP0 PRF added
         size_t nLimitAncestors = GetArg("-limitancestorcount", DEFAULT_ANCESTOR_LIMIT);
         size_t nLimitAncestorSize = GetArg("-limitancestorsize", DEFAULT_ANCESTOR_SIZE_LIMIT)*1000;
         size_t nLimitDescendants = GetArg("-limitdescendantcount", DEFAULT_DESCENDANT_LIMIT);
@@ -1408,10 +1474,14 @@ bool AcceptToMemoryPoolWorker(CTxMemPool& pool, CValidationState &state, const C
 
         // Check if it's economically rational to mine this transaction rather
         // than the ones it replaces.
-        CAmount nConflictingFees = 0;
-        size_t nConflictingSize = 0;
+        // HFP0 PRF changed: kept in ws
+        CAmount& nConflictingFees = ws.nConflictingFees;
+        nConflictingFees = 0;
+        size_t& nConflictingSize = ws.nConflictingSize;
+        nConflictingSize = 0;
         uint64_t nConflictingCount = 0;
-        CTxMemPool::setEntries allConflicting;
+        CTxMemPool::setEntries& allConflicting = ws.allConflicting;
+        allConflicting.clear();
 
         // If we don't hold the lock allConflicting might be incomplete; the
         // subsequent RemoveStaged() and addUnchecked() calls don't guarantee
@@ -1432,24 +1502,7 @@ bool AcceptToMemoryPoolWorker(CTxMemPool& pool, CValidationState &state, const C
                 // Save these to avoid repeated lookups
                 setIterConflicting.insert(mi);
 
-                // If this entry is "dirty", then we don't have descendant
-                // state for this transaction, which means we probably have
-                // lots of in-mempool descendants.
-                // Don't allow replacements of dirty transactions, to ensure
-                // that we don't spend too much time walking descendants.
-                // This should be rare.
-                if (mi->IsDirty()) {
-#if HFP0_DEBUG_BSZ
-                    // HFP0 DBG begin
-                    LogPrintf("HFP0 BSZ: AcceptToMemoryPoolWorker: too many potential replacements\n");
-                    // HFP0 DBG end
-#endif
-                    return state.DoS(0,
-                            error("AcceptToMemoryPool: rejecting replacement %s; cannot replace tx %s with untracked descendants",
-                                hash.ToString(),
-                                mi->GetTx().GetHash().ToString()),
-                            REJECT_NONSTANDARD, "too many potential replacements");
-                }
+                // HFP0 PRF removed rejection of dirty entries (descendant state is always exact now)
 
                 // Don't allow the replacement to reduce the feerate of the
                 // mempool.
@@ -1575,101 +1628,170 @@ bool AcceptToMemoryPoolWorker(CTxMemPool& pool, CValidationState &state, const C
             }
         }
 
-        // Check against previous transactions
-        // This is done last to help prevent CPU exhaustion denial-of-service attacks.
-        // HFP0 BSZ TODO: renamed MAX_BLOCK_SIGOPS to OLD_MAX_BLOCK_SIGOPS here, but should it be using this value? Possible bug.
-        ValidationCostTracker costTracker(OLD_MAX_BLOCK_SIGOPS, MAX_BLOCK_SIGHASH);
-        if (!CheckInputs(tx, state, view, true, STANDARD_SCRIPT_VERIFY_FLAGS, true, &costTracker))
-        {
+        return true;
+    }
+}
+
+// HFP0 PRF begin
+/**
+ * The script checks of AcceptToMemoryPool. They only read view, so they may
+ * run on a script check thread while the caller holds cs_main.
+ */
+static bool AcceptToMemoryPoolScriptChecks(const CTransaction& tx, CValidationState& state, const CCoinsViewCache& view,
+                                           unsigned int nSize, int nSpendHeight, unsigned int nNextBlockFlags)
+// HFP0 PRF end
+{
+    const uint256& hash = tx.GetHash();
+
+    // Check against previous transactions
+    // This is done last to help prevent CPU exhaustion denial-of-service attacks.
+    // HFP0 BSZ TODO: renamed MAX_BLOCK_SIGOPS to OLD_MAX_BLOCK_SIGOPS here, but should it be using this value? Possible bug.
+    ValidationCostTracker costTracker(OLD_MAX_BLOCK_SIGOPS, MAX_BLOCK_SIGHASH);
+    // HFP0 PRF: ConnectBlock never looks up the standard flags, so only the
+    // check below leaves an entry in the script execution cache.
+    if (!CheckInputs(tx, state, view, true, STANDARD_SCRIPT_VERIFY_FLAGS, true, &costTracker, NULL, nSpendHeight, false))  // HFP0 PRF changed
+    {
 #if HFP0_DEBUG_BSZ
-            // HFP0 DBG begin
-            LogPrintf("HFP0 BSZ: AcceptToMemoryPoolWorker: CheckInputs failed\n");
-            // HFP0 DBG end
+        // HFP0 DBG begin
+        LogPrintf("HFP0 BSZ: AcceptToMemoryPoolWorker: CheckInputs failed\n");
+        // HFP0 DBG end
 #endif
-            return false;
-        }
-        // Reject transactions with very high signature-hash cost:
-        uint64_t sighash_limit = (uint64_t)nSize * MAX_BLOCK_SIGHASH / MAX_BLOCK_SIZE;
-        if (costTracker.GetSighashBytes() > sighash_limit)
-        {
+        return false;
+    }
+    // Reject transactions with very high signature-hash cost:
+    uint64_t sighash_limit = (uint64_t)nSize * MAX_BLOCK_SIGHASH / MAX_BLOCK_SIZE;
+    if (costTracker.GetSighashBytes() > sighash_limit)
+    {
 #if HFP0_DEBUG_BSZ
-            // HFP0 DBG begin
-            LogPrintf("HFP0 BSZ: AcceptToMemoryPoolWorker: too many sighash\n");
-            // HFP0 DBG end
+        // HFP0 DBG begin
+        LogPrintf("HFP0 BSZ: AcceptToMemoryPoolWorker: too many sighash\n");
+        // HFP0 DBG end
 #endif
-            return state.DoS(0,
-                             error("AcceptToMemoryPool: too much signature hashing %s: %d > %d",
-                                   hash.ToString(), costTracker.GetSighashBytes(), sighash_limit),
-                             REJECT_NONSTANDARD, "bat-txns-too-many-sighash");
-        }
-        LogPrint("txcost", "txcost %s size: %d sigops: %d sighash: %d\n",
-                 hash.ToString(), nSize, costTracker.GetSigOps(), costTracker.GetSighashBytes());
-
-        // Check again against just the consensus-critical mandatory script
-        // verification flags, in case of bugs in the standard flags that cause
-        // transactions to pass as valid when they're actually invalid. For
-        // instance the STRICTENC flag was incorrectly allowing certain
-        // CHECKSIG NOT scripts to pass, even though they were invalid.
-        //
-        // There is a similar check in CreateNewBlock() to prevent creating
-        // invalid blocks, however allowing such transactions into the mempool
-        // can be exploited as a DoS attack.
-        if (!CheckInputs(tx, state, view, true, MANDATORY_SCRIPT_VERIFY_FLAGS, true, NULL))
-        {
+        return state.DoS(0,
+                         error("AcceptToMemoryPool: too much signature hashing %s: %d > %d",
+                               hash.ToString(), costTracker.GetSighashBytes(), sighash_limit),
+                         REJECT_NONSTANDARD, "bat-txns-too-many-sighash");
+    }
+    LogPrint("txcost", "txcost %s size: %d sigops: %d sighash: %d\n",
+             hash.ToString(), nSize, costTracker.GetSigOps(), costTracker.GetSighashBytes());
+
+    // Check again against just the consensus-critical mandatory script
+    // verification flags, in case of bugs in the standard flags that cause
+    // transactions to pass as valid when they're actually invalid. For
+    // instance the STRICTENC flag was incorrectly allowing certain
+    // CHECKSIG NOT scripts to pass, even though they were invalid.
+    //
+    // There is a similar check in CreateNewBlock() to prevent creating
+    // invalid blocks, however allowing such transactions into the mempool
+    // can be exploited as a DoS attack.
+    // HFP0 PRF: use the flags the next block will most likely be checked
+    // with, which include the mandatory ones, so that ConnectBlock finds
+    // this transaction in the script execution cache.
+    if (!CheckInputs(tx, state, view, true, nNextBlockFlags | MANDATORY_SCRIPT_VERIFY_FLAGS, true, NULL, NULL, nSpendHeight))  // HFP0 PRF changed
+    {
 #if HFP0_DEBUG_BSZ
-            // HFP0 DBG begin
-            LogPrintf("HFP0 BSZ: AcceptToMemoryPoolWorker: bug - ConnectInputs failed against MANDATORY\n");
-            // HFP0 DBG end
+        // HFP0 DBG begin
+        LogPrintf("HFP0 BSZ: AcceptToMemoryPoolWorker: bug - ConnectInputs failed against MANDATORY\n");
+        // HFP0 DBG end
 #endif
-            return error("%s: BUG! PLEASE REPORT THIS! ConnectInputs failed against MANDATORY but not STANDARD flags %s, %s",
-                __func__, hash.ToString(), FormatStateMessage(state));
-        }
+        return error("%s: BUG! PLEASE REPORT THIS! ConnectInputs failed against MANDATORY but not STANDARD flags %s, %s",
+            __func__, hash.ToString(), FormatStateMessage(state));
+    }
 
-        // Remove conflicting transactions from the mempool
-        BOOST_FOREACH(const CTxMemPool::txiter it, allConflicting)
-        {
-            LogPrint("mempool", "replacing tx %s with %s for %s BTC additional fees, %d delta bytes\n",
-                    it->GetTx().GetHash().ToString(),
-                    hash.ToString(),
-                    FormatMoney(nModifiedFees - nConflictingFees),
-                    (int)nSize - (int)nConflictingSize);
-        }
-        pool.RemoveStaged(allConflicting);
+    return true;
+}
 
-        // Store transaction in memory
-        pool.addUnchecked(hash, entry, setAncestors, !IsInitialBlockDownload());
+bool CTxScriptsCheck::operator()() const
+{
+    *pfValid = AcceptToMemoryPoolScriptChecks(*ptx, *pstate, *pview, nSize, nSpendHeight, nNextBlockFlags);
+    return true;
+}
+
+// HFP0 PRF begin
+/** Add a transaction that passed all the checks to the pool, replacing what it conflicts with */
+static bool AcceptToMemoryPoolFinalize(CTxMemPool& pool, CValidationState& state, const CTransaction& tx,
+                                       bool fOverrideMempoolLimit, CTxMemPoolAcceptWorkspace& ws)
+// HFP0 PRF end
+{
+    AssertLockHeld(pool.cs);
+    const uint256& hash = tx.GetHash();
+    const CTxMemPoolEntry& entry = *ws.pentry;
+    const unsigned int nSize = entry.GetTxSize();
+
+    // Remove conflicting transactions from the mempool
+    BOOST_FOREACH(const CTxMemPool::txiter it, ws.allConflicting)
+    {
+        LogPrint("mempool", "replacing tx %s with %s for %s BTC additional fees, %d delta bytes\n",
+                it->GetTx().GetHash().ToString(),
+                hash.ToString(),
+                FormatMoney(ws.nModifiedFees - ws.nConflictingFees),
+                (int)nSize - (int)ws.nConflictingSize);
+    }
+    pool.RemoveStaged(ws.allConflicting);
 
-        // trim mempool and check if tx was trimmed
-        if (!fOverrideMempoolLimit) {
-            LimitMempoolSize(pool, GetArg("-maxmempool", DEFAULT_MAX_MEMPOOL_SIZE) * 1000000, GetArg("-mempoolexpiry", DEFAULT_MEMPOOL_EXPIRY) * 60 * 60);
-            if (!pool.exists(hash)) {
+    // Store transaction in memory
+    pool.addUnchecked(hash, entry, ws.setAncestors, !IsInitialBlockDownload());
+
+    // trim mempool and check if tx was trimmed
+    if (!fOverrideMempoolLimit) {
+        LimitMempoolSize(pool, GetArg("-maxmempool", DEFAULT_MAX_MEMPOOL_SIZE) * 1000000, GetArg("-mempoolexpiry", DEFAULT_MEMPOOL_EXPIRY) * 60 * 60);
+        if (!pool.exists(hash)) {
 #if HFP0_DEBUG_BSZ
-                // HFP0 DBG begin
-                LogPrintf("HFP0 BSZ: AcceptToMemoryPoolWorker: mempool full\n");
-                // HFP0 DBG end
+            // HFP0 DBG begin
+            LogPrintf("HFP0 BSZ: AcceptToMemoryPoolWorker: mempool full\n");
+            // HFP0 DBG end
 #endif
-                return state.DoS(0, false, REJECT_INSUFFICIENTFEE, "mempool full");
-            }
+            return state.DoS(0, false, REJECT_INSUFFICIENTFEE, "mempool full");
         }
     }
 
+    return true;
+}
+
+bool AcceptToMemoryPoolWorker(CTxMemPool& pool, CValidationState &state, const CTransaction &tx, bool fLimitFree,
+                              bool* pfMissingInputs, int64_t nAcceptTime, bool fOverrideMempoolLimit, bool fRejectAbsurdFee,  // HFP0 PRF changed: added nAcceptTime
+                              std::vector<COutPoint>& vCoinsToUncache)
+{
+    AssertLockHeld(cs_main);
+    // HFP0 PRF begin: split into AcceptToMemoryPoolBatch's phases
+    CTxMemPoolAcceptWorkspace ws;
+    {
+        LOCK(pool.cs);
+        if (!AcceptToMemoryPoolPreChecks(pool, state, tx, fLimitFree, pfMissingInputs, nAcceptTime, fRejectAbsurdFee, vCoinsToUncache, ws))
+            return false;
+        unsigned int nNextBlockFlags = GetBlockScriptFlags(CBlockHeader::CURRENT_VERSION, GetAdjustedTime(), chainActive.Tip(), Params().GetConsensus());
+        if (!AcceptToMemoryPoolScriptChecks(tx, state, ws.view, ws.pentry->GetTxSize(), chainActive.Height() + 1, nNextBlockFlags))
+            return false;
+        if (!AcceptToMemoryPoolFinalize(pool, state, tx, fOverrideMempoolLimit, ws))
+            return false;
+    }
+    // HFP0 PRF end
+
     SyncWithWallets(tx, NULL);
 
     return true;
 }
 
-bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState &state, const CTransaction &tx, bool fLimitFree,
-                        bool* pfMissingInputs, bool fOverrideMempoolLimit, bool fRejectAbsurdFee)
+// HFP0 PRF begin: entry time of a transaction reloaded from disk
+bool AcceptToMemoryPoolWithTime(CTxMemPool& pool, CValidationState &state, const CTransaction &tx, bool fLimitFree,
+                                bool* pfMissingInputs, int64_t nAcceptTime, bool fOverrideMempoolLimit, bool fRejectAbsurdFee)
 {
-    std::vector<uint256> vHashTxToUncache;
-    bool res = AcceptToMemoryPoolWorker(pool, state, tx, fLimitFree, pfMissingInputs, fOverrideMempoolLimit, fRejectAbsurdFee, vHashTxToUncache);
+    std::vector<COutPoint> vCoinsToUncache;
+    bool res = AcceptToMemoryPoolWorker(pool, state, tx, fLimitFree, pfMissingInputs, nAcceptTime, fOverrideMempoolLimit, fRejectAbsurdFee, vCoinsToUncache);
     if (!res) {
-        BOOST_FOREACH(const uint256& hashTx, vHashTxToUncache)
-            pcoinsTip->Uncache(hashTx);
+        BOOST_FOREACH(const COutPoint& outpoint, vCoinsToUncache)
+            pcoinsTip->Uncache(outpoint);
     }
     return res;
 }
 
+bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState &state, const CTransaction &tx, bool fLimitFree,
+                        bool* pfMissingInputs, bool fOverrideMempoolLimit, bool fRejectAbsurdFee)
+{
+    return AcceptToMemoryPoolWithTime(pool, state, tx, fLimitFree, pfMissingInputs, GetTime(), fOverrideMempoolLimit, fRejectAbsurdFee);
+}
+// HFP0 PRF end
+
 /** Return transaction in tx, and if it was found inside a block, its hash is placed in hashBlock */
 bool GetTransaction(const uint256 &hash, CTransaction &txOut, const Consensus::Params& consensusParams, uint256 &hashBlock, bool fAllowSlow)
 {
@@ -1706,10 +1828,9 @@ bool GetTransaction(const uint256 &hash, CTransaction &txOut, const Consensus::P
     if (fAllowSlow) { // use coin database to locate block that contains transaction, and scan it
         int nHeight = -1;
         {
-            CCoinsViewCache &view = *pcoinsTip;
-            const CCoins* coins = view.AccessCoins(hash);
-            if (coins)
-                nHeight = coins->nHeight;
+            const Coin& coin = AccessByTxid(*pcoinsTip, hash);
+            if (!coin.IsSpent())
+                nHeight = coin.nHeight;
         }
         if (nHeight > 0)
             pindexSlow = chainActive[nHeight];
@@ -1978,34 +2099,15 @@ void UpdateCoins(const CTransaction& tx, CValidationState &state, CCoinsViewCach
 {
     // mark inputs spent
     if (!tx.IsCoinBase()) {
-        txundo.vprevout.reserve(tx.vin.size());
-        BOOST_FOREACH(const CTxIn &txin, tx.vin) {
-            CCoinsModifier coins = inputs.ModifyCoins(txin.prevout.hash);
-            unsigned nPos = txin.prevout.n;
-
-            if (nPos >= coins->vout.size() || coins->vout[nPos].IsNull())
-                assert(false);
+        txundo.vprevout.resize(tx.vin.size());
+        for (unsigned int i = 0; i < tx.vin.size(); i++) {
             // mark an outpoint spent, and construct undo information
-            txundo.vprevout.push_back(CTxInUndo(coins->vout[nPos]));
-            coins->Spend(nPos);
-            if (coins->vout.size() == 0) {
-                CTxInUndo& undo = txundo.vprevout.back();
-                undo.nHeight = coins->nHeight;
-                undo.fCoinBase = coins->fCoinBase;
-                undo.nVersion = coins->nVersion;
-            }
+            bool is_spent = inputs.SpendCoin(tx.vin[i].prevout, &txundo.vprevout[i]);
+            assert(is_spent);
         }
-        // add outputs
-        inputs.ModifyNewCoins(tx.GetHash())->FromTx(tx, nHeight);
-    }
-    else {
-        // add outputs for coinbase tx
-        // In this case call the full ModifyCoins which will do a database
-        // lookup to be sure the coins do not already exist otherwise we do not
-        // know whether to mark them fresh or not.  We want the duplicate coinbases
-        // before BIP30 to still be properly overwritten.
-        inputs.ModifyCoins(tx.GetHash())->FromTx(tx, nHeight);
     }
+    // add outputs
+    AddCoins(inputs, tx, nHeight);
 }
 
 void UpdateCoins(const CTransaction& tx, CValidationState &state, CCoinsViewCache &inputs, int nHeight)
@@ -2015,11 +2117,17 @@ void UpdateCoins(const CTransaction& tx, CValidationState &state, CCoinsViewCach
 }
 
 bool CScriptCheck::operator()() {
+    // HFP0 PRF begin
+    if (pinputsCheck)
+        return (*pinputsCheck)();
+    if (pscriptsCheck)
+        return (*pscriptsCheck)();
+    // HFP0 PRF end
     if (costTracker && !costTracker->IsWithinLimits())
         return false; // Don't do any more checks if already past limits
 
     const CScript &scriptSig = ptxTo->vin[nIn].scriptSig;
-    CachingTransactionSignatureChecker checker(ptxTo, nIn, cacheStore);
+    CachingTransactionSignatureChecker checker(ptxTo, nIn, cacheStore, precomputed.get());  // HFP0 PRF changed
     if (!VerifyScript(scriptSig, scriptPubKey, nFlags, checker, &error)) {
         return false;
     }
@@ -2039,32 +2147,54 @@ int GetSpendHeight(const CCoinsViewCache& inputs)
 }
 
 namespace Consensus {
-bool CheckTxInputs(const CTransaction& tx, CValidationState& state, const CCoinsViewCache& inputs, int nSpendHeight)
+// HFP0 PRF begin
+namespace {
+/** The coins spent by a transaction, looked up in a coins view */
+class CViewSpentCoins
 {
-        // This doesn't trigger the DoS code on purpose; if it did, it would make it easier
-        // for an attacker to attempt to split the network.
-        if (!inputs.HaveInputs(tx))
-            return state.Invalid(false, 0, "", "Inputs unavailable");
+    const CCoinsViewCache& inputs;
+    const CTransaction& tx;
+public:
+    CViewSpentCoins(const CCoinsViewCache& inputsIn, const CTransaction& txIn) : inputs(inputsIn), tx(txIn) {}
+    const Coin& operator[](unsigned int i) const { return inputs.AccessCoin(tx.vin[i].prevout); }
+};
+
+/** The coins spent by a transaction, as saved in its undo data */
+class CUndoSpentCoins
+{
+    const CTxUndo& txundo;
+public:
+    CUndoSpentCoins(const CTxUndo& txundoIn) : txundo(txundoIn) {}
+    const Coin& operator[](unsigned int i) const { return txundo.vprevout[i]; }
+};
+}
 
+/**
+ * The value and maturity checks of CheckTxInputs, on the coins spent[i]
+ * spent by the inputs of tx. Shared with CTxInputsCheck, so that pipelined
+ * and serial block connection enforce exactly the same rules.
+ */
+template<typename SpentCoins>
+static bool CheckTxInputCoins(const CTransaction& tx, CValidationState& state, const SpentCoins& spent, int nSpendHeight)
+{
         CAmount nValueIn = 0;
         CAmount nFees = 0;
         for (unsigned int i = 0; i < tx.vin.size(); i++)
         {
-            const COutPoint &prevout = tx.vin[i].prevout;
-            const CCoins *coins = inputs.AccessCoins(prevout.hash);
-            assert(coins);
+            const Coin& coin = spent[i];
+            assert(!coin.IsSpent());
 
             // If prev is coinbase, check that it's matured
-            if (coins->IsCoinBase()) {
-                if (nSpendHeight - coins->nHeight < COINBASE_MATURITY)
+            if (coin.IsCoinBase()) {
+                if (nSpendHeight - (int)coin.nHeight < COINBASE_MATURITY)
                     return state.Invalid(false,
                         REJECT_INVALID, "bad-txns-premature-spend-of-coinbase",
-                        strprintf("tried to spend coinbase at depth %d", nSpendHeight - coins->nHeight));
+                        strprintf("tried to spend coinbase at depth %d", nSpendHeight - (int)coin.nHeight));
             }
 
             // Check for negative or overflow input values
-            nValueIn += coins->vout[prevout.n].nValue;
-            if (!MoneyRange(coins->vout[prevout.n].nValue) || !MoneyRange(nValueIn))
+            nValueIn += coin.out.nValue;
+            if (!MoneyRange(coin.out.nValue) || !MoneyRange(nValueIn))
                 return state.DoS(100, false, REJECT_INVALID, "bad-txns-inputvalues-outofrange");
 
         }
@@ -2082,13 +2212,59 @@ bool CheckTxInputs(const CTransaction& tx, CValidationState& state, const CCoins
             return state.DoS(100, false, REJECT_INVALID, "bad-txns-fee-outofrange");
     return true;
 }
+// HFP0 PRF end
+
+bool CheckTxInputs(const CTransaction& tx, CValidationState& state, const CCoinsViewCache& inputs, int nSpendHeight)
+{
+        // This doesn't trigger the DoS code on purpose; if it did, it would make it easier
+        // for an attacker to attempt to split the network.
+        if (!inputs.HaveInputs(tx))
+            return state.Invalid(false, 0, "", "Inputs unavailable");
+
+        return CheckTxInputCoins(tx, state, CViewSpentCoins(inputs, tx), nSpendHeight);  // HFP0 PRF changed
+}
 }// namespace Consensus
 
-bool CheckInputs(const CTransaction& tx, CValidationState &state, const CCoinsViewCache &inputs, bool fScriptChecks, unsigned int flags, bool cacheStore, ValidationCostTracker* costTracker, std::vector<CScriptCheck> *pvChecks)
+// HFP0 PRF begin
+bool CTxInputsCheck::operator()() const
+{
+    const CTransaction& tx = *ptx;
+    const Consensus::CUndoSpentCoins spent(*pundo);
+
+    std::vector<int> prevheights(tx.vin.size());
+    for (size_t j = 0; j < tx.vin.size(); j++)
+        prevheights[j] = spent[j].nHeight;
+    if (!SequenceLocks(tx, nLockTimeFlags, &prevheights, *pindex))
+        return false;
+
+    CAmount nValueIn = 0;
+    unsigned int nSigOps = 0;
+    for (unsigned int i = 0; i < tx.vin.size(); i++) {
+        const CTxOut& prevout = spent[i].out;
+        if (fStrictPayToScriptHash && prevout.scriptPubKey.IsPayToScriptHash())
+            nSigOps += prevout.scriptPubKey.GetSigOpCount(tx.vin[i].scriptSig);
+        nValueIn += prevout.nValue;
+    }
+
+    // Transactions pre-verified by a thin block only get the checks ConnectBlock
+    // itself makes; the rest were done when they were accepted to the mempool.
+    if (fCheckValues) {
+        CValidationState state;
+        if (!Consensus::CheckTxInputCoins(tx, state, spent, pindex->nHeight))
+            return false;
+    }
+
+    *pnSigOps += nSigOps;
+    *pnFees += nValueIn - tx.GetValueOut();
+    return true;
+}
+// HFP0 PRF end
+
+bool CheckInputs(const CTransaction& tx, CValidationState &state, const CCoinsViewCache &inputs, bool fScriptChecks, unsigned int flags, bool cacheStore, ValidationCostTracker* costTracker, std::vector<CScriptCheck> *pvChecks, int nSpendHeight, bool fCacheScriptExecution)
 {
     if (!tx.IsCoinBase())
     {
-        if (!Consensus::CheckTxInputs(tx, state, inputs, GetSpendHeight(inputs)))
+        if (!Consensus::CheckTxInputs(tx, state, inputs, nSpendHeight >= 0 ? nSpendHeight : GetSpendHeight(inputs)))  // HFP0 PRF changed
             return false;
 
         if (pvChecks)
@@ -2102,13 +2278,39 @@ bool CheckInputs(const CTransaction& tx, CValidationState &state, const CCoinsVi
         // before the last block chain checkpoint. This is safe because block merkle hashes are
         // still computed and checked, and any change will be caught at the next checkpoint.
         if (fScriptChecks) {
+            // HFP0 PRF begin
+            // Scripts that all passed with these flags before are not run
+            // again; only what they cost is counted against the limits.
+            uint32_t nCachedSigOps, nCachedSighashBytes;
+            if (GetCachedScriptExecution(tx.GetHash(), flags, !cacheStore, nCachedSigOps, nCachedSighashBytes)) {
+                if (!costTracker)
+                    return true;
+                ScriptError serror = costTracker->IsWithinLimits() ? SCRIPT_ERR_OK : SCRIPT_ERR_UNKNOWN_ERROR;
+                if (costTracker->Update(tx.GetHash(), nCachedSigOps, nCachedSighashBytes))
+                    return true;
+                // Fail the way the checks below do when running over the limits
+                if (flags & STANDARD_NOT_MANDATORY_VERIFY_FLAGS)
+                    return state.Invalid(false, REJECT_NONSTANDARD, strprintf("non-mandatory-script-verify-flag (%s)", ScriptErrorString(serror)));
+                return state.DoS(100,false, REJECT_INVALID, strprintf("mandatory-script-verify-flag-failed (%s)", ScriptErrorString(serror)));
+            }
+
+            // Inline checks also count their cost on their own, for the cache
+            ValidationCostTracker txCostTracker(std::numeric_limits<uint32_t>::max(), std::numeric_limits<uint32_t>::max());
+            ValidationCostTracker* pcostTracker = pvChecks || costTracker ? costTracker : &txCostTracker;
+            uint32_t nSigOpsBefore = pcostTracker ? pcostTracker->GetSigOps() : 0;
+            uint32_t nSighashBytesBefore = pcostTracker ? pcostTracker->GetSighashBytes() : 0;
+            // Hash the parts of the transaction all its signatures cover only once
+            boost::shared_ptr<const PrecomputedSighashData> precomputed;
+            if (tx.vin.size() >= MIN_PRECOMPUTED_SIGHASH_INPUTS)
+                precomputed.reset(new PrecomputedSighashData(tx));
+            // HFP0 PRF end
             for (unsigned int i = 0; i < tx.vin.size(); i++) {
                 const COutPoint &prevout = tx.vin[i].prevout;
-                const CCoins* coins = inputs.AccessCoins(prevout.hash);
-                assert(coins);
+                const Coin& coin = inputs.AccessCoin(prevout);
+                assert(!coin.IsSpent());
 
                 // Verify signature
-                CScriptCheck check(costTracker, *coins, tx, i, flags, cacheStore);
+                CScriptCheck check(pcostTracker, coin.out, tx, i, flags, cacheStore, precomputed);  // HFP0 PRF changed
                 if (pvChecks) {
                     pvChecks->push_back(CScriptCheck());
                     check.swap(pvChecks->back());
@@ -2120,7 +2322,7 @@ bool CheckInputs(const CTransaction& tx, CValidationState &state, const CCoinsVi
                         // arguments; if so, don't trigger DoS protection to
                         // avoid splitting the network between upgraded and
                         // non-upgraded nodes.
-                        CScriptCheck check2(NULL, *coins, tx, i,
+                        CScriptCheck check2(NULL, coin.out, tx, i,
                                 flags & ~STANDARD_NOT_MANDATORY_VERIFY_FLAGS, cacheStore);
                         if (check2())
                             return state.Invalid(false, REJECT_NONSTANDARD, strprintf("non-mandatory-script-verify-flag (%s)", ScriptErrorString(check.GetScriptError())));
@@ -2135,6 +2337,10 @@ bool CheckInputs(const CTransaction& tx, CValidationState &state, const CCoinsVi
                     return state.DoS(100,false, REJECT_INVALID, strprintf("mandatory-script-verify-flag-failed (%s)", ScriptErrorString(check.GetScriptError())));
                 }
             }
+            // HFP0 PRF begin
+            if (cacheStore && fCacheScriptExecution && !pvChecks)
+                CacheScriptExecution(tx.GetHash(), flags, pcostTracker->GetSigOps() - nSigOpsBefore, pcostTracker->GetSighashBytes() - nSighashBytesBefore);
+            // HFP0 PRF end
         }
     }
 
@@ -2218,34 +2424,35 @@ bool AbortNode(CValidationState& state, const std::string& strMessage, const std
 } // anon namespace
 
 /**
- * Apply the undo operation of a CTxInUndo to the given chain state.
- * @param undo The undo object.
+ * Restore the UTXO in a Coin at a given COutPoint.
+ * @param undo The Coin to be restored.
  * @param view The coins view to which to apply the changes.
  * @param out The out point that corresponds to the tx input.
  * @return True on success.
  */
-static bool ApplyTxInUndo(const CTxInUndo& undo, CCoinsViewCache& view, const COutPoint& out)
+static bool ApplyTxInUndo(Coin& undo, CCoinsViewCache& view, const COutPoint& out)
 {
     bool fClean = true;
 
-    CCoinsModifier coins = view.ModifyCoins(out.hash);
-    if (undo.nHeight != 0) {
-        // undo data contains height: this is the last output of the prevout tx being spent
-        if (!coins->IsPruned())
-            fClean = fClean && error("%s: undo data overwriting existing transaction", __func__);
-        coins->Clear();
-        coins->fCoinBase = undo.fCoinBase;
-        coins->nHeight = undo.nHeight;
-        coins->nVersion = undo.nVersion;
-    } else {
-        if (coins->IsPruned())
-            fClean = fClean && error("%s: undo data adding output to missing transaction", __func__);
-    }
-    if (coins->IsAvailable(out.n))
+    if (view.HaveCoin(out))
         fClean = fClean && error("%s: undo data overwriting existing output", __func__);
-    if (coins->vout.size() < out.n+1)
-        coins->vout.resize(out.n+1);
-    coins->vout[out.n] = undo.txout;
+    if (undo.nHeight == 0) {
+        // Missing undo metadata (height and coinbase). Older versions included this
+        // information only in undo records for the last spend of a transactions'
+        // outputs. This implies that it must be present for some other output of the same tx.
+        const Coin& alternate = AccessByTxid(view, out.hash);
+        if (!alternate.IsSpent()) {
+            undo.nHeight = alternate.nHeight;
+            undo.fCoinBase = alternate.fCoinBase;
+        } else {
+            return error("%s: undo data adding output to missing transaction", __func__);
+        }
+    }
+    // The potential_overwrite parameter to AddCoin is only allowed to be false if we know for
+    // sure that the coin did not already exist in the cache. As we have queried for that above
+    // using HaveCoin, we don't need to guess. When fClean is false, a coin already existed and
+    // it is an overwrite.
+    view.AddCoin(out, undo, !fClean);
 
     return fClean;
 }
@@ -2273,35 +2480,29 @@ bool DisconnectBlock(const CBlock& block, CValidationState& state, const CBlockI
     for (int i = block.vtx.size() - 1; i >= 0; i--) {
         const CTransaction &tx = block.vtx[i];
         uint256 hash = tx.GetHash();
+        bool is_coinbase = tx.IsCoinBase();
 
         // Check that all outputs are available and match the outputs in the block itself
         // exactly.
-        {
-        CCoinsModifier outs = view.ModifyCoins(hash);
-        outs->ClearUnspendable();
-
-        CCoins outsBlock(tx, pindex->nHeight);
-        // The CCoins serialization does not serialize negative numbers.
-        // No network rules currently depend on the version here, so an inconsistency is harmless
-        // but it must be corrected before txout nversion ever influences a network rule.
-        if (outsBlock.nVersion < 0)
-            outs->nVersion = outsBlock.nVersion;
-        if (*outs != outsBlock)
-            fClean = fClean && error("DisconnectBlock(): added transaction mismatch? database corrupted");
-
-        // remove outputs
-        outs->Clear();
+        for (size_t o = 0; o < tx.vout.size(); o++) {
+            if (!tx.vout[o].scriptPubKey.IsUnspendable()) {
+                COutPoint out(hash, o);
+                Coin coin;
+                bool is_spent = view.SpendCoin(out, &coin);
+                if (!is_spent || tx.vout[o] != coin.out || pindex->nHeight != (int)coin.nHeight || is_coinbase != (bool)coin.fCoinBase) {
+                    fClean = fClean && error("DisconnectBlock(): added transaction mismatch? database corrupted");
+                }
+            }
         }
 
         // restore inputs
         if (i > 0) { // not coinbases
-            const CTxUndo &txundo = blockUndo.vtxundo[i-1];
+            CTxUndo &txundo = blockUndo.vtxundo[i-1];
             if (txundo.vprevout.size() != tx.vin.size())
                 return error("DisconnectBlock(): transaction and undo data inconsistent");
             for (unsigned int j = tx.vin.size(); j-- > 0;) {
                 const COutPoint &out = tx.vin[j].prevout;
-                const CTxInUndo &undo = txundo.vprevout[j];
-                if (!ApplyTxInUndo(undo, view, out))
+                if (!ApplyTxInUndo(txundo.vprevout[j], view, out))
                     fClean = false;
             }
         }
@@ -2343,13 +2544,116 @@ void static FlushBlockFile(bool fFinalize = false)
 
 bool FindUndoPos(CValidationState &state, int nFile, CDiskBlockPos &pos, unsigned int nAddSize);
 
-static CCheckQueue<CScriptCheck> scriptcheckqueue(128);
+static CCheckQueue<CScriptCheck> scriptcheckqueue(128, MAX_SCRIPTCHECK_THREADS); // HFP0 PRF changed
 
 void ThreadScriptCheck() {
     RenameThread("bitcoin-scriptch");
     scriptcheckqueue.Thread();
 }
 
+// HFP0 PRF begin
+unsigned int AcceptToMemoryPoolBatch(CTxMemPool& pool, const std::vector<CTransaction>& vtx, bool fLimitFree,
+                                     std::vector<bool>& vAccepted, std::vector<bool>& vMissingInputs, std::vector<CValidationState>& vState)
+{
+    AssertLockHeld(cs_main);
+    vAccepted.assign(vtx.size(), false);
+    vMissingInputs.assign(vtx.size(), false);
+    vState.assign(vtx.size(), CValidationState());
+    std::vector<std::vector<COutPoint> > vCoinsToUncache(vtx.size());
+    std::vector<size_t> vSync;
+    unsigned int nAccepted = 0;
+
+    {
+        LOCK(pool.cs);
+        const int64_t nAcceptTime = GetTime();
+        const int nSpendHeight = chainActive.Height() + 1;
+        const unsigned int nNextBlockFlags = GetBlockScriptFlags(CBlockHeader::CURRENT_VERSION, GetAdjustedTime(), chainActive.Tip(), Params().GetConsensus());
+
+        // Transactions spending outputs of others in the batch only pass the
+        // checks once those are in the pool, so go in rounds until one adds nothing.
+        std::vector<size_t> vTodo;
+        for (size_t i = 0; i < vtx.size(); i++)
+            vTodo.push_back(i);
+        while (!vTodo.empty()) {
+            // All the checks but the scripts, fetching the inputs of each transaction once
+            std::vector<boost::shared_ptr<CTxMemPoolAcceptWorkspace> > vws(vtx.size());
+            std::vector<size_t> vChecked, vDeferred;
+            BOOST_FOREACH(size_t i, vTodo) {
+                bool fMissingInputs = false;
+                vState[i] = CValidationState();
+                vws[i].reset(new CTxMemPoolAcceptWorkspace());
+                if (AcceptToMemoryPoolPreChecks(pool, vState[i], vtx[i], fLimitFree, &fMissingInputs, nAcceptTime, false, vCoinsToUncache[i], *vws[i]))
+                    vChecked.push_back(i);
+                else if (fMissingInputs)
+                    vDeferred.push_back(i);
+            }
+
+            // The scripts of each transaction as one check, on the script check threads
+            std::vector<CTxScriptsCheck> vScriptsChecks;
+            vScriptsChecks.reserve(vChecked.size());
+            BOOST_FOREACH(size_t i, vChecked)
+                vScriptsChecks.push_back(CTxScriptsCheck(vtx[i], vws[i]->view, vws[i]->pentry->GetTxSize(), nSpendHeight, nNextBlockFlags, vState[i], vws[i]->fScriptsValid));
+            if (nScriptCheckThreads) {
+                std::vector<CScriptCheck> vChecks(vScriptsChecks.size());
+                for (size_t j = 0; j < vScriptsChecks.size(); j++) {
+                    CScriptCheck check(vScriptsChecks[j]);
+                    check.swap(vChecks[j]);
+                }
+                CCheckQueueControl<CScriptCheck> control(&scriptcheckqueue);
+                control.Add(vChecks);
+                control.Wait();
+            } else {
+                BOOST_FOREACH(const CTxScriptsCheck& check, vScriptsChecks)
+                    check();
+            }
+
+            // Add the ones that passed, in order. Once the pool has changed,
+            // the checks that depend on it are made again; the verdict on the
+            // scripts, which only depend on the coins spent, stands.
+            bool fPoolChanged = false;
+            BOOST_FOREACH(size_t i, vChecked) {
+                if (!vws[i]->fScriptsValid)
+                    continue;
+                if (fPoolChanged) {
+                    // Afresh, as the coins of parents evicted meanwhile may be in the old view.
+                    // Free transactions were already counted against the rate limit.
+                    bool fMissingInputs = false;
+                    vws[i].reset(new CTxMemPoolAcceptWorkspace());
+                    if (!AcceptToMemoryPoolPreChecks(pool, vState[i], vtx[i], false, &fMissingInputs, nAcceptTime, false, vCoinsToUncache[i], *vws[i])) {
+                        vMissingInputs[i] = fMissingInputs;
+                        continue;
+                    }
+                }
+                fPoolChanged = true;
+                if (AcceptToMemoryPoolFinalize(pool, vState[i], vtx[i], false, *vws[i])) {
+                    vAccepted[i] = true;
+                    vSync.push_back(i);
+                    nAccepted++;
+                }
+            }
+
+            if (!fPoolChanged) {
+                BOOST_FOREACH(size_t i, vDeferred)
+                    vMissingInputs[i] = true;
+                break;
+            }
+            vTodo.swap(vDeferred);
+        }
+    }
+
+    // Outside of mempool.cs, as the wallets take cs_wallet
+    BOOST_FOREACH(size_t i, vSync)
+        SyncWithWallets(vtx[i], NULL);
+    for (size_t i = 0; i < vtx.size(); i++) {
+        if (vAccepted[i])
+            continue;
+        BOOST_FOREACH(const COutPoint& outpoint, vCoinsToUncache[i])
+            pcoinsTip->Uncache(outpoint);
+    }
+    return nAccepted;
+}
+// HFP0 PRF end
+
 //
 // Called periodically asynchronously; alerts if it smells like
 // we're being fed a bad chain (blocks being generated much
@@ -2421,6 +2725,12 @@ static int64_t nTimeConnect = 0;
 static int64_t nTimeIndex = 0;
 static int64_t nTimeCallbacks = 0;
 static int64_t nTimeTotal = 0;
+// HFP0 PRF begin
+static int64_t nTimePipelineInputs = 0;
+static int64_t nTimePipelineUpdate = 0;
+static int64_t nTimePipelineQueue = 0;
+static int64_t nTimePipelineWait = 0;
+// HFP0 PRF end
 
 // HFP0 FRK begin
 static bool DidBlockTriggerHFP0SizeFork(const CBlock &block, const CBlockIndex *pindex, const CChainParams &chainparams)
@@ -2445,6 +2755,129 @@ void UpdateAdaptiveBlockSizeVars(CBlockIndex* pindexPrev)
 }
 // HFP0 BSZ end
 
+// HFP0 PRF begin
+/**
+ * Connect the transactions of a block to view with all per-transaction checks
+ * running on the script check threads. The calling thread only resolves the
+ * inputs and updates the coins; the undo data it builds holds the spent coins
+ * the queued CTxInputsCheck and CScriptCheck jobs work on, so checking a
+ * transaction starts as soon as its inputs are known.
+ * Returns false, without a reason, if any check failed: the caller then
+ * connects the block serially to find the exact rejection.
+ */
+static bool ConnectTransactionsPipelined(const CBlock& block, const CBlockIndex* pindex, CCoinsViewCache& view,
+                                         unsigned int flags, int nLockTimeFlags, bool fStrictPayToScriptHash, bool fCacheResults,
+                                         CBlockUndo& blockundo, std::vector<std::pair<uint256, CDiskTxPos> >& vPos,
+                                         CAmount& nFeesOut, int& nCheckedOut, int& nOrphansCheckedOut)
+{
+    int64_t nTimeStart = GetTimeMicros();
+    int64_t nInputs = 0, nUpdate = 0, nQueue = 0;
+
+    ValidationCostTracker costTracker(MaxBlockSigops(pindex->nHeight), MaxBlockSighash(pindex->nHeight));
+    boost::atomic<int64_t> nFees(0);
+    boost::atomic<uint32_t> nP2SHSigOps(0);
+    uint32_t nSigOps = 0;
+    int nChecked = 0;
+    int nOrphansChecked = 0;
+    std::vector<uint256> vPreVerified;
+    // Referenced by the queued checks; never reallocated while they run
+    std::vector<CTxInputsCheck> vInputsChecks;
+    vInputsChecks.reserve(block.vtx.size());
+    blockundo.vtxundo.reserve(blockundo.vtxundo.size() + block.vtx.size() - 1);
+    CDiskTxPos pos(pindex->GetBlockPos(), GetSizeOfCompactSize(block.vtx.size()));
+    CValidationState stateDummy;
+    CTxUndo undoDummy;
+
+    CCheckQueueControl<CScriptCheck> control(&scriptcheckqueue);
+    for (unsigned int i = 0; i < block.vtx.size(); i++)
+    {
+        const CTransaction &tx = block.vtx[i];
+        int64_t nTime0 = GetTimeMicros();
+
+        nSigOps += GetLegacySigOpCount(tx);
+        if (nSigOps > maxBlockSigops)
+            return false;
+        if (!tx.IsCoinBase() && !view.HaveInputs(tx))
+            return false;
+        int64_t nTime1 = GetTimeMicros(); nInputs += nTime1 - nTime0;
+
+        if (i > 0)
+            blockundo.vtxundo.push_back(CTxUndo());
+        UpdateCoins(tx, stateDummy, view, i == 0 ? undoDummy : blockundo.vtxundo.back(), pindex->nHeight);
+        vPos.push_back(std::make_pair(tx.GetHash(), pos));
+        pos.nTxOffset += ::GetSerializeSize(tx, SER_DISK, CLIENT_VERSION);
+        int64_t nTime2 = GetTimeMicros(); nUpdate += nTime2 - nTime1;
+
+        if (!tx.IsCoinBase())
+        {
+            const CTxUndo& txundo = blockundo.vtxundo.back();
+
+            // HFP0 XTB: as in ConnectBlock, skip the input checks of transactions pre-verified by a thin block
+            uint256 hash = tx.GetHash();
+            bool inOrphanCache = setUnVerifiedOrphanTxHash.count(hash);
+            bool fCheckInputs = inOrphanCache || !setPreVerifiedTxHash.count(hash);
+            if (fCheckInputs) {
+                nChecked++;
+                if (inOrphanCache)
+                    nOrphansChecked++;
+            } else {
+                vPreVerified.push_back(hash);
+            }
+
+            vInputsChecks.push_back(CTxInputsCheck(tx, txundo, *pindex, nLockTimeFlags, fStrictPayToScriptHash, fCheckInputs, nFees, nP2SHSigOps));
+            std::vector<CScriptCheck> vChecks;
+            vChecks.reserve(1 + (fCheckInputs ? tx.vin.size() : 0));
+            vChecks.push_back(CScriptCheck(vInputsChecks.back()));
+            // Scripts that passed with these flags before only count their cost
+            bool fCheckScripts = fCheckInputs;
+            uint32_t nCachedSigOps, nCachedSighashBytes;
+            if (fCheckScripts && GetCachedScriptExecution(hash, flags, !fCacheResults, nCachedSigOps, nCachedSighashBytes)) {
+                if (!costTracker.Update(hash, nCachedSigOps, nCachedSighashBytes))
+                    return false;
+                fCheckScripts = false;
+            }
+            boost::shared_ptr<const PrecomputedSighashData> precomputed;
+            if (fCheckScripts && tx.vin.size() >= MIN_PRECOMPUTED_SIGHASH_INPUTS)
+                precomputed.reset(new PrecomputedSighashData(tx));
+            for (unsigned int j = 0; fCheckScripts && j < tx.vin.size(); j++) {
+                CScriptCheck check(&costTracker, txundo.vprevout[j].out, tx, j, flags, fCacheResults, precomputed);
+                vChecks.push_back(CScriptCheck());
+                check.swap(vChecks.back());
+            }
+            control.Add(vChecks);
+        }
+        nQueue += GetTimeMicros() - nTime2;
+    }
+
+    int64_t nTime3 = GetTimeMicros();
+    bool fOk = control.Wait();
+    int64_t nTime4 = GetTimeMicros();
+    nTimePipelineInputs += nInputs;
+    nTimePipelineUpdate += nUpdate;
+    nTimePipelineQueue += nQueue;
+    nTimePipelineWait += nTime4 - nTime3;
+    LogPrint("bench", "        - Resolve inputs: %.2fms [%.2fs]\n", 0.001 * nInputs, nTimePipelineInputs * 0.000001);
+    LogPrint("bench", "        - Update coins: %.2fms [%.2fs]\n", 0.001 * nUpdate, nTimePipelineUpdate * 0.000001);
+    LogPrint("bench", "        - Queue checks: %.2fms [%.2fs]\n", 0.001 * nQueue, nTimePipelineQueue * 0.000001);
+    LogPrint("bench", "        - Wait for checks: %.2fms (%.2fms pipelined) [%.2fs]\n", 0.001 * (nTime4 - nTime3), 0.001 * (nTime3 - nTimeStart), nTimePipelineWait * 0.000001);
+
+    if (!fOk)
+        return false;
+    nSigOps += nP2SHSigOps;
+    if (nSigOps > maxBlockSigops)
+        return false;
+
+    BOOST_FOREACH(const uint256& hash, vPreVerified) {
+        setPreVerifiedTxHash.erase(hash);
+        setUnVerifiedOrphanTxHash.erase(hash);
+    }
+    nFeesOut = nFees;
+    nCheckedOut = nChecked;
+    nOrphansCheckedOut = nOrphansChecked;
+    return true;
+}
+// HFP0 PRF end
+
 bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pindex, CCoinsViewCache& view, bool fJustCheck)
 {
     const CChainParams& chainparams = Params();
@@ -2508,30 +2941,18 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
 
     if (fEnforceBIP30) {
         BOOST_FOREACH(const CTransaction& tx, block.vtx) {
-            const CCoins* coins = view.AccessCoins(tx.GetHash());
-            if (coins && !coins->IsPruned())
-                return state.DoS(100, error("ConnectBlock(): tried to overwrite transaction"),
-                                 REJECT_INVALID, "bad-txns-BIP30");
+            for (size_t o = 0; o < tx.vout.size(); o++) {
+                if (view.HaveCoin(COutPoint(tx.GetHash(), o))) {
+                    return state.DoS(100, error("ConnectBlock(): tried to overwrite transaction"),
+                                     REJECT_INVALID, "bad-txns-BIP30");
+                }
+            }
         }
     }
 
-    // BIP16 didn't become active until Apr 1 2012
-    int64_t nBIP16SwitchTime = 1333238400;
-    bool fStrictPayToScriptHash = (pindex->GetBlockTime() >= nBIP16SwitchTime);
-
-    unsigned int flags = fStrictPayToScriptHash ? SCRIPT_VERIFY_P2SH : SCRIPT_VERIFY_NONE;
-
-    // Start enforcing the DERSIG (BIP66) rules, for block.nVersion=3 blocks,
-    // when 75% of the network has upgraded:
-    if (block.nVersion >= 3 && IsSuperMajority(3, pindex->pprev, chainparams.GetConsensus().nMajorityEnforceBlockUpgrade, chainparams.GetConsensus())) {
-        flags |= SCRIPT_VERIFY_DERSIG;
-    }
-
-    // Start enforcing CHECKLOCKTIMEVERIFY, (BIP65) for block.nVersion=4
-    // blocks, when 75% of the network has upgraded:
-    if (block.nVersion >= 4 && IsSuperMajority(4, pindex->pprev, chainparams.GetConsensus().nMajorityEnforceBlockUpgrade, chainparams.GetConsensus())) {
-        flags |= SCRIPT_VERIFY_CHECKLOCKTIMEVERIFY;
-    }
+    // HFP0 PRF changed: script flags moved to GetBlockScriptFlags
+    unsigned int flags = GetBlockScriptFlags(block.nVersion, pindex->GetBlockTime(), pindex->pprev, chainparams.GetConsensus());
+    bool fStrictPayToScriptHash = (flags & SCRIPT_VERIFY_P2SH) != 0;
 
     // HFP0 FRK, BSZ begin: activate adaptive block size (BSZ) after fork trigger
     if (pindex->nHeight+1 >= chainparams.GetConsensus().nHFP0ActivateSizeForkHeight) {
@@ -2561,7 +2982,7 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
 
     // HFP0 RLT (BIP68) begin
     std::vector<int> prevheights;
-    int nLockTimeFlags = 0;
+    int nLockTimeFlags = nBlockLockTimeFlags;
     // HFP0 RLT (BIP68) end
     CAmount nFees = 0;
     int nInputs = 0;
@@ -2575,7 +2996,29 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
     int nChecked = 0;
     int nOrphansChecked = 0;
     // HFP0 XTB end
-    for (unsigned int i = 0; i < block.vtx.size(); i++)
+    // HFP0 PRF begin
+    // With script check threads, first try connecting with all checks pipelined;
+    // on failure, throw that attempt away and redo it serially below, which
+    // leaves exactly the state and reject reason the serial checks produce.
+    bool fPipelined = false;
+    if (fPipelineConnect && fScriptChecks && nScriptCheckThreads) {
+        BOOST_FOREACH(const CTransaction& tx, block.vtx)
+            nInputs += tx.vin.size();
+        CCoinsViewCache viewPipeline(&view);
+        fPipelined = ConnectTransactionsPipelined(block, pindex, viewPipeline, flags, nLockTimeFlags, fStrictPayToScriptHash, fJustCheck,
+                                                  blockundo, vPos, nFees, nChecked, nOrphansChecked);
+        if (fPipelined) {
+            viewPipeline.SetBestBlock(view.GetBestBlock());
+            viewPipeline.Flush();
+        } else {
+            LogPrint("bench", "      - Pipelined connect failed, connecting serially\n");
+            nInputs = 0;
+            blockundo.vtxundo.clear();
+            vPos.clear();
+        }
+    }
+    // HFP0 PRF end
+    for (unsigned int i = 0; i < block.vtx.size() && !fPipelined; i++)  // HFP0 PRF changed: skipped once pipelined
     {
         const CTransaction &tx = block.vtx[i];
 
@@ -2599,7 +3042,7 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
             // be in ConnectBlock because they require the UTXO set
             prevheights.resize(tx.vin.size());
             for (size_t j = 0; j < tx.vin.size(); j++) {
-                prevheights[j] = view.AccessCoins(tx.vin[j].prevout.hash)->nHeight;
+                prevheights[j] = view.AccessCoin(tx.vin[j].prevout).nHeight;
             }
 
             if (!SequenceLocks(tx, nLockTimeFlags, &prevheights, *pindex)) {
@@ -2819,12 +3262,12 @@ bool static FlushStateToDisk(CValidationState &state, FlushStateMode mode) {
     }
     // Flush best chain related state. This can only be done if the blocks / block index write was also done.
     if (fDoFullFlush) {
-        // Typical CCoins structures on disk are around 128 bytes in size.
+        // Typical Coin structures on disk are around 48 bytes in size.
         // Pushing a new one to the database can cause it to be written
         // twice (once in the log, and once in the tables). This is already
         // an overestimation, as most will delete an existing entry or
         // overwrite one. Still, use a conservative safety factor of 2.
-        if (!CheckDiskSpace(128 * 2 * 2 * pcoinsTip->GetCacheSize()))
+        if (!CheckDiskSpace(48 * 2 * 2 * pcoinsTip->GetCacheSize()))
             return state.Error("out of disk space");
         // Flush the chainstate (which may refer to block index entries).
         if (!pcoinsTip->Flush())
@@ -2956,11 +3399,107 @@ bool static DisconnectTip(CValidationState& state, const Consensus::Params& cons
 }
 
 static int64_t nTimeReadFromDisk = 0;
+static int64_t nTimePrefetch = 0;  // HFP0 PRF added
 static int64_t nTimeConnectTotal = 0;
 static int64_t nTimeFlush = 0;
 static int64_t nTimeChainState = 0;
 static int64_t nTimePostConnect = 0;
 
+// HFP0 PRF begin: parallel pre-fetching of block inputs
+/**
+ * Work shared by the threads pre-fetching the inputs of one block. Each thread
+ * takes small runs of outpoints and reads them from the backing view, which must
+ * allow concurrent GetCoin calls (the LevelDB backed CCoinsViewDB does).
+ */
+class CInputPrefetcher
+{
+private:
+    CCoinsView& base;
+    const std::vector<COutPoint>& outpoints;
+    boost::mutex cs;
+    size_t nNext;
+
+public:
+    std::vector<Coin> coins;
+    std::vector<char> found;
+
+    CInputPrefetcher(CCoinsView& baseIn, const std::vector<COutPoint>& outpointsIn) :
+        base(baseIn), outpoints(outpointsIn), nNext(0), coins(outpointsIn.size()), found(outpointsIn.size(), 0) {}
+
+    void Run()
+    {
+        const size_t nBatchSize = 16;
+        while (true) {
+            size_t nBegin, nEnd;
+            {
+                boost::unique_lock<boost::mutex> lock(cs);
+                if (nNext >= outpoints.size())
+                    return;
+                nBegin = nNext;
+                nEnd = std::min(nBegin + nBatchSize, outpoints.size());
+                nNext = nEnd;
+            }
+            for (size_t i = nBegin; i < nEnd; i++)
+                found[i] = base.GetCoin(outpoints[i], coins[i]);
+        }
+    }
+};
+
+/**
+ * Load the coins spent by a block into the coins tip cache before ConnectBlock
+ * runs, reading the ones that are not cached yet from the database on up to
+ * -utxoprefetch threads. ConnectBlock then finds all its inputs in memory
+ * instead of paying for one serial database read per missing input.
+ */
+static void PrefetchBlockInputs(const CBlock& block, CCoinsViewCache& cache)
+{
+    AssertLockHeld(cs_main);
+    if (nUtxoPrefetchThreads <= 0 || block.vtx.size() <= 1)
+        return;
+
+    int64_t nTimeStart = GetTimeMicros();
+    std::set<uint256> setBlockTxids;
+    BOOST_FOREACH(const CTransaction& tx, block.vtx)
+        setBlockTxids.insert(tx.GetHash());
+    std::set<COutPoint> setPrevouts;
+    for (unsigned int i = 1; i < block.vtx.size(); i++) {
+        BOOST_FOREACH(const CTxIn& txin, block.vtx[i].vin) {
+            if (!setBlockTxids.count(txin.prevout.hash))
+                setPrevouts.insert(txin.prevout);
+        }
+    }
+    std::vector<COutPoint> vMissing;
+    BOOST_FOREACH(const COutPoint& outpoint, setPrevouts) {
+        if (!cache.HaveCoinInCache(outpoint))
+            vMissing.push_back(outpoint);
+    }
+
+    unsigned int nFound = 0;
+    int nThreads = 0;
+    if (!vMissing.empty()) {
+        nThreads = std::min(nUtxoPrefetchThreads, (int)vMissing.size());
+        CInputPrefetcher prefetcher(*cache.GetBackend(), vMissing);
+        boost::thread_group threadGroup;
+        for (int i = 0; i < nThreads - 1; i++)
+            threadGroup.create_thread(boost::bind(&CInputPrefetcher::Run, &prefetcher));
+        prefetcher.Run();
+        threadGroup.join_all();
+        for (size_t i = 0; i < vMissing.size(); i++) {
+            if (prefetcher.found[i]) {
+                cache.InsertFetchedCoin(vMissing[i], prefetcher.coins[i]);
+                nFound++;
+            }
+        }
+    }
+
+    int64_t nTimeEnd = GetTimeMicros(); nTimePrefetch += nTimeEnd - nTimeStart;
+    LogPrint("bench", "  - Prefetch %u inputs: %u cached (%.1f%%), %u of %u read on %d threads: %.2fms [%.2fs]\n",
+        (unsigned)setPrevouts.size(), (unsigned)(setPrevouts.size() - vMissing.size()),
+        setPrevouts.empty() ? 100.0 : 100.0 * (setPrevouts.size() - vMissing.size()) / setPrevouts.size(),
+        nFound, (unsigned)vMissing.size(), nThreads, 0.001 * (nTimeEnd - nTimeStart), nTimePrefetch * 0.000001);
+}
+// HFP0 PRF end
+
 /**
  * Connect a new block to chainActive. pblock is either NULL or a pointer to a CBlock
  * corresponding to pindexNew, to bypass loading it again from disk.
@@ -2980,6 +3519,7 @@ bool static ConnectTip(CValidationState& state, const CChainParams& chainparams,
     int64_t nTime2 = GetTimeMicros(); nTimeReadFromDisk += nTime2 - nTime1;
     int64_t nTime3;
     LogPrint("bench", "  - Load block from disk: %.2fms [%.2fs]\n", (nTime2 - nTime1) * 0.001, nTimeReadFromDisk * 0.000001);
+    PrefetchBlockInputs(*pblock, *pcoinsTip);  // HFP0 PRF added
     {
         CCoinsViewCache view(pcoinsTip);
         bool rv = ConnectBlock(*pblock, state, pindexNew, view);
@@ -3371,10 +3911,24 @@ CBlockIndex* AddToBlockIndex(const CBlockHeader& block)
     return pindexNew;
 }
 
+// HFP0 BSZ begin
+/** Record size and sigop count of a block in its index, so the adaptive block size never has to read it back */
+static void SetBlockIndexSize(CBlockIndex* pindex, const CBlock& block)
+{
+    unsigned int nSigOps = 0;
+    BOOST_FOREACH(const CTransaction& tx, block.vtx)
+        nSigOps += GetLegacySigOpCount(tx);
+    pindex->nSize = ::GetSerializeSize(block, SER_NETWORK, PROTOCOL_VERSION);
+    pindex->nSigOps = nSigOps;
+    pindex->nStatus |= BLOCK_HAVE_SIZE;
+}
+// HFP0 BSZ end
+
 /** Mark a block as having its data received and checked (up to BLOCK_VALID_TRANSACTIONS). */
 bool ReceivedBlockTransactions(const CBlock &block, CValidationState& state, CBlockIndex *pindexNew, const CDiskBlockPos& pos)
 {
     pindexNew->nTx = block.vtx.size();
+    SetBlockIndexSize(pindexNew, block);    // HFP0 BSZ
     pindexNew->nChainTx = 0;
     pindexNew->nFile = pos.nFile;
     pindexNew->nDataPos = pos.nPos;
@@ -3505,19 +4059,22 @@ bool FindUndoPos(CValidationState &state, int nFile, CDiskBlockPos &pos, unsigne
     return true;
 }
 
-bool CheckBlockHeader(const CBlockHeader& block, CValidationState& state, bool fCheckPOW)
+// HFP0 FRK, DIF begin
+// HFP0 TODO: refactor: this is used in ReadBlockFromDisk too
+static uint256 GetActivePowLimit(const CBlockHeader& block)
 {
-    // HFP0 FRK, DIF begin
-    // HFP0 TODO: refactor: this is used in ReadBlockFromDisk too
-    uint256 activePowLimit = Params().GetConsensus().powLimitHistoric;
     if ((block.nVersion & FULL_FORK_VERSION_MAX) >= FULL_FORK_VERSION_MIN) {
-        activePowLimit = Params().GetConsensus().powLimitResetAtFork;
+        return Params().GetConsensus().powLimitResetAtFork;
     }
-    // HFP0 FRK, DIF end
+    return Params().GetConsensus().powLimitHistoric;
+}
+// HFP0 FRK, DIF end
 
+bool CheckBlockHeader(const CBlockHeader& block, CValidationState& state, bool fCheckPOW)
+{
     // Check proof of work matches claimed amount
     // HFP0 FRK, DIF begin
-    if (fCheckPOW && !CheckProofOfWork(block.GetHash(), block.nBits, activePowLimit))
+    if (fCheckPOW && !CheckProofOfWork(block.GetHash(), block.nBits, GetActivePowLimit(block)))
         return state.DoS(50, error("CheckBlockHeader(): proof of work failed"),
                          REJECT_INVALID, "high-hash");
     // HFP0 FRK, DIF end
@@ -3710,6 +4267,167 @@ bool ContextualCheckBlock(const CBlock& block, CValidationState& state, CBlockIn
     return true;
 }
 
+#if HFP0_POW
+// HFP0 POW begin: batch PoW verification for headers messages
+/**
+ * Work shared by the threads hashing one batch of headers. Headers are handed
+ * out in order, and handing out stops at the first header failing its proof of
+ * work or not building on the header before it. The hash of a header is its
+ * block id, so a break in the chain is only seen once the header before it is
+ * hashed: a peer sending bogus headers costs at most one hash per thread more
+ * than checking them one by one.
+ */
+class CHeaderBatchHasher
+{
+private:
+    const std::vector<CBlockHeader>& headers;
+    boost::mutex cs;
+    size_t nNext;
+    bool fAbort;
+
+public:
+    CHeaderBatchHasher(const std::vector<CBlockHeader>& headersIn) : headers(headersIn), nNext(0), fAbort(false) {}
+
+    void Run()
+    {
+        while (true) {
+            size_t n;
+            {
+                boost::unique_lock<boost::mutex> lock(cs);
+                if (fAbort || nNext >= headers.size())
+                    return;
+                n = nNext++;
+            }
+            const CBlockHeader& header = headers[n];
+            bool fValid = false;
+            try {
+                // Leaves the hash in the PoW hash cache for AcceptBlockHeader
+                uint256 hash = header.GetHash();
+                fValid = !header.UsesModifiedScrypt() || CheckProofOfWork(hash, header.nBits, GetActivePowLimit(header));
+                if (n + 1 < headers.size() && headers[n + 1].hashPrevBlock != hash)
+                    fValid = false;
+            } catch (const std::exception& e) {
+                LogPrintf("%s: %s\n", __func__, e.what());
+            }
+            if (!fValid) {
+                boost::unique_lock<boost::mutex> lock(cs);
+                fAbort = true;
+            }
+        }
+    }
+};
+
+/**
+ * Compute the proof-of-work hashes of a headers message on up to
+ * -powhashthreads threads, so that accepting the headers one by one under
+ * cs_main afterwards only hits the PoW hash cache. Headers that do not build
+ * on a known block are left to be rejected by the serial checks.
+ */
+static void PrecomputeHeaderHashes(const std::vector<CBlockHeader>& headers)
+{
+    if (headers.empty())
+        return;
+    {
+        LOCK(cs_main);
+        if (!mapBlockIndex.count(headers[0].hashPrevBlock))
+            return;
+    }
+
+    int nScrypt = 0;
+    BOOST_FOREACH(const CBlockHeader& header, headers) {
+        if (header.UsesModifiedScrypt())
+            nScrypt++;
+    }
+    int nThreads = std::min(GetModifiedScryptThreads(), nScrypt);
+    if (nThreads <= 1)
+        return;
+
+    int64_t nTimeStart = GetTimeMicros();
+    CHeaderBatchHasher hasher(headers);
+    boost::thread_group threadGroup;
+    for (int i = 0; i < nThreads - 1; i++)
+        threadGroup.create_thread(boost::bind(&CHeaderBatchHasher::Run, &hasher));
+    hasher.Run();
+    threadGroup.join_all();
+    LogPrint("bench", "    - Hash %u headers on %d threads: %.2fms\n", (unsigned)headers.size(), nThreads, 0.001 * (GetTimeMicros() - nTimeStart));
+}
+// HFP0 POW end
+#endif
+
+// HFP0 PRF begin: compute the txids of received blocks off the message handler thread
+/**
+ * Work shared by the threads hashing the transactions of one message.
+ * Transactions are handed out in runs, so that the threads take the lock
+ * once per run rather than once per transaction.
+ */
+class CTxBatchHasher
+{
+private:
+    static const size_t RUN = 32;
+
+    const std::vector<CTransaction>& vtx;
+    boost::mutex cs;
+    size_t nNext;
+
+public:
+    CTxBatchHasher(const std::vector<CTransaction>& vtxIn) : vtx(vtxIn), nNext(0) {}
+
+    void Run()
+    {
+        while (true) {
+            size_t nBegin;
+            {
+                boost::unique_lock<boost::mutex> lock(cs);
+                if (nNext >= vtx.size())
+                    return;
+                nBegin = nNext;
+                nNext = std::min(nNext + RUN, vtx.size());
+            }
+            for (size_t n = nBegin; n < std::min(nBegin + RUN, vtx.size()); n++)
+                vtx[n].UpdateHash();
+        }
+    }
+};
+
+void ComputeTransactionHashes(const std::vector<CTransaction>& vtx)
+{
+    int nThreads = std::min(nScriptCheckThreads, (int)(vtx.size() / MIN_TXHASH_TXS_PER_THREAD));
+    if (nThreads <= 1) {
+        BOOST_FOREACH(const CTransaction& tx, vtx)
+            tx.UpdateHash();
+        return;
+    }
+
+    int64_t nTimeStart = GetTimeMicros();
+    CTxBatchHasher hasher(vtx);
+    boost::thread_group threadGroup;
+    for (int i = 0; i < nThreads - 1; i++)
+        threadGroup.create_thread(boost::bind(&CTxBatchHasher::Run, &hasher));
+    hasher.Run();
+    threadGroup.join_all();
+    LogPrint("bench", "    - Hash %u transactions on %d threads: %.2fms\n", (unsigned)vtx.size(), nThreads, 0.001 * (GetTimeMicros() - nTimeStart));
+}
+
+/** Deserialize from a stream without computing txids while this is in scope */
+class CDeferTxHashes
+{
+private:
+    CDataStream& stream;
+    int nTypeSaved;
+
+public:
+    CDeferTxHashes(CDataStream& streamIn) : stream(streamIn), nTypeSaved(streamIn.GetType())
+    {
+        stream.SetType(nTypeSaved | SER_DEFERTXHASH);
+    }
+
+    ~CDeferTxHashes()
+    {
+        stream.SetType(nTypeSaved);
+    }
+};
+// HFP0 PRF end
+
 static bool AcceptBlockHeader(const CBlockHeader& block, CValidationState& state, const CChainParams& chainparams, CBlockIndex** ppindex=NULL)
 {
     AssertLockHeld(cs_main);
@@ -4063,6 +4781,42 @@ CBlockIndex * InsertBlockIndex(uint256 hash)
     return pindexNew;
 }
 
+// HFP0 BSZ begin
+/**
+ * Block indexes written before sizes were recorded lack them, as do entries
+ * rewritten by such a version after a downgrade. Fill them in
+ * for the blocks of the median window once, so the adaptive block size does
+ * not go back to the block files on every restart. Older blocks are read
+ * from disk on demand as before.
+ */
+static void UpgradeBlockIndexSizes()
+{
+    int64_t nStart = GetTimeMillis();
+    int nUpgraded = 0;
+    CBlockIndex* pindex = chainActive.Tip();
+    for (unsigned int i = 0; pindex != NULL && i < median_block_lookback; i++, pindex = pindex->pprev) {
+        if ((pindex->nStatus & BLOCK_HAVE_SIZE) || !(pindex->nStatus & BLOCK_HAVE_DATA))
+            continue;
+        // Not ReadBlockFromDisk: the proof of work of these blocks was checked when they were accepted
+        CAutoFile filein(OpenBlockFile(pindex->GetBlockPos(), true), SER_DISK, CLIENT_VERSION);
+        if (filein.IsNull())
+            continue;
+        CBlock block;
+        try {
+            filein >> block;
+        } catch (const std::exception& e) {
+            LogPrintf("%s: unable to read block %s: %s\n", __func__, pindex->GetBlockHash().ToString(), e.what());
+            continue;
+        }
+        SetBlockIndexSize(pindex, block);
+        setDirtyBlockIndex.insert(pindex);
+        nUpgraded++;
+    }
+    if (nUpgraded > 0)
+        LogPrintf("%s: recorded the size of %d blocks in the block index in %dms\n", __func__, nUpgraded, GetTimeMillis() - nStart);
+}
+// HFP0 BSZ end
+
 bool static LoadBlockIndexDB()
 {
     const CChainParams& chainparams = Params();
@@ -4167,6 +4921,8 @@ bool static LoadBlockIndexDB()
 
     PruneBlockIndexCandidates();
 
+    UpgradeBlockIndexSizes();   // HFP0 BSZ
+
     LogPrintf("%s: hashBestChain=%s height=%d date=%s progress=%f\n", __func__,
         chainActive.Tip()->GetBlockHash().ToString(), chainActive.Height(),
         DateTimeStrFormat("%Y-%m-%d %H:%M:%S", chainActive.Tip()->GetBlockTime()),
@@ -4287,6 +5043,8 @@ void UnloadBlockIndex()
     mapNodeState.clear();
     recentRejects.reset(NULL);
 
+    BlockSizeCalculator::ClearBlockSizes();  // HFP0 BSZ added: the window points into the block index
+
     BOOST_FOREACH(BlockMap::value_type& entry, mapBlockIndex) {
         delete entry.second;
     }
@@ -4733,7 +5491,8 @@ bool static AlreadyHave(const CInv& inv) EXCLUSIVE_LOCKS_REQUIRED(cs_main)
             return recentRejects->contains(inv.hash) ||
                    mempool.exists(inv.hash) ||
                    mapOrphanTransactions.count(inv.hash) ||
-                   pcoinsTip->HaveCoins(inv.hash);
+                   pcoinsTip->HaveCoinInCache(COutPoint(inv.hash, 0)) || // Best effort: only try output 0 and 1
+                   pcoinsTip->HaveCoinInCache(COutPoint(inv.hash, 1));   // HFP0 PRF
         }
     case MSG_BLOCK:
         return mapBlockIndex.count(inv.hash);
@@ -5421,43 +6180,65 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
                 mempool.size(), mempool.DynamicMemoryUsage() / 1000);
 
             // Recursively process any orphan transactions that depended on this one
+            // HFP0 PRF changed: a generation of orphans at a time, through AcceptToMemoryPoolBatch
             set<NodeId> setMisbehaving;
-            for (unsigned int i = 0; i < vWorkQueue.size(); i++)
+            set<uint256> setDone;
+            while (!vWorkQueue.empty())
             {
-                map<uint256, set<uint256> >::iterator itByPrev = mapOrphanTransactionsByPrev.find(vWorkQueue[i]);
-                if (itByPrev == mapOrphanTransactionsByPrev.end())
-                    continue;
-                for (set<uint256>::iterator mi = itByPrev->second.begin();
-                     mi != itByPrev->second.end();
-                     ++mi)
+                vector<CTransaction> vOrphans;
+                vector<NodeId> vFromPeer;
+                BOOST_FOREACH(const uint256& hashPrev, vWorkQueue)
                 {
-                    const uint256& orphanHash = *mi;
-                    const CTransaction& orphanTx = mapOrphanTransactions[orphanHash].tx;
-                    NodeId fromPeer = mapOrphanTransactions[orphanHash].fromPeer;
-                    bool fMissingInputs2 = false;
-                    // Use a dummy CValidationState so someone can't setup nodes to counter-DoS based on orphan
-                    // resolution (that is, feeding people an invalid transaction based on LegitTxX in order to get
-                    // anyone relaying LegitTxX banned)
-                    CValidationState stateDummy;
+                    map<uint256, set<uint256> >::iterator itByPrev = mapOrphanTransactionsByPrev.find(hashPrev);
+                    if (itByPrev == mapOrphanTransactionsByPrev.end())
+                        continue;
+                    for (set<uint256>::iterator mi = itByPrev->second.begin();
+                         mi != itByPrev->second.end();
+                         ++mi)
+                    {
+                        const uint256& orphanHash = *mi;
+                        NodeId fromPeer = mapOrphanTransactions[orphanHash].fromPeer;
+                        if (setMisbehaving.count(fromPeer) || !setDone.insert(orphanHash).second)
+                            continue;
+                        vOrphans.push_back(mapOrphanTransactions[orphanHash].tx);
+                        vFromPeer.push_back(fromPeer);
+                    }
+                }
+                vWorkQueue.clear();
+                if (vOrphans.empty())
+                    break;
 
+                // Use dummy CValidationStates so someone can't setup nodes to counter-DoS based on orphan
+                // resolution (that is, feeding people an invalid transaction based on LegitTxX in order to get
+                // anyone relaying LegitTxX banned)
+                vector<bool> vAccepted, vMissingInputs;
+                vector<CValidationState> vStateDummy;
+                AcceptToMemoryPoolBatch(mempool, vOrphans, true, vAccepted, vMissingInputs, vStateDummy);
 
-                    if (setMisbehaving.count(fromPeer))
-                        continue;
-                    if (AcceptToMemoryPool(mempool, stateDummy, orphanTx, true, &fMissingInputs2))
+                for (unsigned int i = 0; i < vOrphans.size(); i++)
+                {
+                    const CTransaction& orphanTx = vOrphans[i];
+                    const uint256& orphanHash = orphanTx.GetHash();
+                    if (vAccepted[i])
                     {
                         LogPrint("mempool", "   accepted orphan tx %s\n", orphanHash.ToString());
                         RelayTransaction(orphanTx);
                         vWorkQueue.push_back(orphanHash);
                         vEraseQueue.push_back(orphanHash);
                     }
-                    else if (!fMissingInputs2)
+                    else if (vMissingInputs[i])
+                    {
+                        // Still an orphan; it is tried again once another of its parents arrives
+                        setDone.erase(orphanHash);
+                    }
+                    else
                     {
                         int nDos = 0;
-                        if (stateDummy.IsInvalid(nDos) && nDos > 0)
+                        if (vStateDummy[i].IsInvalid(nDos) && nDos > 0)
                         {
-                            // Punish peer that gave us an invalid orphan tx
-                            Misbehaving(fromPeer, nDos);
-                            setMisbehaving.insert(fromPeer);
+                            // Punish peer that gave us an invalid orphan tx, once per generation as before
+                            if (setMisbehaving.insert(vFromPeer[i]).second)
+                                Misbehaving(vFromPeer[i], nDos);
                             LogPrint("mempool", "   invalid orphan tx %s\n", orphanHash.ToString());
                         }
                         // Has inputs but not accepted to mempool
@@ -5467,8 +6248,8 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
                         assert(recentRejects);
                         recentRejects->insert(orphanHash);
                     }
-                    mempool.check(pcoinsTip);
                 }
+                mempool.check(pcoinsTip);
             }
 
             BOOST_FOREACH(uint256 hash, vEraseQueue)
@@ -5537,6 +6318,12 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
             ReadCompactSize(vRecv); // ignore tx count; assume it is 0.
         }
 
+#if HFP0_POW
+        // HFP0 POW begin: hash the headers in parallel before accepting them in order
+        PrecomputeHeaderHashes(headers);
+        // HFP0 POW end
+#endif
+
         LOCK(cs_main);
 
         if (nCount == 0) {
@@ -5638,7 +6425,13 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
     else if (strCommand == NetMsgType::XTHINBLOCK  && !fImporting && !fReindex) // Ignore blocks received while importing
     {
         CXThinBlock thinBlock;
-        vRecv >> thinBlock;
+        // HFP0 PRF begin
+        {
+            CDeferTxHashes defer(vRecv);
+            vRecv >> thinBlock;
+        }
+        ComputeTransactionHashes(thinBlock.vMissingTx);
+        // HFP0 PRF end
 
         CInv inv(MSG_BLOCK, thinBlock.header.GetHash());
         int nSizeThinBlock = ::GetSerializeSize(thinBlock, SER_NETWORK, PROTOCOL_VERSION);
@@ -5663,42 +6456,55 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
         BOOST_FOREACH(CTransaction tx, thinBlock.vMissingTx)
             mapMissingTx[tx.GetHash()] = tx;
 
-        // Create a map of all 8 bytes tx hashes pointing to their full tx hash counterpart
-        // We need to check all transaction sources (orphan list, mempool, and new (incoming) transactions in this block) for a collision.
-        bool collision = false;
+        // HFP0 XTB begin: resolve the 8 byte tx hashes with the mempool's persistent short id index
+        // instead of building a map of the whole mempool for every block. Only the orphan pool and
+        // the transactions supplied with this block still need an ad hoc index, and both are small.
+        // A collision only matters if it involves a short id of this block.
+        int64_t nTimeLookupStart = GetTimeMicros();
         std::map<uint64_t, uint256> mapPartialTxHash;
+        std::set<uint64_t> setCollisions;
         LOCK(cs_main);
-        std::vector<uint256> memPoolHashes;
-        mempool.queryHashes(memPoolHashes);
-        for (uint64_t i = 0; i < memPoolHashes.size(); i++) {
-            uint64_t cheapHash = memPoolHashes[i].GetCheapHash();
-            if(mapPartialTxHash.count(cheapHash)) //Check for collisions
-                collision = true;
-            mapPartialTxHash[cheapHash] = memPoolHashes[i];
-        }
         for (map<uint256, COrphanTx>::iterator mi = mapOrphanTransactions.begin(); mi != mapOrphanTransactions.end(); ++mi) {
             uint64_t cheapHash = (*mi).first.GetCheapHash();
             if(mapPartialTxHash.count(cheapHash)) //Check for collisions
-                collision = true;
+                setCollisions.insert(cheapHash);
             mapPartialTxHash[cheapHash] = (*mi).first;
         }
         for (map<uint256, CTransaction>::iterator mi = mapMissingTx.begin(); mi != mapMissingTx.end(); ++mi) {
             uint64_t cheapHash = (*mi).first.GetCheapHash();
-            // Check for cheap hash collision. Only mark as collision if the full hash is not the same,
-            // because the same tx could have been received into the mempool during the request of the xthinblock.
-            // In that case we would have the same transaction twice, so it is not a real cheap hash collision and we continue normally.
-            const uint256 existingHash = mapPartialTxHash[cheapHash];
-            if( (!existingHash.IsNull()) ) { // Check if we already have the cheap hash
-                if ((existingHash != (*mi).first)) { // Check if it really is a cheap hash collision and not just the same transaction
-                    collision = true;
-                }
-            }
+            // Only mark as collision if the full hash is not the same, the same tx could be in the orphan pool.
+            std::map<uint64_t, uint256>::iterator it = mapPartialTxHash.find(cheapHash);
+            if (it != mapPartialTxHash.end() && it->second != (*mi).first)
+                setCollisions.insert(cheapHash);
             mapPartialTxHash[cheapHash] = (*mi).first;
         }
 
+        bool collision = false;
+        std::vector<uint256> vTxHashesFull;
+        vTxHashesFull.reserve(thinBlock.vTxHashes.size());
+        BOOST_FOREACH(const uint64_t &cheapHash, thinBlock.vTxHashes)
+        {
+            uint256 hash;
+            std::map<uint64_t, uint256>::iterator it = mapPartialTxHash.find(cheapHash);
+            if (it != mapPartialTxHash.end())
+                hash = it->second;
+            uint256 hashMemPool;
+            unsigned int nMemPool = mempool.lookupShortId(cheapHash, hashMemPool);
+            // The same transaction could have been received into the mempool during the request
+            // of the xthinblock, that is not a real collision.
+            if (setCollisions.count(cheapHash) || nMemPool > 1 || (nMemPool == 1 && !hash.IsNull() && hash != hashMemPool)) {
+                collision = true;
+                break;
+            }
+            if (hash.IsNull() && nMemPool == 1)
+                hash = hashMemPool;
+            vTxHashesFull.push_back(hash);
+        }
+
         // There is a remote possiblity of a Tx hash collision therefore if it occurs we re-request a normal
         // thinblock which has the full Tx hash data rather than just the truncated hash.
         if (collision) {
+            thinBlockStats.UpdateCollision(GetTimeMicros() - nTimeLookupStart);
             vector<CInv> vGetData;
             vGetData.push_back(CInv(MSG_THINBLOCK, thinBlock.header.GetHash()));
             pfrom->PushMessage("getdata", vGetData);
@@ -5713,10 +6519,8 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
 
         // Look for each transaction in our various pools and buffers.
         // With xThinBlocks the vTxHashes contains only the first 8 bytes of the tx hash.
-        BOOST_FOREACH(uint64_t &cheapHash, thinBlock.vTxHashes)
+        BOOST_FOREACH(const uint256 &hash, vTxHashesFull)
         {
-            // Replace the truncated hash with the full hash value if it exists
-            const uint256 hash = mapPartialTxHash[cheapHash];
             CTransaction tx;
             if (!hash.IsNull())
             {
@@ -5741,6 +6545,10 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
             // This will push an empty/invalid transaction if we don't have it yet
             pfrom->thinBlock.vtx.push_back(tx);
         }
+        int64_t nTimeLookup = GetTimeMicros() - nTimeLookupStart;
+        thinBlockStats.UpdateReconstruction(missingCount == 0, nTimeLookup);
+        LogPrint("bench", "    - Xthin short id lookup: %.2fms [%u txs]\n", 0.001 * nTimeLookup, vTxHashesFull.size());
+        // HFP0 XTB end
         pfrom->thinBlockWaitingForTxns = missingCount;
         LogPrint("thin", "thinblock waiting for: %d, unnecessary: %d, txs: %d full: %d\n", pfrom->thinBlockWaitingForTxns, unnecessaryCount, pfrom->thinBlock.vtx.size(), mapMissingTx.size());
 
@@ -5757,8 +6565,8 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
                      );
 
             HandleBlockMessage(pfrom, strCommand, pfrom->thinBlock, inv);  // clears the thin block
-            BOOST_FOREACH(uint64_t &cheapHash, thinBlock.vTxHashes)
-                EraseOrphanTx(mapPartialTxHash[cheapHash]);
+            BOOST_FOREACH(const uint256 &hash, vTxHashesFull)   // HFP0 XTB
+                EraseOrphanTx(hash);
         }
         else if (pfrom->thinBlockWaitingForTxns > 0) {
             // This marks the end of the transactions we've received. If we get this and we have NOT been able to
@@ -5781,7 +6589,13 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
     else if (strCommand == NetMsgType::THINBLOCK && !fImporting && !fReindex) // Ignore blocks received while importing
     {
         CThinBlock thinBlock;
-        vRecv >> thinBlock;
+        // HFP0 PRF begin
+        {
+            CDeferTxHashes defer(vRecv);
+            vRecv >> thinBlock;
+        }
+        ComputeTransactionHashes(thinBlock.vMissingTx);
+        // HFP0 PRF end
 
         CInv inv(MSG_BLOCK, thinBlock.header.GetHash());
         int nSizeThinBlock = ::GetSerializeSize(thinBlock, SER_NETWORK, PROTOCOL_VERSION);
@@ -5875,7 +6689,13 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
     else if (strCommand == NetMsgType::XBLOCKTX && !fImporting && !fReindex) // handle Re-requested thinblock transactions
     {
         CXThinBlockTx thinBlockTx;
-        vRecv >> thinBlockTx;
+        // HFP0 PRF begin
+        {
+            CDeferTxHashes defer(vRecv);
+            vRecv >> thinBlockTx;
+        }
+        ComputeTransactionHashes(thinBlockTx.vMissingTx);
+        // HFP0 PRF end
 
         CInv inv(MSG_XTHINBLOCK, thinBlockTx.blockhash);
         LogPrint("net", "received blocktxs for %s peer=%d\n", inv.hash.ToString(), pfrom->id);
@@ -5978,7 +6798,13 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
     else if (strCommand == NetMsgType::BLOCK && !fImporting && !fReindex) // Ignore blocks received while importing
     {
         CBlock block;
-        vRecv >> block;
+        // HFP0 PRF begin
+        {
+            CDeferTxHashes defer(vRecv);
+            vRecv >> block;
+        }
+        ComputeTransactionHashes(block.vtx);
+        // HFP0 PRF end
 
         CInv inv(MSG_BLOCK, block.GetHash());
         LogPrint("net", "received block %s peer=%d\n", inv.hash.ToString(), pfrom->id);
@@ -6791,6 +7617,132 @@ uint32_t MaxLegacySigops(uint32_t nHeight)
 // HFP0 BSZ end
 
 
+// HFP0 PRF begin: mempool persistence
+static const char* MEMPOOL_FILENAME = "mempool.dat";
+static const uint64_t MEMPOOL_DUMP_VERSION = 1;
+
+/** Orders mempool entries so that every transaction comes after its in-mempool parents */
+struct CompareMempoolDumpOrder {
+    bool operator()(const CTxMemPool::txiter& a, const CTxMemPool::txiter& b) const
+    {
+        if (a->GetCountWithAncestors() != b->GetCountWithAncestors())
+            return a->GetCountWithAncestors() < b->GetCountWithAncestors();
+        return CTxMemPool::CompareIteratorByHash()(a, b);
+    }
+};
+
+bool LoadMempool()
+{
+    int64_t nExpiryTimeout = GetArg("-mempoolexpiry", DEFAULT_MEMPOOL_EXPIRY) * 60 * 60;
+    FILE* filestr = fopen((GetDataDir() / MEMPOOL_FILENAME).string().c_str(), "rb");
+    CAutoFile file(filestr, SER_DISK, CLIENT_VERSION);
+    if (file.IsNull()) {
+        LogPrintf("Failed to open mempool file from disk. Continuing anyway.\n");
+        return false;
+    }
+
+    int64_t nTimeStart = GetTimeMicros();
+    int64_t nNow = GetTime();
+    int64_t count = 0;
+    int64_t skipped = 0;
+    int64_t failed = 0;
+    try {
+        uint64_t version;
+        file >> version;
+        if (version != MEMPOOL_DUMP_VERSION) {
+            LogPrintf("Unsupported mempool file version %u. Continuing anyway.\n", version);
+            return false;
+        }
+
+        // Fee deltas come first, so that they count when the transactions are accepted
+        std::map<uint256, std::pair<double, CAmount> > mapDeltas;
+        file >> mapDeltas;
+        for (std::map<uint256, std::pair<double, CAmount> >::const_iterator it = mapDeltas.begin(); it != mapDeltas.end(); it++)
+            mempool.PrioritiseTransaction(it->first, it->first.ToString(), it->second.first, it->second.second);
+
+        uint64_t num;
+        file >> num;
+        while (num--) {
+            CTransaction tx;
+            int64_t nTime;
+            file >> tx;
+            file >> nTime;
+
+            if (nTime + nExpiryTimeout > nNow) {
+                LOCK(cs_main);
+                CValidationState state;
+                if (AcceptToMemoryPoolWithTime(mempool, state, tx, true, NULL, nTime))
+                    count++;
+                else
+                    failed++;
+            } else {
+                skipped++;
+            }
+            if (ShutdownRequested())
+                return false;
+        }
+    } catch (const std::exception& e) {
+        LogPrintf("Failed to deserialize mempool data on disk: %s. Continuing anyway.\n", e.what());
+        return false;
+    }
+
+    LogPrintf("Imported mempool transactions from disk: %i successes, %i failed, %i expired, in %.2fs\n",
+              count, failed, skipped, 0.000001 * (GetTimeMicros() - nTimeStart));
+    return true;
+}
+
+bool DumpMempool()
+{
+    int64_t nTimeStart = GetTimeMicros();
+
+    // Copied under the lock, written without it
+    std::map<uint256, std::pair<double, CAmount> > mapDeltas;
+    std::vector<std::pair<CTransaction, int64_t> > vtx;
+    {
+        LOCK(mempool.cs);
+        mapDeltas = mempool.mapDeltas;
+        // Parents before children, for LoadMempool to accept them
+        std::vector<CTxMemPool::txiter> vSorted;
+        vSorted.reserve(mempool.mapTx.size());
+        for (CTxMemPool::txiter it = mempool.mapTx.begin(); it != mempool.mapTx.end(); it++)
+            vSorted.push_back(it);
+        std::sort(vSorted.begin(), vSorted.end(), CompareMempoolDumpOrder());
+        vtx.reserve(vSorted.size());
+        BOOST_FOREACH(const CTxMemPool::txiter it, vSorted)
+            vtx.push_back(std::make_pair(it->GetTx(), it->GetTime()));
+    }
+    int64_t nTimeCopied = GetTimeMicros();
+
+    try {
+        boost::filesystem::path path = GetDataDir() / MEMPOOL_FILENAME;
+        boost::filesystem::path pathNew = path.string() + ".new";
+        FILE* filestr = fopen(pathNew.string().c_str(), "wb");
+        if (!filestr)
+            return false;
+        CAutoFile file(filestr, SER_DISK, CLIENT_VERSION);
+
+        file << MEMPOOL_DUMP_VERSION;
+        file << mapDeltas;
+        file << (uint64_t)vtx.size();
+        for (std::vector<std::pair<CTransaction, int64_t> >::const_iterator it = vtx.begin(); it != vtx.end(); it++) {
+            file << it->first;
+            file << it->second;
+        }
+        FileCommit(file.Get());
+        file.fclose();
+        if (!RenameOver(pathNew, path))
+            throw std::runtime_error("Rename failed");
+    } catch (const std::exception& e) {
+        LogPrintf("Failed to dump mempool: %s. Continuing anyway.\n", e.what());
+        return false;
+    }
+
+    LogPrint("mempool", "Dumped %u mempool transactions: %.2fms to copy, %.2fms to write\n", (unsigned)vtx.size(),
+             0.001 * (nTimeCopied - nTimeStart), 0.001 * (GetTimeMicros() - nTimeCopied));
+    return true;
+}
+// HFP0 PRF end
+
 
 class CMainCleanup
 {
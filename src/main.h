@@ -27,6 +27,7 @@
 #include <vector>
 
 #include <boost/atomic.hpp>
+#include <boost/shared_ptr.hpp>  // HFP0 PRF added
 #include <boost/unordered_map.hpp>
 
 class ValidationCostTracker;
@@ -37,6 +38,8 @@ class CChainParams;
 class CInv;
 class CScriptCheck;
 class CTxMemPool;
+class CTxUndo;            // HFP0 PRF added
+class PrecomputedSighashData;  // HFP0 PRF added
 class CValidationInterface;
 class CValidationState;
 
@@ -68,6 +71,12 @@ static const unsigned int DEFAULT_DESCENDANT_LIMIT = 25;
 static const unsigned int DEFAULT_DESCENDANT_SIZE_LIMIT = 101;
 /** Default for -mempoolexpiry, expiration time for mempool transactions in hours */
 static const unsigned int DEFAULT_MEMPOOL_EXPIRY = 72;
+// HFP0 PRF begin
+/** Default for -persistmempool */
+static const bool DEFAULT_PERSIST_MEMPOOL = true;
+/** Seconds between writes of the mempool to disk, besides the one at shutdown */
+static const int64_t MEMPOOL_DUMP_INTERVAL = 15 * 60;
+// HFP0 PRF end
 /** The maximum size of a blk?????.dat file (since 0.8) */
 static const unsigned int MAX_BLOCKFILE_SIZE = 0x8000000; // 128 MiB
 /** The pre-allocation chunk size for blk?????.dat files (since 0.8) */
@@ -79,6 +88,18 @@ static const unsigned int UNDOFILE_CHUNK_SIZE = 0x100000; // 1 MiB
 static const int MAX_SCRIPTCHECK_THREADS = 16;
 /** -par default (number of script-checking threads, 0 = auto) */
 static const int DEFAULT_SCRIPTCHECK_THREADS = 0;
+// HFP0 PRF begin
+/** Maximum number of threads pre-fetching block inputs from the UTXO database */
+static const int MAX_UTXO_PREFETCH_THREADS = 16;
+/** -utxoprefetch default (number of input pre-fetching threads, 0 = disabled) */
+static const int DEFAULT_UTXO_PREFETCH_THREADS = 4;
+/** -pipelineconnect default (run the per-transaction input checks of ConnectBlock on the script threads) */
+static const bool DEFAULT_PIPELINE_CONNECT = true;
+/** Transactions with at least this many inputs share one PrecomputedSighashData between their script checks */
+static const unsigned int MIN_PRECOMPUTED_SIGHASH_INPUTS = 4;
+/** Received transactions whose txids are computed on several threads come at least this many per thread */
+static const unsigned int MIN_TXHASH_TXS_PER_THREAD = 128;
+// HFP0 PRF end
 /** Number of blocks that can be requested at any given time from a single peer. */
 static const int MAX_BLOCKS_IN_TRANSIT_PER_PEER = 16;
 /** Timeout in seconds during which a peer must stall block download progress before being disconnected. */
@@ -142,6 +163,9 @@ extern CConditionVariable cvBlockChange;
 extern bool fImporting;
 extern bool fReindex;
 extern int nScriptCheckThreads;
+extern int nUtxoPrefetchThreads;  // HFP0 PRF added
+extern bool fPipelineConnect;     // HFP0 PRF added
+extern int nBlockLockTimeFlags;   // HFP0 RLT added: lock-time flags ConnectBlock enforces, BIP68 is not active yet
 extern bool fTxIndex;
 extern bool fIsBareMultisigStd;
 extern bool fRequireStandard;
@@ -292,9 +316,27 @@ void FlushStateToDisk();
 /** Prune block files and flush state to disk. */
 void PruneAndFlush();
 
+// HFP0 PRF begin
+/** Write the mempool, with the fee deltas of PrioritiseTransaction, to disk */
+bool DumpMempool();
+/** Re-admit the transactions of a mempool written by DumpMempool */
+bool LoadMempool();
+// HFP0 PRF end
+
 /** (try to) add transaction to memory pool **/
 bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState &state, const CTransaction &tx, bool fLimitFree,
                         bool* pfMissingInputs, bool fOverrideMempoolLimit=false, bool fRejectAbsurdFee=false);
+/** HFP0 PRF added: (try to) add transaction to memory pool, as if it had arrived at nAcceptTime */
+bool AcceptToMemoryPoolWithTime(CTxMemPool& pool, CValidationState &state, const CTransaction &tx, bool fLimitFree,
+                                bool* pfMissingInputs, int64_t nAcceptTime, bool fOverrideMempoolLimit=false, bool fRejectAbsurdFee=false);
+/**
+ * HFP0 PRF added: (try to) add the transactions of vtx to memory pool, in order, so
+ * that they may spend the outputs of earlier ones. Those that pass the policy and
+ * fee checks have their scripts checked in parallel, a transaction per check, and
+ * are then added under one lock. Returns how many were accepted.
+ */
+unsigned int AcceptToMemoryPoolBatch(CTxMemPool& pool, const std::vector<CTransaction>& vtx, bool fLimitFree,
+                                     std::vector<bool>& vAccepted, std::vector<bool>& vMissingInputs, std::vector<CValidationState>& vState);
 
 /** Convert CValidationState to a human-readable message for logging */
 std::string FormatStateMessage(const CValidationState &state);
@@ -353,10 +395,13 @@ unsigned int GetP2SHSigOpCount(const CTransaction& tx, const CCoinsViewCache& ma
  * Check whether all inputs of this transaction are valid (no double spends, scripts & sigs, amounts)
  * This does not modify the UTXO set. If pvChecks is not NULL, script checks are pushed onto it
  * instead of being performed inline.
+ * HFP0 PRF: nSpendHeight of -1 looks the height up, which takes cs_main.
+ * Scripts checked inline with cacheStore set are remembered in the script
+ * execution cache, unless fCacheScriptExecution is false.
  */
 bool CheckInputs(const CTransaction& tx, CValidationState &state, const CCoinsViewCache &view, bool fScriptChecks,
                  unsigned int flags, bool cacheStore, ValidationCostTracker* costTracker,
-                 std::vector<CScriptCheck> *pvChecks = NULL);
+                 std::vector<CScriptCheck> *pvChecks = NULL, int nSpendHeight = -1, bool fCacheScriptExecution = true);
 
 /** Apply the effects of this transaction on the UTXO set represented by view */
 void UpdateCoins(const CTransaction& tx, CValidationState &state, CCoinsViewCache &inputs, int nHeight);
@@ -448,9 +493,66 @@ bool CheckSequenceLocks(const CTransaction &tx, int flags, LockPoints* lp = NULL
 // HFP0 CSV (BIP112) end
 // HFP0 RLT (BIP68) end
 
+// HFP0 PRF begin
+/**
+ * The inexpensive checks ConnectBlock makes on the inputs of one transaction:
+ * BIP68 sequence locks, input values, coinbase maturity and the fee, plus
+ * counting its P2SH sigops. A pipelined ConnectBlock runs these on the script
+ * check threads, reading the spent coins from the transaction's undo data,
+ * and adds the fee and sigops to totals shared by the whole block.
+ */
+class CTxInputsCheck
+{
+private:
+    const CTransaction* ptx;
+    const CTxUndo* pundo;
+    const CBlockIndex* pindex;
+    int nLockTimeFlags;
+    bool fStrictPayToScriptHash;
+    bool fCheckValues;
+    boost::atomic<int64_t>* pnFees;
+    boost::atomic<uint32_t>* pnSigOps;
+
+public:
+    CTxInputsCheck(const CTransaction& txIn, const CTxUndo& undoIn, const CBlockIndex& indexIn, int nLockTimeFlagsIn,
+                   bool fStrictPayToScriptHashIn, bool fCheckValuesIn, boost::atomic<int64_t>& nFeesIn, boost::atomic<uint32_t>& nSigOpsIn) :
+        ptx(&txIn), pundo(&undoIn), pindex(&indexIn), nLockTimeFlags(nLockTimeFlagsIn),
+        fStrictPayToScriptHash(fStrictPayToScriptHashIn), fCheckValues(fCheckValuesIn), pnFees(&nFeesIn), pnSigOps(&nSigOpsIn) { }
+
+    bool operator()() const;
+};
+
+/**
+ * The script checks AcceptToMemoryPool makes of one transaction, for the
+ * script check threads. The verdict goes to state and fValid rather than
+ * being returned, so that one failing transaction of a batch does not stop
+ * the checks of the others.
+ */
+class CTxScriptsCheck
+{
+private:
+    const CTransaction* ptx;
+    const CCoinsViewCache* pview;
+    unsigned int nSize;
+    int nSpendHeight;
+    unsigned int nNextBlockFlags;
+    CValidationState* pstate;
+    bool* pfValid;
+
+public:
+    CTxScriptsCheck(const CTransaction& txIn, const CCoinsViewCache& viewIn, unsigned int nSizeIn, int nSpendHeightIn,
+                    unsigned int nNextBlockFlagsIn, CValidationState& stateIn, bool& fValidIn) :
+        ptx(&txIn), pview(&viewIn), nSize(nSizeIn), nSpendHeight(nSpendHeightIn),
+        nNextBlockFlags(nNextBlockFlagsIn), pstate(&stateIn), pfValid(&fValidIn) { }
+
+    bool operator()() const;
+};
+// HFP0 PRF end
+
 /**
  * Closure representing one script verification
  * Note that this stores references to the spending transaction
+ * HFP0 PRF: or, when constructed from a CTxInputsCheck or CTxScriptsCheck, runs that instead
  */
 class CScriptCheck
 {
@@ -462,12 +564,24 @@ private:
     unsigned int nFlags;
     bool cacheStore;
     ScriptError error;
+    const CTxInputsCheck* pinputsCheck;  // HFP0 PRF added
+    const CTxScriptsCheck* pscriptsCheck;  // HFP0 PRF added
+    boost::shared_ptr<const PrecomputedSighashData> precomputed;  // HFP0 PRF added: shared by the checks of one transaction
 
 public:
-    CScriptCheck(): costTracker(NULL), ptxTo(0), nIn(0), nFlags(0), cacheStore(false), error(SCRIPT_ERR_UNKNOWN_ERROR) {}
-    CScriptCheck(ValidationCostTracker* costTrackerIn, const CCoins& txFromIn, const CTransaction& txToIn, unsigned int nInIn, unsigned int nFlagsIn, bool cacheIn) :
-        costTracker(costTrackerIn), scriptPubKey(txFromIn.vout[txToIn.vin[nInIn].prevout.n].scriptPubKey),
-        ptxTo(&txToIn), nIn(nInIn), nFlags(nFlagsIn), cacheStore(cacheIn), error(SCRIPT_ERR_UNKNOWN_ERROR) { }
+    CScriptCheck(): costTracker(NULL), ptxTo(0), nIn(0), nFlags(0), cacheStore(false), error(SCRIPT_ERR_UNKNOWN_ERROR), pinputsCheck(NULL), pscriptsCheck(NULL) {}
+    // HFP0 PRF changed: added precomputedIn
+    CScriptCheck(ValidationCostTracker* costTrackerIn, const CTxOut& outIn, const CTransaction& txToIn, unsigned int nInIn, unsigned int nFlagsIn, bool cacheIn,
+                 const boost::shared_ptr<const PrecomputedSighashData>& precomputedIn = boost::shared_ptr<const PrecomputedSighashData>()) :
+        costTracker(costTrackerIn), scriptPubKey(outIn.scriptPubKey),
+        ptxTo(&txToIn), nIn(nInIn), nFlags(nFlagsIn), cacheStore(cacheIn), error(SCRIPT_ERR_UNKNOWN_ERROR), pinputsCheck(NULL),
+        pscriptsCheck(NULL), precomputed(precomputedIn) { }
+    // HFP0 PRF added
+    explicit CScriptCheck(const CTxInputsCheck& inputsCheckIn) :
+        costTracker(NULL), ptxTo(0), nIn(0), nFlags(0), cacheStore(false), error(SCRIPT_ERR_UNKNOWN_ERROR), pinputsCheck(&inputsCheckIn), pscriptsCheck(NULL) { }
+    // HFP0 PRF added
+    explicit CScriptCheck(const CTxScriptsCheck& scriptsCheckIn) :
+        costTracker(NULL), ptxTo(0), nIn(0), nFlags(0), cacheStore(false), error(SCRIPT_ERR_UNKNOWN_ERROR), pinputsCheck(NULL), pscriptsCheck(&scriptsCheckIn) { }
 
     bool operator()();
 
@@ -479,6 +593,9 @@ public:
         std::swap(nFlags, check.nFlags);
         std::swap(cacheStore, check.cacheStore);
         std::swap(error, check.error);
+        std::swap(pinputsCheck, check.pinputsCheck);  // HFP0 PRF added
+        std::swap(pscriptsCheck, check.pscriptsCheck);  // HFP0 PRF added
+        precomputed.swap(check.precomputed);  // HFP0 PRF added
     }
 
     ScriptError GetScriptError() const { return error; }
@@ -505,6 +622,14 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
 bool CheckBlockHeader(const CBlockHeader& block, CValidationState& state, bool fCheckPOW = true);
 bool CheckBlock(const CBlock& block, CValidationState& state, bool fCheckPOW = true, bool fCheckMerkleRoot = true);
 
+// HFP0 PRF begin
+/**
+ * Compute the txids of transactions deserialized with SER_DEFERTXHASH, on as
+ * many threads as script verification uses when there are enough of them.
+ */
+void ComputeTransactionHashes(const std::vector<CTransaction>& vtx);
+// HFP0 PRF end
+
 /** Context-dependent validity checks */
 bool ContextualCheckBlockHeader(const CBlockHeader& block, CValidationState& state, CBlockIndex *pindexPrev);
 bool ContextualCheckBlock(const CBlock& block, CValidationState& state, CBlockIndex *pindexPrev);
@@ -26,6 +26,8 @@
 #include "validationinterface.h"
 #include "blocksizecalculator.h"   // HFP0 BSZ
 
+#include <algorithm>  // HFP0 PRF added
+#include <boost/scoped_ptr.hpp>  // HFP0 PRF added
 #include <boost/thread.hpp>
 #include <boost/tuple/tuple.hpp>
 #include <queue>
@@ -46,17 +48,6 @@ using namespace std;
 uint64_t nLastBlockTx = 0;
 uint64_t nLastBlockSize = 0;
 
-class ScoreCompare
-{
-public:
-    ScoreCompare() {}
-
-    bool operator()(const CTxMemPool::txiter a, const CTxMemPool::txiter b)
-    {
-        return CompareTxMemPoolEntryByScore()(*b,*a); // Convert to less than
-    }
-};
-
 int64_t UpdateTime(CBlockHeader* pblock, const Consensus::Params& consensusParams, const CBlockIndex* pindexPrev)
 {
     int64_t nOldTime = pblock->nTime;
@@ -73,6 +64,341 @@ int64_t UpdateTime(CBlockHeader* pblock, const Consensus::Params& consensusParam
 }
 
 
+// HFP0 PRF begin: ancestor feerate (CPFP) block assembly
+BlockAssembler::BlockAssembler(CTxMemPool& poolIn, CBlockTemplate& blocktemplateIn, int nHeightIn, int64_t nLockTimeCutoffIn,
+                               uint64_t nBlockMaxSizeIn, uint64_t nBlockMinSizeIn, unsigned int nMaxBlockSigOpsIn)
+    : pool(poolIn), blocktemplate(blocktemplateIn), nHeight(nHeightIn), nLockTimeCutoff(nLockTimeCutoffIn),
+      nBlockMaxSize(nBlockMaxSizeIn), nBlockMinSize(nBlockMinSizeIn), nMaxBlockSigOps(nMaxBlockSigOpsIn),
+      fPrintPriority(GetBoolArg("-printpriority", DEFAULT_PRINTPRIORITY))
+{
+    // Reserve space for coinbase tx
+    nBlockSize = 1000;
+    nBlockSigOps = 100;
+
+    nBlockTx = 0;
+    nFees = 0;
+}
+
+void BlockAssembler::AddToBlock(CTxMemPool::txiter iter)
+{
+    blocktemplate.block.vtx.push_back(iter->GetTx());
+    blocktemplate.vTxFees.push_back(iter->GetFee());
+    blocktemplate.vTxSigOps.push_back(iter->GetSigOpCount());
+    nBlockSize += iter->GetTxSize();
+    ++nBlockTx;
+    nBlockSigOps += iter->GetSigOpCount();
+    nFees += iter->GetFee();
+    inBlock.insert(iter);
+
+    if (fPrintPriority) {
+        double dPriority = iter->GetPriority(nHeight);
+        CAmount dummy;
+        pool.ApplyDeltas(iter->GetTx().GetHash(), dPriority, dummy);
+        LogPrintf("priority %.1f fee %s txid %s\n",
+                  dPriority,
+                  CFeeRate(iter->GetModifiedFee(), iter->GetTxSize()).ToString(),
+                  iter->GetTx().GetHash().ToString());
+    }
+}
+
+bool BlockAssembler::TestPackage(uint64_t packageSize, unsigned int packageSigOps) const
+{
+    if (nBlockSize + packageSize >= nBlockMaxSize)
+        return false;
+    if (nBlockSigOps + packageSigOps >= nMaxBlockSigOps)
+        return false;
+    return true;
+}
+
+bool BlockAssembler::TestPackageFinality(const CTxMemPool::setEntries& package) const
+{
+    BOOST_FOREACH(const CTxMemPool::txiter it, package) {
+        if (!IsFinalTx(it->GetTx(), nHeight, nLockTimeCutoff))
+            return false;
+    }
+    return true;
+}
+
+void BlockAssembler::OnlyUnconfirmed(CTxMemPool::setEntries& testSet) const
+{
+    for (CTxMemPool::setEntries::iterator iit = testSet.begin(); iit != testSet.end(); ) {
+        // Only test txs not already in the block
+        if (inBlock.count(*iit)) {
+            testSet.erase(iit++);
+        } else {
+            iit++;
+        }
+    }
+}
+
+bool BlockAssembler::SkipMapTxEntry(CTxMemPool::txiter it, indexed_modified_transaction_set& mapModifiedTx, const setTxIters& failedTx) const
+{
+    assert(it != pool.mapTx.end());
+    return mapModifiedTx.count(it) || inBlock.count(it) || failedTx.count(it);
+}
+
+void BlockAssembler::UpdatePackagesForAdded(const CTxMemPool::setEntries& alreadyAdded, indexed_modified_transaction_set& mapModifiedTx)
+{
+    BOOST_FOREACH(const CTxMemPool::txiter it, alreadyAdded) {
+        CTxMemPool::setEntries descendants;
+        pool.CalculateDescendants(it, descendants);
+        // Insert all descendants (not yet in block) into the modified set
+        BOOST_FOREACH(CTxMemPool::txiter desc, descendants) {
+            if (alreadyAdded.count(desc))
+                continue;
+            modtxiter mit = mapModifiedTx.find(desc);
+            if (mit == mapModifiedTx.end()) {
+                CTxMemPoolModifiedEntry modEntry(desc);
+                update_for_parent_inclusion updateForParent(it);
+                updateForParent(modEntry);
+                mapModifiedTx.insert(modEntry);
+            } else {
+                mapModifiedTx.modify(mit, update_for_parent_inclusion(it));
+            }
+        }
+    }
+}
+
+void BlockAssembler::AddPriorityTxs(uint64_t nBlockPrioritySize)
+{
+    if (nBlockPrioritySize == 0)
+        return;
+
+    // This vector will be sorted into a priority queue:
+    vector<TxCoinAgePriority> vecPriority;
+    TxCoinAgePriorityCompare pricomparer;
+    std::map<CTxMemPool::txiter, double, CTxMemPool::CompareIteratorByHash> waitPriMap;
+    typedef std::map<CTxMemPool::txiter, double, CTxMemPool::CompareIteratorByHash>::iterator waitPriIter;
+    double actualPriority = -1;
+
+    vecPriority.reserve(pool.mapTx.size());
+    for (CTxMemPool::indexed_transaction_set::iterator mi = pool.mapTx.begin();
+         mi != pool.mapTx.end(); ++mi)
+    {
+        double dPriority = mi->GetPriority(nHeight);
+        CAmount dummy;
+        pool.ApplyDeltas(mi->GetTx().GetHash(), dPriority, dummy);
+        vecPriority.push_back(TxCoinAgePriority(dPriority, mi));
+    }
+    std::make_heap(vecPriority.begin(), vecPriority.end(), pricomparer);
+
+    while (!vecPriority.empty()) {
+        CTxMemPool::txiter iter = vecPriority.front().second;
+        actualPriority = vecPriority.front().first;
+        std::pop_heap(vecPriority.begin(), vecPriority.end(), pricomparer);
+        vecPriority.pop_back();
+
+        // If tx is dependent on other mempool txs which haven't yet been
+        // included then wait for them
+        bool fOrphan = false;
+        BOOST_FOREACH(CTxMemPool::txiter parent, pool.GetMemPoolParents(iter)) {
+            if (!inBlock.count(parent)) {
+                fOrphan = true;
+                break;
+            }
+        }
+        if (fOrphan) {
+            waitPriMap.insert(std::make_pair(iter, actualPriority));
+            continue;
+        }
+
+        // The last priority transaction may be the one that reaches the
+        // priority size or is no longer free
+        bool fLast = nBlockSize + iter->GetTxSize() >= nBlockPrioritySize || !AllowFree(actualPriority);
+
+        if (TestPackage(iter->GetTxSize(), iter->GetSigOpCount()) && IsFinalTx(iter->GetTx(), nHeight, nLockTimeCutoff)) {
+            AddToBlock(iter);
+
+            // Add transactions that depend on this one to the priority queue
+            BOOST_FOREACH(CTxMemPool::txiter child, pool.GetMemPoolChildren(iter)) {
+                waitPriIter wpiter = waitPriMap.find(child);
+                if (wpiter != waitPriMap.end()) {
+                    vecPriority.push_back(TxCoinAgePriority(wpiter->second, child));
+                    std::push_heap(vecPriority.begin(), vecPriority.end(), pricomparer);
+                    waitPriMap.erase(wpiter);
+                }
+            }
+        }
+        if (fLast)
+            break;
+    }
+}
+
+void BlockAssembler::AddPackageTxs()
+{
+    // mapModifiedTx will store sorted packages after they are modified
+    // because some of their txs are already in the block
+    indexed_modified_transaction_set mapModifiedTx;
+    // Keep track of entries that failed inclusion, to avoid duplicate work
+    setTxIters failedTx;
+
+    // Start by adding all descendants of previously added txs to mapModifiedTx
+    // and modifying them for their already included ancestors
+    CTxMemPool::setEntries alreadyAdded(inBlock.begin(), inBlock.end());
+    UpdatePackagesForAdded(alreadyAdded, mapModifiedTx);
+
+    CTxMemPool::indexed_transaction_set::nth_index<4>::type::iterator mi = pool.mapTx.get<4>().begin();
+    CTxMemPool::txiter iter;
+
+    // Once we're within 1000 bytes of a full block, only look at 50 more
+    // packages to try to fill the remaining space.
+    int lastFewTxs = 0;
+
+    while (mi != pool.mapTx.get<4>().end() || !mapModifiedTx.empty())
+    {
+        // First try to find a new transaction in mapTx to evaluate.
+        if (mi != pool.mapTx.get<4>().end() &&
+                SkipMapTxEntry(pool.mapTx.project<0>(mi), mapModifiedTx, failedTx)) {
+            ++mi;
+            continue;
+        }
+
+        // Now that mi is not stale, determine which transaction to evaluate:
+        // the next entry from mapTx, or the best from mapModifiedTx?
+        bool fUsingModified = false;
+
+        modtxscoreiter modit = mapModifiedTx.get<1>().begin();
+        if (mi == pool.mapTx.get<4>().end()) {
+            // We're out of entries in mapTx; use the entry from mapModifiedTx
+            iter = modit->iter;
+            fUsingModified = true;
+        } else {
+            // Try to compare the mapTx entry to the mapModifiedTx entry
+            iter = pool.mapTx.project<0>(mi);
+            if (modit != mapModifiedTx.get<1>().end() &&
+                    CompareModifiedEntry()(*modit, CTxMemPoolModifiedEntry(iter))) {
+                // The best entry in mapModifiedTx has higher score
+                // than the one from mapTx.
+                // Switch which transaction (package) to consider
+                iter = modit->iter;
+                fUsingModified = true;
+            } else {
+                // Either no entry in mapModifiedTx, or it's worse than mapTx.
+                // Increment mi for the next loop iteration.
+                ++mi;
+            }
+        }
+
+        // We skip mapTx entries that are inBlock, and mapModifiedTx shouldn't
+        // contain anything that is inBlock.
+        assert(!inBlock.count(iter));
+
+        uint64_t packageSize = iter->GetSizeWithAncestors();
+        CAmount packageFees = iter->GetModFeesWithAncestors();
+        unsigned int packageSigOps = iter->GetSigOpCountWithAncestors();
+        if (fUsingModified) {
+            packageSize = modit->nSizeWithAncestors;
+            packageFees = modit->nModFeesWithAncestors;
+            packageSigOps = modit->nSigOpCountWithAncestors;
+        }
+
+        if (packageFees < ::minRelayTxFee.GetFee(packageSize) && nBlockSize >= nBlockMinSize) {
+            // Everything else we might consider has a lower fee rate
+            return;
+        }
+
+        if (!TestPackage(packageSize, packageSigOps)) {
+            if (fUsingModified) {
+                // Since we always look at the best entry in mapModifiedTx,
+                // we must erase failed entries so that we can consider the
+                // next best entry on the next loop iteration
+                mapModifiedTx.get<1>().erase(modit);
+                failedTx.insert(iter);
+            }
+            if (nBlockSize > nBlockMaxSize - 1000 && ++lastFewTxs > 50) {
+                // Give up if we're close to full and haven't succeeded in a while
+                return;
+            }
+            continue;
+        }
+
+        CTxMemPool::setEntries ancestors;
+        uint64_t nNoLimit = std::numeric_limits<uint64_t>::max();
+        std::string dummy;
+        pool.CalculateMemPoolAncestors(*iter, ancestors, nNoLimit, nNoLimit, nNoLimit, nNoLimit, dummy, false);
+
+        OnlyUnconfirmed(ancestors);
+        ancestors.insert(iter);
+
+        // Test if all tx's are Final
+        if (!TestPackageFinality(ancestors)) {
+            if (fUsingModified) {
+                mapModifiedTx.get<1>().erase(modit);
+                failedTx.insert(iter);
+            }
+            continue;
+        }
+
+        // Package can be added. Sort the entries in a valid order.
+        std::vector<CTxMemPool::txiter> sortedEntries(ancestors.begin(), ancestors.end());
+        std::sort(sortedEntries.begin(), sortedEntries.end(), CompareTxIterByAncestorCount());
+
+        for (size_t i = 0; i < sortedEntries.size(); ++i) {
+            AddToBlock(sortedEntries[i]);
+            // Erase from the modified set, if present
+            mapModifiedTx.erase(sortedEntries[i]);
+        }
+
+        // Update transactions that depend on each of these
+        UpdatePackagesForAdded(ancestors, mapModifiedTx);
+    }
+}
+// HFP0 PRF end
+
+// HFP0 PRF begin
+/**
+ * The checks of TestBlockValidity short of connecting the block. Mempool
+ * transactions passed the input and script checks of AcceptToMemoryPool on
+ * top of the tip, and the mempool keeps them consistent with it, so this
+ * leaves the checks of the block as a whole; its sigops and signature
+ * hashing are bounded by what was counted for the mempool.
+ */
+static bool TestBlockTemplateValidity(CValidationState& state, const CChainParams& chainparams, const CBlockTemplate& blocktemplate, CBlockIndex* pindexPrev)
+{
+    AssertLockHeld(cs_main);
+    const CBlock& block = blocktemplate.block;
+    const int nHeight = pindexPrev->nHeight + 1;
+
+    if (!ContextualCheckBlockHeader(block, state, pindexPrev))
+        return false;
+    if (!CheckBlock(block, state, false, false))
+        return false;
+    if (!ContextualCheckBlock(block, state, pindexPrev))
+        return false;
+
+    uint64_t nSigOps = 0;
+    BOOST_FOREACH(int64_t nTxSigOps, blocktemplate.vTxSigOps)
+        nSigOps += nTxSigOps;
+    if (nSigOps > maxBlockSigops || nSigOps > MaxBlockSigops(nHeight))
+        return state.DoS(100, error("%s: too many sigops", __func__), REJECT_INVALID, "bad-blk-sigops");
+
+    // Each transaction hashes at most its share by size of MAX_BLOCK_SIGHASH
+    uint64_t nSize = ::GetSerializeSize(block, SER_NETWORK, PROTOCOL_VERSION);
+    if (nSize > MaxBlockSize(nHeight) || nSize * MAX_BLOCK_SIGHASH / MAX_BLOCK_SIZE > MaxBlockSighash(nHeight))
+        return state.DoS(100, error("%s: signature hashing may exceed the limit", __func__), REJECT_INVALID, "bad-blk-sighash");
+
+    CAmount nFees = -blocktemplate.vTxFees[0];
+    if (block.vtx[0].GetValueOut() > nFees + GetBlockSubsidy(nHeight, chainparams.GetConsensus()))
+        return state.DoS(100, error("%s: coinbase pays too much", __func__), REJECT_INVALID, "bad-cb-amount");
+
+    return true;
+}
+
+/**
+ * Check a new template on top of pindexPrev, the tip: connecting the block
+ * is only done on request (-checkblocktemplate).
+ */
+static bool CheckNewBlockTemplate(CValidationState& state, const CChainParams& chainparams, const CBlockTemplate& blocktemplate, CBlockIndex* pindexPrev)
+{
+    bool fCheckBlockTemplate = GetBoolArg("-checkblocktemplate", DEFAULT_CHECK_BLOCK_TEMPLATE);
+    int64_t nTimeValidityStart = GetTimeMicros();
+    bool fValid = fCheckBlockTemplate ? TestBlockValidity(state, chainparams, blocktemplate.block, pindexPrev, false, false)
+                                      : TestBlockTemplateValidity(state, chainparams, blocktemplate, pindexPrev);
+    LogPrint("bench", "    - Check template%s: %.2fms\n", fCheckBlockTemplate ? " (connected)" : "", 0.001 * (GetTimeMicros() - nTimeValidityStart));
+    return fValid;
+}
+// HFP0 PRF end
+
 CBlockTemplate* CreateNewBlock(const CChainParams& chainparams, const CScript& scriptPubKeyIn)
 {
     // Create new block
@@ -94,25 +420,6 @@ CBlockTemplate* CreateNewBlock(const CChainParams& chainparams, const CScript& s
     pblocktemplate->vTxFees.push_back(-1); // updated at end
     pblocktemplate->vTxSigOps.push_back(-1); // updated at end
 
-    // Collect memory pool transactions into the block
-    CTxMemPool::setEntries inBlock;
-    CTxMemPool::setEntries waitSet;
-
-    // This vector will be sorted into a priority queue:
-    vector<TxCoinAgePriority> vecPriority;
-    TxCoinAgePriorityCompare pricomparer;
-    std::map<CTxMemPool::txiter, double, CTxMemPool::CompareIteratorByHash> waitPriMap;
-    typedef std::map<CTxMemPool::txiter, double, CTxMemPool::CompareIteratorByHash>::iterator waitPriIter;
-    double actualPriority = -1;
-
-    std::priority_queue<CTxMemPool::txiter, std::vector<CTxMemPool::txiter>, ScoreCompare> clearedTxs;
-    bool fPrintPriority = GetBoolArg("-printpriority", DEFAULT_PRINTPRIORITY);
-    uint64_t nBlockSize = 1000;
-    uint64_t nBlockTx = 0;
-    unsigned int nBlockSigOps = 100;
-    int lastFewTxs = 0;
-    CAmount nFees = 0;
-
     {
         LOCK2(cs_main, mempool.cs);
         CBlockIndex* pindexPrev = chainActive.Tip();
@@ -234,180 +541,23 @@ CBlockTemplate* CreateNewBlock(const CChainParams& chainparams, const CScript& s
                                 ? nMedianTimePast
                                 : pblock->GetBlockTime();
 
-        bool fPriorityBlock = nBlockPrioritySize > 0;
-        if (fPriorityBlock) {
-            vecPriority.reserve(mempool.mapTx.size());
-            for (CTxMemPool::indexed_transaction_set::iterator mi = mempool.mapTx.begin();
-                 mi != mempool.mapTx.end(); ++mi)
-            {
-                double dPriority = mi->GetPriority(nHeight);
-                CAmount dummy;
-                mempool.ApplyDeltas(mi->GetTx().GetHash(), dPriority, dummy);
-                vecPriority.push_back(TxCoinAgePriority(dPriority, mi));
-            }
-            std::make_heap(vecPriority.begin(), vecPriority.end(), pricomparer);
-        }
-
-        CTxMemPool::indexed_transaction_set::nth_index<3>::type::iterator mi = mempool.mapTx.get<3>().begin();
-        CTxMemPool::txiter iter;
-
-        // HFP0 BSZ, CLN removed obsolete nMaxLegacySigops evaluation
-
-#if HFP0_DEBUG_BSZ
-        // HFP0 DBG begin
-        // track loop exit code to assist in debugging
-        unsigned int loop_exit_code = 0;  // 0 is natural end, all the breaks will set a unique code to identify the reason...
-        // HFP0 DBG end
-#endif
-        while (mi != mempool.mapTx.get<3>().end() || !clearedTxs.empty())
-        {
-            bool priorityTx = false;
-            if (fPriorityBlock && !vecPriority.empty()) { // add a tx from priority queue to fill the blockprioritysize
-                priorityTx = true;
-                iter = vecPriority.front().second;
-                actualPriority = vecPriority.front().first;
-                std::pop_heap(vecPriority.begin(), vecPriority.end(), pricomparer);
-                vecPriority.pop_back();
-            }
-            else if (clearedTxs.empty()) { // add tx with next highest score
-                iter = mempool.mapTx.project<0>(mi);
-                mi++;
-            }
-            else {  // try to add a previously postponed child tx
-                iter = clearedTxs.top();
-                clearedTxs.pop();
-            }
-
-            if (inBlock.count(iter))
-                continue; // could have been added to the priorityBlock
-
-            const CTransaction& tx = iter->GetTx();
-
-            bool fOrphan = false;
-            BOOST_FOREACH(CTxMemPool::txiter parent, mempool.GetMemPoolParents(iter))
-            {
-                if (!inBlock.count(parent)) {
-                    fOrphan = true;
-#if HFP0_DEBUG_BSZ
-                    // HFP0 DBG begin
-                    loop_exit_code = 1;
-                    // HFP0 DBG end
-#endif
-                    break;
-                }
-            }
-            if (fOrphan) {
-                if (priorityTx)
-                    waitPriMap.insert(std::make_pair(iter,actualPriority));
-                else
-                    waitSet.insert(iter);
-                continue;
-            }
-
-            unsigned int nTxSize = iter->GetTxSize();
-            if (fPriorityBlock &&
-                (nBlockSize + nTxSize >= nBlockPrioritySize || !AllowFree(actualPriority))) {
-                fPriorityBlock = false;
-                waitPriMap.clear();
-            }
-            if (!priorityTx &&
-                (iter->GetModifiedFee() < ::minRelayTxFee.GetFee(nTxSize) && nBlockSize >= nBlockMinSize)) {
-#if HFP0_DEBUG_BSZ
-                // HFP0 DBG begin
-                loop_exit_code = 2;
-                // HFP0 DBG end
-#endif
-                break;
-            }
-            if (nBlockSize + nTxSize >= nBlockMaxSize) {
-                if (nBlockSize >  nBlockMaxSize - 100 || lastFewTxs > 50) {
-#if HFP0_DEBUG_BSZ
-                    // HFP0 DBG begin
-                    loop_exit_code = 3;
-                    // HFP0 DBG end
-#endif
-                    break;
-                }
-                // Once we're within 1000 bytes of a full block, only look at 50 more txs
-                // to try to fill the remaining space.
-                if (nBlockSize > nBlockMaxSize - 1000) {
-                    lastFewTxs++;
-                }
-                continue;
-            }
-
-            if (!IsFinalTx(tx, nHeight, nLockTimeCutoff))
-                continue;
-
-            unsigned int nTxSigOps = iter->GetSigOpCount();
-            // HFP0 BSZ begin
-            // (replaced nMaxLegacySigops by maxBlockSigops)
-
-#if HFP0_DEBUG_BSZ
-            // HFP0 DBG begin
-            LogPrintf("HFP0 BSZ: CreateNewBlock: maxBlockSigops = %u at address %p\n", maxBlockSigops, &maxBlockSigops);
-            LogPrintf("HFP0 BSZ: CreateNewBlock: nMaxBlockSigops = %u\n", nMaxBlockSigops);
-            // HFP0 DBG end
-#endif
-
-            if (nBlockSigOps + nTxSigOps >= nMaxBlockSigops) {
-                if (nBlockSigOps > nMaxBlockSigops - 2) {
-#if HFP0_DEBUG_BSZ
-                    // HFP0 DBG begin
-                    loop_exit_code = 4;
-                    // HFP0 DBG end
-#endif
-                    break;
-                }
-                continue;
-            }
-            // HFP0 BSZ end
-
-            CAmount nTxFees = iter->GetFee();
-            // Added
-            pblock->vtx.push_back(tx);
-            pblocktemplate->vTxFees.push_back(nTxFees);
-            pblocktemplate->vTxSigOps.push_back(nTxSigOps);
-            nBlockSize += nTxSize;
-            ++nBlockTx;
-            nBlockSigOps += nTxSigOps;
-            nFees += nTxFees;
-
-            if (fPrintPriority)
-            {
-                double dPriority = iter->GetPriority(nHeight);
-                CAmount dummy;
-                mempool.ApplyDeltas(tx.GetHash(), dPriority, dummy);
-                LogPrintf("priority %.1f fee %s txid %s\n",
-                          dPriority , CFeeRate(iter->GetModifiedFee(), nTxSize).ToString(), tx.GetHash().ToString());
-            }
-
-            inBlock.insert(iter);
-
-            // Add transactions that depend on this one to the priority queue
-            BOOST_FOREACH(CTxMemPool::txiter child, mempool.GetMemPoolChildren(iter))
-            {
-                if (fPriorityBlock) {
-                    waitPriIter wpiter = waitPriMap.find(child);
-                    if (wpiter != waitPriMap.end()) {
-                        vecPriority.push_back(TxCoinAgePriority(wpiter->second,child));
-                        std::push_heap(vecPriority.begin(), vecPriority.end(), pricomparer);
-                        waitPriMap.erase(wpiter);
-                    }
-                }
-                else {
-                    if (waitSet.count(child)) {
-                        clearedTxs.push(child);
-                        waitSet.erase(child);
-                    }
-                }
-            }
-        }
-#if HFP0_DEBUG_BSZ
-        // HFP0 DBG begin
-        LogPrintf("HFP0 BSZ: CreateNewBlock() while loop exit code: %d\n", loop_exit_code);
-        // HFP0 DBG end
-#endif
+        // HFP0 PRF begin: priority transactions, then packages by ancestor feerate
+        int64_t nTimeStart = GetTimeMicros();
+        BlockAssembler assembler(mempool, *pblocktemplate, nHeight, nLockTimeCutoff, nBlockMaxSize, nBlockMinSize, nMaxBlockSigops);
+        assembler.AddPriorityTxs(nBlockPrioritySize);
+        assembler.AddPackageTxs();
+        uint64_t nBlockSize = assembler.GetBlockSize();
+        uint64_t nBlockTx = assembler.GetBlockTx();
+        unsigned int nBlockSigOps = assembler.GetBlockSigOps();
+        CAmount nFees = assembler.GetFees();
+        LogPrint("bench", "    - Assemble %u txs from %u in the mempool: %.2fms\n", (unsigned)nBlockTx, (unsigned)mempool.mapTx.size(), 0.001 * (GetTimeMicros() - nTimeStart));
+        pblocktemplate->nHeight = nHeight;
+        pblocktemplate->nLockTimeCutoff = nLockTimeCutoff;
+        pblocktemplate->nBlockMaxSize = nBlockMaxSize;
+        pblocktemplate->nMaxBlockSigOps = nMaxBlockSigops;
+        pblocktemplate->nBlockSize = nBlockSize;
+        pblocktemplate->nBlockSigOps = nBlockSigOps;
+        // HFP0 PRF end
 
         nLastBlockTx = nBlockTx;
         nLastBlockSize = nBlockSize;
@@ -427,7 +577,7 @@ CBlockTemplate* CreateNewBlock(const CChainParams& chainparams, const CScript& s
         pblocktemplate->vTxSigOps[0] = GetLegacySigOpCount(pblock->vtx[0]);
 
         CValidationState state;
-        if (!TestBlockValidity(state, chainparams, *pblock, pindexPrev, false, false)) {
+        if (!CheckNewBlockTemplate(state, chainparams, *pblocktemplate, pindexPrev)) {  // HFP0 PRF changed
 #if HFP0_DEBUG_BSZ
             // HFP0 DBG begin
             LogPrintf("HFP0 BSZ: CreateNewBlock(): TestBlockValidity failed: %s\n", FormatStateMessage(state));
@@ -459,41 +609,178 @@ void IncrementExtraNonce(CBlock* pblock, const CBlockIndex* pindexPrev, unsigned
     pblock->hashMerkleRoot = BlockMerkleRoot(*pblock);
 }
 
+// HFP0 PRF begin: incrementally maintained block template
+CBlockTemplateEngine* pblocktemplateengine = NULL;
+
+CBlockTemplateEngine::CBlockTemplateEngine(const CChainParams& chainparamsIn, const CScript& scriptPubKeyIn, unsigned int nMaxPendingIn)
+    : chainparams(chainparamsIn), scriptPubKey(scriptPubKeyIn), pindexPrev(NULL), nMaxPending(nMaxPendingIn), fStale(false), fServed(false), nRebuilds(0)
+{
+}
+
+void CBlockTemplateEngine::Rebuild()
+{
+    AssertLockHeld(cs_main);
+    boost::scoped_ptr<CBlockTemplate> pblocktemplateNew(CreateNewBlock(chainparams, scriptPubKey));
+    if (!pblocktemplateNew.get())
+        throw std::runtime_error(strprintf("%s: out of memory", __func__));
+
+    blocktemplate = *pblocktemplateNew;
+    pindexPrev = chainActive.Tip();
+    setInTemplate.clear();
+    for (unsigned int i = 1; i < blocktemplate.block.vtx.size(); i++)
+        setInTemplate.insert(blocktemplate.block.vtx[i].GetHash());
+    pblocktemplateServed.reset();
+    vPending.clear();
+    fStale = false;
+    fServed = false;
+    nRebuilds++;
+}
+
+bool CBlockTemplateEngine::Append(const uint256& hash, CAmount& nFeesAdded)
+{
+    CTxMemPool::txiter it = mempool.mapTx.find(hash);
+    if (it == mempool.mapTx.end() || setInTemplate.count(hash))
+        return true;
+
+    // Parents outside the block would have to come with it, as a package
+    BOOST_FOREACH(const CTxMemPool::txiter parent, mempool.GetMemPoolParents(it)) {
+        if (!setInTemplate.count(parent->GetTx().GetHash()))
+            return false;
+    }
+    if (blocktemplate.nBlockSize + it->GetTxSize() >= blocktemplate.nBlockMaxSize ||
+        blocktemplate.nBlockSigOps + it->GetSigOpCount() >= blocktemplate.nMaxBlockSigOps)
+        return false;
+
+    // Neither would a rebuild include these, until the next block
+    if (!IsFinalTx(it->GetTx(), blocktemplate.nHeight, blocktemplate.nLockTimeCutoff))
+        return true;
+    if (it->GetModifiedFee() < ::minRelayTxFee.GetFee(it->GetTxSize()))
+        return true;
+
+    blocktemplate.block.vtx.push_back(it->GetTx());
+    blocktemplate.vTxFees.push_back(it->GetFee());
+    blocktemplate.vTxSigOps.push_back(it->GetSigOpCount());
+    blocktemplate.nBlockSize += it->GetTxSize();
+    blocktemplate.nBlockSigOps += it->GetSigOpCount();
+    setInTemplate.insert(hash);
+    nFeesAdded += it->GetFee();
+    return true;
+}
+
+void CBlockTemplateEngine::AppendPending()
+{
+    if (vPending.empty())
+        return;
+
+    CAmount nFeesAdded = 0;
+    unsigned int nAppended = setInTemplate.size();
+    BOOST_FOREACH(const uint256& hash, vPending) {
+        if (!Append(hash, nFeesAdded))
+            fStale = true;
+    }
+    nAppended = setInTemplate.size() - nAppended;
+    vPending.clear();
+    if (nAppended == 0)
+        return;
+
+    CMutableTransaction txCoinbase(blocktemplate.block.vtx[0]);
+    txCoinbase.vout[0].nValue += nFeesAdded;
+    blocktemplate.block.vtx[0] = txCoinbase;
+    blocktemplate.vTxFees[0] -= nFeesAdded;
+    pblocktemplateServed.reset();
+    LogPrint("bench", "    - Appended %u txs to the block template\n", nAppended);
+
+    // The template gets the checks CreateNewBlock makes; one failing them is assembled afresh
+    CValidationState state;
+    if (!CheckNewBlockTemplate(state, chainparams, blocktemplate, chainActive.Tip())) {
+        LogPrintf("%s: extended block template failed its checks: %s\n", __func__, FormatStateMessage(state));
+        pindexPrev = NULL;
+    }
+}
+
+bool CBlockTemplateEngine::AllInMempool() const
+{
+    BOOST_FOREACH(const uint256& hash, setInTemplate) {
+        if (!mempool.mapTx.count(hash))
+            return false;
+    }
+    return true;
+}
+
+void CBlockTemplateEngine::UpdatedBlockTip(const CBlockIndex* pindex)
+{
+    LOCK(cs);
+    // The template is rebuilt on top of the new tip anyway
+    if (pindex != pindexPrev)
+        vPending.clear();
+}
+
+void CBlockTemplateEngine::SyncTransaction(const CTransaction& tx, const CBlock* pblock)
+{
+    if (pblock != NULL)
+        return;
+    LOCK(cs);
+    if (pindexPrev == NULL)
+        return;
+    if (vPending.size() >= nMaxPending) {
+        // Nobody asked for the template in a while; assemble it afresh when someone does
+        vPending.clear();
+        pindexPrev = NULL;
+        return;
+    }
+    vPending.push_back(tx.GetHash());
+}
+
+boost::shared_ptr<CBlockTemplate> CBlockTemplateEngine::GetTemplate()
+{
+    LOCK2(cs_main, mempool.cs);
+    LOCK(cs);
+    if (pindexPrev == chainActive.Tip())
+        AppendPending();
+    if (pindexPrev != chainActive.Tip() || !AllInMempool())
+        Rebuild();
+    if (!pblocktemplateServed)
+        pblocktemplateServed.reset(new CBlockTemplate(blocktemplate));
+    fServed = true;
+    return pblocktemplateServed;
+}
+
+void CBlockTemplateEngine::RebuildIfStale()
+{
+    LOCK2(cs_main, mempool.cs);
+    LOCK(cs);
+    if (pindexPrev == NULL || !fServed)
+        return;
+    if (pindexPrev == chainActive.Tip())
+        AppendPending();
+    try {
+        if (fStale || pindexPrev != chainActive.Tip() || !AllInMempool())
+            Rebuild();
+    } catch (const std::runtime_error& e) {
+        // Left for the next request to rebuild, and report
+        LogPrintf("%s: %s\n", __func__, e.what());
+    }
+}
+
+uint64_t CBlockTemplateEngine::GetRebuildCount()
+{
+    LOCK(cs);
+    return nRebuilds;
+}
+// HFP0 PRF end
+
 //////////////////////////////////////////////////////////////////////////////
 //
 // Internal miner
 //
 
+#if !HFP0_POW
 //
 // ScanHash scans nonces looking for a hash with at least some zero bits.
 // The nonce is usually preserved between calls, but periodically or if the
 // nonce is 0xffff0000 or above, the block is rebuilt and nNonce starts over at
 // zero.
 //
-#if HFP0_POW
-// HFP0 POW begin
-bool static ScanHash(CBlockHeader *pblock, uint32_t& nNonce, uint256 *phash, arith_uint256 hashTarget)
-{
-    while (true) {
-        nNonce++;
-        pblock->nNonce = nNonce;
-        *phash = pblock->GetHash(false);   // false means do not use cache
-        // Return the nonce if it is below the hashTarget
-        if (UintToArith256(*phash) <= hashTarget)
-            return true;
-        // If nothing found after trying for 16 hashes return failed, rebuild a new block and try again
-        // Using smaller number of hashes to try at once due to longer hashing times
-        if ( (nNonce & 0x0000000f) == 0)
-            return false;
-        if (shutdownAllMinerThreads)
-            return false;
-
-        // Allow thread to pass control (each hash takes ~1 sec)
-        MilliSleep(0);
-    }
-}
-// HFP0 POW end
-#else
 bool static ScanHash(const CBlockHeader *pblock, uint32_t& nNonce, uint256 *phash)
 {
     // Write the first 76 bytes of the block header to a double-SHA256 state.
@@ -545,6 +832,313 @@ static bool ProcessBlockFound(const CBlock* pblock, const CChainParams& chainpar
     return true;
 }
 
+/** Wait for the network to come online so we don't waste time mining on an obsolete chain */
+static void WaitForMiningPeers(const CChainParams& chainparams)
+{
+    if (!chainparams.MiningRequiresPeers())
+        return;
+    // In regtest mode we expect to fly solo.
+    do {
+        bool fvNodesEmpty;
+        {
+            LOCK(cs_vNodes);
+            fvNodesEmpty = vNodes.empty();
+        }
+        if (!fvNodesEmpty && !IsInitialBlockDownload())
+            break;
+        MilliSleep(1000);
+    } while (true);
+}
+
+#if HFP0_POW
+// HFP0 POW begin: miner for long-latency PoW
+boost::atomic<bool> shutdownAllMinerThreads(false);
+
+void SetShutdownAllMinerThreads()
+{
+    shutdownAllMinerThreads = true;
+}
+
+/** Hash rate of each miner thread, measured over the last MINER_HASHRATE_INTERVAL */
+static CCriticalSection cs_minerHashRate;
+static std::vector<double> vMinerHashesPerSec;
+/** Seconds over which a miner thread's hash rate is measured */
+static const int64_t MINER_HASHRATE_INTERVAL = 30;
+/** Minimum seconds between rebuilding the template for new mempool transactions */
+static const int64_t MINER_TEMPLATE_REFRESH_INTERVAL = 60;
+
+std::vector<double> GetMinerHashesPerSec()
+{
+    LOCK(cs_minerHashRate);
+    return vMinerHashesPerSec;
+}
+
+/**
+ * The block template shared by all miner threads.
+ *
+ * With a hash taking about a second, rebuilding the template between hashes
+ * (and taking cs_main and mempool.cs to do so) costs more than it gains. A
+ * background thread therefore rebuilds it when the tip changes, or at most
+ * once a minute when the mempool has changed, and the hashing threads switch
+ * to a new template between two hashes without waiting for CreateNewBlock.
+ */
+class CMinerTemplate
+{
+private:
+    boost::mutex cs;
+    boost::condition_variable cond;
+    boost::shared_ptr<CBlockTemplate> pblocktemplate;
+    uint64_t nSequence;
+    bool fRefreshRequested;
+    //! Set once no more templates will be published
+    bool fQuit;
+
+public:
+    CMinerTemplate() : nSequence(0), fRefreshRequested(false), fQuit(false) {}
+
+    void Publish(const boost::shared_ptr<CBlockTemplate>& pblocktemplateIn)
+    {
+        boost::unique_lock<boost::mutex> lock(cs);
+        pblocktemplate = pblocktemplateIn;
+        nSequence++;
+        fRefreshRequested = false;
+        cond.notify_all();
+    }
+
+    /** Wait until a template newer than nHave is published, and return it; false if none will be */
+    bool WaitForNew(uint64_t& nHave, boost::shared_ptr<CBlockTemplate>& pblocktemplateOut)
+    {
+        boost::unique_lock<boost::mutex> lock(cs);
+        while (nSequence == nHave && !fQuit)
+            cond.wait(lock); // interruption point
+        if (fQuit)
+            return false;
+        pblocktemplateOut = pblocktemplate;
+        nHave = nSequence;
+        return true;
+    }
+
+    /** Stop publishing, and wake the threads waiting for a template */
+    void Quit()
+    {
+        boost::unique_lock<boost::mutex> lock(cs);
+        fQuit = true;
+        cond.notify_all();
+    }
+
+    bool IsQuitting()
+    {
+        boost::unique_lock<boost::mutex> lock(cs);
+        return fQuit;
+    }
+
+    uint64_t GetSequence()
+    {
+        boost::unique_lock<boost::mutex> lock(cs);
+        return nSequence;
+    }
+
+    /** Ask for a new template (new extra nonce), e.g. when a thread has exhausted its nonce range */
+    void RequestRefresh()
+    {
+        boost::unique_lock<boost::mutex> lock(cs);
+        fRefreshRequested = true;
+    }
+
+    bool IsRefreshRequested()
+    {
+        boost::unique_lock<boost::mutex> lock(cs);
+        return fRefreshRequested;
+    }
+};
+
+/** Background thread keeping the shared template up to date */
+void static BitcoinMinerTemplateRefresher(const CChainParams& chainparams, boost::shared_ptr<CReserveScript> coinbaseScript, CMinerTemplate* ptemplate)
+{
+    RenameThread("bitcoin-minertmpl");
+
+    unsigned int nExtraNonce = 0;
+    unsigned int nTransactionsUpdatedLast = 0;
+    int64_t nLastBuild = 0;
+    uint256 hashPrevLast;
+    // HFP0 PRF added: extended with new transactions instead of reassembled each time
+    CBlockTemplateEngine engine(chainparams, coinbaseScript->reserveScript);
+    RegisterValidationInterface(&engine);
+
+    try {
+        while (true) {
+            WaitForMiningPeers(chainparams);
+            if (shutdownAllMinerThreads)
+                break;
+
+            uint256 hashTip;
+            {
+                LOCK(cs_main);
+                hashTip = chainActive.Tip()->GetBlockHash();
+            }
+            bool fNewTip = hashTip != hashPrevLast;
+            bool fNewTransactions = mempool.GetTransactionsUpdated() != nTransactionsUpdatedLast && GetTime() - nLastBuild > MINER_TEMPLATE_REFRESH_INTERVAL;
+            if (fNewTip || fNewTransactions || ptemplate->IsRefreshRequested()) {
+                int64_t nTimeStart = GetTimeMicros();
+                nTransactionsUpdatedLast = mempool.GetTransactionsUpdated();
+                // HFP0 PRF begin: the engine's template is shared, so mine a copy
+                if (fNewTransactions)
+                    engine.RebuildIfStale();
+                boost::shared_ptr<CBlockTemplate> pblocktemplate(new CBlockTemplate(*engine.GetTemplate()));
+                // HFP0 PRF end
+                CBlock *pblock = &pblocktemplate->block;
+                {
+                    LOCK(cs_main);
+                    BlockMap::iterator mi = mapBlockIndex.find(pblock->hashPrevBlock);
+                    assert(mi != mapBlockIndex.end());
+                    UpdateTime(pblock, chainparams.GetConsensus(), mi->second);  // HFP0 PRF added: the template may be older than this
+                    IncrementExtraNonce(pblock, mi->second, nExtraNonce);
+                }
+                hashPrevLast = pblock->hashPrevBlock;
+                nLastBuild = GetTime();
+                ptemplate->Publish(pblocktemplate);
+
+                LogPrintf("Running BitcoinMiner with %u transactions in block (%u bytes), template built in %.2fms\n", pblock->vtx.size(),
+                    ::GetSerializeSize(*pblock, SER_NETWORK, PROTOCOL_VERSION), 0.001 * (GetTimeMicros() - nTimeStart));
+            }
+            MilliSleep(100);
+        }
+    }
+    catch (const boost::thread_interrupted&)
+    {
+        UnregisterValidationInterface(&engine);  // HFP0 PRF added
+        LogPrintf("BitcoinMiner template refresher terminated\n");
+        throw;
+    }
+    catch (const std::runtime_error &e)
+    {
+        LogPrintf("BitcoinMiner template refresher runtime error: %s\n", e.what());
+    }
+    UnregisterValidationInterface(&engine);  // HFP0 PRF added
+    // Without templates the hashing threads have nothing left to do
+    ptemplate->Quit();
+}
+
+/**
+ * Hashing thread nThread of nThreads. Each thread scans its own slice of the
+ * nonce space of the shared template, so threads never duplicate work.
+ */
+void static BitcoinMiner(const CChainParams& chainparams, boost::shared_ptr<CReserveScript> coinbaseScript, CMinerTemplate* ptemplate, int nThread, int nThreads)
+{
+    LogPrintf("BitcoinMiner %d started\n", nThread);
+    SetThreadPriority(THREAD_PRIORITY_LOWEST);
+    RenameThread("bitcoin-miner");
+
+    const uint32_t nNonceBegin = (uint32_t)(((uint64_t)nThread << 32) / nThreads);
+    const uint32_t nNonceLast = (uint32_t)((((uint64_t)nThread + 1) << 32) / nThreads - 1);
+    uint64_t nSequence = 0;
+    int64_t nHashes = 0;
+    int64_t nRateStart = GetTime();
+
+    try {
+        while (true) {
+            if (shutdownAllMinerThreads)
+                break;
+
+            boost::shared_ptr<CBlockTemplate> pblocktemplate;
+            if (!ptemplate->WaitForNew(nSequence, pblocktemplate)) {
+                LogPrintf("BitcoinMiner %d stopped: no new block templates\n", nThread);
+                break;
+            }
+            CBlock block = pblocktemplate->block;
+            CBlockIndex* pindexPrev;
+            {
+                LOCK(cs_main);
+                pindexPrev = mapBlockIndex[block.hashPrevBlock];
+            }
+
+            //
+            // Search
+            //
+            arith_uint256 hashTarget = arith_uint256().SetCompact(block.nBits);
+            block.nNonce = nNonceBegin;
+            while (true) {
+                uint256 hash = block.GetHash(false);   // false means do not use cache
+                nHashes++;
+
+                if (UintToArith256(hash) <= hashTarget) {
+                    // Found a solution
+                    SetThreadPriority(THREAD_PRIORITY_NORMAL);
+#if HFP0_DEBUG_POW
+                    // HFP0 DBG begin
+                    LogPrintf("HFP0 POW: miner %d found hash: %s  \nnonce: %d\n", nThread, hash.GetHex(), block.nNonce);
+                    // HFP0 DBG end
+#endif
+                    assert(hash == block.GetHash());
+                    LogPrintf("BitcoinMiner:\n");
+                    LogPrintf("proof-of-work found  \n  hash: %s  \ntarget: %s\n", hash.GetHex(), hashTarget.GetHex());
+                    ProcessBlockFound(&block, chainparams);
+                    SetThreadPriority(THREAD_PRIORITY_LOWEST);
+                    coinbaseScript->KeepScript();
+
+                    // In regression test mode, stop mining after a block is found.
+                    if (chainparams.MineBlocksOnDemand())
+                        throw boost::thread_interrupted();
+
+                    // Wait for the template on top of the new tip
+                    break;
+                }
+
+                int64_t nNow = GetTime();
+                if (nNow - nRateStart >= MINER_HASHRATE_INTERVAL) {
+                    LOCK(cs_minerHashRate);
+                    if (nThread < (int)vMinerHashesPerSec.size())
+                        vMinerHashesPerSec[nThread] = (double)nHashes / (nNow - nRateStart);
+                    nHashes = 0;
+                    nRateStart = nNow;
+                }
+
+                // Check for stop or if a new template is available
+                boost::this_thread::interruption_point();
+                if (shutdownAllMinerThreads || ptemplate->IsQuitting())
+                    break;
+                // Regtest mode doesn't require peers
+                if (vNodes.empty() && chainparams.MiningRequiresPeers()) {
+                    WaitForMiningPeers(chainparams);
+                    ptemplate->RequestRefresh();
+                    break;
+                }
+                if (pindexPrev != chainActive.Tip() || ptemplate->GetSequence() != nSequence)
+                    break;
+                if (block.nNonce == nNonceLast) {
+                    ptemplate->RequestRefresh();
+                    break;
+                }
+                block.nNonce++;
+
+                // Update nTime every few seconds
+                if (UpdateTime(&block, chainparams.GetConsensus(), pindexPrev) < 0) {
+                    // Have the template recreated if the clock has run backwards,
+                    // so that we can use the correct time.
+                    ptemplate->RequestRefresh();
+                    break;
+                }
+                if (chainparams.GetConsensus().fPowAllowMinDifficultyBlocks)
+                {
+                    // Changing block.nTime can change work required on testnet:
+                    hashTarget.SetCompact(block.nBits);
+                }
+            }
+        }
+    }
+    catch (const boost::thread_interrupted&)
+    {
+        LogPrintf("BitcoinMiner terminated\n");
+        throw;
+    }
+    catch (const std::runtime_error &e)
+    {
+        LogPrintf("BitcoinMiner runtime error: %s\n", e.what());
+        return;
+    }
+}
+// HFP0 POW end
+#else
 void static BitcoinMiner(const CChainParams& chainparams)
 {
     LogPrintf("BitcoinMiner started\n");
@@ -564,26 +1158,7 @@ void static BitcoinMiner(const CChainParams& chainparams)
             throw std::runtime_error("No coinbase script available (mining requires a wallet)");
 
         while (true) {
-            if (chainparams.MiningRequiresPeers()) {
-                // Busy-wait for the network to come online so we don't waste time mining
-                // on an obsolete chain. In regtest mode we expect to fly solo.
-                do {
-                    bool fvNodesEmpty;
-                    {
-                        LOCK(cs_vNodes);
-                        fvNodesEmpty = vNodes.empty();
-                    }
-                    if (!fvNodesEmpty && !IsInitialBlockDownload())
-                        break;
-                    MilliSleep(1000);
-                } while (true);
-            }
-#if HFP0_POW
-            // HFP0 POW begin
-            if (shutdownAllMinerThreads)
-                break;
-            // HFP0 POW end
-#endif
+            WaitForMiningPeers(chainparams);
             //
             // Create new block
             //
@@ -611,38 +1186,19 @@ void static BitcoinMiner(const CChainParams& chainparams)
             uint32_t nNonce = 0;
             while (true) {
                 // Check if something found
-#if HFP0_POW
-                if (ScanHash(pblock, nNonce, &hash, hashTarget))
-#else
                 if (ScanHash(pblock, nNonce, &hash))
-#endif
                 {
                     if (UintToArith256(hash) <= hashTarget)
                     {
                         // Found a solution
                         pblock->nNonce = nNonce;
-#if HFP0_POW
-                        // HFP0 POW changed order of SetThreadPriority/assert as per satoshisbitcoin
-                        SetThreadPriority(THREAD_PRIORITY_NORMAL);
-#if HFP0_DEBUG_POW
-                        // HFP0 DBG begin
-                        LogPrintf("HFP0 POW: ScanHash returned hash: %s  \nnonce: %d\n", hash.GetHex(), nNonce);
-                        // HFP0 DBG end
-#endif
-                        assert(hash == pblock->GetHash());
-#else
                         assert(hash == pblock->GetHash());
+
                         SetThreadPriority(THREAD_PRIORITY_NORMAL);
-#endif
                         LogPrintf("BitcoinMiner:\n");
                         LogPrintf("proof-of-work found  \n  hash: %s  \ntarget: %s\n", hash.GetHex(), hashTarget.GetHex());
                         ProcessBlockFound(pblock, chainparams);
-
-#if HFP0_POW
-                        // HFP0 POW removed SetThreadPriority as per satoshisbitcoin
-#else
                         SetThreadPriority(THREAD_PRIORITY_LOWEST);
-#endif
                         coinbaseScript->KeepScript();
 
                         // In regression test mode, stop mining after a block is found.
@@ -658,24 +1214,13 @@ void static BitcoinMiner(const CChainParams& chainparams)
                 // Regtest mode doesn't require peers
                 if (vNodes.empty() && chainparams.MiningRequiresPeers())
                     break;
-#if HFP0_POW
-                // HFP0 POW begin: change threshold as per satoshisbitcoin
-                if (nNonce >= 0x000000ff)
-                // HFP0 POW end
-#else
                 if (nNonce >= 0xffff0000)
-#endif
                     break;
                 if (mempool.GetTransactionsUpdated() != nTransactionsUpdatedLast && GetTime() - nStart > 60)
                     break;
                 if (pindexPrev != chainActive.Tip())
                     break;
-#if HFP0_POW
-                // HFP0 POW begin
-                if (shutdownAllMinerThreads)
-                    break;
-                // HFP0 POW end
-#endif
+
                 // Update nTime every few seconds
                 if (UpdateTime(pblock, chainparams.GetConsensus(), pindexPrev) < 0)
                     break; // Recreate the block if the clock has run backwards,
@@ -699,10 +1244,16 @@ void static BitcoinMiner(const CChainParams& chainparams)
         return;
     }
 }
+#endif
 
 void GenerateBitcoins(bool fGenerate, int nThreads, const CChainParams& chainparams)
 {
     static boost::thread_group* minerThreads = NULL;
+#if HFP0_POW
+    // HFP0 POW begin: miner for long-latency PoW
+    static CMinerTemplate* minerTemplate = NULL;
+    // HFP0 POW end
+#endif
 
     if (nThreads < 0)
         nThreads = GetNumCores();
@@ -710,9 +1261,22 @@ void GenerateBitcoins(bool fGenerate, int nThreads, const CChainParams& chainpar
     if (minerThreads != NULL)
     {
         minerThreads->interrupt_all();
+#if HFP0_POW
+        // HFP0 POW begin: the threads use minerTemplate until they have exited
+        minerThreads->join_all();
+        delete minerTemplate;
+        minerTemplate = NULL;
+        // HFP0 POW end
+#endif
         delete minerThreads;
         minerThreads = NULL;
     }
+#if HFP0_POW
+    {
+        LOCK(cs_minerHashRate);
+        vMinerHashesPerSec.clear();
+    }
+#endif
 
     if (nThreads == 0 || !fGenerate)
         return;
@@ -722,10 +1286,36 @@ void GenerateBitcoins(bool fGenerate, int nThreads, const CChainParams& chainpar
     // Run one thread less than the number of hardware cores, needed due to long processing time of new hash
     if (nThreads > 1)
         nThreads--;
-    // HFP0 POW end
-#endif
 
+    boost::shared_ptr<CReserveScript> coinbaseScript;
+    GetMainSignals().ScriptForMining(coinbaseScript);
+    // Throw an error if no script was provided.  This can happen
+    // due to some internal error but also if the keypool is empty.
+    // In the latter case, already the pointer is NULL.
+    if (!coinbaseScript || coinbaseScript->reserveScript.empty()) {
+        LogPrintf("BitcoinMiner runtime error: No coinbase script available (mining requires a wallet)\n");
+        return;
+    }
+
+    // Every miner thread hashes concurrently and needs its own scratchpad
+    if (GetModifiedScryptThreads() < nThreads) {
+        LogPrintf("%s: raising the number of concurrent proof-of-work hashes to %d for the miner threads\n", __func__, nThreads);
+        SetModifiedScryptThreads(nThreads);
+    }
+
+    {
+        LOCK(cs_minerHashRate);
+        vMinerHashesPerSec.assign(nThreads, 0.0);
+    }
+    minerTemplate = new CMinerTemplate();
+    minerThreads = new boost::thread_group();
+    minerThreads->create_thread(boost::bind(&BitcoinMinerTemplateRefresher, boost::cref(chainparams), coinbaseScript, minerTemplate));
+    for (int i = 0; i < nThreads; i++)
+        minerThreads->create_thread(boost::bind(&BitcoinMiner, boost::cref(chainparams), coinbaseScript, minerTemplate, i, nThreads));
+    // HFP0 POW end
+#else
     minerThreads = new boost::thread_group();
     for (int i = 0; i < nThreads; i++)
         minerThreads->create_thread(boost::bind(&BitcoinMiner, boost::cref(chainparams)));
+#endif
 }
@@ -7,9 +7,21 @@
 #define BITCOIN_MINER_H
 
 #include "primitives/block.h"
+#include "txmempool.h"  // HFP0 PRF added
+#include "validationinterface.h"  // HFP0 PRF added
 
 #include <stdint.h>
 
+#include <boost/atomic.hpp>  // HFP0 POW added
+
+// HFP0 PRF begin
+#include <boost/multi_index/hashed_index.hpp>
+#include <boost/multi_index_container.hpp>
+#include <boost/multi_index/ordered_index.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/unordered_set.hpp>
+// HFP0 PRF end
+
 // HFP0 POW begin: safety
 #include "consensus/consensus.h"
 #ifndef HFP0_POW
@@ -18,8 +30,8 @@
 // HFP0 POW end
 #if HFP0_POW
 // HFP0 POW begin
-static bool shutdownAllMinerThreads = false;
-inline void SetShutdownAllMinerThreads() { shutdownAllMinerThreads = true; }
+extern boost::atomic<bool> shutdownAllMinerThreads;
+void SetShutdownAllMinerThreads();
 // HFP0 POW end
 #endif
 
@@ -34,14 +46,258 @@ static const bool DEFAULT_GENERATE = false;
 static const int DEFAULT_GENERATE_THREADS = 1;
 
 static const bool DEFAULT_PRINTPRIORITY = false;
+/** HFP0 PRF added: fully connect new block templates in TestBlockValidity, for debugging */
+static const bool DEFAULT_CHECK_BLOCK_TEMPLATE = false;
+/** HFP0 PRF added: seconds between background rebuilds of a block template that new transactions could improve */
+static const int BLOCK_TEMPLATE_REBUILD_INTERVAL = 5;
+/** HFP0 PRF added: new transactions a block template engine queues for appending before it rebuilds instead */
+static const unsigned int MAX_BLOCK_TEMPLATE_PENDING = 50000;
 
 struct CBlockTemplate
 {
     CBlock block;
     std::vector<CAmount> vTxFees;
     std::vector<int64_t> vTxSigOps;
+
+    // HFP0 PRF begin: what the block was assembled within, to extend it later
+    int nHeight;
+    int64_t nLockTimeCutoff;
+    uint64_t nBlockMaxSize;
+    unsigned int nMaxBlockSigOps;
+    uint64_t nBlockSize;
+    unsigned int nBlockSigOps;
+
+    CBlockTemplate() : nHeight(0), nLockTimeCutoff(0), nBlockMaxSize(0), nMaxBlockSigOps(0), nBlockSize(0), nBlockSigOps(0) {}
+    // HFP0 PRF end
+};
+
+// HFP0 PRF begin: ancestor feerate (CPFP) block assembly
+/** Hash of a mempool iterator, for the unordered containers of block assembly */
+struct TxIterHasher
+{
+    size_t operator()(const CTxMemPool::txiter& it) const
+    {
+        return it->GetTx().GetHash().GetCheapHash();
+    }
+};
+
+typedef boost::unordered_set<CTxMemPool::txiter, TxIterHasher> setTxIters;
+
+/**
+ * Container for tracking updates to ancestor feerate as we include (parent)
+ * transactions in a block
+ */
+struct CTxMemPoolModifiedEntry {
+    CTxMemPoolModifiedEntry(CTxMemPool::txiter entry)
+    {
+        iter = entry;
+        nSizeWithAncestors = entry->GetSizeWithAncestors();
+        nModFeesWithAncestors = entry->GetModFeesWithAncestors();
+        nSigOpCountWithAncestors = entry->GetSigOpCountWithAncestors();
+    }
+
+    CTxMemPool::txiter iter;
+    uint64_t nSizeWithAncestors;
+    CAmount nModFeesWithAncestors;
+    unsigned int nSigOpCountWithAncestors;
 };
 
+/** Comparator for CTxMemPool::txiter objects by their ancestor count, so that
+ *  parents sort before their children. */
+struct CompareTxIterByAncestorCount {
+    bool operator()(const CTxMemPool::txiter& a, const CTxMemPool::txiter& b) const
+    {
+        if (a->GetCountWithAncestors() != b->GetCountWithAncestors())
+            return a->GetCountWithAncestors() < b->GetCountWithAncestors();
+        return CTxMemPool::CompareIteratorByHash()(a, b);
+    }
+};
+
+/** Extracts the mempool iterator of a CTxMemPoolModifiedEntry */
+struct modifiedentry_iter {
+    typedef CTxMemPool::txiter result_type;
+    result_type operator() (const CTxMemPoolModifiedEntry& entry) const
+    {
+        return entry.iter;
+    }
+};
+
+/** Sort by ancestor feerate in descending order, as CompareTxMemPoolEntryByAncestorFee */
+struct CompareModifiedEntry {
+    bool operator()(const CTxMemPoolModifiedEntry& a, const CTxMemPoolModifiedEntry& b) const
+    {
+        double f1 = (double)a.nModFeesWithAncestors * b.nSizeWithAncestors;
+        double f2 = (double)b.nModFeesWithAncestors * a.nSizeWithAncestors;
+        if (f1 == f2) {
+            return CTxMemPool::CompareIteratorByHash()(a.iter, b.iter);
+        }
+        return f1 > f2;
+    }
+};
+
+/**
+ * Transactions some of whose ancestors are already in the block, with the
+ * ancestor state those ancestors no longer count towards; looked up by
+ * mempool entry and ordered by the remaining package's feerate.
+ */
+typedef boost::multi_index_container<
+    CTxMemPoolModifiedEntry,
+    boost::multi_index::indexed_by<
+        boost::multi_index::hashed_unique<
+            modifiedentry_iter,
+            TxIterHasher
+        >,
+        // sorted by modified ancestor fee rate
+        boost::multi_index::ordered_non_unique<
+            boost::multi_index::identity<CTxMemPoolModifiedEntry>,
+            CompareModifiedEntry
+        >
+    >
+> indexed_modified_transaction_set;
+
+typedef indexed_modified_transaction_set::nth_index<0>::type::iterator modtxiter;
+typedef indexed_modified_transaction_set::nth_index<1>::type::iterator modtxscoreiter;
+
+struct update_for_parent_inclusion
+{
+    update_for_parent_inclusion(CTxMemPool::txiter it) : iter(it) {}
+
+    void operator() (CTxMemPoolModifiedEntry &e)
+    {
+        e.nModFeesWithAncestors -= iter->GetModifiedFee();
+        e.nSizeWithAncestors -= iter->GetTxSize();
+        e.nSigOpCountWithAncestors -= iter->GetSigOpCount();
+    }
+
+    CTxMemPool::txiter iter;
+};
+
+/**
+ * Fills a block template with mempool transactions: first by coin age
+ * priority, up to the priority size, then by the feerate of each
+ * transaction together with its not yet included ancestors, so that a high
+ * fee child pulls in its low fee parents (CPFP). The caller holds
+ * mempool.cs for the lifetime of the assembler and sets the header and
+ * coinbase afterwards.
+ */
+class BlockAssembler
+{
+private:
+    CTxMemPool& pool;
+    CBlockTemplate& blocktemplate;
+
+    // Limits of the block being assembled
+    const int nHeight;
+    const int64_t nLockTimeCutoff;
+    const uint64_t nBlockMaxSize;
+    const uint64_t nBlockMinSize;
+    const unsigned int nMaxBlockSigOps;
+    const bool fPrintPriority;
+
+    // Information on the current status of the block
+    uint64_t nBlockSize;
+    uint64_t nBlockTx;
+    unsigned int nBlockSigOps;
+    CAmount nFees;
+    setTxIters inBlock;
+
+    /** Add a tx to the block */
+    void AddToBlock(CTxMemPool::txiter iter);
+    /** Test if a new package would "fit" in the block */
+    bool TestPackage(uint64_t packageSize, unsigned int packageSigOps) const;
+    /** Test if all the transactions of a package are final at the new height */
+    bool TestPackageFinality(const CTxMemPool::setEntries& package) const;
+    /** Remove confirmed (inBlock) entries from given set */
+    void OnlyUnconfirmed(CTxMemPool::setEntries& testSet) const;
+    /** Return true if given transaction from mapTx has already been evaluated */
+    bool SkipMapTxEntry(CTxMemPool::txiter it, indexed_modified_transaction_set& mapModifiedTx, const setTxIters& failedTx) const;
+    /** Add descendants of given transactions to mapModifiedTx with ancestor
+      * state updated assuming given transactions are inBlock. */
+    void UpdatePackagesForAdded(const CTxMemPool::setEntries& alreadyAdded, indexed_modified_transaction_set& mapModifiedTx);
+
+public:
+    BlockAssembler(CTxMemPool& poolIn, CBlockTemplate& blocktemplateIn, int nHeightIn, int64_t nLockTimeCutoffIn,
+                   uint64_t nBlockMaxSizeIn, uint64_t nBlockMinSizeIn, unsigned int nMaxBlockSigOpsIn);
+
+    /** Add transactions by coin age priority, until nBlockPrioritySize bytes are used */
+    void AddPriorityTxs(uint64_t nBlockPrioritySize);
+    /** Add transactions by ancestor feerate, parents before children */
+    void AddPackageTxs();
+
+    uint64_t GetBlockSize() const { return nBlockSize; }
+    uint64_t GetBlockTx() const { return nBlockTx; }
+    unsigned int GetBlockSigOps() const { return nBlockSigOps; }
+    CAmount GetFees() const { return nFees; }
+};
+// HFP0 PRF end
+
+// HFP0 PRF begin: incrementally maintained block template
+/**
+ * Keeps a block template on top of the tip, for getblocktemplate and the
+ * internal miner, without walking the whole mempool on every request.
+ *
+ * Transactions entering the mempool are queued through SyncTransaction and
+ * appended to the template when it is next asked for, provided their
+ * in-mempool parents are already in it and they still fit. Appending only
+ * takes time in the number of new transactions, and needs no
+ * TestBlockValidity as they were validated on their way into the mempool.
+ *
+ * A transaction that could not be appended (the block is full, or it needs
+ * parents that are not in it) marks the template stale, and RebuildIfStale()
+ * then assembles it from scratch; it is meant to run in the background. The
+ * template is only rebuilt while serving it when it became invalid: a new
+ * tip, or one of its transactions having left the mempool.
+ */
+class CBlockTemplateEngine : public CValidationInterface
+{
+private:
+    const CChainParams& chainparams;
+    const CScript scriptPubKey;
+
+    //! Guards the members below; taken after cs_main and mempool.cs
+    CCriticalSection cs;
+    //! The template being extended; pindexPrev is NULL until one is asked for, or once too many transactions are pending
+    CBlockTemplate blocktemplate;
+    const CBlockIndex* pindexPrev;
+    std::set<uint256> setInTemplate;
+    //! Copy of blocktemplate last handed out, reset when blocktemplate changes
+    boost::shared_ptr<CBlockTemplate> pblocktemplateServed;
+    //! Transactions that entered the mempool since the template was last updated, at most nMaxPending
+    std::vector<uint256> vPending;
+    const unsigned int nMaxPending;
+    //! Whether a rebuild could include transactions appending could not
+    bool fStale;
+    //! Whether the template was handed out since it was last assembled
+    bool fServed;
+    uint64_t nRebuilds;
+
+    void Rebuild();
+    /** Returns false if the transaction may belong in the block, but could not be appended */
+    bool Append(const uint256& hash, CAmount& nFeesAdded);
+    /** Append the pending transactions to the template on top of the tip; resets pindexPrev if it then fails its checks */
+    void AppendPending();
+    bool AllInMempool() const;
+
+protected:
+    void UpdatedBlockTip(const CBlockIndex* pindex);
+    void SyncTransaction(const CTransaction& tx, const CBlock* pblock);
+
+public:
+    CBlockTemplateEngine(const CChainParams& chainparamsIn, const CScript& scriptPubKeyIn, unsigned int nMaxPendingIn = MAX_BLOCK_TEMPLATE_PENDING);
+    virtual ~CBlockTemplateEngine() {}
+
+    /** The template on top of the current tip; do not modify it, copy it instead */
+    boost::shared_ptr<CBlockTemplate> GetTemplate();
+    /** Assemble the template from scratch, if it has been served and new transactions could improve it */
+    void RebuildIfStale();
+    /** Number of times the template was assembled from scratch */
+    uint64_t GetRebuildCount();
+};
+
+/** Template served by getblocktemplate */
+extern CBlockTemplateEngine* pblocktemplateengine;
+// HFP0 PRF end
+
 /** Run the miner threads */
 void GenerateBitcoins(bool fGenerate, int nThreads, const CChainParams& chainparams);
 /** Generate a new block, without valid proof-of-work */
@@ -49,5 +305,11 @@ CBlockTemplate* CreateNewBlock(const CChainParams& chainparams, const CScript& s
 /** Modify the extranonce in a block */
 void IncrementExtraNonce(CBlock* pblock, const CBlockIndex* pindexPrev, unsigned int& nExtraNonce);
 int64_t UpdateTime(CBlockHeader* pblock, const Consensus::Params& consensusParams, const CBlockIndex* pindexPrev);
+#if HFP0_POW
+// HFP0 POW begin: miner for long-latency PoW
+/** Hashes per second of each internal miner thread, empty if not generating */
+std::vector<double> GetMinerHashesPerSec();
+// HFP0 POW end
+#endif
 
 #endif // BITCOIN_MINER_H
@@ -9,9 +9,12 @@
 #include "arith_uint256.h"
 #include "chain.h"
 #include "primitives/block.h"
+#include "sync.h"
 #include "uint256.h"
 #include "util.h"
 
+#include <vector>
+
 // HFP0 DIF begin: add MIDAS (Multi Interval Difficulty Adjustment System)
 // http://dillingers.com/blog/2015/04/21/altcoin-difficulty-adjustment-with-midas/
 //
@@ -39,7 +42,7 @@ void avgRecentTimestamps(const CBlockIndex* pindexLast, int64_t *avgOf5, int64_t
   for (blockoffset = 0; blockoffset < 17; blockoffset++)
   {
     oldblocktime = blocktime;
-    if (pindexLast)
+    if (pindexLast && pindexLast->pprev) // HFP0 DIF: do not dereference the predecessor of genesis
     {
       pindexLast = pindexLast->pprev;
       blocktime = pindexLast->GetBlockTime();
@@ -61,6 +64,81 @@ void avgRecentTimestamps(const CBlockIndex* pindexLast, int64_t *avgOf5, int64_t
   *avgOf17 /= 17;
 }
 
+// HFP0 DIF begin
+// The interval sums above telescope to the time between pindexLast and its
+// 5th, 7th, 9th and 17th ancestor, which never change for a given block index.
+// Header acceptance, CheckBlockIndex, block templates and the miner ask for
+// them repeatedly for the same parent, so they are kept in the block index.
+// Block indexes are shared between threads (the miner calls UpdateTime
+// without cs_main), hence the lock.
+static CCriticalSection cs_midasCache;
+
+void avgRecentTimestampsCached(const CBlockIndex* pindexLast, int64_t *avgOf5, int64_t *avgOf7, int64_t *avgOf9, int64_t *avgOf17, const Consensus::Params& params)
+{
+    if (pindexLast == NULL) {
+        avgRecentTimestamps(pindexLast, avgOf5, avgOf7, avgOf9, avgOf17, params);
+        return;
+    }
+
+    int64_t sums[4];
+    bool fCached;
+    {
+        LOCK(cs_midasCache);
+        fCached = pindexLast->fMidasIntervalSumsCached;
+        for (unsigned int i = 0; i < 4; i++)
+            sums[i] = pindexLast->nMidasIntervalSums[i];
+    }
+    if (!fCached) {
+        static const int nOffsets[4] = {5, 7, 9, 17};
+        const CBlockIndex* pindex = pindexLast;
+        int64_t blocktime = pindexLast->GetBlockTime();
+        int nOffset = 0;
+        for (unsigned int i = 0; i < 4; i++) {
+            for (; nOffset < nOffsets[i]; nOffset++) {
+                if (pindex->pprev) {
+                    pindex = pindex->pprev;
+                    blocktime = pindex->GetBlockTime();
+                } else {
+                    // genesis block or previous
+                    blocktime -= params.nPowTargetSpacing;
+                }
+            }
+            sums[i] = pindexLast->GetBlockTime() - blocktime;
+        }
+        LOCK(cs_midasCache);
+        for (unsigned int i = 0; i < 4; i++)
+            pindexLast->nMidasIntervalSums[i] = sums[i];
+        pindexLast->fMidasIntervalSumsCached = true;
+    }
+
+    *avgOf5 = sums[0] / 5;
+    *avgOf7 = sums[1] / 7;
+    *avgOf9 = sums[2] / 9;
+    *avgOf17 = sums[3] / 17;
+}
+
+/**
+ * Last block at or before pindexLast that was not mined under the testnet
+ * min-difficulty rule. Every block walked over remembers the answer, so a run
+ * of min-difficulty blocks is only walked once.
+ */
+static const CBlockIndex* GetLastRegularBlockMIDAS(const CBlockIndex* pindexLast, unsigned int nProofOfWorkLimit, const Consensus::Params& params)
+{
+    LOCK(cs_midasCache);
+    std::vector<const CBlockIndex*> vWalked;
+    const CBlockIndex* pindex = pindexLast;
+    while (pindex->pindexMidasLastRegular == NULL && pindex->pprev && pindex->nBits == nProofOfWorkLimit && pindex->nHeight > params.nHFP0ActivateSizeForkHeight) {
+        vWalked.push_back(pindex);
+        pindex = pindex->pprev;
+    }
+    if (pindex->pindexMidasLastRegular != NULL)
+        pindex = pindex->pindexMidasLastRegular;
+    for (unsigned int i = 0; i < vWalked.size(); i++)
+        vWalked[i]->pindexMidasLastRegular = pindex;
+    return pindex;
+}
+// HFP0 DIF end
+
 unsigned int GetNextWorkRequiredMIDAS(const CBlockIndex *pindexLast, const CBlockHeader *pblock, const Consensus::Params& params)
 {
     int64_t avgOf5;
@@ -117,9 +195,7 @@ unsigned int GetNextWorkRequiredMIDAS(const CBlockIndex *pindexLast, const CBloc
         }
         else {
             // Return the last non-special-min-difficulty-rules-block after the fork triggered
-            const CBlockIndex* pindex = pindexLast;
-            while (pindex->pprev && pindex->nBits == nProofOfWorkLimit && pindex->nHeight > params.nHFP0ActivateSizeForkHeight)
-                pindex = pindex->pprev;
+            const CBlockIndex* pindex = GetLastRegularBlockMIDAS(pindexLast, nProofOfWorkLimit, params);    // HFP0 DIF: memoized
             // HFP0 DBG begin
             arith_uint256 dbgBits;
             dbgBits.SetCompact(pindex->nBits);
@@ -173,7 +249,7 @@ unsigned int GetNextWorkRequiredMIDAS(const CBlockIndex *pindexLast, const CBloc
     else  nIntervalDesired = nFastInterval;
 
     // find out what average intervals over last 5, 7, 9, and 17 blocks have been.
-    avgRecentTimestamps(pindexLast, &avgOf5, &avgOf7, &avgOf9, &avgOf17, params);
+    avgRecentTimestampsCached(pindexLast, &avgOf5, &avgOf7, &avgOf9, &avgOf17, params);   // HFP0 DIF: memoized
 
     // check for emergency adjustments. These are to bring the diff up or down FAST when a burst miner or multipool
     // jumps on or off.  Once they kick in they can adjust difficulty very rapidly, and they can kick in very rapidly
@@ -23,6 +23,11 @@ enum DiffMode {
     DIFF_BTC_2016  = 0, // Retarget every 2016 blocks (historic Bitcoin style)
     DIFF_BTC_MIDAS = 1, // after initial HFP0 fork : retarget using MIDAS
 };
+
+/** Average block intervals over the last 5, 7, 9 and 17 blocks, walking back from pindexLast */
+void avgRecentTimestamps(const CBlockIndex* pindexLast, int64_t *avgOf5, int64_t *avgOf7, int64_t *avgOf9, int64_t *avgOf17, const Consensus::Params& params);
+/** Same as avgRecentTimestamps, memoized in the block index */
+void avgRecentTimestampsCached(const CBlockIndex* pindexLast, int64_t *avgOf5, int64_t *avgOf7, int64_t *avgOf9, int64_t *avgOf17, const Consensus::Params& params);
 // HFP0 DIF end
 
 /** Check whether a block hash satisfies the proof-of-work requirement specified by nBits */
@@ -19,16 +19,95 @@
 #if HFP0_POW
 // HFP0 POW begin
 #include "util.h"                              // for LogPrintf
+#include "lrumap.h"
+#include "sync.h"
 
-static std::map<uint256,uint256> hashCache;    // A cache of past modified scrypt hashes performed
+#include <algorithm>
+#include <string.h>
+
+/** Cache key: the full 80-byte header, exactly as fed into the modified scrypt hash */
+struct CPowHashCacheKey
+{
+    unsigned char data[80];
+
+    explicit CPowHashCacheKey(const CBlockHeader& header)
+    {
+        memcpy(data, BEGIN(header.nVersion), sizeof(data));
+    }
+
+    bool operator<(const CPowHashCacheKey& other) const
+    {
+        return memcmp(data, other.data, sizeof(data)) < 0;
+    }
+};
+
+/** A bounded cache of past modified scrypt hashes performed, evicting the least recently used */
+class CPowHashCache
+{
+private:
+    CCriticalSection cs;
+    lrumap<CPowHashCacheKey, uint256> cache;
+    uint64_t nHits;
+    uint64_t nMisses;
+    uint64_t nEvictions;
+
+public:
+    CPowHashCache() : cache(DEFAULT_POWHASHCACHE_SIZE), nHits(0), nMisses(0), nEvictions(0) {}
+
+    bool Get(const CPowHashCacheKey& key, uint256& hash)
+    {
+        LOCK(cs);
+        if (cache.get(key, hash)) {
+            nHits++;
+            return true;
+        }
+        nMisses++;
+        return false;
+    }
+
+    void Insert(const CPowHashCacheKey& key, const uint256& hash)
+    {
+        LOCK(cs);
+        nEvictions += cache.insert(std::make_pair(key, hash));
+    }
+
+    void SetMaxSize(size_t nMaxEntries)
+    {
+        LOCK(cs);
+        nEvictions += cache.max_size(std::max<size_t>(nMaxEntries, 1));
+    }
+
+    CPowHashCacheStats GetStats()
+    {
+        LOCK(cs);
+        CPowHashCacheStats stats;
+        stats.nEntries = cache.size();
+        stats.nMaxEntries = cache.max_size();
+        stats.nHits = nHits;
+        stats.nMisses = nMisses;
+        stats.nEvictions = nEvictions;
+        return stats;
+    }
+};
+
+static CPowHashCache hashCache;
+
+void SetPowHashCacheSize(size_t nMaxEntries)
+{
+    hashCache.SetMaxSize(nMaxEntries);
+}
+
+CPowHashCacheStats GetPowHashCacheStats()
+{
+    return hashCache.GetStats();
+}
 
 uint256 CBlockHeader::GetHash(bool useCache) const
 {
-    uint256 key, returnHash;
-    uint32_t * keyBegin, * hashPrevBlockBegin, * hashMerkleRootBegin;
+    uint256 returnHash;
 
     // HFP0 FRK begin: check block version to decide which POW hash to apply
-    if ((uint32_t)nVersion < (BASE_VERSION + FULL_FORK_VERSION_MIN) || (uint32_t)nVersion > (BASE_VERSION + FULL_FORK_VERSION_MAX)) {
+    if (!UsesModifiedScrypt()) {
         // if not a HFP0 block, return old hash type
         return SerializeHash(*this);
     }
@@ -36,27 +115,17 @@ uint256 CBlockHeader::GetHash(bool useCache) const
 
     // Due to the long hash runtime and the fact that bitcoind requests the
     // same hash multiple times during a block validation, cache previous
-    // hashes and return the cached result if available
+    // hashes and return the cached result if available.
+    // The lock is not held while hashing, so concurrent callers do not wait on each other.
+    CPowHashCacheKey key(*this);
     if ( useCache ) {
-        // Build the search key
-        keyBegin            = (uint32_t *)key.begin();
-        hashPrevBlockBegin  = (uint32_t *)hashPrevBlock.begin();
-        hashMerkleRootBegin = (uint32_t *)hashMerkleRoot.begin();
-        for( int i = 0; i < 8; i++ )
-            keyBegin[i] = hashPrevBlockBegin[i] ^ hashMerkleRootBegin[i];
-        keyBegin[0] ^= nVersion;
-        keyBegin[1] ^= nTime;
-        keyBegin[2] ^= nBits;
-        keyBegin[3] ^= nNonce;
-
-        std::map<uint256,uint256>::iterator search = hashCache.find(key);
-        if(search != hashCache.end()) {
+        if (hashCache.Get(key, returnHash)) {
 #if HFP0_DEBUG_POW
             // HFP0 DBG begin
-            LogPrintf("HFP0 POW GetHash(): Cache hit for %s\n", search->second.GetHex().c_str());
+            LogPrintf("HFP0 POW GetHash(): Cache hit for %s\n", returnHash.GetHex().c_str());
             // HFP0 DBG end
 #endif
-            return search->second;   // Cache hit
+            return returnHash;   // Cache hit
         }
     }
     // No cache hit, compute the hash
@@ -69,7 +138,7 @@ uint256 CBlockHeader::GetHash(bool useCache) const
         LogPrintf("HFP0 POW GetHash(): Cache miss - adding %s\n", returnHash.GetHex().c_str());
         // HFP0 DBG end
 #endif
-        hashCache.insert( std::pair<uint256,uint256>(key,returnHash) );
+        hashCache.Insert(key, returnHash);
     }
 
     return returnHash;
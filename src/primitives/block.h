@@ -86,6 +86,12 @@ public:
 #if HFP0_POW
 // HFP0 POW begin
     uint256 GetHash(bool UseCache = true) const;
+
+    /** Whether GetHash() computes the (slow) modified scrypt hash for this header's version */
+    bool UsesModifiedScrypt() const
+    {
+        return (uint32_t)nVersion >= (BASE_VERSION + FULL_FORK_VERSION_MIN) && (uint32_t)nVersion <= (BASE_VERSION + FULL_FORK_VERSION_MAX);
+    }
 // HFP0 POW end
 #else
     uint256 GetHash() const;
@@ -97,6 +103,27 @@ public:
     }
 };
 
+#if HFP0_POW
+// HFP0 POW begin: bounded, thread-safe PoW hash cache
+/** Default number of entries kept in the modified scrypt hash cache used by CBlockHeader::GetHash */
+static const unsigned int DEFAULT_POWHASHCACHE_SIZE = 50000;
+
+struct CPowHashCacheStats
+{
+    size_t nEntries;
+    size_t nMaxEntries;
+    uint64_t nHits;
+    uint64_t nMisses;
+    uint64_t nEvictions;
+};
+
+/** Set the maximum number of entries in the PoW hash cache, evicting the least recently used if needed */
+void SetPowHashCacheSize(size_t nMaxEntries);
+/** Get the PoW hash cache counters */
+CPowHashCacheStats GetPowHashCacheStats();
+// HFP0 POW end
+#endif
+
 
 class CBlock : public CBlockHeader
 {
@@ -211,9 +211,17 @@ class CTransaction
 private:
     /** Memory only. */
     const uint256 hash;
-    void UpdateHash() const;
 
 public:
+    // HFP0 PRF begin
+    /**
+     * Compute the cached txid. Deserializing with SER_DEFERTXHASH leaves it
+     * null, for the caller to compute, possibly on another thread, before the
+     * transaction is used.
+     */
+    void UpdateHash() const;
+    // HFP0 PRF end
+
     // HFP0 CRY begin: merge 4fea8e741ba38b2c1c4fb1c79962234f711c846e
     // Default transaction version.
     static const int32_t CURRENT_VERSION=1;
@@ -252,7 +260,7 @@ public:
         READWRITE(*const_cast<std::vector<CTxIn>*>(&vin));
         READWRITE(*const_cast<std::vector<CTxOut>*>(&vout));
         READWRITE(*const_cast<uint32_t*>(&nLockTime));
-        if (ser_action.ForRead())
+        if (ser_action.ForRead() && !(nType & SER_DEFERTXHASH))  // HFP0 PRF changed: txid may be deferred
             UpdateHash();
     }
 
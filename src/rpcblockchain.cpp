@@ -13,6 +13,7 @@
 #include "policy/policy.h"
 #include "primitives/transaction.h"
 #include "rpcserver.h"
+#include "script/sigcache.h"  // HFP0 PRF added
 #include "streams.h"
 #include "sync.h"
 #include "txmempool.h"
@@ -79,6 +80,13 @@ UniValue blockheaderToJSON(const CBlockIndex* blockindex)
     result.push_back(Pair("bits", strprintf("%08x", blockindex->nBits)));
     result.push_back(Pair("difficulty", GetDifficulty(blockindex)));
     result.push_back(Pair("chainwork", blockindex->nChainWork.GetHex()));
+    // HFP0 BSZ begin: recorded in the block index, no need to read the block
+    if (blockindex->nStatus & BLOCK_HAVE_SIZE) {
+        result.push_back(Pair("size", (uint64_t)blockindex->nSize));
+        result.push_back(Pair("ntx", (uint64_t)blockindex->nTx));
+        result.push_back(Pair("sigops", (uint64_t)blockindex->nSigOps));
+    }
+    // HFP0 BSZ end
 
     if (blockindex->pprev)
         result.push_back(Pair("previousblockhash", blockindex->pprev->GetBlockHash().GetHex()));
@@ -327,6 +335,9 @@ UniValue getblockheader(const UniValue& params, bool fHelp)
             "  \"previousblockhash\" : \"hash\",  (string) The hash of the previous block\n"
             "  \"nextblockhash\" : \"hash\",      (string) The hash of the next block\n"
             "  \"chainwork\" : \"0000...1f3\"     (string) Expected number of hashes required to produce the current chain (in hex)\n"
+            "  \"size\" : n,            (numeric) The block size, if known\n"
+            "  \"ntx\" : n,             (numeric) The number of transactions in the block, if the size is known\n"
+            "  \"sigops\" : n,          (numeric) The legacy signature operation count of the block, if the size is known\n"
             "}\n"
             "\nResult (for verbose=false):\n"
             "\"data\"             (string) A string that is serialized, hex-encoded data for block 'hash'.\n"
@@ -493,7 +504,6 @@ UniValue gettxout(const UniValue& params, bool fHelp)
             "        ,...\n"
             "     ]\n"
             "  },\n"
-            "  \"version\" : n,            (numeric) The version\n"
             "  \"coinbase\" : true|false   (boolean) Coinbase or not\n"
             "}\n"
 
@@ -517,33 +527,33 @@ UniValue gettxout(const UniValue& params, bool fHelp)
     if (params.size() > 2)
         fMempool = params[2].get_bool();
 
-    CCoins coins;
+    if (n < 0)
+        return NullUniValue;
+    COutPoint out(hash, n);
+
+    Coin coin;
     if (fMempool) {
         LOCK(mempool.cs);
         CCoinsViewMemPool view(pcoinsTip, mempool);
-        if (!view.GetCoins(hash, coins))
+        if (!view.GetCoin(out, coin) || mempool.mapNextTx.count(out))
             return NullUniValue;
-        mempool.pruneSpent(hash, coins); // TODO: this should be done by the CCoinsViewMemPool
     } else {
-        if (!pcoinsTip->GetCoins(hash, coins))
+        if (!pcoinsTip->GetCoin(out, coin))
             return NullUniValue;
     }
-    if (n<0 || (unsigned int)n>=coins.vout.size() || coins.vout[n].IsNull())
-        return NullUniValue;
 
     BlockMap::iterator it = mapBlockIndex.find(pcoinsTip->GetBestBlock());
     CBlockIndex *pindex = it->second;
     ret.push_back(Pair("bestblock", pindex->GetBlockHash().GetHex()));
-    if ((unsigned int)coins.nHeight == MEMPOOL_HEIGHT)
+    if (coin.nHeight == MEMPOOL_HEIGHT)
         ret.push_back(Pair("confirmations", 0));
     else
-        ret.push_back(Pair("confirmations", pindex->nHeight - coins.nHeight + 1));
-    ret.push_back(Pair("value", ValueFromAmount(coins.vout[n].nValue)));
+        ret.push_back(Pair("confirmations", (int64_t)(pindex->nHeight - coin.nHeight + 1)));
+    ret.push_back(Pair("value", ValueFromAmount(coin.out.nValue)));
     UniValue o(UniValue::VOBJ);
-    ScriptPubKeyToJSON(coins.vout[n].scriptPubKey, o, true);
+    ScriptPubKeyToJSON(coin.out.scriptPubKey, o, true);
     ret.push_back(Pair("scriptPubKey", o));
-    ret.push_back(Pair("version", coins.nVersion));
-    ret.push_back(Pair("coinbase", coins.fCoinBase));
+    ret.push_back(Pair("coinbase", (bool)coin.fCoinBase));
 
     return ret;
 }
@@ -668,6 +678,7 @@ UniValue getblockchaininfo(const UniValue& params, bool fHelp)
             "  \"chainwork\": \"xxxx\"     (string) total amount of work in active chain, in hexadecimal\n"
             "  \"pruned\": xx,             (boolean) if the blocks are subject to pruning\n"
             "  \"pruneheight\": xxxxxx,    (numeric) heighest block available\n"
+            "  \"maxblocksize\": xxxxxx,   (numeric) current adaptive maximum block size in bytes\n"
             "  \"softforks\": [            (array) status of softforks in progress\n"
             "     {\n"
             "        \"id\": \"xxxx\",        (string) name of softfork\n"
@@ -713,6 +724,7 @@ UniValue getblockchaininfo(const UniValue& params, bool fHelp)
     obj.push_back(Pair("verificationprogress",  Checkpoints::GuessVerificationProgress(Params().Checkpoints(), chainActive.Tip())));
     obj.push_back(Pair("chainwork",             chainActive.Tip()->nChainWork.GetHex()));
     obj.push_back(Pair("pruned",                fPruneMode));
+    obj.push_back(Pair("maxblocksize",          (uint64_t)maxBlockSize));   // HFP0 BSZ
 
     const Consensus::Params& consensusParams = Params().GetConsensus();
     CBlockIndex* tip = chainActive.Tip();
@@ -852,6 +864,18 @@ UniValue mempoolInfoToJSON()
     size_t maxmempool = GetArg("-maxmempool", DEFAULT_MAX_MEMPOOL_SIZE) * 1000000;
     ret.push_back(Pair("maxmempool", (int64_t) maxmempool));
     ret.push_back(Pair("mempoolminfee", ValueFromAmount(mempool.GetMinFee(maxmempool).GetFeePerK())));
+    // HFP0 PRF begin
+    CScriptCacheStats sigcache = GetSignatureCacheStats();
+    ret.push_back(Pair("sigcacheentries", (int64_t) sigcache.nEntries));
+    ret.push_back(Pair("sigcachecapacity", (int64_t) sigcache.nCapacity));
+    ret.push_back(Pair("sigcachehits", (int64_t) sigcache.nHits));
+    ret.push_back(Pair("sigcachemisses", (int64_t) sigcache.nMisses));
+    ret.push_back(Pair("sigcacheevictions", (int64_t) sigcache.nEvictions));
+    CScriptCacheStats scriptcache = GetScriptExecutionCacheStats();
+    ret.push_back(Pair("scriptcacheentries", (int64_t) scriptcache.nEntries));
+    ret.push_back(Pair("scriptcachehits", (int64_t) scriptcache.nHits));
+    ret.push_back(Pair("scriptcachemisses", (int64_t) scriptcache.nMisses));
+    // HFP0 PRF end
 
     return ret;
 }
@@ -868,7 +892,15 @@ UniValue getmempoolinfo(const UniValue& params, bool fHelp)
             "  \"bytes\": xxxxx,              (numeric) Sum of all tx sizes\n"
             "  \"usage\": xxxxx,              (numeric) Total memory usage for the mempool\n"
             "  \"maxmempool\": xxxxx,         (numeric) Maximum memory usage for the mempool\n"
-            "  \"mempoolminfee\": xxxxx       (numeric) Minimum fee for tx to be accepted\n"
+            "  \"mempoolminfee\": xxxxx,      (numeric) Minimum fee for tx to be accepted\n"
+            "  \"sigcacheentries\": xxxxx,    (numeric) Valid signatures in the signature cache\n"
+            "  \"sigcachecapacity\": xxxxx,   (numeric) Maximum number of signatures the cache holds\n"
+            "  \"sigcachehits\": xxxxx,       (numeric) Signature checks answered from the cache\n"
+            "  \"sigcachemisses\": xxxxx,     (numeric) Signature checks not found in the cache\n"
+            "  \"sigcacheevictions\": xxxxx,  (numeric) Signatures dropped from the cache to make room\n"
+            "  \"scriptcacheentries\": xxxxx, (numeric) Transactions in the script execution cache\n"
+            "  \"scriptcachehits\": xxxxx,    (numeric) Transactions whose scripts were skipped thanks to the cache\n"
+            "  \"scriptcachemisses\": xxxxx   (numeric) Transactions whose scripts had to be run\n"
             "}\n"
             "\nExamples:\n"
             + HelpExampleCli("getmempoolinfo", "")
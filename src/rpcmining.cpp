@@ -9,6 +9,7 @@
 #include "consensus/consensus.h"
 #include "consensus/validation.h"
 #include "core_io.h"
+#include "hash.h"
 #include "init.h"
 #include "main.h"
 #include "miner.h"
@@ -234,6 +235,31 @@ UniValue setgenerate(const UniValue& params, bool fHelp)
     return NullUniValue;
 }
 
+#if HFP0_POW
+// HFP0 POW begin: miner for long-latency PoW
+UniValue gethashespersec(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() != 0)
+        throw runtime_error(
+            "gethashespersec\n"
+            "\nReturns a recent hashes per second performance measurement while generating.\n"
+            "See the getgenerate and setgenerate calls to turn generation on and off.\n"
+            "\nResult:\n"
+            "n            (numeric) The recent hashes per second when generation is on (will return 0 if generation is off)\n"
+            "\nExamples:\n"
+            + HelpExampleCli("gethashespersec", "")
+            + HelpExampleRpc("gethashespersec", "")
+        );
+
+    std::vector<double> vRates = GetMinerHashesPerSec();
+    double dTotal = 0;
+    for (unsigned int i = 0; i < vRates.size(); i++)
+        dTotal += vRates[i];
+    return dTotal;
+}
+// HFP0 POW end
+#endif
+
 UniValue getmininginfo(const UniValue& params, bool fHelp)
 {
     if (fHelp || params.size() != 0)
@@ -252,6 +278,30 @@ UniValue getmininginfo(const UniValue& params, bool fHelp)
             "  \"pooledtx\": n              (numeric) The size of the mem pool\n"
             "  \"testnet\": true|false      (boolean) If using testnet or not\n"
             "  \"chain\": \"xxxx\",         (string) current network name as defined in BIP70 (main, test, regtest)\n"
+            "  \"hashespersec\": n          (numeric) The recent hashes per second of all miner threads (see gethashespersec)\n"
+            "  \"threadhashespersec\": [    (array) The recent hashes per second of each miner thread\n"
+            "     n,                      (numeric)\n"
+            "     ...\n"
+            "  ],\n"
+            "  \"powhashcache\": {          (json object) proof-of-work hash cache statistics\n"
+            "     \"entries\": n,           (numeric) number of cached hashes\n"
+            "     \"maxentries\": n,        (numeric) maximum number of cached hashes\n"
+            "     \"hits\": n,              (numeric) lookups answered from the cache\n"
+            "     \"misses\": n,            (numeric) lookups which required computing the hash\n"
+            "     \"evictions\": n          (numeric) hashes evicted to stay within the size limit\n"
+            "  },\n"
+            "  \"powscratchpads\": {        (json object) proof-of-work hashing memory\n"
+            "     \"max\": n,               (numeric) maximum number of concurrent hashes (-powhashthreads)\n"
+            "     \"allocated\": n,         (numeric) number of 128MB scratchpads allocated\n"
+            "     \"inuse\": n,             (numeric) number of scratchpads currently hashing\n"
+            "     \"kernel\": \"xxxx\",       (string) salsa20/8 implementation in use\n"
+            "     \"pages\": \"xxxx\",        (string) requested page type (-powhugepages)\n"
+            "     \"normal\": n,            (numeric) scratchpads backed by normal pages\n"
+            "     \"transparenthuge\": n,   (numeric) scratchpads advised to use transparent huge pages\n"
+            "     \"huge2m\": n,            (numeric) scratchpads backed by 2MB huge pages\n"
+            "     \"huge1g\": n,            (numeric) scratchpads backed by 1GB huge pages\n"
+            "     \"locked\": n             (numeric) scratchpads locked in memory (-powmlock)\n"
+            "  }\n"
             "}\n"
             "\nExamples:\n"
             + HelpExampleCli("getmininginfo", "")
@@ -273,6 +323,44 @@ UniValue getmininginfo(const UniValue& params, bool fHelp)
     obj.push_back(Pair("testnet",          Params().TestnetToBeDeprecatedFieldRPC()));
     obj.push_back(Pair("chain",            Params().NetworkIDString()));
     obj.push_back(Pair("generate",         getgenerate(params, false)));
+#if HFP0_POW
+    // HFP0 POW begin: miner for long-latency PoW
+    std::vector<double> vRates = GetMinerHashesPerSec();
+    UniValue rates(UniValue::VARR);
+    double dTotalRate = 0;
+    for (unsigned int i = 0; i < vRates.size(); i++) {
+        rates.push_back(vRates[i]);
+        dTotalRate += vRates[i];
+    }
+    obj.push_back(Pair("hashespersec",     dTotalRate));
+    obj.push_back(Pair("threadhashespersec", rates));
+    // HFP0 POW end
+    // HFP0 POW begin: bounded, thread-safe PoW hash cache
+    CPowHashCacheStats cacheStats = GetPowHashCacheStats();
+    UniValue powcache(UniValue::VOBJ);
+    powcache.push_back(Pair("entries",     (uint64_t)cacheStats.nEntries));
+    powcache.push_back(Pair("maxentries",  (uint64_t)cacheStats.nMaxEntries));
+    powcache.push_back(Pair("hits",        cacheStats.nHits));
+    powcache.push_back(Pair("misses",      cacheStats.nMisses));
+    powcache.push_back(Pair("evictions",   cacheStats.nEvictions));
+    obj.push_back(Pair("powhashcache",     powcache));
+    // HFP0 POW end
+    // HFP0 POW begin: huge page / mlock backed scratchpads
+    CScryptScratchpadStats padStats = GetModifiedScryptScratchpadStats();
+    UniValue pads(UniValue::VOBJ);
+    pads.push_back(Pair("max",             padStats.nMax));
+    pads.push_back(Pair("allocated",       padStats.nAllocated));
+    pads.push_back(Pair("inuse",           padStats.nInUse));
+    pads.push_back(Pair("kernel",          crypto_scrypt_smix_kernel()));
+    pads.push_back(Pair("pages",           PowHugePagesModeName(padStats.requestedMode)));
+    pads.push_back(Pair("normal",          padStats.nBacking[POW_HUGEPAGES_NONE]));
+    pads.push_back(Pair("transparenthuge", padStats.nBacking[POW_HUGEPAGES_TRANSPARENT]));
+    pads.push_back(Pair("huge2m",          padStats.nBacking[POW_HUGEPAGES_2M]));
+    pads.push_back(Pair("huge1g",          padStats.nBacking[POW_HUGEPAGES_1G]));
+    pads.push_back(Pair("locked",          padStats.nLocked));
+    obj.push_back(Pair("powscratchpads",   pads));
+    // HFP0 POW end
+#endif
     return obj;
 }
 
@@ -498,35 +586,18 @@ UniValue getblocktemplate(const UniValue& params, bool fHelp)
     }
 
     // Update block
-    static CBlockIndex* pindexPrev;
-    static int64_t nStart;
-    static CBlockTemplate* pblocktemplate;
-    if (pindexPrev != chainActive.Tip() ||
-        (mempool.GetTransactionsUpdated() != nTransactionsUpdatedLast && GetTime() - nStart > 5))
-    {
-        // Clear pindexPrev so future calls make a new block, despite any failures from here on
-        pindexPrev = NULL;
-
-        // Store the pindexBest used before CreateNewBlock, to avoid races
-        nTransactionsUpdatedLast = mempool.GetTransactionsUpdated();
-        CBlockIndex* pindexPrevNew = chainActive.Tip();
-        nStart = GetTime();
-
-        // Create new block
-        if(pblocktemplate)
-        {
-            delete pblocktemplate;
-            pblocktemplate = NULL;
-        }
-        CScript scriptDummy = CScript() << OP_TRUE;
-        pblocktemplate = CreateNewBlock(Params(), scriptDummy);
-        if (!pblocktemplate)
-            throw JSONRPCError(RPC_OUT_OF_MEMORY, "Out of memory");
-
-        // Need to update only after we know CreateNewBlock succeeded
-        pindexPrev = pindexPrevNew;
-    }
-    CBlock* pblock = &pblocktemplate->block; // pointer for convenience
+    // HFP0 PRF begin: served by the template engine, which keeps it up to date
+    // with the mempool; the template is shared, so the time and nonce are set
+    // on a copy of the header
+    if (!pblocktemplateengine)
+        throw JSONRPCError(RPC_INTERNAL_ERROR, "Block template engine not running");
+    nTransactionsUpdatedLast = mempool.GetTransactionsUpdated();
+    CBlockIndex* pindexPrev = chainActive.Tip();
+    boost::shared_ptr<CBlockTemplate> pblocktemplate = pblocktemplateengine->GetTemplate();
+    const std::vector<CTransaction>& vtx = pblocktemplate->block.vtx;
+    CBlockHeader header = pblocktemplate->block.GetBlockHeader();
+    CBlockHeader* pblock = &header; // pointer for convenience
+    // HFP0 PRF end
 
     // Update nTime
     UpdateTime(pblock, Params().GetConsensus(), pindexPrev);
@@ -537,7 +608,7 @@ UniValue getblocktemplate(const UniValue& params, bool fHelp)
     UniValue transactions(UniValue::VARR);
     map<uint256, int64_t> setTxIndex;
     int i = 0;
-    BOOST_FOREACH (const CTransaction& tx, pblock->vtx) {
+    BOOST_FOREACH (const CTransaction& tx, vtx) {  // HFP0 PRF changed: vtx of the shared template
         uint256 txHash = tx.GetHash();
         setTxIndex[txHash] = i++;
 
@@ -584,7 +655,7 @@ UniValue getblocktemplate(const UniValue& params, bool fHelp)
     result.push_back(Pair("previousblockhash", pblock->hashPrevBlock.GetHex()));
     result.push_back(Pair("transactions", transactions));
     result.push_back(Pair("coinbaseaux", aux));
-    result.push_back(Pair("coinbasevalue", (int64_t)pblock->vtx[0].vout[0].nValue));
+    result.push_back(Pair("coinbasevalue", (int64_t)vtx[0].vout[0].nValue));  // HFP0 PRF changed: vtx of the shared template
     result.push_back(Pair("longpollid", chainActive.Tip()->GetBlockHash().GetHex() + i64tostr(nTransactionsUpdatedLast)));
     result.push_back(Pair("target", hashTarget.GetHex()));
     result.push_back(Pair("mintime", (int64_t)pindexPrev->GetMedianTimePast()+1));
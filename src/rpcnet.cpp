@@ -16,6 +16,7 @@
 #include "util.h"
 #include "utilstrencodings.h"
 #include "version.h"
+#include "xthinblocks.h"        // HFP0 XTB added
 
 #include <boost/foreach.hpp>
 
@@ -488,6 +489,7 @@ UniValue getnetworkinfo(const UniValue& params, bool fHelp)
     }
     obj.push_back(Pair("localaddresses", localAddresses));
     obj.push_back(Pair("warnings",       GetWarnings("statusbar")));
+    obj.push_back(Pair("thinblockstats", thinBlockStats.ToString()));   // HFP0 XTB added
     return obj;
 }
 
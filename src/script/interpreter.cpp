@@ -1107,7 +1107,112 @@ public:
 
 } // anon namespace
 
-uint256 SignatureHash(const CScript& scriptCode, const CTransaction& txTo, unsigned int nIn, int nHashType, size_t* nHashedOut)
+// HFP0 PRF begin
+namespace {
+
+/** Stream that appends serialized data to a byte vector */
+class CByteVectorWriter
+{
+private:
+    std::vector<unsigned char>& vch;
+
+public:
+    int nType;
+    int nVersion;
+
+    CByteVectorWriter(std::vector<unsigned char>& vchIn, int nTypeIn, int nVersionIn) : vch(vchIn), nType(nTypeIn), nVersion(nVersionIn) {}
+
+    CByteVectorWriter& write(const char* pch, size_t size)
+    {
+        vch.insert(vch.end(), (const unsigned char*)pch, (const unsigned char*)pch + size);
+        return (*this);
+    }
+
+    template<typename T>
+    CByteVectorWriter& operator<<(const T& obj)
+    {
+        ::Serialize(*this, obj, nType, nVersion);
+        return (*this);
+    }
+};
+
+/** Like CHashWriter, but resuming from a SHA256 midstate */
+class CMidstateHashWriter
+{
+private:
+    CSHA256 ctx;
+    size_t nBytesHashed;
+
+public:
+    int nType;
+    int nVersion;
+
+    CMidstateHashWriter(const CSHA256& midstate, int nTypeIn, int nVersionIn) : ctx(midstate), nBytesHashed(0), nType(nTypeIn), nVersion(nVersionIn) {}
+
+    CMidstateHashWriter& write(const char* pch, size_t size)
+    {
+        ctx.Write((const unsigned char*)pch, size);
+        nBytesHashed += size;
+        return (*this);
+    }
+
+    template<typename T>
+    CMidstateHashWriter& operator<<(const T& obj)
+    {
+        ::Serialize(*this, obj, nType, nVersion);
+        return (*this);
+    }
+
+    //! Double SHA256, as CHash256; invalidates the object
+    uint256 GetHash()
+    {
+        unsigned char buf[CSHA256::OUTPUT_SIZE];
+        ctx.Finalize(buf);
+        uint256 result;
+        CSHA256().Write(buf, sizeof(buf)).Finalize(result.begin());
+        return result;
+    }
+
+    size_t GetNumBytesHashed() const { return nBytesHashed; }
+};
+
+} // anon namespace
+
+PrecomputedSighashData::PrecomputedSighashData(const CTransaction& txTo) : ptxTo(&txTo)
+{
+    // An input index past the end blanks the scripts of all inputs
+    const CScript scriptEmpty;
+    CTransactionSignatureSerializer txBlank(txTo, scriptEmpty, txTo.vin.size(), SIGHASH_ALL);
+
+    std::vector<unsigned char> vchHead;
+    CByteVectorWriter head(vchHead, SER_GETHASH, 0);
+    head << txTo.nVersion;
+    ::WriteCompactSize(head, txTo.vin.size());
+    nHeadSize = vchHead.size();
+
+    CSHA256 ctx;
+    ctx.Write(begin_ptr(vchHead), vchHead.size());
+    CByteVectorWriter inputs(vchInputs, SER_GETHASH, 0);
+    vMidstates.reserve(txTo.vin.size());
+    vInputOffsets.reserve(txTo.vin.size() + 1);
+    for (unsigned int i = 0; i < txTo.vin.size(); i++) {
+        vMidstates.push_back(ctx);
+        vInputOffsets.push_back(vchInputs.size());
+        txBlank.SerializeInput(inputs, i, SER_GETHASH, 0);
+        ctx.Write(begin_ptr(vchInputs) + vInputOffsets.back(), vchInputs.size() - vInputOffsets.back());
+    }
+    vInputOffsets.push_back(vchInputs.size());
+
+    CByteVectorWriter tail(vchTail, SER_GETHASH, 0);
+    ::WriteCompactSize(tail, txTo.vout.size());
+    for (unsigned int i = 0; i < txTo.vout.size(); i++)
+        txBlank.SerializeOutput(tail, i, SER_GETHASH, 0);
+    tail << txTo.nLockTime;
+}
+// HFP0 PRF end
+
+uint256 SignatureHash(const CScript& scriptCode, const CTransaction& txTo, unsigned int nIn, int nHashType, size_t* nHashedOut,
+                      const PrecomputedSighashData* precomputed)
 {
     static const uint256 one(uint256S("0000000000000000000000000000000000000000000000000000000000000001"));
     if (nIn >= txTo.vin.size()) {
@@ -1126,6 +1231,23 @@ uint256 SignatureHash(const CScript& scriptCode, const CTransaction& txTo, unsig
     // Wrapper to serialize only the necessary parts of the transaction being signed
     CTransactionSignatureSerializer txTmp(txTo, scriptCode, nIn, nHashType);
 
+    // HFP0 PRF begin
+    // Without SIGHASH_NONE, SIGHASH_SINGLE or SIGHASH_ANYONECANPAY, only the
+    // input being signed differs from the precomputed serialization.
+    if (precomputed && precomputed->ptxTo == &txTo &&
+        !(nHashType & SIGHASH_ANYONECANPAY) && (nHashType & 0x1f) != SIGHASH_NONE && (nHashType & 0x1f) != SIGHASH_SINGLE) {
+        const size_t nRestOffset = precomputed->vInputOffsets[nIn + 1];
+        CMidstateHashWriter ss(precomputed->vMidstates[nIn], SER_GETHASH, 0);
+        txTmp.SerializeInput(ss, nIn, SER_GETHASH, 0);
+        ss.write((const char*)begin_ptr(precomputed->vchInputs) + nRestOffset, precomputed->vchInputs.size() - nRestOffset);
+        ss.write((const char*)begin_ptr(precomputed->vchTail), precomputed->vchTail.size());
+        ss << nHashType;
+        if (nHashedOut != NULL)
+            *nHashedOut = precomputed->nHeadSize + precomputed->vInputOffsets[nIn] + ss.GetNumBytesHashed();
+        return ss.GetHash();
+    }
+    // HFP0 PRF end
+
     // Serialize and hash
     CHashWriter ss(SER_GETHASH, 0);
     ss << txTmp << nHashType;
@@ -1154,7 +1276,7 @@ bool TransactionSignatureChecker::CheckSig(const vector<unsigned char>& vchSigIn
     vchSig.pop_back();
 
     size_t nHashed = 0;
-    uint256 sighash = SignatureHash(scriptCode, *txTo, nIn, nHashType, &nHashed);
+    uint256 sighash = SignatureHash(scriptCode, *txTo, nIn, nHashType, &nHashed, precomputed);  // HFP0 PRF changed
     nBytesHashed += nHashed;
     ++nSigops;
 
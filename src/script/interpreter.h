@@ -8,6 +8,7 @@
 
 #include "script_error.h"
 #include "primitives/transaction.h"
+#include "crypto/sha256.h"  // HFP0 PRF added
 
 #include <vector>
 #include <stdint.h>
@@ -90,7 +91,39 @@ enum
 
 bool CheckSignatureEncoding(const std::vector<unsigned char> &vchSig, unsigned int flags, ScriptError* serror);
 
-uint256 SignatureHash(const CScript &scriptCode, const CTransaction& txTo, unsigned int nIn, int nHashType, size_t* nHashedOut=NULL);
+// HFP0 PRF begin
+/**
+ * The parts of the legacy SIGHASH_ALL signature hash of a transaction that are
+ * the same for all its inputs: the SHA256 state after the preimage up to each
+ * input, and the serialized inputs (with blanked scripts), outputs and lock
+ * time that follow. Built once per transaction; being immutable afterwards, it
+ * can be shared by the signature checks of all inputs on any thread.
+ * SignatureHash returns the same hash, and counts the same number of bytes
+ * hashed, with or without it.
+ */
+class PrecomputedSighashData
+{
+private:
+    friend uint256 SignatureHash(const CScript &scriptCode, const CTransaction& txTo, unsigned int nIn, int nHashType, size_t* nHashedOut, const PrecomputedSighashData* precomputed);
+
+    const CTransaction* ptxTo;
+    //! Size of the version and input count that start the preimage
+    size_t nHeadSize;
+    //! vMidstates[i]: SHA256 of the preimage up to input i
+    std::vector<CSHA256> vMidstates;
+    //! All inputs serialized with blank scripts; input i starts at vInputOffsets[i]
+    std::vector<unsigned char> vchInputs;
+    std::vector<size_t> vInputOffsets;
+    //! The outputs and lock time
+    std::vector<unsigned char> vchTail;
+
+public:
+    explicit PrecomputedSighashData(const CTransaction& txTo);
+};
+
+uint256 SignatureHash(const CScript &scriptCode, const CTransaction& txTo, unsigned int nIn, int nHashType, size_t* nHashedOut=NULL,
+                      const PrecomputedSighashData* precomputed=NULL);  // HFP0 PRF changed: added precomputed
+// HFP0 PRF end
 
 class BaseSignatureChecker
 {
@@ -122,12 +155,14 @@ private:
     unsigned int nIn;
     mutable size_t nBytesHashed;
     mutable size_t nSigops;
+    const PrecomputedSighashData* precomputed;  // HFP0 PRF added
 
 protected:
     virtual bool VerifySignature(const std::vector<unsigned char>& vchSig, const CPubKey& vchPubKey, const uint256& sighash) const;
 
 public:
-    TransactionSignatureChecker(const CTransaction* txToIn, unsigned int nInIn) : txTo(txToIn), nIn(nInIn), nBytesHashed(0), nSigops(0) {}
+    TransactionSignatureChecker(const CTransaction* txToIn, unsigned int nInIn, const PrecomputedSighashData* precomputedIn = NULL) :
+        txTo(txToIn), nIn(nInIn), nBytesHashed(0), nSigops(0), precomputed(precomputedIn) {}  // HFP0 PRF changed: added precomputed
     bool CheckSig(const std::vector<unsigned char>& scriptSig, const std::vector<unsigned char>& vchPubKey, const CScript& scriptCode) const;
     bool CheckLockTime(const CScriptNum& nLockTime) const;
     size_t GetBytesHashed() const { return nBytesHashed; }
@@ -5,26 +5,145 @@
 
 #include "sigcache.h"
 
-#include "memusage.h"
+#include "crypto/common.h"  // HFP0 PRF added
 #include "pubkey.h"
 #include "random.h"
 #include "uint256.h"
 #include "util.h"
 
-#include <boost/thread.hpp>
-#include <boost/unordered_set.hpp>
+#include <utility>
+
+#include <boost/atomic.hpp>
+#include <boost/thread/locks.hpp>
+#include <boost/thread/mutex.hpp>
 
 namespace {
 
 /**
- * We're hashing a nonce into the entries themselves, so we don't need extra
- * blinding in the set hash computation.
+ * HFP0 PRF: a fixed table of salted hashes, each with a Value, split into
+ * shards with a lock each, so that the script check threads rarely wait on
+ * one another. An entry can only live in one bucket of WAYS slots; inserting
+ * into a full bucket overwrites one of them, which bounds both memory and
+ * the cost of eviction.
  */
-class CSignatureCacheHasher
+template <typename Value>
+class CShardedCache
 {
+private:
+    //! Number of independently locked parts of the table
+    static const unsigned int SHARDS = 64;
+    //! Number of slots an entry can be stored in
+    static const unsigned int WAYS = 4;
+
+    //! sizeof(Slot) is 33 bytes for the signature cache, 40 for the script execution cache
+    typedef std::pair<uint256, Value> Slot;
+
+    struct Shard {
+        boost::mutex mutex;
+        //! nBuckets * WAYS entries, with a null hash when free
+        std::vector<Slot> vSlots;
+        size_t nBuckets;
+        //! Slot of a full bucket to overwrite next
+        unsigned int nNextVictim;
+
+        Shard() : nBuckets(0), nNextVictim(0) {}
+    };
+
+    Shard shards[SHARDS];
+
+    boost::atomic<uint64_t> nEntries;
+    boost::atomic<uint64_t> nCapacity;
+    boost::atomic<uint64_t> nHits;
+    boost::atomic<uint64_t> nMisses;
+    boost::atomic<uint64_t> nEvictions;
+
+    //! Entries are uniformly distributed, so their bits pick the shard and bucket directly
+    Shard& Locate(const uint256& entry, size_t& nBucket)
+    {
+        uint64_t nHash = entry.GetCheapHash();
+        Shard& shard = shards[nHash % SHARDS];
+        nBucket = shard.nBuckets ? (nHash / SHARDS) % shard.nBuckets : 0;
+        return shard;
+    }
+
 public:
-    size_t operator()(const uint256& key) const {
-        return key.GetCheapHash();
+    CShardedCache() : nEntries(0), nCapacity(0), nHits(0), nMisses(0), nEvictions(0) {}
+
+    //! Replace the table by an empty one of at most nMaxBytes, and reset the counters
+    void Resize(size_t nMaxBytes)
+    {
+        size_t nBuckets = nMaxBytes / (SHARDS * WAYS * sizeof(Slot));
+        for (unsigned int i = 0; i < SHARDS; i++) {
+            boost::unique_lock<boost::mutex> lock(shards[i].mutex);
+            std::vector<Slot>(nBuckets * WAYS).swap(shards[i].vSlots);
+            shards[i].nBuckets = nBuckets;
+        }
+        nEntries = 0;
+        nCapacity = (uint64_t)nBuckets * WAYS * SHARDS;
+        nHits = 0;
+        nMisses = 0;
+        nEvictions = 0;
+    }
+
+    /** Look an entry up, and remove it if it is not to be kept around */
+    bool
+    Get(const uint256& entry, Value& value, bool fErase)
+    {
+        size_t nBucket;
+        Shard& shard = Locate(entry, nBucket);
+        {
+            boost::unique_lock<boost::mutex> lock(shard.mutex);
+            for (size_t i = nBucket * WAYS; i < (nBucket + 1) * WAYS && i < shard.vSlots.size(); i++) {
+                if (shard.vSlots[i].first == entry) {
+                    value = shard.vSlots[i].second;
+                    if (fErase) {
+                        shard.vSlots[i].first.SetNull();
+                        nEntries--;
+                    }
+                    nHits++;
+                    return true;
+                }
+            }
+        }
+        nMisses++;
+        return false;
+    }
+
+    void Set(const uint256& entry, const Value& value)
+    {
+        size_t nBucket;
+        Shard& shard = Locate(entry, nBucket);
+        boost::unique_lock<boost::mutex> lock(shard.mutex);
+        if (shard.vSlots.empty())
+            return;
+        Slot* pbucket = &shard.vSlots[nBucket * WAYS];
+        for (unsigned int i = 0; i < WAYS; i++) {
+            if (pbucket[i].first == entry) {
+                pbucket[i].second = value;
+                return;
+            }
+        }
+        for (unsigned int i = 0; i < WAYS; i++) {
+            if (pbucket[i].first.IsNull()) {
+                pbucket[i] = Slot(entry, value);
+                nEntries++;
+                return;
+            }
+        }
+        pbucket[shard.nNextVictim] = Slot(entry, value);
+        shard.nNextVictim = (shard.nNextVictim + 1) % WAYS;
+        nEvictions++;
+    }
+
+    CScriptCacheStats GetStats() const
+    {
+        CScriptCacheStats stats;
+        stats.nEntries = nEntries;
+        stats.nCapacity = nCapacity;
+        stats.nHits = nHits;
+        stats.nMisses = nMisses;
+        stats.nEvictions = nEvictions;
+        return stats;
     }
 };
 
@@ -38,12 +157,10 @@ class CSignatureCache
 private:
      //! Entries are SHA256(nonce || signature hash || public key || signature):
     uint256 nonce;
-    typedef boost::unordered_set<uint256, CSignatureCacheHasher> map_type;
-    map_type setValid;
-    boost::shared_mutex cs_sigcache;
-
 
 public:
+    CShardedCache<unsigned char> setValid;  // HFP0 PRF changed: the value is unused
+
     CSignatureCache()
     {
         GetRandBytes(nonce.begin(), 32);
@@ -54,60 +171,112 @@ public:
     {
         CSHA256().Write(nonce.begin(), 32).Write(hash.begin(), 32).Write(&pubkey[0], pubkey.size()).Write(&vchSig[0], vchSig.size()).Finalize(entry.begin());
     }
+};
 
-    bool
-    Get(const uint256& entry)
+CSignatureCache& GetSignatureCache()
+{
+    static CSignatureCache signatureCache;
+    return signatureCache;
+}
+
+// HFP0 PRF begin
+/**
+ * Transactions whose scripts all passed with a set of verification flags,
+ * with the sigops and signature hash bytes that took.
+ */
+class CScriptExecutionCache
+{
+private:
+    //! Entries are SHA256(nonce || txid || flags)
+    uint256 nonce;
+
+public:
+    CShardedCache<std::pair<uint32_t, uint32_t> > mapValid;
+
+    CScriptExecutionCache()
     {
-        boost::shared_lock<boost::shared_mutex> lock(cs_sigcache);
-        return setValid.count(entry);
+        GetRandBytes(nonce.begin(), 32);
     }
 
-    void Erase(const uint256& entry)
+    void
+    ComputeEntry(uint256& entry, const uint256& txid, unsigned int flags)
     {
-        boost::unique_lock<boost::shared_mutex> lock(cs_sigcache);
-        setValid.erase(entry);
+        unsigned char vchFlags[4];
+        WriteLE32(vchFlags, flags);
+        CSHA256().Write(nonce.begin(), 32).Write(txid.begin(), 32).Write(vchFlags, sizeof(vchFlags)).Finalize(entry.begin());
     }
+};
 
-    void Set(const uint256& entry)
-    {
-        size_t nMaxCacheSize = GetArg("-maxsigcachesize", DEFAULT_MAX_SIG_CACHE_SIZE) * ((size_t) 1 << 20);
-        if (nMaxCacheSize <= 0) return;
+CScriptExecutionCache& GetScriptExecutionCache()
+{
+    static CScriptExecutionCache scriptExecutionCache;
+    return scriptExecutionCache;
+}
+// HFP0 PRF end
 
-        boost::unique_lock<boost::shared_mutex> lock(cs_sigcache);
-        while (memusage::DynamicUsage(setValid) > nMaxCacheSize)
-        {
-            map_type::size_type s = GetRand(setValid.bucket_count());
-            map_type::local_iterator it = setValid.begin(s);
-            if (it != setValid.end(s)) {
-                setValid.erase(*it);
-            }
-        }
+}
 
-        setValid.insert(entry);
-    }
-};
+void InitSignatureCache()
+{
+    int64_t nMaxSize = GetArg("-maxsigcachesize", DEFAULT_MAX_SIG_CACHE_SIZE);
+    GetSignatureCache().setValid.Resize(nMaxSize > 0 ? (size_t)nMaxSize << 20 : 0);
+}
 
+CScriptCacheStats GetSignatureCacheStats()
+{
+    return GetSignatureCache().setValid.GetStats();
+}
+
+// HFP0 PRF begin
+void InitScriptExecutionCache()
+{
+    int64_t nMaxSize = GetArg("-maxscriptcachesize", DEFAULT_MAX_SCRIPT_CACHE_SIZE);
+    GetScriptExecutionCache().mapValid.Resize(nMaxSize > 0 ? (size_t)nMaxSize << 20 : 0);
+}
+
+bool GetCachedScriptExecution(const uint256& txid, unsigned int flags, bool fErase, uint32_t& nSigOps, uint32_t& nSighashBytes)
+{
+    CScriptExecutionCache& cache = GetScriptExecutionCache();
+    uint256 entry;
+    cache.ComputeEntry(entry, txid, flags);
+    std::pair<uint32_t, uint32_t> cost;
+    if (!cache.mapValid.Get(entry, cost, fErase))
+        return false;
+    nSigOps = cost.first;
+    nSighashBytes = cost.second;
+    return true;
 }
 
+void CacheScriptExecution(const uint256& txid, unsigned int flags, uint32_t nSigOps, uint32_t nSighashBytes)
+{
+    CScriptExecutionCache& cache = GetScriptExecutionCache();
+    uint256 entry;
+    cache.ComputeEntry(entry, txid, flags);
+    cache.mapValid.Set(entry, std::make_pair(nSigOps, nSighashBytes));
+}
+
+CScriptCacheStats GetScriptExecutionCacheStats()
+{
+    return GetScriptExecutionCache().mapValid.GetStats();
+}
+// HFP0 PRF end
+
 bool CachingTransactionSignatureChecker::VerifySignature(const std::vector<unsigned char>& vchSig, const CPubKey& pubkey, const uint256& sighash) const
 {
-    static CSignatureCache signatureCache;
+    CSignatureCache& signatureCache = GetSignatureCache();
 
     uint256 entry;
     signatureCache.ComputeEntry(entry, sighash, vchSig, pubkey);
 
-    if (signatureCache.Get(entry)) {
-        if (!store) {
-            signatureCache.Erase(entry);
-        }
+    unsigned char unused;
+    if (signatureCache.setValid.Get(entry, unused, !store))  // HFP0 PRF changed: erases in the same lookup
         return true;
-    }
 
     if (!TransactionSignatureChecker::VerifySignature(vchSig, pubkey, sighash))
         return false;
 
     if (store) {
-        signatureCache.Set(entry);
+        signatureCache.setValid.Set(entry, 0);
     }
     return true;
 }
@@ -12,17 +12,55 @@
 
 // DoS prevention: limit cache size to less than 40MB (over 500000
 // entries on 64-bit systems).
+// HFP0 PRF: the cache is a fixed table of 33-byte slots now (a 32-byte hash
+// and a one-byte value), so 40MB holds about 1.27 million of them.
 static const unsigned int DEFAULT_MAX_SIG_CACHE_SIZE = 40;
 
 class CPubKey;
 
+// HFP0 PRF begin
+/** Default for -maxscriptcachesize, in MiB: about 200000 transactions in 40-byte slots */
+static const unsigned int DEFAULT_MAX_SCRIPT_CACHE_SIZE = 8;
+
+/** Usage counters of the signature and script execution caches */
+struct CScriptCacheStats
+{
+    uint64_t nEntries;
+    uint64_t nCapacity;
+    uint64_t nHits;
+    uint64_t nMisses;
+    uint64_t nEvictions;
+};
+
+/** Allocate the signature cache, sized by -maxsigcachesize; until then nothing is cached */
+void InitSignatureCache();
+
+CScriptCacheStats GetSignatureCacheStats();
+
+/** Allocate the script execution cache, sized by -maxscriptcachesize; until then nothing is cached */
+void InitScriptExecutionCache();
+
+/**
+ * Whether all scripts of transaction txid are known to pass with flags, and
+ * if so the sigops and signature hash bytes their checks count. The txid
+ * commits to the spent outputs, so this does not depend on the coins view.
+ */
+bool GetCachedScriptExecution(const uint256& txid, unsigned int flags, bool fErase, uint32_t& nSigOps, uint32_t& nSighashBytes);
+
+/** Remember that all scripts of transaction txid passed with flags */
+void CacheScriptExecution(const uint256& txid, unsigned int flags, uint32_t nSigOps, uint32_t nSighashBytes);
+
+CScriptCacheStats GetScriptExecutionCacheStats();
+// HFP0 PRF end
+
 class CachingTransactionSignatureChecker : public TransactionSignatureChecker
 {
 private:
     bool store;
 
 public:
-    CachingTransactionSignatureChecker(const CTransaction* txToIn, unsigned int nInIn, bool storeIn=true) : TransactionSignatureChecker(txToIn, nInIn), store(storeIn) {}
+    CachingTransactionSignatureChecker(const CTransaction* txToIn, unsigned int nInIn, bool storeIn=true, const PrecomputedSighashData* precomputedIn=NULL) :
+        TransactionSignatureChecker(txToIn, nInIn, precomputedIn), store(storeIn) {}  // HFP0 PRF changed: added precomputed
 
     bool VerifySignature(const std::vector<unsigned char>& vchSig, const CPubKey& vchPubKey, const uint256& sighash) const;
 };
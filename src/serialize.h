@@ -158,6 +158,9 @@ enum
     SER_NETWORK         = (1 << 0),
     SER_DISK            = (1 << 1),
     SER_GETHASH         = (1 << 2),
+
+    // modifiers
+    SER_DEFERTXHASH     = (1 << 3),  // HFP0 PRF added: deserialized transactions leave their txid to CTransaction::UpdateHash
 };
 
 #define READWRITE(obj)      (::SerReadWrite(s, (obj), nType, nVersion, ser_action))
@@ -162,7 +162,6 @@ BOOST_AUTO_TEST_CASE(ComputeBlockSizeWithEverIncreasingBlockSizes)
     unsigned int size = 0;
     median_block_lookback = NUM_BLOCKS_FOR_MEDIAN_TEST;
     TestChainForComputingMediansSetup::AdvanceToBeforeFork();
-    BlockSizeCalculator::ClearBlockSizes();
     // go over the 2MB lower limit
     TestChainForComputingMediansSetup::BuildIncreasingBlocks(10, 2000);
     size = BlockSizeCalculator::ComputeBlockSize(chainActive.Tip(), NUM_BLOCKS_FOR_MEDIAN_TEST);
@@ -171,6 +170,100 @@ BOOST_AUTO_TEST_CASE(ComputeBlockSizeWithEverIncreasingBlockSizes)
     TestChainForComputingMediansSetup::BuildIncreasingBlocks(11, 2000);
     size = BlockSizeCalculator::ComputeBlockSize(chainActive.Tip(), NUM_BLOCKS_FOR_MEDIAN_TEST);
     BOOST_CHECK_EQUAL(size, MAX_BLOCK_SIZE);
+    // HFP0 TST begin: sliding the window back and forth agrees with a full rebuild
+    const int nBack[] = {3, 12, 1, 16, 14, 0};
+    std::vector<unsigned int> vIncremental;
+    for (unsigned int i = 0; i < sizeof(nBack) / sizeof(nBack[0]); i++)
+        vIncremental.push_back(BlockSizeCalculator::ComputeBlockSize(chainActive[chainActive.Height() - nBack[i]], NUM_BLOCKS_FOR_MEDIAN_TEST));
+    BOOST_CHECK_EQUAL(vIncremental.back(), MAX_BLOCK_SIZE);
+    for (unsigned int i = 0; i < sizeof(nBack) / sizeof(nBack[0]); i++) {
+        BlockSizeCalculator::ClearBlockSizes();
+        BOOST_CHECK_EQUAL(BlockSizeCalculator::ComputeBlockSize(chainActive[chainActive.Height() - nBack[i]], NUM_BLOCKS_FOR_MEDIAN_TEST), vIncremental[i]);
+    }
+    // HFP0 TST end
 }
 
+// HFP0 TST begin
+BOOST_AUTO_TEST_CASE(BlockIndexRecordsSize)
+{
+    // size and sigops are recorded when a block is received
+    CScript scriptPubKey = CScript() << ToByteVector(coinbaseKey.GetPubKey()) << OP_CHECKSIG;
+    std::vector<CMutableTransaction> noTxns;
+    CBlock b = CreateAndProcessBlock(noTxns, scriptPubKey);
+    CBlockIndex* pindex = chainActive.Tip();
+    BOOST_CHECK(pindex->GetBlockHash() == b.GetHash());
+    BOOST_CHECK(pindex->nStatus & BLOCK_HAVE_SIZE);
+    BOOST_CHECK_EQUAL(pindex->nSize, ::GetSerializeSize(b, SER_NETWORK, PROTOCOL_VERSION));
+    BOOST_CHECK_EQUAL(pindex->nSigOps, 1U);
+    BOOST_CHECK_EQUAL(pindex->nTx, 1U);
+
+    // and survive the block index database
+    CDataStream ss(SER_DISK, CLIENT_VERSION);
+    ss << CDiskBlockIndex(pindex);
+    size_t nFullSize = ss.size();
+    CDiskBlockIndex diskindex;
+    ss >> diskindex;
+    BOOST_CHECK(ss.empty());
+    BOOST_CHECK_EQUAL(diskindex.nSize, pindex->nSize);
+    BOOST_CHECK_EQUAL(diskindex.nSigOps, pindex->nSigOps);
+
+    // an index entry written without them is still readable
+    CBlockIndex indexOld(*pindex);
+    indexOld.nStatus &= ~BLOCK_HAVE_SIZE;
+    CDataStream ssOld(SER_DISK, CLIENT_VERSION);
+    ssOld << CDiskBlockIndex(&indexOld);
+    BOOST_CHECK(ssOld.size() < nFullSize);
+    CDiskBlockIndex diskindexOld;
+    ssOld >> diskindexOld;
+    BOOST_CHECK(ssOld.empty());
+    BOOST_CHECK(!(diskindexOld.nStatus & BLOCK_HAVE_SIZE));
+    BOOST_CHECK_EQUAL(diskindexOld.nSize, 0U);
+
+    // an entry rewritten by an older version keeps BLOCK_HAVE_SIZE but loses
+    // the fields; the flag is dropped rather than reading past the record
+    CDataStream ssFull(SER_DISK, CLIENT_VERSION);
+    ssFull << CDiskBlockIndex(pindex);
+    CDataStream ssTail(SER_DISK, CLIENT_VERSION);
+    ssTail << VARINT(pindex->nSize) << VARINT(pindex->nSigOps);
+    CDataStream ssDowngraded(ssFull.begin(), ssFull.end() - ssTail.size(), SER_DISK, CLIENT_VERSION);
+    CDiskBlockIndex diskindexDowngraded;
+    ssDowngraded >> diskindexDowngraded;
+    BOOST_CHECK(ssDowngraded.empty());
+    BOOST_CHECK(!(diskindexDowngraded.nStatus & BLOCK_HAVE_SIZE));
+    BOOST_CHECK(diskindexDowngraded.GetBlockHash() == pindex->GetBlockHash());
+}
+
+BOOST_AUTO_TEST_CASE(SlidingMedian)
+{
+    // compare against sorting the multiset on every step
+    BlockSizeCalculator::CSlidingMedian median;
+    std::multiset<unsigned int> ref;
+    BOOST_CHECK_EQUAL(median.Median(), 0U);
+    BOOST_CHECK(!median.Erase(1));
+    for (int i = 0; i < 2000; i++) {
+        unsigned int n = insecure_rand() % 50;
+        if (!ref.empty() && insecure_rand() % 3 == 0) {
+            bool fPresent = ref.count(n) > 0;
+            if (fPresent)
+                ref.erase(ref.find(n));
+            BOOST_CHECK_EQUAL(median.Erase(n), fPresent);
+        } else {
+            ref.insert(n);
+            median.Insert(n);
+        }
+        BOOST_CHECK_EQUAL(median.Size(), ref.size());
+        std::vector<unsigned int> sorted(ref.begin(), ref.end());
+        unsigned int expected = 0;
+        if (!sorted.empty())
+            expected = sorted.size() % 2 ? sorted[sorted.size() / 2] : (sorted[sorted.size() / 2] + sorted[sorted.size() / 2 - 1]) / 2;
+        BOOST_CHECK_EQUAL(median.Median(), expected);
+    }
+    // no overflow when averaging two large sizes
+    median.Clear();
+    median.Insert(std::numeric_limits<unsigned int>::max());
+    median.Insert(std::numeric_limits<unsigned int>::max() - 2);
+    BOOST_CHECK_EQUAL(median.Median(), std::numeric_limits<unsigned int>::max() - 1);
+}
+// HFP0 TST end
+
 BOOST_AUTO_TEST_SUITE_END()
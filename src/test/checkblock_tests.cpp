@@ -3,9 +3,12 @@
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
 #include "clientversion.h"
+#include "consensus/merkle.h"  // HFP0 PRF added
 #include "consensus/validation.h"
 #include "main.h" // For CheckBlock
 #include "primitives/block.h"
+#include "random.h"   // HFP0 PRF added
+#include "streams.h"  // HFP0 PRF added
 #include "test/test_bitcoin.h"
 #include "utiltime.h"
 
@@ -65,4 +68,39 @@ BOOST_AUTO_TEST_CASE(May15)
     SetMockTime(0);
 }
 
+// HFP0 PRF begin
+BOOST_AUTO_TEST_CASE(deferred_txid_hashing)
+{
+    CBlock block;
+    for (unsigned int i = 0; i < 1000; i++) {
+        CMutableTransaction tx;
+        tx.vin.resize(1);
+        tx.vin[0].prevout = COutPoint(GetRandHash(), i);
+        tx.vout.resize(1 + i % 3);
+        tx.vout[0].nValue = i;
+        block.vtx.push_back(tx);
+    }
+    block.hashMerkleRoot = BlockMerkleRoot(block);
+
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    ss << block;
+
+    // Serial and on several threads, the txids come out as computed eagerly
+    int nScriptCheckThreadsSaved = nScriptCheckThreads;
+    for (int nThreads = 0; nThreads <= 4; nThreads += 4) {
+        nScriptCheckThreads = nThreads;
+        CDataStream ssDeferred(ss.begin(), ss.end(), SER_NETWORK | SER_DEFERTXHASH, PROTOCOL_VERSION);
+        CBlock blockDeferred;
+        ssDeferred >> blockDeferred;
+        BOOST_CHECK(blockDeferred.vtx[0].GetHash().IsNull());
+
+        ComputeTransactionHashes(blockDeferred.vtx);
+        for (unsigned int i = 0; i < block.vtx.size(); i++)
+            BOOST_CHECK(blockDeferred.vtx[i].GetHash() == block.vtx[i].GetHash());
+        BOOST_CHECK(BlockMerkleRoot(blockDeferred) == block.hashMerkleRoot);
+    }
+    nScriptCheckThreads = nScriptCheckThreadsSaved;
+}
+// HFP0 PRF end
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,159 @@
+// Copyright (c) 2016 The Bitcoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+// HFP0 PRF added file (entire file): work-stealing check queue
+#include "checkqueue.h"
+
+#include "test/test_bitcoin.h"
+
+#include <vector>
+
+#include <boost/atomic.hpp>
+#include <boost/bind.hpp>
+#include <boost/thread.hpp>
+#include <boost/test/unit_test.hpp>
+
+namespace
+{
+boost::atomic<int> nChecksRun(0);
+
+/** Check that counts its executions and fails when told to. */
+struct CountingCheck {
+    bool fOk;
+    CountingCheck(bool fOkIn = true) : fOk(fOkIn) {}
+
+    bool operator()()
+    {
+        nChecksRun++;
+        return fOk;
+    }
+
+    void swap(CountingCheck& other) { std::swap(fOk, other.fOk); }
+};
+
+struct CheckQueueSetup : public BasicTestingSetup {
+    CCheckQueue<CountingCheck> queue;
+    boost::thread_group threads;
+
+    CheckQueueSetup() : queue(16, 8)
+    {
+        for (int i = 0; i < 7; i++)
+            threads.create_thread(boost::bind(&CCheckQueue<CountingCheck>::Thread, &queue));
+        nChecksRun = 0;
+    }
+
+    ~CheckQueueSetup()
+    {
+        queue.Quit();
+        threads.join_all();
+    }
+
+    void AddChecks(CCheckQueueControl<CountingCheck>& control, int nCount, int nFailAt = -1)
+    {
+        std::vector<CountingCheck> vChecks;
+        for (int i = 0; i < nCount; i++)
+            vChecks.push_back(CountingCheck(i != nFailAt));
+        control.Add(vChecks);
+    }
+};
+}
+
+BOOST_FIXTURE_TEST_SUITE(checkqueue_tests, CheckQueueSetup)
+
+BOOST_AUTO_TEST_CASE(checkqueue_all_checks_run_once)
+{
+    for (int nRound = 0; nRound < 20; nRound++) {
+        nChecksRun = 0;
+        int nTotal = 0;
+        {
+            CCheckQueueControl<CountingCheck> control(&queue);
+            for (int n = 1; n < 200; n += 7) {
+                AddChecks(control, n);
+                nTotal += n;
+            }
+            BOOST_CHECK(control.Wait());
+        }
+        BOOST_CHECK_EQUAL(nChecksRun, nTotal);
+        BOOST_CHECK(queue.IsIdle());
+    }
+}
+
+BOOST_AUTO_TEST_CASE(checkqueue_failure)
+{
+    {
+        CCheckQueueControl<CountingCheck> control(&queue);
+        AddChecks(control, 500, 100);
+        for (int n = 0; n < 50; n++)
+            AddChecks(control, 100);
+        BOOST_CHECK(!control.Wait());
+    }
+    BOOST_CHECK(queue.IsIdle());
+
+    // The failure does not leak into the next use of the queue
+    nChecksRun = 0;
+    {
+        CCheckQueueControl<CountingCheck> control(&queue);
+        AddChecks(control, 300);
+        BOOST_CHECK(control.Wait());
+    }
+    BOOST_CHECK_EQUAL(nChecksRun, 300);
+}
+
+BOOST_AUTO_TEST_CASE(checkqueue_without_workers)
+{
+    CCheckQueue<CountingCheck> single(16, 1);
+    nChecksRun = 0;
+    {
+        CCheckQueueControl<CountingCheck> control(&single);
+        AddChecks(control, 1000);
+        BOOST_CHECK(control.Wait());
+    }
+    BOOST_CHECK_EQUAL(nChecksRun, 1000);
+
+    // More than a batch is queued, so the master runs the newest batch while
+    // adding; the first check fails and everything else is dropped unexecuted.
+    nChecksRun = 0;
+    {
+        CCheckQueueControl<CountingCheck> control(&single);
+        AddChecks(control, 20, 19);
+        BOOST_CHECK_EQUAL(nChecksRun, 1);
+        AddChecks(control, 100);
+        BOOST_CHECK(!control.Wait());
+    }
+    BOOST_CHECK_EQUAL(nChecksRun, 1);
+    BOOST_CHECK(single.IsIdle());
+}
+
+BOOST_AUTO_TEST_CASE(checkqueue_restart_workers)
+{
+    // Workers come and go as often as test fixtures start and stop the
+    // script check threads; their slots must be freed for the next ones.
+    CCheckQueue<CountingCheck> small(16, 3);
+    for (int nRound = 0; nRound < 20; nRound++) {
+        boost::thread_group workers;
+        for (int i = 0; i < 2; i++)
+            workers.create_thread(boost::bind(&CCheckQueue<CountingCheck>::Thread, &small));
+        nChecksRun = 0;
+        {
+            CCheckQueueControl<CountingCheck> control(&small);
+            AddChecks(control, 200);
+            BOOST_CHECK(control.Wait());
+        }
+        BOOST_CHECK_EQUAL(nChecksRun, 200);
+        workers.interrupt_all();
+        workers.join_all();
+    }
+
+    // With all workers gone, the master does the work on its own
+    nChecksRun = 0;
+    {
+        CCheckQueueControl<CountingCheck> control(&small);
+        AddChecks(control, 100);
+        BOOST_CHECK(control.Wait());
+    }
+    BOOST_CHECK_EQUAL(nChecksRun, 100);
+    BOOST_CHECK(small.IsIdle());
+}
+
+BOOST_AUTO_TEST_SUITE_END()
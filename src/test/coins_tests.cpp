@@ -7,6 +7,9 @@
 #include "uint256.h"
 #include "test/test_bitcoin.h"
 #include "main.h"
+#include "script/standard.h"
+#include "txdb.h"
+#include "utilstrencodings.h"
 #include "consensus/validation.h"
 
 #include <vector>
@@ -19,27 +22,27 @@ namespace
 class CCoinsViewTest : public CCoinsView
 {
     uint256 hashBestBlock_;
-    std::map<uint256, CCoins> map_;
+    std::map<COutPoint, Coin> map_;
 
 public:
-    bool GetCoins(const uint256& txid, CCoins& coins) const
+    bool GetCoin(const COutPoint& outpoint, Coin& coin) const
     {
-        std::map<uint256, CCoins>::const_iterator it = map_.find(txid);
+        std::map<COutPoint, Coin>::const_iterator it = map_.find(outpoint);
         if (it == map_.end()) {
             return false;
         }
-        coins = it->second;
-        if (coins.IsPruned() && insecure_rand() % 2 == 0) {
+        coin = it->second;
+        if (coin.IsSpent() && insecure_rand() % 2 == 0) {
             // Randomly return false in case of an empty entry.
             return false;
         }
         return true;
     }
 
-    bool HaveCoins(const uint256& txid) const
+    bool HaveCoin(const COutPoint& outpoint) const
     {
-        CCoins coins;
-        return GetCoins(txid, coins);
+        Coin coin;
+        return GetCoin(outpoint, coin);
     }
 
     uint256 GetBestBlock() const { return hashBestBlock_; }
@@ -49,8 +52,8 @@ public:
         for (CCoinsMap::iterator it = mapCoins.begin(); it != mapCoins.end(); ) {
             if (it->second.flags & CCoinsCacheEntry::DIRTY) {
                 // Same optimization used in CCoinsViewDB is to only write dirty entries.
-                map_[it->first] = it->second.coins;
-                if (it->second.coins.IsPruned() && insecure_rand() % 3 == 0) {
+                map_[it->first] = it->second.coin;
+                if (it->second.coin.IsSpent() && insecure_rand() % 3 == 0) {
                     // Randomly delete empty entries on write.
                     map_.erase(it->first);
                 }
@@ -74,14 +77,48 @@ public:
     {
         // Manually recompute the dynamic usage of the whole data, and compare it.
         size_t ret = memusage::DynamicUsage(cacheCoins);
+        size_t count = 0;
         for (CCoinsMap::iterator it = cacheCoins.begin(); it != cacheCoins.end(); it++) {
-            ret += it->second.coins.DynamicMemoryUsage();
+            ret += it->second.coin.DynamicMemoryUsage();
+            ++count;
         }
+        BOOST_CHECK_EQUAL(GetCacheSize(), count);
         BOOST_CHECK_EQUAL(DynamicMemoryUsage(), ret);
     }
 
 };
 
+/** Coins database which can be seeded with records in the old per-transaction format. */
+class CCoinsViewDBTest : public CCoinsViewDB
+{
+    /** Raw record bytes, written without a length prefix. */
+    struct RawRecord {
+        const std::vector<unsigned char>& data;
+        RawRecord(const std::vector<unsigned char>& dataIn) : data(dataIn) {}
+
+        unsigned int GetSerializeSize(int nType, int nVersion) const { return data.size(); }
+
+        template<typename Stream>
+        void Serialize(Stream& s, int nType, int nVersion) const {
+            s.write((const char*)&data[0], data.size());
+        }
+    };
+
+public:
+    CCoinsViewDBTest() : CCoinsViewDB(1 << 20, true, true) {}
+
+    void WriteLegacyCoins(const uint256& txid, const std::string& strHex)
+    {
+        std::vector<unsigned char> data = ParseHex(strHex);
+        BOOST_CHECK(db.Write(std::make_pair('c', txid), RawRecord(data)));
+    }
+
+    bool HaveLegacyCoins(const uint256& txid) const
+    {
+        return db.Exists(std::make_pair('c', txid));
+    }
+};
+
 }
 
 BOOST_FIXTURE_TEST_SUITE(coins_tests, BasicTestingSetup)
@@ -91,7 +128,7 @@ static const unsigned int NUM_SIMULATION_ITERATIONS = 40000;
 // This is a large randomized insert/remove simulation test on a variable-size
 // stack of caches on top of CCoinsViewTest.
 //
-// It will randomly create/update/delete CCoins entries to a tip of caches, with
+// It will randomly create/update/delete Coin entries to a tip of caches, with
 // txids picked from a limited list of random 256-bit hashes. Occasionally, a
 // new tip is added to the stack of caches, or the tip is flushed and removed.
 //
@@ -103,13 +140,15 @@ BOOST_AUTO_TEST_CASE(coins_cache_simulation_test)
     bool removed_all_caches = false;
     bool reached_4_caches = false;
     bool added_an_entry = false;
+    bool added_an_unspendable_entry = false;
     bool removed_an_entry = false;
     bool updated_an_entry = false;
     bool found_an_entry = false;
     bool missed_an_entry = false;
+    bool uncached_an_entry = false;
 
     // A simple map to track what we expect the cache stack to represent.
-    std::map<uint256, CCoins> result;
+    std::map<COutPoint, Coin> result;
 
     // The cache stack.
     CCoinsViewTest base; // A CCoinsViewTest at the bottom.
@@ -127,36 +166,51 @@ BOOST_AUTO_TEST_CASE(coins_cache_simulation_test)
         // Do a random modification.
         {
             uint256 txid = txids[insecure_rand() % txids.size()]; // txid we're going to modify in this iteration.
-            CCoins& coins = result[txid];
-            CCoinsModifier entry = stack.back()->ModifyCoins(txid);
-            BOOST_CHECK(coins == *entry);
-            if (insecure_rand() % 5 == 0 || coins.IsPruned()) {
-                if (coins.IsPruned()) {
-                    added_an_entry = true;
+            Coin& coin = result[COutPoint(txid, 0)];
+            const Coin& entry = (insecure_rand() % 500 == 0) ? AccessByTxid(*stack.back(), txid) : stack.back()->AccessCoin(COutPoint(txid, 0));
+            BOOST_CHECK(coin == entry);
+
+            if (insecure_rand() % 5 == 0 || coin.IsSpent()) {
+                Coin newcoin;
+                newcoin.out.nValue = insecure_rand();
+                newcoin.nHeight = 1;
+                if (insecure_rand() % 16 == 0 && coin.IsSpent()) {
+                    newcoin.out.scriptPubKey.assign(1 + (insecure_rand() & 0x3F), OP_RETURN);
+                    BOOST_CHECK(newcoin.out.scriptPubKey.IsUnspendable());
+                    added_an_unspendable_entry = true;
                 } else {
-                    updated_an_entry = true;
+                    newcoin.out.scriptPubKey.assign(insecure_rand() & 0x3F, 0); // Random sizes so we can test memory usage accounting
+                    (coin.IsSpent() ? added_an_entry : updated_an_entry) = true;
+                    coin = newcoin;
                 }
-                coins.nVersion = insecure_rand();
-                coins.vout.resize(1);
-                coins.vout[0].nValue = insecure_rand();
-                *entry = coins;
+                stack.back()->AddCoin(COutPoint(txid, 0), newcoin, !coin.IsSpent() || insecure_rand() & 1);
             } else {
-                coins.Clear();
-                entry->Clear();
                 removed_an_entry = true;
+                coin.Clear();
+                stack.back()->SpendCoin(COutPoint(txid, 0));
             }
         }
 
+        // One every 10 iterations, remove a random entry from the cache
+        if (insecure_rand() % 10 == 0) {
+            COutPoint out(txids[insecure_rand() % txids.size()], 0);
+            int cacheid = insecure_rand() % stack.size();
+            stack[cacheid]->Uncache(out);
+            uncached_an_entry |= !stack[cacheid]->HaveCoinInCache(out);
+        }
+
         // Once every 1000 iterations and at the end, verify the full cache.
         if (insecure_rand() % 1000 == 1 || i == NUM_SIMULATION_ITERATIONS - 1) {
-            for (std::map<uint256, CCoins>::iterator it = result.begin(); it != result.end(); it++) {
-                const CCoins* coins = stack.back()->AccessCoins(it->first);
-                if (coins) {
-                    BOOST_CHECK(*coins == it->second);
-                    found_an_entry = true;
-                } else {
-                    BOOST_CHECK(it->second.IsPruned());
+            for (std::map<COutPoint, Coin>::iterator it = result.begin(); it != result.end(); it++) {
+                bool have = stack.back()->HaveCoin(it->first);
+                const Coin& coin = stack.back()->AccessCoin(it->first);
+                BOOST_CHECK(have == !coin.IsSpent());
+                BOOST_CHECK(coin == it->second);
+                if (coin.IsSpent()) {
                     missed_an_entry = true;
+                } else {
+                    BOOST_CHECK(stack.back()->HaveCoinInCache(it->first));
+                    found_an_entry = true;
                 }
             }
             BOOST_FOREACH(const CCoinsViewCacheTest *test, stack) {
@@ -205,10 +259,12 @@ BOOST_AUTO_TEST_CASE(coins_cache_simulation_test)
     BOOST_CHECK(removed_all_caches);
     BOOST_CHECK(reached_4_caches);
     BOOST_CHECK(added_an_entry);
+    BOOST_CHECK(added_an_unspendable_entry);
     BOOST_CHECK(removed_an_entry);
     BOOST_CHECK(updated_an_entry);
     BOOST_CHECK(found_an_entry);
     BOOST_CHECK(missed_an_entry);
+    BOOST_CHECK(uncached_an_entry);
 }
 
 // This test is similar to the previous test
@@ -220,7 +276,7 @@ BOOST_AUTO_TEST_CASE(updatecoins_simulation_test)
 {
     bool spent_a_duplicate_coinbase = false;
     // A simple map to track what we expect the cache stack to represent.
-    std::map<uint256, CCoins> result;
+    std::map<COutPoint, Coin> result;
 
     // The cache stack.
     CCoinsViewTest base; // A CCoinsViewTest at the bottom.
@@ -238,7 +294,7 @@ BOOST_AUTO_TEST_CASE(updatecoins_simulation_test)
             tx.vin.resize(1);
             tx.vout.resize(1);
             tx.vout[0].nValue = i; //Keep txs unique unless intended to duplicate
-            unsigned int height = insecure_rand();
+            unsigned int height = insecure_rand() & 0x7FFFFFFF;
 
             // 1/10 times create a coinbase
             if (insecure_rand() % 10 == 0 || coinbaseids.size() < 10) {
@@ -273,8 +329,7 @@ BOOST_AUTO_TEST_CASE(updatecoins_simulation_test)
                 tx.vin[0].prevout.n = 0;
 
                 // Update the expected result of prevouthash to know these coins are spent
-                CCoins& oldcoins = result[prevouthash];
-                oldcoins.Clear();
+                result[tx.vin[0].prevout].Clear();
 
                 // It is of particular importance here that once we spend a coinbase tx hash
                 // it is no longer available to be duplicated (or spent again)
@@ -294,8 +349,7 @@ BOOST_AUTO_TEST_CASE(updatecoins_simulation_test)
             alltxids.insert(tx.GetHash());
 
             // Update the expected result to know about the new output coins
-            CCoins &coins = result[tx.GetHash()];
-            coins.FromTx(tx, height);
+            result[COutPoint(tx.GetHash(), 0)] = Coin(tx.vout[0], height, CTransaction(tx).IsCoinBase());
 
             CValidationState dummy;
             UpdateCoins(tx, dummy, *(stack.back()), height);
@@ -303,13 +357,11 @@ BOOST_AUTO_TEST_CASE(updatecoins_simulation_test)
 
         // Once every 1000 iterations and at the end, verify the full cache.
         if (insecure_rand() % 1000 == 1 || i == NUM_SIMULATION_ITERATIONS - 1) {
-            for (std::map<uint256, CCoins>::iterator it = result.begin(); it != result.end(); it++) {
-                const CCoins* coins = stack.back()->AccessCoins(it->first);
-                if (coins) {
-                    BOOST_CHECK(*coins == it->second);
-                 } else {
-                    BOOST_CHECK(it->second.IsPruned());
-                 }
+            for (std::map<COutPoint, Coin>::iterator it = result.begin(); it != result.end(); it++) {
+                bool have = stack.back()->HaveCoin(it->first);
+                const Coin& coin = stack.back()->AccessCoin(it->first);
+                BOOST_CHECK(have == !coin.IsSpent());
+                BOOST_CHECK(coin == it->second);
             }
         }
 
@@ -347,4 +399,113 @@ BOOST_AUTO_TEST_CASE(updatecoins_simulation_test)
     BOOST_CHECK(spent_a_duplicate_coinbase);
 }
 
+BOOST_AUTO_TEST_CASE(coin_serialization)
+{
+    // Good example
+    CDataStream ss1(ParseHex("97f23c835800816115944e077fe7c803cfa57f29b36bf87c1d35"), SER_DISK, CLIENT_VERSION);
+    Coin c1;
+    ss1 >> c1;
+    BOOST_CHECK_EQUAL(c1.IsCoinBase(), false);
+    BOOST_CHECK_EQUAL(c1.nHeight, 203998U);
+    BOOST_CHECK_EQUAL(c1.out.nValue, 60000000000ULL);
+    BOOST_CHECK_EQUAL(HexStr(c1.out.scriptPubKey), HexStr(GetScriptForDestination(CKeyID(uint160(ParseHex("816115944e077fe7c803cfa57f29b36bf87c1d35"))))));
+
+    // Good example
+    CDataStream ss2(ParseHex("8ddf77bbd123008c988f1a4a4de2161e0f50aac7f17e7f9555caa4"), SER_DISK, CLIENT_VERSION);
+    Coin c2;
+    ss2 >> c2;
+    BOOST_CHECK_EQUAL(c2.IsCoinBase(), true);
+    BOOST_CHECK_EQUAL(c2.nHeight, 120891U);
+    BOOST_CHECK_EQUAL(c2.out.nValue, 110397);
+    BOOST_CHECK_EQUAL(HexStr(c2.out.scriptPubKey), HexStr(GetScriptForDestination(CKeyID(uint160(ParseHex("8c988f1a4a4de2161e0f50aac7f17e7f9555caa4"))))));
+
+    // Round trip
+    CDataStream ss3(SER_DISK, CLIENT_VERSION);
+    ss3 << c1;
+    BOOST_CHECK_EQUAL(HexStr(ss3.begin(), ss3.end()), "97f23c835800816115944e077fe7c803cfa57f29b36bf87c1d35");
+}
+
+// HFP0 PRF begin
+BOOST_AUTO_TEST_CASE(insertfetchedcoin_test)
+{
+    CCoinsViewTest base;
+    COutPoint outA(GetRandHash(), 0);
+    COutPoint outB(GetRandHash(), 1);
+    {
+        CCoinsViewCacheTest writer(&base);
+        CTxOut txout;
+        txout.nValue = 42;
+        writer.AddCoin(outA, Coin(txout, 1, false), false);
+        BOOST_CHECK(writer.Flush());
+    }
+
+    CCoinsViewCacheTest cache(&base);
+    BOOST_CHECK(cache.GetBackend() == &base);
+
+    // Coins read from the backend behave as if they had been loaded on demand
+    Coin fetched;
+    BOOST_CHECK(cache.GetBackend()->GetCoin(outA, fetched));
+    cache.InsertFetchedCoin(outA, fetched);
+    BOOST_CHECK(cache.HaveCoinInCache(outA));
+    BOOST_CHECK(cache.AccessCoin(outA).out.nValue == 42);
+    cache.SelfTest();
+
+    // An entry that is already cached is left alone
+    CTxOut txoutOther;
+    txoutOther.nValue = 7;
+    Coin other(txoutOther, 1, false);
+    cache.InsertFetchedCoin(outA, other);
+    BOOST_CHECK(cache.AccessCoin(outA).out.nValue == 42);
+
+    // Fetched entries are not dirty, so flushing does not write them back
+    CTxOut txoutBogus;
+    txoutBogus.nValue = 1;
+    Coin bogus(txoutBogus, 1, false);
+    cache.InsertFetchedCoin(outB, bogus);
+    BOOST_CHECK(cache.HaveCoinInCache(outB));
+    cache.SelfTest();
+    BOOST_CHECK(cache.Flush());
+    BOOST_CHECK(!base.HaveCoin(outB));
+    BOOST_CHECK(base.HaveCoin(outA));
+}
+
+BOOST_AUTO_TEST_CASE(coins_db_upgrade)
+{
+    CCoinsViewDBTest db;
+    uint256 txidA = GetRandHash();
+    uint256 txidB = GetRandHash();
+
+    // vout[1] unspent: 600 BTC to a pubkey hash, height 203998
+    db.WriteLegacyCoins(txidA, "0104835800816115944e077fe7c803cfa57f29b36bf87c1d358bb85e");
+    // coinbase with vout[4] and vout[16] unspent, height 120891
+    db.WriteLegacyCoins(txidB, "0109044086ef97d5790061b01caab50f1b8e9c50a5057eb43c2d9563a4eebbd123008c988f1a4a4de2161e0f50aac7f17e7f9555caa486af3b");
+
+    BOOST_CHECK(db.Upgrade());
+    BOOST_CHECK(!db.HaveLegacyCoins(txidA));
+    BOOST_CHECK(!db.HaveLegacyCoins(txidB));
+
+    Coin coin;
+    BOOST_CHECK(!db.HaveCoin(COutPoint(txidA, 0)));
+    BOOST_CHECK(db.GetCoin(COutPoint(txidA, 1), coin));
+    BOOST_CHECK_EQUAL(coin.IsCoinBase(), false);
+    BOOST_CHECK_EQUAL(coin.nHeight, 203998U);
+    BOOST_CHECK_EQUAL(coin.out.nValue, 60000000000ULL);
+    BOOST_CHECK(!db.HaveCoin(COutPoint(txidA, 2)));
+
+    for (unsigned int n = 0; n < 17; n++) {
+        BOOST_CHECK_EQUAL(db.HaveCoin(COutPoint(txidB, n)), n == 4 || n == 16);
+    }
+    BOOST_CHECK(db.GetCoin(COutPoint(txidB, 4), coin));
+    BOOST_CHECK_EQUAL(coin.IsCoinBase(), true);
+    BOOST_CHECK_EQUAL(coin.nHeight, 120891U);
+    BOOST_CHECK_EQUAL(coin.out.nValue, 234925952);
+    BOOST_CHECK(db.GetCoin(COutPoint(txidB, 16), coin));
+    BOOST_CHECK_EQUAL(coin.out.nValue, 110397);
+
+    // Running it again on an upgraded database is a no-op
+    BOOST_CHECK(db.Upgrade());
+    BOOST_CHECK(db.HaveCoin(COutPoint(txidA, 1)));
+}
+// HFP0 PRF end
+
 BOOST_AUTO_TEST_SUITE_END()
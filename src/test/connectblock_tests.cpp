@@ -0,0 +1,134 @@
+// Copyright (c) 2016 The Bitcoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+// HFP0 PRF added file (entire file): pipelined and serial ConnectBlock agree
+#include "chainparams.h"
+#include "consensus/consensus.h"
+#include "consensus/validation.h"
+#include "key.h"
+#include "main.h"
+#include "miner.h"
+#include "script/standard.h"
+#include "test/test_bitcoin.h"
+
+#include <boost/test/unit_test.hpp>
+
+namespace
+{
+struct ConnectBlockSetup : public TestChain100Setup {
+    CScript scriptPubKey;
+
+    ConnectBlockSetup()
+    {
+        scriptPubKey = CScript() << ToByteVector(coinbaseKey.GetPubKey()) << OP_CHECKSIG;
+    }
+
+    ~ConnectBlockSetup()
+    {
+        fPipelineConnect = DEFAULT_PIPELINE_CONNECT;
+        nBlockLockTimeFlags = 0;
+    }
+
+    /** Check a block with txns on top of the tip; returns "valid" or the reject reason */
+    std::string TestBlock(const std::vector<CMutableTransaction>& txns, bool fPipeline)
+    {
+        const CChainParams& chainparams = Params();
+        CBlockTemplate* pblocktemplate = CreateNewBlock(chainparams, scriptPubKey);
+        CBlock& block = pblocktemplate->block;
+        block.vtx.resize(1);
+        BOOST_FOREACH(const CMutableTransaction& tx, txns)
+            block.vtx.push_back(tx);
+        unsigned int extraNonce = 0;
+        IncrementExtraNonce(&block, chainActive.Tip(), extraNonce);
+
+        fPipelineConnect = fPipeline;
+        CValidationState state;
+        bool fValid;
+        {
+            LOCK(cs_main);
+            fValid = TestBlockValidity(state, chainparams, block, chainActive.Tip(), false, false);
+        }
+        fPipelineConnect = DEFAULT_PIPELINE_CONNECT;
+        delete pblocktemplate;
+        return fValid ? "valid" : state.GetRejectReason();
+    }
+
+    /** Both ways of connecting a block must come to the same verdict */
+    std::string TestBlockBothWays(const std::vector<CMutableTransaction>& txns)
+    {
+        std::string strSerial = TestBlock(txns, false);
+        BOOST_CHECK_EQUAL(TestBlock(txns, true), strSerial);
+        return strSerial;
+    }
+};
+}
+
+BOOST_FIXTURE_TEST_SUITE(connectblock_tests, ConnectBlockSetup)
+
+BOOST_AUTO_TEST_CASE(pipelined_connect_valid_block)
+{
+    // A spend and a spend of that spend, inside the same block
+    std::vector<CMutableTransaction> txns;
+    txns.push_back(CreateSpend(coinbaseTxns[0], 0, 40 * COIN));
+    txns.push_back(CreateSpend(txns[0], 0, 39 * COIN));
+    BOOST_CHECK_EQUAL(TestBlockBothWays(txns), "valid");
+
+    fPipelineConnect = true;
+    CBlock block = CreateAndProcessBlock(txns, scriptPubKey);
+    BOOST_CHECK(chainActive.Tip()->GetBlockHash() == block.GetHash());
+
+    LOCK(cs_main);
+    BOOST_CHECK(!pcoinsTip->HaveCoin(txns[0].vin[0].prevout));
+    BOOST_CHECK(!pcoinsTip->HaveCoin(COutPoint(txns[0].GetHash(), 0)));
+    BOOST_CHECK(pcoinsTip->HaveCoin(COutPoint(txns[1].GetHash(), 0)));
+}
+
+BOOST_AUTO_TEST_CASE(pipelined_connect_rejects_like_serial)
+{
+    std::vector<CMutableTransaction> txns;
+
+    // Spending more than the input
+    txns.push_back(CreateSpend(coinbaseTxns[0], 0, 60 * COIN));
+    BOOST_CHECK_EQUAL(TestBlockBothWays(txns), "bad-txns-in-belowout");
+
+    // Spending a coinbase that is one block deep
+    txns[0] = CreateSpend(coinbaseTxns.back(), 0, 10 * COIN);
+    BOOST_CHECK_EQUAL(TestBlockBothWays(txns), "bad-txns-premature-spend-of-coinbase");
+
+    // A bad signature on a spend of a valid spend
+    txns[0] = CreateSpend(coinbaseTxns[0], 0, 10 * COIN);
+    txns.push_back(CreateSpend(txns[0], 0, 10 * COIN));
+    txns[1].vin[0].scriptSig = txns[0].vin[0].scriptSig;
+    BOOST_CHECK(TestBlockBothWays(txns) != "valid");
+
+    // Spending a missing output
+    txns[1] = CreateSpend(txns[0], 0, 10 * COIN);
+    txns[1].vin[0].prevout.n = 1;
+    BOOST_CHECK_EQUAL(TestBlockBothWays(txns), "bad-txns-inputs-missingorspent");
+
+    // The valid spend on its own
+    txns.resize(1);
+    BOOST_CHECK_EQUAL(TestBlockBothWays(txns), "valid");
+}
+
+BOOST_AUTO_TEST_CASE(pipelined_connect_enforces_sequence_locks)
+{
+    // A version 2 spend of the first coinbase, relatively locked for 200 blocks
+    std::vector<CMutableTransaction> txns;
+    txns.push_back(CreateSpend(coinbaseTxns[0], 0, 40 * COIN));
+    txns[0].nVersion = 2;
+    txns[0].vin[0].nSequence = 200;
+    SignInput(txns[0], 0, coinbaseTxns[0].vout[0].scriptPubKey, coinbaseKey);
+    BOOST_CHECK_EQUAL(TestBlockBothWays(txns), "valid");
+
+    nBlockLockTimeFlags = LOCKTIME_VERIFY_SEQUENCE;
+    BOOST_CHECK_EQUAL(TestBlockBothWays(txns), "bad-txns-nonfinal");
+
+    // Once the lock has expired
+    txns[0].vin[0].nSequence = 50;
+    SignInput(txns[0], 0, coinbaseTxns[0].vout[0].scriptPubKey, coinbaseKey);
+    BOOST_CHECK_EQUAL(TestBlockBothWays(txns), "valid");
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -8,6 +8,8 @@
 #include "crypto/sha512.h"
 #include "crypto/hmac_sha256.h"
 #include "crypto/hmac_sha512.h"
+#include "crypto/modified_scrypt_smix.h"   // HFP0 TST added
+#include "hash.h"  // HFP0 PRF added
 #include "random.h"
 #include "utilstrencodings.h"
 #include "test/test_bitcoin.h"
@@ -131,6 +133,22 @@ BOOST_AUTO_TEST_CASE(sha256_testvectors) {
     TestSHA256(test1, "a316d55510b49662420f49d145d42fb83f31ef8dc016aa4e32df049991a91e26");
 }
 
+// HFP0 PRF begin
+BOOST_AUTO_TEST_CASE(sha256d64)
+{
+    // Every lane count, and the leftovers after the multi-way transforms
+    for (int i = 0; i <= 34; i++) {
+        std::vector<unsigned char> in(64 * i), out1(32 * i), out2(32 * i);
+        for (int j = 0; j < 64 * i; j++)
+            in[j] = insecure_rand();
+        for (int j = 0; j < i; j++)
+            CHash256().Write(&in[64 * j], 64).Finalize(&out1[32 * j]);
+        SHA256D64(begin_ptr(out2), begin_ptr(in), i);
+        BOOST_CHECK(out1 == out2);
+    }
+}
+// HFP0 PRF end
+
 BOOST_AUTO_TEST_CASE(sha512_testvectors) {
     TestSHA512("",
                "cf83e1357eefb8bdf1542850d66d8007d620e4050b5715dc83f4a921d36ce9ce"
@@ -248,4 +266,32 @@ BOOST_AUTO_TEST_CASE(hmac_sha512_testvectors) {
                    "b6022cac3c4982b10d5eeb55c3e4de15134676fb6de0446065c97440fa8c6a58");
 }
 
+// HFP0 TST begin: known-answer test for the modified scrypt kernels
+void TestModifiedScrypt(const std::string &hexin, const std::string &hexout) {
+    std::vector<unsigned char> in = ParseHex(hexin);
+    std::vector<unsigned char> out(32);
+    void *V0 = malloc(128 * 1024 * 1024 + 63);
+    BOOST_REQUIRE(V0 != NULL);
+    crypto_1M_1_1_256_scrypt(&in[0], in.size(), V0, &out[0], out.size());
+    free(V0);
+    BOOST_CHECK_EQUAL(HexStr(out), hexout);
+}
+
+BOOST_AUTO_TEST_CASE(modified_scrypt_testvectors) {
+    // 80-byte header 00 01 02 .. 4f, both the portable and (if available) the SIMD kernel must match bit for bit
+    const std::string header = "000102030405060708090a0b0c0d0e0f101112131415161718191a1b1c1d1e1f"
+                               "202122232425262728292a2b2c2d2e2f303132333435363738393a3b3c3d3e3f"
+                               "404142434445464748494a4b4c4d4e4f";
+    const std::string hash = "1c9799f5ce93ff4ac4a812a2e189e6b5787be7368be98bb1def12efe25a4e395";
+    bool fSimd = crypto_scrypt_smix_simd_available();
+    crypto_scrypt_smix_use_simd(false);
+    TestModifiedScrypt(header, hash);
+    if (fSimd) {
+        BOOST_CHECK(crypto_scrypt_smix_use_simd(true));
+        TestModifiedScrypt(header, hash);
+    }
+    crypto_scrypt_smix_use_simd(fSimd);
+}
+// HFP0 TST end
+
 BOOST_AUTO_TEST_SUITE_END()
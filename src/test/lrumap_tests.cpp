@@ -0,0 +1,62 @@
+// Copyright (c) 2016 The Bitcoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+// HFP0 POW added file (entire file): tests for the LRU container used by the PoW hash cache
+#include "lrumap.h"
+
+#include "test/test_bitcoin.h"
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(lrumap_tests, BasicTestingSetup)
+
+BOOST_AUTO_TEST_CASE(lrumap_test)
+{
+    // create a lrumap capped at 3 items
+    lrumap<int, int> map(3);
+    BOOST_CHECK(map.max_size() == 3);
+    BOOST_CHECK(map.empty());
+
+    // fill it up, nothing gets evicted
+    BOOST_CHECK(map.insert(std::make_pair(1, 10)) == 0);
+    BOOST_CHECK(map.insert(std::make_pair(2, 20)) == 0);
+    BOOST_CHECK(map.insert(std::make_pair(3, 30)) == 0);
+    BOOST_CHECK(map.size() == 3);
+
+    // touch 1, so 2 becomes the least recently used
+    int v = 0;
+    BOOST_CHECK(map.get(1, v));
+    BOOST_CHECK(v == 10);
+
+    // inserting a fourth item evicts 2
+    BOOST_CHECK(map.insert(std::make_pair(4, 40)) == 1);
+    BOOST_CHECK(map.size() == 3);
+    BOOST_CHECK(map.count(2) == 0);
+    BOOST_CHECK(!map.get(2, v));
+    BOOST_CHECK(map.count(1) == 1);
+    BOOST_CHECK(map.count(3) == 1);
+    BOOST_CHECK(map.count(4) == 1);
+
+    // re-inserting an existing key updates it without evicting
+    BOOST_CHECK(map.insert(std::make_pair(3, 31)) == 0);
+    BOOST_CHECK(map.get(3, v));
+    BOOST_CHECK(v == 31);
+    BOOST_CHECK(map.size() == 3);
+
+    // shrinking evicts the least recently used items: 1, then 4
+    BOOST_CHECK(map.max_size(1) == 2);
+    BOOST_CHECK(map.size() == 1);
+    BOOST_CHECK(map.count(3) == 1);
+
+    // erase and clear
+    map.max_size(3);
+    map.insert(std::make_pair(5, 50));
+    map.erase(3);
+    BOOST_CHECK(map.size() == 1);
+    BOOST_CHECK(map.count(3) == 0);
+    map.clear();
+    BOOST_CHECK(map.empty());
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -2,6 +2,8 @@
 // Distributed under the MIT software license, see the accompanying
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
+#include "consensus/validation.h"  // HFP0 PRF added
+#include "main.h"  // HFP0 PRF added
 #include "txmempool.h"
 #include "util.h"
 
@@ -317,6 +319,136 @@ BOOST_AUTO_TEST_CASE(MempoolIndexingTest)
     CheckSort<3>(pool, sortedOrder);
 }
 
+// HFP0 PRF begin
+BOOST_AUTO_TEST_CASE(MempoolAncestorIndexingTest)
+{
+    CTxMemPool pool(CFeeRate(0));
+    TestMemPoolEntryHelper entry;
+    entry.hadNoDependencies = true;
+
+    /* 3rd highest fee */
+    CMutableTransaction tx1 = CMutableTransaction();
+    tx1.vout.resize(1);
+    tx1.vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+    tx1.vout[0].nValue = 10 * COIN;
+    pool.addUnchecked(tx1.GetHash(), entry.Fee(10000LL).Priority(10.0).FromTx(tx1));
+
+    /* highest fee */
+    CMutableTransaction tx2 = CMutableTransaction();
+    tx2.vout.resize(1);
+    tx2.vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+    tx2.vout[0].nValue = 2 * COIN;
+    pool.addUnchecked(tx2.GetHash(), entry.Fee(20000LL).Priority(9.0).FromTx(tx2));
+    uint64_t tx2Size = GetSerializeSize(tx2, SER_NETWORK, PROTOCOL_VERSION);
+
+    /* lowest fee */
+    CMutableTransaction tx3 = CMutableTransaction();
+    tx3.vout.resize(1);
+    tx3.vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+    tx3.vout[0].nValue = 5 * COIN;
+    pool.addUnchecked(tx3.GetHash(), entry.Fee(0LL).Priority(100.0).FromTx(tx3));
+
+    /* 2nd highest fee */
+    CMutableTransaction tx4 = CMutableTransaction();
+    tx4.vout.resize(1);
+    tx4.vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+    tx4.vout[0].nValue = 6 * COIN;
+    pool.addUnchecked(tx4.GetHash(), entry.Fee(15000LL).Priority(1.0).FromTx(tx4));
+
+    /* equal fee rate to tx1, but newer */
+    CMutableTransaction tx5 = CMutableTransaction();
+    tx5.vout.resize(1);
+    tx5.vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+    tx5.vout[0].nValue = 11 * COIN;
+    pool.addUnchecked(tx5.GetHash(), entry.Fee(10000LL).FromTx(tx5));
+    BOOST_CHECK_EQUAL(pool.size(), 5);
+
+    std::vector<std::string> sortedOrder;
+    sortedOrder.resize(5);
+    sortedOrder[0] = tx2.GetHash().ToString(); // 20000
+    sortedOrder[1] = tx4.GetHash().ToString(); // 15000
+    // tx1 and tx5 are both 10000
+    // Ties are broken by hash, not timestamp, so determine which
+    // hash comes first.
+    if (tx1.GetHash() < tx5.GetHash()) {
+        sortedOrder[2] = tx1.GetHash().ToString();
+        sortedOrder[3] = tx5.GetHash().ToString();
+    } else {
+        sortedOrder[2] = tx5.GetHash().ToString();
+        sortedOrder[3] = tx1.GetHash().ToString();
+    }
+    sortedOrder[4] = tx3.GetHash().ToString(); // 0
+
+    CheckSort<4>(pool, sortedOrder);
+
+    /* low fee parent with high fee child */
+    /* tx6 (0) -> tx7 (high) */
+    CMutableTransaction tx6 = CMutableTransaction();
+    tx6.vout.resize(1);
+    tx6.vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+    tx6.vout[0].nValue = 20 * COIN;
+    uint64_t tx6Size = GetSerializeSize(tx6, SER_NETWORK, PROTOCOL_VERSION);
+
+    pool.addUnchecked(tx6.GetHash(), entry.Fee(0LL).FromTx(tx6));
+    BOOST_CHECK_EQUAL(pool.size(), 6);
+    // Ties are broken by hash
+    if (tx3.GetHash() < tx6.GetHash())
+        sortedOrder.push_back(tx6.GetHash().ToString());
+    else
+        sortedOrder.insert(sortedOrder.end()-1,tx6.GetHash().ToString());
+
+    CheckSort<4>(pool, sortedOrder);
+
+    CMutableTransaction tx7 = CMutableTransaction();
+    tx7.vin.resize(1);
+    tx7.vin[0].prevout = COutPoint(tx6.GetHash(), 0);
+    tx7.vin[0].scriptSig = CScript() << OP_11;
+    tx7.vout.resize(1);
+    tx7.vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+    tx7.vout[0].nValue = 10 * COIN;
+    uint64_t tx7Size = GetSerializeSize(tx7, SER_NETWORK, PROTOCOL_VERSION);
+
+    /* set the fee to just below tx2's feerate when including ancestor */
+    CAmount fee = (20000/tx2Size)*(tx7Size + tx6Size) - 1;
+
+    pool.addUnchecked(tx7.GetHash(), entry.Fee(fee).FromTx(tx7));
+    BOOST_CHECK_EQUAL(pool.size(), 7);
+    sortedOrder.insert(sortedOrder.begin()+1, tx7.GetHash().ToString());
+    CheckSort<4>(pool, sortedOrder);
+
+    CTxMemPool::txiter it7 = pool.mapTx.find(tx7.GetHash());
+    BOOST_CHECK_EQUAL(it7->GetCountWithAncestors(), 2);
+    BOOST_CHECK_EQUAL(it7->GetSizeWithAncestors(), tx6Size + tx7Size);
+    BOOST_CHECK_EQUAL(it7->GetModFeesWithAncestors(), fee);
+    BOOST_CHECK_EQUAL(it7->GetSigOpCountWithAncestors(), 2);
+
+    /* prioritising the parent raises the package */
+    pool.PrioritiseTransaction(tx6.GetHash(), tx6.GetHash().ToString(), 0, 1000);
+    it7 = pool.mapTx.find(tx7.GetHash());
+    BOOST_CHECK_EQUAL(it7->GetModFeesWithAncestors(), fee + 1000);
+    pool.PrioritiseTransaction(tx6.GetHash(), tx6.GetHash().ToString(), 0, -1000);
+
+    /* after tx6 is mined, tx7 should move up in the sort */
+    std::vector<CTransaction> vtx;
+    vtx.push_back(tx6);
+    std::list<CTransaction> dummy;
+    pool.removeForBlock(vtx, 1, dummy, false);
+
+    sortedOrder.erase(sortedOrder.begin()+1);
+    // Ties are broken by hash
+    if (tx3.GetHash() < tx6.GetHash())
+        sortedOrder.pop_back();
+    else
+        sortedOrder.erase(sortedOrder.end()-2);
+    sortedOrder.insert(sortedOrder.begin(), tx7.GetHash().ToString());
+    CheckSort<4>(pool, sortedOrder);
+
+    it7 = pool.mapTx.find(tx7.GetHash());
+    BOOST_CHECK_EQUAL(it7->GetCountWithAncestors(), 1);
+    BOOST_CHECK_EQUAL(it7->GetSizeWithAncestors(), tx7Size);
+}
+// HFP0 PRF end
+
 
 BOOST_AUTO_TEST_CASE(MempoolSizeLimitTest)
 {
@@ -473,4 +605,130 @@ BOOST_AUTO_TEST_CASE(MempoolSizeLimitTest)
     SetMockTime(0);
 }
 
+// HFP0 TST begin
+BOOST_AUTO_TEST_CASE(MempoolShortIdTest)
+{
+    // The xthin short id index follows additions and removals
+    CTxMemPool pool(CFeeRate(0));
+    TestMemPoolEntryHelper entry;
+    std::list<CTransaction> removed;
+    uint256 hash;
+
+    CMutableTransaction tx[3];
+    for (int i = 0; i < 3; i++) {
+        tx[i].vin.resize(1);
+        tx[i].vin[0].scriptSig = CScript() << OP_11;
+        tx[i].vout.resize(1);
+        tx[i].vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+        tx[i].vout[0].nValue = 10000LL * (i + 1);
+        pool.addUnchecked(tx[i].GetHash(), entry.FromTx(tx[i]));
+    }
+    for (int i = 0; i < 3; i++) {
+        BOOST_CHECK_EQUAL(pool.lookupShortId(tx[i].GetHash().GetCheapHash(), hash), 1U);
+        BOOST_CHECK(hash == tx[i].GetHash());
+    }
+
+    pool.remove(tx[1], removed, true);
+    BOOST_CHECK_EQUAL(pool.lookupShortId(tx[1].GetHash().GetCheapHash(), hash), 0U);
+    BOOST_CHECK_EQUAL(pool.lookupShortId(tx[2].GetHash().GetCheapHash(), hash), 1U);
+    BOOST_CHECK(hash == tx[2].GetHash());
+
+    pool.clear();
+    BOOST_CHECK_EQUAL(pool.lookupShortId(tx[0].GetHash().GetCheapHash(), hash), 0U);
+}
+// HFP0 TST end
+
+// HFP0 PRF begin
+BOOST_FIXTURE_TEST_CASE(MempoolPersistTest, TestChain100Setup)
+{
+    // A spend of a mature coinbase, and a spend of that
+    int64_t nTimeBase = GetTime() - 100;
+    std::vector<CMutableTransaction> txns(2);
+    for (unsigned int i = 0; i < txns.size(); i++) {
+        const CTransaction prev = i == 0 ? CTransaction(coinbaseTxns[0]) : CTransaction(txns[i - 1]);
+        txns[i] = CreateSpend(prev, 0, prev.vout[0].nValue - 10000);
+
+        LOCK(cs_main);
+        CValidationState state;
+        BOOST_CHECK(AcceptToMemoryPoolWithTime(mempool, state, txns[i], false, NULL, nTimeBase + i));
+    }
+    uint256 hashUnknown = GetRandHash();
+    mempool.PrioritiseTransaction(txns[1].GetHash(), txns[1].GetHash().ToString(), 0.0, 5000);
+    mempool.PrioritiseTransaction(hashUnknown, hashUnknown.ToString(), 1.0, 2000);
+
+    BOOST_CHECK(DumpMempool());
+    mempool.clear();
+    {
+        LOCK(mempool.cs);
+        mempool.mapDeltas.clear();
+    }
+    BOOST_CHECK(LoadMempool());
+
+    {
+        LOCK(mempool.cs);
+        BOOST_CHECK_EQUAL(mempool.mapTx.size(), 2);
+        for (unsigned int i = 0; i < txns.size(); i++) {
+            CTxMemPool::txiter it = mempool.mapTx.find(txns[i].GetHash());
+            BOOST_REQUIRE(it != mempool.mapTx.end());
+            BOOST_CHECK_EQUAL(it->GetTime(), nTimeBase + i);
+            BOOST_CHECK_EQUAL(it->GetModifiedFee(), i == 0 ? 10000 : 15000);
+        }
+        BOOST_CHECK(mempool.mapDeltas.count(hashUnknown));
+        BOOST_CHECK_EQUAL(mempool.mapDeltas[hashUnknown].second, 2000);
+    }
+
+    // Expired transactions are not re-admitted
+    mempool.clear();
+    mapArgs["-mempoolexpiry"] = "0";
+    BOOST_CHECK(LoadMempool());
+    BOOST_CHECK_EQUAL(mempool.size(), 0);
+    mapArgs.erase("-mempoolexpiry");
+}
+
+BOOST_FIXTURE_TEST_CASE(MempoolBatchAcceptTest, TestChain100Setup)
+{
+    mempool.clear();
+    CMutableTransaction parent = CreateSpend(coinbaseTxns[0], 0, 20 * COIN, 2);
+    CMutableTransaction child = CreateSpend(parent, 0, 19 * COIN);
+    CMutableTransaction grandchild = CreateSpend(child, 0, 18 * COIN);
+    // Changing an output after signing invalidates the signature
+    CMutableTransaction badChild = CreateSpend(parent, 1, 19 * COIN);
+    badChild.vout[0].nValue = 18 * COIN;
+    CMutableTransaction orphan = child;
+    orphan.vin[0].prevout = COutPoint(GetRandHash(), 0);
+
+    // The grandchild comes before its parent, and the invalid transaction
+    // before a valid one; neither keeps the others out.
+    std::vector<CTransaction> vtx;
+    vtx.push_back(parent);
+    vtx.push_back(grandchild);
+    vtx.push_back(badChild);
+    vtx.push_back(child);
+    vtx.push_back(orphan);
+
+    LOCK(cs_main);
+    std::vector<bool> vAccepted, vMissingInputs;
+    std::vector<CValidationState> vState;
+    BOOST_CHECK_EQUAL(AcceptToMemoryPoolBatch(mempool, vtx, false, vAccepted, vMissingInputs, vState), 3);
+    BOOST_REQUIRE_EQUAL(vAccepted.size(), vtx.size());
+    BOOST_CHECK(vAccepted[0] && vAccepted[1] && !vAccepted[2] && vAccepted[3] && !vAccepted[4]);
+    BOOST_CHECK(!vMissingInputs[0] && !vMissingInputs[1] && !vMissingInputs[2] && !vMissingInputs[3] && vMissingInputs[4]);
+    int nDoS = 0;
+    BOOST_CHECK(vState[2].IsInvalid(nDoS));
+    BOOST_CHECK_EQUAL(nDoS, 100);
+    BOOST_CHECK(mempool.exists(parent.GetHash()));
+    BOOST_CHECK(mempool.exists(child.GetHash()));
+    BOOST_CHECK(mempool.exists(grandchild.GetHash()));
+    BOOST_CHECK_EQUAL(mempool.size(), 3);
+
+    // Transactions already in are refused
+    vtx.resize(2);
+    BOOST_CHECK_EQUAL(AcceptToMemoryPoolBatch(mempool, vtx, false, vAccepted, vMissingInputs, vState), 0);
+    BOOST_CHECK_EQUAL(vState[0].GetRejectReason(), "txn-already-in-mempool");
+    BOOST_CHECK_EQUAL(vState[1].GetRejectReason(), "txn-already-in-mempool");
+    BOOST_CHECK_EQUAL(mempool.size(), 3);
+    mempool.clear();
+}
+// HFP0 PRF end
+
 BOOST_AUTO_TEST_SUITE_END()
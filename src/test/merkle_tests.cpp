@@ -133,4 +133,24 @@ BOOST_AUTO_TEST_CASE(merkle_test)
     }
 }
 
+// HFP0 PRF begin
+BOOST_AUTO_TEST_CASE(merkle_root_batched)
+{
+    // The level by level root matches the constant-space computation behind the branches
+    for (int i = 0; i < 40; i++) {
+        int nLeaves = (i <= 33) ? i : 34 + (insecure_rand() % 3000);
+        std::vector<uint256> leaves(nLeaves);
+        for (int j = 0; j < nLeaves; j++)
+            leaves[j] = GetRandHash();
+        uint256 root = ComputeMerkleRoot(leaves);
+        if (nLeaves == 0) {
+            BOOST_CHECK(root.IsNull());
+            continue;
+        }
+        int pos = insecure_rand() % nLeaves;
+        BOOST_CHECK(ComputeMerkleRootFromBranch(leaves[pos], ComputeMerkleBranch(leaves, pos), pos) == root);
+    }
+}
+// HFP0 PRF end
+
 BOOST_AUTO_TEST_SUITE_END()
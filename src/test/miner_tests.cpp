@@ -11,6 +11,7 @@
 #include "main.h"
 #include "miner.h"
 #include "pubkey.h"
+#include "random.h"  // HFP0 PRF added
 #include "script/standard.h"
 #include "txmempool.h"
 #include "uint256.h"
@@ -19,6 +20,7 @@
 
 #include "test/test_bitcoin.h"
 
+#include <boost/scoped_ptr.hpp>  // HFP0 PRF added
 #include <boost/test/unit_test.hpp>
 
 BOOST_FIXTURE_TEST_SUITE(miner_tests, TestingSetup)
@@ -88,6 +90,7 @@ BOOST_AUTO_TEST_CASE(CreateNewBlock_validity)
 
     LOCK(cs_main);
     fCheckpointsEnabled = false;
+    mapArgs["-checkblocktemplate"] = "1";  // HFP0 PRF added: the mempool is filled unchecked
 
     // Simple block creation, nothing special yet:
     BOOST_CHECK(pblocktemplate = CreateNewBlock(chainparams, scriptPubKey));
@@ -358,7 +361,223 @@ BOOST_AUTO_TEST_CASE(CreateNewBlock_validity)
         delete tx;
 
     fCheckpointsEnabled = true;
+    mapArgs.erase("-checkblocktemplate");  // HFP0 PRF added
 }
 
+// HFP0 PRF begin
+BOOST_AUTO_TEST_CASE(BlockAssembler_package_selection)
+{
+    CTxMemPool pool(CFeeRate(0));
+    TestMemPoolEntryHelper entry;
+    entry.SigOps(1);
+
+    // A parent paying nothing with a child paying for both, and a lone
+    // transaction with a feerate between the child's own and the package's
+    CMutableTransaction txParent;
+    txParent.vin.resize(1);
+    txParent.vin[0].prevout = COutPoint(GetRandHash(), 0);
+    txParent.vin[0].scriptSig = CScript() << OP_1;
+    txParent.vout.resize(1);
+    txParent.vout[0].scriptPubKey = CScript() << OP_1;
+    txParent.vout[0].nValue = 10 * COIN;
+    pool.addUnchecked(txParent.GetHash(), entry.Fee(0).FromTx(txParent));
+
+    CMutableTransaction txChild;
+    txChild.vin.resize(1);
+    txChild.vin[0].prevout = COutPoint(txParent.GetHash(), 0);
+    txChild.vin[0].scriptSig = CScript() << OP_1;
+    txChild.vout.resize(1);
+    txChild.vout[0].scriptPubKey = CScript() << OP_1;
+    txChild.vout[0].nValue = 9 * COIN;
+    pool.addUnchecked(txChild.GetHash(), entry.Fee(100000).FromTx(txChild));
+
+    CMutableTransaction txLone = txParent;
+    txLone.vin[0].prevout = COutPoint(GetRandHash(), 0);
+    pool.addUnchecked(txLone.GetHash(), entry.Fee(30000).FromTx(txLone));
+
+    LOCK(pool.cs);
+    {
+        CBlockTemplate blocktemplate;
+        blocktemplate.block.vtx.push_back(CTransaction());
+        BlockAssembler assembler(pool, blocktemplate, 1, 0, 1000000, 0, 20000);
+        assembler.AddPackageTxs();
+        BOOST_CHECK_EQUAL(blocktemplate.block.vtx.size(), 4);
+        BOOST_CHECK(blocktemplate.block.vtx[1].GetHash() == txParent.GetHash());
+        BOOST_CHECK(blocktemplate.block.vtx[2].GetHash() == txChild.GetHash());
+        BOOST_CHECK(blocktemplate.block.vtx[3].GetHash() == txLone.GetHash());
+        BOOST_CHECK_EQUAL(assembler.GetFees(), 130000);
+        BOOST_CHECK_EQUAL(assembler.GetBlockTx(), 3);
+    }
+
+    // Without room for the package, the lone transaction still gets in
+    {
+        unsigned int nSize = ::GetSerializeSize(txLone, SER_NETWORK, PROTOCOL_VERSION);
+        CBlockTemplate blocktemplate;
+        blocktemplate.block.vtx.push_back(CTransaction());
+        BlockAssembler assembler(pool, blocktemplate, 1, 0, 1000 + nSize + 1, 0, 20000);
+        assembler.AddPackageTxs();
+        BOOST_CHECK_EQUAL(blocktemplate.block.vtx.size(), 2);
+        BOOST_CHECK(blocktemplate.block.vtx[1].GetHash() == txLone.GetHash());
+    }
+}
+
+static bool TemplateHasTx(const CBlockTemplate& blocktemplate, const CTransaction& tx)
+{
+    BOOST_FOREACH(const CTransaction& txIn, blocktemplate.block.vtx) {
+        if (txIn.GetHash() == tx.GetHash())
+            return true;
+    }
+    return false;
+}
+
+BOOST_FIXTURE_TEST_CASE(BlockTemplateEngine_incremental, TestChain100Setup)
+{
+    const CChainParams& chainparams = Params();
+    CScript scriptPubKey = CScript() << ToByteVector(coinbaseKey.GetPubKey()) << OP_CHECKSIG;
+    // One more block, for a second mature coinbase
+    std::vector<CMutableTransaction> noTxns;
+    CreateAndProcessBlock(noTxns, scriptPubKey);
+
+    CBlockTemplateEngine engine(chainparams, scriptPubKey);
+    RegisterValidationInterface(&engine);
+    CValidationState state;
+    const CAmount nSubsidy = GetBlockSubsidy(chainActive.Height() + 1, chainparams.GetConsensus());
+
+    boost::shared_ptr<CBlockTemplate> pblocktemplate = engine.GetTemplate();
+    BOOST_CHECK_EQUAL(engine.GetRebuildCount(), 1);
+    BOOST_CHECK_EQUAL(pblocktemplate->block.vtx.size(), 1);
+
+    // Transactions entering the mempool are appended, children after their parents
+    CMutableTransaction txParent = CreateSpend(coinbaseTxns[0], 0, coinbaseTxns[0].vout[0].nValue - 10000);
+    CMutableTransaction txChild = CreateSpend(txParent, 0, txParent.vout[0].nValue - 20000);
+    {
+        LOCK(cs_main);
+        BOOST_CHECK(AcceptToMemoryPool(mempool, state, txParent, false, NULL));
+        BOOST_CHECK(AcceptToMemoryPool(mempool, state, txChild, false, NULL));
+    }
+    pblocktemplate = engine.GetTemplate();
+    BOOST_CHECK_EQUAL(engine.GetRebuildCount(), 1);
+    BOOST_CHECK_EQUAL(pblocktemplate->block.vtx.size(), 3);
+    BOOST_CHECK(pblocktemplate->block.vtx[1].GetHash() == txParent.GetHash());
+    BOOST_CHECK(pblocktemplate->block.vtx[2].GetHash() == txChild.GetHash());
+    BOOST_CHECK_EQUAL(pblocktemplate->block.vtx[0].vout[0].nValue, nSubsidy + 30000);
+    BOOST_CHECK_EQUAL(pblocktemplate->vTxFees[0], -30000);
+
+    // ... and the result is still a valid block
+    {
+        CBlock block = pblocktemplate->block;
+        unsigned int nExtraNonce = 0;
+        LOCK(cs_main);
+        IncrementExtraNonce(&block, chainActive.Tip(), nExtraNonce);
+        BOOST_CHECK(TestBlockValidity(state, chainparams, block, chainActive.Tip(), false, false));
+    }
+
+    // A transaction whose parent entered the mempool unannounced makes the
+    // template stale; it is picked up when rebuilt in the background
+    CMutableTransaction txUnannounced = CreateSpend(coinbaseTxns[1], 0, coinbaseTxns[1].vout[0].nValue - 10000);
+    CMutableTransaction txOrphaned = CreateSpend(txUnannounced, 0, txUnannounced.vout[0].nValue - 10000);
+    {
+        LOCK(cs_main);
+        UnregisterValidationInterface(&engine);
+        BOOST_CHECK(AcceptToMemoryPool(mempool, state, txUnannounced, false, NULL));
+        RegisterValidationInterface(&engine);
+        BOOST_CHECK(AcceptToMemoryPool(mempool, state, txOrphaned, false, NULL));
+    }
+    pblocktemplate = engine.GetTemplate();
+    BOOST_CHECK_EQUAL(engine.GetRebuildCount(), 1);
+    BOOST_CHECK(!TemplateHasTx(*pblocktemplate, txOrphaned));
+    engine.RebuildIfStale();
+    BOOST_CHECK_EQUAL(engine.GetRebuildCount(), 2);
+    pblocktemplate = engine.GetTemplate();
+    BOOST_CHECK_EQUAL(pblocktemplate->block.vtx.size(), 5);
+    BOOST_CHECK(TemplateHasTx(*pblocktemplate, txUnannounced));
+    BOOST_CHECK(TemplateHasTx(*pblocktemplate, txOrphaned));
+
+    // Without anything new there is nothing to rebuild
+    engine.RebuildIfStale();
+    BOOST_CHECK_EQUAL(engine.GetRebuildCount(), 2);
+
+    // A transaction leaving the mempool forces a rebuild
+    {
+        std::list<CTransaction> removed;
+        mempool.remove(txChild, removed);
+    }
+    pblocktemplate = engine.GetTemplate();
+    BOOST_CHECK_EQUAL(engine.GetRebuildCount(), 3);
+    BOOST_CHECK(!TemplateHasTx(*pblocktemplate, txChild));
+    BOOST_CHECK(TemplateHasTx(*pblocktemplate, txParent));
+
+    // So does a new tip (the test block's coinbase does not claim the mempool's fees)
+    mempool.clear();
+    CreateAndProcessBlock(noTxns, scriptPubKey);
+    pblocktemplate = engine.GetTemplate();
+    BOOST_CHECK_EQUAL(engine.GetRebuildCount(), 4);
+    BOOST_CHECK(pblocktemplate->block.hashPrevBlock == chainActive.Tip()->GetBlockHash());
+
+    BOOST_CHECK_EQUAL(pblocktemplate->block.vtx.size(), 1);
+    UnregisterValidationInterface(&engine);
+
+    // Too many transactions pending and the template is assembled afresh instead
+    CBlockTemplateEngine engineBehind(chainparams, scriptPubKey, 1);
+    RegisterValidationInterface(&engineBehind);
+    engineBehind.GetTemplate();
+    {
+        LOCK(cs_main);
+        BOOST_CHECK(AcceptToMemoryPool(mempool, state, txParent, false, NULL));
+        BOOST_CHECK(AcceptToMemoryPool(mempool, state, txChild, false, NULL));
+    }
+    pblocktemplate = engineBehind.GetTemplate();
+    BOOST_CHECK_EQUAL(engineBehind.GetRebuildCount(), 2);
+    BOOST_CHECK_EQUAL(pblocktemplate->block.vtx.size(), 3);
+    UnregisterValidationInterface(&engineBehind);
+}
+
+BOOST_FIXTURE_TEST_CASE(CreateNewBlock_template_checks, TestChain100Setup)
+{
+    const CChainParams& chainparams = Params();
+    CScript scriptPubKey = CScript() << ToByteVector(coinbaseKey.GetPubKey()) << OP_CHECKSIG;
+    CValidationState state;
+
+    CMutableTransaction txParent = CreateSpend(coinbaseTxns[0], 0, coinbaseTxns[0].vout[0].nValue - 10000);
+    CMutableTransaction txChild = CreateSpend(txParent, 0, txParent.vout[0].nValue - 20000);
+    {
+        LOCK(cs_main);
+        BOOST_CHECK(AcceptToMemoryPool(mempool, state, txParent, false, NULL));
+        BOOST_CHECK(AcceptToMemoryPool(mempool, state, txChild, false, NULL));
+    }
+
+    // Without and with connecting the block, the same template passes
+    boost::scoped_ptr<CBlockTemplate> pblocktemplate(CreateNewBlock(chainparams, scriptPubKey));
+    BOOST_CHECK_EQUAL(pblocktemplate->block.vtx.size(), 3);
+    mapArgs["-checkblocktemplate"] = "1";
+    boost::scoped_ptr<CBlockTemplate> pblocktemplateConnected(CreateNewBlock(chainparams, scriptPubKey));
+    mapArgs.erase("-checkblocktemplate");
+    BOOST_CHECK_EQUAL(pblocktemplateConnected->block.vtx.size(), 3);
+    BOOST_CHECK(pblocktemplateConnected->block.vtx[0].GetHash() == pblocktemplate->block.vtx[0].GetHash());
+
+    // The checks of the block as a whole remain: a coinbase in the mempool
+    CMutableTransaction txCoinbase;
+    txCoinbase.vin.resize(1);
+    txCoinbase.vin[0].prevout.SetNull();
+    txCoinbase.vin[0].scriptSig = CScript() << OP_0 << OP_1;
+    txCoinbase.vout.resize(1);
+    txCoinbase.vout[0].nValue = COIN;
+    txCoinbase.vout[0].scriptPubKey = scriptPubKey;
+    TestMemPoolEntryHelper entry;
+    CBlockTemplateEngine engine(chainparams, scriptPubKey);
+    RegisterValidationInterface(&engine);
+    engine.GetTemplate();
+    mempool.addUnchecked(txCoinbase.GetHash(), entry.Fee(100000).FromTx(txCoinbase));
+    BOOST_CHECK_THROW(CreateNewBlock(chainparams, scriptPubKey), std::runtime_error);
+
+    // ... including on a template it was appended to, which is not served
+    GetMainSignals().SyncTransaction(txCoinbase, NULL);
+    BOOST_CHECK_THROW(engine.GetTemplate(), std::runtime_error);
+    UnregisterValidationInterface(&engine);
+
+    mempool.clear();
+}
+// HFP0 PRF end
+
 BOOST_AUTO_TEST_SUITE_END()
 // HFP0 RLT (BIP68) end
@@ -95,4 +95,31 @@ BOOST_AUTO_TEST_CASE(GetBlockProofEquivalentTime_test)
     }
 }
 
+// HFP0 TST begin
+BOOST_AUTO_TEST_CASE(midas_interval_cache)
+{
+    SelectParams(CBaseChainParams::MAIN);
+    const Consensus::Params& params = Params().GetConsensus();
+
+    std::vector<CBlockIndex> blocks(1000);
+    for (int i = 0; i < 1000; i++) {
+        blocks[i].pprev = i ? &blocks[i - 1] : NULL;
+        blocks[i].nHeight = i;
+        blocks[i].nTime = 1269211443 + i * params.nPowTargetSpacing + GetRand(2 * params.nPowTargetSpacing) - params.nPowTargetSpacing;
+    }
+
+    // the memoized averages match the walk, also close to genesis and when asked again
+    for (int j = 0; j < 2; j++) {
+        for (int i = 0; i < 1000; i++) {
+            int64_t walk[4], cached[4];
+            avgRecentTimestamps(&blocks[i], &walk[0], &walk[1], &walk[2], &walk[3], params);
+            avgRecentTimestampsCached(&blocks[i], &cached[0], &cached[1], &cached[2], &cached[3], params);
+            for (int k = 0; k < 4; k++)
+                BOOST_CHECK_EQUAL(walk[k], cached[k]);
+            BOOST_CHECK(blocks[i].fMidasIntervalSumsCached);
+        }
+    }
+}
+// HFP0 TST end
+
 BOOST_AUTO_TEST_SUITE_END()
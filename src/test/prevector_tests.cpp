@@ -25,6 +25,9 @@ class prevector_tester {
     typedef prevector<N, T> pretype;
     pretype pre_vector;
 
+    realtype real_vector_alt;
+    pretype pre_vector_alt;
+
     typedef typename pretype::size_type Size;
 
     void test() {
@@ -151,6 +154,12 @@ public:
         pre_vector.shrink_to_fit();
         test();
     }
+
+    void swap() {
+        real_vector.swap(real_vector_alt);
+        pre_vector.swap(pre_vector_alt);
+        test();
+    }
 };
 
 BOOST_AUTO_TEST_CASE(PrevectorTestInt)
@@ -212,6 +221,9 @@ BOOST_AUTO_TEST_CASE(PrevectorTestInt)
             if (((r >> 21) & 512) == 12) {
                 test.assign(insecure_rand() % 32, insecure_rand());
             }
+            if (((r >> 15) % 8) == 3) {
+                test.swap();
+            }
         }
     }
 }
@@ -0,0 +1,111 @@
+// Copyright (c) 2016 The Bitcoin developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+// HFP0 PRF added file (entire file): sharded signature cache
+#include "script/sigcache.h"
+
+#include "key.h"
+#include "primitives/transaction.h"
+#include "script/interpreter.h"
+#include "script/script.h"
+#include "test/test_bitcoin.h"
+
+#include <vector>
+
+#include <boost/atomic.hpp>
+#include <boost/bind.hpp>
+#include <boost/thread.hpp>
+#include <boost/test/unit_test.hpp>
+
+namespace
+{
+struct SigCacheSetup : public BasicTestingSetup {
+    CKey key;
+    CScript scriptPubKey;
+    std::vector<CMutableTransaction> vTx;
+
+    /** Transactions with one signed input each, spending scriptPubKey */
+    SigCacheSetup(int nTx = 16)
+    {
+        key.MakeNewKey(true);
+        scriptPubKey = CScript() << ToByteVector(key.GetPubKey()) << OP_CHECKSIG;
+        for (int i = 0; i < nTx; i++) {
+            CMutableTransaction tx;
+            tx.vin.resize(1);
+            tx.vin[0].prevout.n = i;
+            tx.vout.resize(1);
+            tx.vout[0].nValue = i;
+            TestChain100Setup::SignInput(tx, 0, scriptPubKey, key);
+            vTx.push_back(tx);
+        }
+    }
+
+    bool Verify(const CMutableTransaction& mtx, bool fStore)
+    {
+        CTransaction tx(mtx);
+        return VerifyScript(tx.vin[0].scriptSig, scriptPubKey, SCRIPT_VERIFY_NONE, CachingTransactionSignatureChecker(&tx, 0, fStore));
+    }
+};
+
+void VerifyAll(SigCacheSetup* setup, boost::atomic<bool>* pfOk)
+{
+    for (int nRound = 0; nRound < 4; nRound++)
+        for (unsigned int i = 0; i < setup->vTx.size(); i++)
+            if (!setup->Verify(setup->vTx[i], true))
+                *pfOk = false;
+}
+}
+
+BOOST_FIXTURE_TEST_SUITE(sigcache_tests, SigCacheSetup)
+
+BOOST_AUTO_TEST_CASE(sigcache_hit_and_erase)
+{
+    CScriptCacheStats before = GetSignatureCacheStats();
+    BOOST_CHECK(before.nCapacity > 0);
+
+    // The first check misses and stores, the second one hits
+    BOOST_CHECK(Verify(vTx[0], true));
+    BOOST_CHECK(Verify(vTx[0], true));
+    CScriptCacheStats stats = GetSignatureCacheStats();
+    BOOST_CHECK_EQUAL(stats.nMisses, before.nMisses + 1);
+    BOOST_CHECK_EQUAL(stats.nHits, before.nHits + 1);
+    BOOST_CHECK_EQUAL(stats.nEntries, before.nEntries + 1);
+
+    // A check that does not store removes the entry it hits...
+    BOOST_CHECK(Verify(vTx[0], false));
+    stats = GetSignatureCacheStats();
+    BOOST_CHECK_EQUAL(stats.nHits, before.nHits + 2);
+    BOOST_CHECK_EQUAL(stats.nEntries, before.nEntries);
+
+    // ...and does not add what it misses
+    BOOST_CHECK(Verify(vTx[0], false));
+    stats = GetSignatureCacheStats();
+    BOOST_CHECK_EQUAL(stats.nMisses, before.nMisses + 2);
+    BOOST_CHECK_EQUAL(stats.nEntries, before.nEntries);
+
+    // A different signature hash never hits
+    CMutableTransaction tx = vTx[1];
+    BOOST_CHECK(Verify(tx, true));
+    tx.vout[0].nValue++;
+    BOOST_CHECK(!Verify(tx, true));
+    stats = GetSignatureCacheStats();
+    BOOST_CHECK_EQUAL(stats.nHits, before.nHits + 2);
+}
+
+BOOST_AUTO_TEST_CASE(sigcache_concurrent)
+{
+    boost::atomic<bool> fOk(true);
+    boost::thread_group threads;
+    for (int i = 0; i < 4; i++)
+        threads.create_thread(boost::bind(&VerifyAll, this, &fOk));
+    threads.join_all();
+    BOOST_CHECK(fOk);
+
+    CScriptCacheStats stats = GetSignatureCacheStats();
+    BOOST_CHECK_EQUAL(stats.nHits + stats.nMisses, 4 * 4 * vTx.size());
+    BOOST_CHECK_EQUAL(stats.nEntries, vTx.size());
+    BOOST_CHECK(stats.nEntries <= stats.nCapacity);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -166,6 +166,33 @@ BOOST_AUTO_TEST_CASE(sighash_test)
     #endif
 }
 
+// HFP0 PRF begin
+// Goal: check that precomputed data changes neither the hash nor the bytes counted as hashed
+BOOST_AUTO_TEST_CASE(sighash_precomputed)
+{
+    seed_insecure_rand(false);
+
+    for (int i=0; i<5000; i++) {
+        // Half of them SIGHASH_ALL, which is what the precomputed data speeds up
+        int nHashType = (insecure_rand() % 2) ? (int)SIGHASH_ALL : insecure_rand();
+        CMutableTransaction txMutable;
+        RandomTransaction(txMutable, (nHashType & 0x1f) == SIGHASH_SINGLE);
+        const CTransaction txTo(txMutable);
+        const PrecomputedSighashData precomputed(txTo);
+        CScript scriptCode;
+        RandomScript(scriptCode);
+
+        for (unsigned int nIn = 0; nIn < txTo.vin.size(); nIn++) {
+            size_t nHashed = 0, nHashedPrecomputed = 0;
+            uint256 sh = SignatureHash(scriptCode, txTo, nIn, nHashType, &nHashed);
+            uint256 shp = SignatureHash(scriptCode, txTo, nIn, nHashType, &nHashedPrecomputed, &precomputed);
+            BOOST_CHECK(sh == shp);
+            BOOST_CHECK_EQUAL(nHashed, nHashedPrecomputed);
+        }
+    }
+}
+// HFP0 PRF end
+
 // Goal: check that SignatureHash generates correct hash
 BOOST_AUTO_TEST_CASE(sighash_from_data)
 {
@@ -212,6 +239,10 @@ BOOST_AUTO_TEST_CASE(sighash_from_data)
 
         sh = SignatureHash(scriptCode, tx, nIn, nHashType);
         BOOST_CHECK_MESSAGE(sh.GetHex() == sigHashHex, strTest);
+        // HFP0 PRF added
+        PrecomputedSighashData precomputed(tx);
+        sh = SignatureHash(scriptCode, tx, nIn, nHashType, NULL, &precomputed);
+        BOOST_CHECK_MESSAGE(sh.GetHex() == sigHashHex, strTest);
     }
 }
 BOOST_AUTO_TEST_SUITE_END()
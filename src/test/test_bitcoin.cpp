@@ -9,11 +9,14 @@
 #include "chainparams.h"
 #include "consensus/consensus.h"
 #include "consensus/validation.h"
+#include "crypto/sha256.h"  // HFP0 PRF added
 #include "key.h"
 #include "main.h"
 #include "miner.h"
 #include "pubkey.h"
 #include "random.h"
+#include "script/interpreter.h"  // HFP0 TST added
+#include "script/sigcache.h"  // HFP0 PRF added
 #include "txdb.h"
 #include "txmempool.h"
 #include "ui_interface.h"
@@ -35,8 +38,13 @@ extern void noui_connect();
 
 BasicTestingSetup::BasicTestingSetup(const std::string& chainName)
 {
+        SHA256AutoDetect();  // HFP0 PRF added
         ECC_Start();
         SetupEnvironment();
+        // HFP0 PRF begin
+        InitSignatureCache();
+        InitScriptExecutionCache();
+        // HFP0 PRF end
         SetupNetworking();
         fPrintToDebugLog = false; // don't want to write to debug.log file
         fCheckBlockIndex = true;
@@ -157,6 +165,33 @@ TestChain100Setup::CreateAndProcessBlock(const std::vector<CMutableTransaction>&
     return result;
 }
 
+// HFP0 TST begin
+void
+TestChain100Setup::SignInput(CMutableTransaction& tx, unsigned int nIn, const CScript& scriptPubKey, const CKey& key)
+{
+    std::vector<unsigned char> vchSig;
+    uint256 hash = SignatureHash(scriptPubKey, tx, nIn, SIGHASH_ALL);
+    BOOST_CHECK(key.Sign(hash, vchSig));
+    vchSig.push_back((unsigned char)SIGHASH_ALL);
+    tx.vin[nIn].scriptSig = CScript() << vchSig;
+}
+
+CMutableTransaction
+TestChain100Setup::CreateSpend(const CTransaction& prev, unsigned int n, CAmount nValue, unsigned int nOutputs)
+{
+    CMutableTransaction tx;
+    tx.vin.resize(1);
+    tx.vin[0].prevout = COutPoint(prev.GetHash(), n);
+    tx.vout.resize(nOutputs);
+    for (unsigned int i = 0; i < nOutputs; i++) {
+        tx.vout[i].nValue = nValue;
+        tx.vout[i].scriptPubKey = CScript() << ToByteVector(coinbaseKey.GetPubKey()) << OP_CHECKSIG;
+    }
+    SignInput(tx, 0, prev.vout[n].scriptPubKey, coinbaseKey);
+    return tx;
+}
+// HFP0 TST end
+
 TestChain100Setup::~TestChain100Setup()
 {
 }
@@ -49,6 +49,16 @@ struct TestChain100Setup : public TestingSetup {
     CBlock CreateAndProcessBlock(const std::vector<CMutableTransaction>& txns,
                                  const CScript& scriptPubKey);
 
+    // HFP0 TST begin
+    // Sign input nIn of tx, which spends an output paying to scriptPubKey,
+    // with key and SIGHASH_ALL.
+    static void SignInput(CMutableTransaction& tx, unsigned int nIn, const CScript& scriptPubKey, const CKey& key);
+
+    // Create a transaction spending output n of prev into nOutputs outputs
+    // of nValue each, paying to coinbaseKey and signed by it.
+    CMutableTransaction CreateSpend(const CTransaction& prev, unsigned int n, CAmount nValue, unsigned int nOutputs = 1);
+    // HFP0 TST end
+
     ~TestChain100Setup();
 
     std::vector<CTransaction> coinbaseTxns; // For convenience, coinbase transactions
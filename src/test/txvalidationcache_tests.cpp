@@ -6,9 +6,11 @@
 #include "key.h"
 #include "main.h"
 #include "miner.h"
+#include "policy/policy.h"
 #include "pubkey.h"
 #include "txmempool.h"
 #include "random.h"
+#include "script/sigcache.h"
 #include "script/standard.h"
 #include "test/test_bitcoin.h"
 #include "utiltime.h"
@@ -85,4 +87,61 @@ BOOST_FIXTURE_TEST_CASE(tx_mempool_block_doublespend, TestChain100Setup)
     BOOST_CHECK_EQUAL(mempool.size(), 0);
 }
 
+// HFP0 PRF begin
+BOOST_FIXTURE_TEST_CASE(tx_mempool_block_scriptcache, TestChain100Setup)
+{
+    CScript scriptPubKey = CScript() <<  ToByteVector(coinbaseKey.GetPubKey()) << OP_CHECKSIG;
+
+    CMutableTransaction spend;
+    spend.vin.resize(1);
+    spend.vin[0].prevout.hash = coinbaseTxns[0].GetHash();
+    spend.vin[0].prevout.n = 0;
+    spend.vout.resize(1);
+    spend.vout[0].nValue = 11*CENT;
+    spend.vout[0].scriptPubKey = scriptPubKey;
+
+    // An unsigned spend fails its script, unless the cache says otherwise
+    unsigned int flags = SCRIPT_VERIFY_P2SH;
+    {
+        LOCK(cs_main);
+        CCoinsViewCache view(pcoinsTip);
+        CValidationState state;
+        BOOST_CHECK(!CheckInputs(spend, state, view, true, flags, true, NULL));
+        CacheScriptExecution(spend.GetHash(), flags, 1, 100);
+        BOOST_CHECK(CheckInputs(spend, state, view, true, flags, true, NULL));
+        BOOST_CHECK(!CheckInputs(spend, state, view, true, flags | SCRIPT_VERIFY_DERSIG, true, NULL));
+
+        // The cached cost still counts against the limits
+        ValidationCostTracker costTracker(1, 1000);
+        BOOST_CHECK(CheckInputs(spend, state, view, true, flags, true, &costTracker));
+        BOOST_CHECK_EQUAL(costTracker.GetSigOps(), 1);
+        BOOST_CHECK(!CheckInputs(spend, state, view, true, flags, true, &costTracker));
+    }
+
+    // Sign it for real: accepting it to the mempool caches its scripts
+    // under the flags of the next block, which then skips them.
+    SignInput(spend, 0, scriptPubKey, coinbaseKey);
+
+    // The regtest chain enforces BIP66 and BIP65 by now
+    unsigned int blockFlags = SCRIPT_VERIFY_P2SH | SCRIPT_VERIFY_DERSIG | SCRIPT_VERIFY_CHECKLOCKTIMEVERIFY;
+    BOOST_CHECK(ToMemPool(spend));
+    uint32_t nSigOps, nSighashBytes;
+    BOOST_CHECK(GetCachedScriptExecution(spend.GetHash(), blockFlags, false, nSigOps, nSighashBytes));
+    BOOST_CHECK_EQUAL(nSigOps, 1);
+    BOOST_CHECK(nSighashBytes > 0);
+    // Nothing is cached under the standard flags, which blocks are not checked with
+    BOOST_CHECK(!GetCachedScriptExecution(spend.GetHash(), STANDARD_SCRIPT_VERIFY_FLAGS, false, nSigOps, nSighashBytes));
+
+    CScriptCacheStats before = GetScriptExecutionCacheStats();
+    std::vector<CMutableTransaction> txns;
+    txns.push_back(spend);
+    CBlock block = CreateAndProcessBlock(txns, scriptPubKey);
+    BOOST_CHECK(chainActive.Tip()->GetBlockHash() == block.GetHash());
+    BOOST_CHECK(GetScriptExecutionCacheStats().nHits > before.nHits);
+
+    // Connecting the block used the entry up
+    BOOST_CHECK(!GetCachedScriptExecution(spend.GetHash(), blockFlags, false, nSigOps, nSighashBytes));
+}
+// HFP0 PRF end
+
 BOOST_AUTO_TEST_SUITE_END()
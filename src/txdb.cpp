@@ -8,9 +8,12 @@
 #include "chain.h"
 #include "chainparams.h"
 #include "hash.h"
+#include "init.h"
 #include "main.h"
 #include "pow.h"
+#include "ui_interface.h"
 #include "uint256.h"
+#include "util.h"
 
 #include <stdint.h>
 
@@ -18,6 +21,7 @@
 
 using namespace std;
 
+static const char DB_COIN = 'C';
 static const char DB_COINS = 'c';
 static const char DB_BLOCK_FILES = 'f';
 static const char DB_TXINDEX = 't';
@@ -30,16 +34,102 @@ static const char DB_LAST_BLOCK = 'l';
 
 static const char DB_FORK_ACTIVATION = 'a';
 
+//! Number of records written or erased per batch while upgrading the UTXO database
+static const size_t UPGRADE_BATCH_RECORDS = 200000;
+
+namespace {
+
+/** Key of a per-output record: 'C', txid, VARINT(output index), which sorts by outpoint. */
+struct CoinEntry {
+    COutPoint* outpoint;
+    char key;
+    CoinEntry(const COutPoint* ptr) : outpoint(const_cast<COutPoint*>(ptr)), key(DB_COIN) {}
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion) {
+        READWRITE(key);
+        READWRITE(outpoint->hash);
+        READWRITE(VARINT(outpoint->n));
+    }
+};
+
+/**
+ * Per-transaction record written under the 'c' prefix by older versions. It is
+ * only read, by CCoinsViewDB::Upgrade().
+ *
+ * Serialized format:
+ * - VARINT(nVersion)
+ * - VARINT(nCode)
+ * - unspentness bitvector, for vout[2] and further; least significant byte first
+ * - the non-spent CTxOuts (via CTxOutCompressor)
+ * - VARINT(nHeight)
+ *
+ * The nCode value consists of:
+ * - bit 0: IsCoinBase()
+ * - bit 1: vout[0] is not spent
+ * - bit 2: vout[1] is not spent
+ * - The higher bits encode N, the number of non-zero bytes in the following bitvector.
+ *   - In case both bit 1 and bit 2 are unset, they encode N-1, as there must be at
+ *     least one non-spent output).
+ */
+class CLegacyCoins
+{
+public:
+    bool fCoinBase;
+    std::vector<CTxOut> vout;
+    int nHeight;
+
+    CLegacyCoins() : fCoinBase(false), nHeight(0) {}
+
+    template<typename Stream>
+    void Unserialize(Stream &s, int nType, int nVersion) {
+        unsigned int nCode = 0;
+        // version
+        int nVersionDummy;
+        ::Unserialize(s, VARINT(nVersionDummy), nType, nVersion);
+        // header code
+        ::Unserialize(s, VARINT(nCode), nType, nVersion);
+        fCoinBase = nCode & 1;
+        std::vector<bool> vAvail(2, false);
+        vAvail[0] = (nCode & 2) != 0;
+        vAvail[1] = (nCode & 4) != 0;
+        unsigned int nMaskCode = (nCode / 8) + ((nCode & 6) != 0 ? 0 : 1);
+        // spentness bitmask
+        while (nMaskCode > 0) {
+            unsigned char chAvail = 0;
+            ::Unserialize(s, chAvail, nType, nVersion);
+            for (unsigned int p = 0; p < 8; p++) {
+                bool f = (chAvail & (1 << p)) != 0;
+                vAvail.push_back(f);
+            }
+            if (chAvail != 0)
+                nMaskCode--;
+        }
+        // txouts themself
+        vout.assign(vAvail.size(), CTxOut());
+        for (unsigned int i = 0; i < vAvail.size(); i++) {
+            if (vAvail[i])
+                ::Unserialize(s, REF(CTxOutCompressor(vout[i])), nType, nVersion);
+        }
+        // coinbase height
+        ::Unserialize(s, VARINT(nHeight), nType, nVersion);
+    }
+};
+
+}
+
 CCoinsViewDB::CCoinsViewDB(size_t nCacheSize, bool fMemory, bool fWipe) : db(GetDataDir() / "chainstate", nCacheSize, fMemory, fWipe, false)
 {
 }
 
-bool CCoinsViewDB::GetCoins(const uint256 &txid, CCoins &coins) const {
-    return db.Read(make_pair(DB_COINS, txid), coins);
+bool CCoinsViewDB::GetCoin(const COutPoint &outpoint, Coin &coin) const {
+    return db.Read(CoinEntry(&outpoint), coin);
 }
 
-bool CCoinsViewDB::HaveCoins(const uint256 &txid) const {
-    return db.Exists(make_pair(DB_COINS, txid));
+bool CCoinsViewDB::HaveCoin(const COutPoint &outpoint) const {
+    return db.Exists(CoinEntry(&outpoint));
 }
 
 uint256 CCoinsViewDB::GetBestBlock() const {
@@ -55,10 +145,11 @@ bool CCoinsViewDB::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) {
     size_t changed = 0;
     for (CCoinsMap::iterator it = mapCoins.begin(); it != mapCoins.end();) {
         if (it->second.flags & CCoinsCacheEntry::DIRTY) {
-            if (it->second.coins.IsPruned())
-                batch.Erase(make_pair(DB_COINS, it->first));
+            CoinEntry entry(&it->first);
+            if (it->second.coin.IsSpent())
+                batch.Erase(entry);
             else
-                batch.Write(make_pair(DB_COINS, it->first), it->second.coins);
+                batch.Write(entry, it->second.coin);
             changed++;
         }
         count++;
@@ -68,10 +159,77 @@ bool CCoinsViewDB::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) {
     if (!hashBlock.IsNull())
         batch.Write(DB_BEST_BLOCK, hashBlock);
 
-    LogPrint("coindb", "Committing %u changed transactions (out of %u) to coin database...\n", (unsigned int)changed, (unsigned int)count);
+    LogPrint("coindb", "Committing %u changed transaction outputs (out of %u) to coin database...\n", (unsigned int)changed, (unsigned int)count);
     return db.WriteBatch(batch);
 }
 
+bool CCoinsViewDB::Upgrade() {
+    boost::scoped_ptr<CDBIterator> pcursor(db.NewIterator());
+    pcursor->Seek(make_pair(DB_COINS, uint256()));
+    if (!pcursor->Valid()) {
+        return true;
+    }
+
+    int64_t nStart = GetTimeMillis();
+    LogPrintf("Upgrading UTXO database to per-output records...\n");
+    uiInterface.ShowProgress(_("Upgrading UTXO database"), 0);
+    size_t nTransactions = 0, nOutputs = 0, nBatchSize = 0;
+    int nReportDone = 0;
+    // Each batch moves a run of transactions: it writes their unspent outputs
+    // as 'C' records and erases their 'c' records in one atomic write, so an
+    // interrupted upgrade simply resumes with the records that are left.
+    CDBBatch batch(&db.GetObfuscateKey());
+    while (pcursor->Valid()) {
+        boost::this_thread::interruption_point();
+        if (ShutdownRequested()) {
+            break;
+        }
+        std::pair<char, uint256> key;
+        if (!pcursor->GetKey(key) || key.first != DB_COINS) {
+            break;
+        }
+        if (nTransactions % 256 == 0) {
+            uint32_t high = 0x100 * *key.second.begin() + *(key.second.begin() + 1);
+            int nPercentageDone = (int)(high * 100.0 / 65536.0 + 0.5);
+            uiInterface.ShowProgress(_("Upgrading UTXO database"), nPercentageDone);
+            if (nReportDone < nPercentageDone / 10) {
+                // report max. 10 times per upgrade
+                LogPrintf("[%d%%]...", nPercentageDone);
+                nReportDone = nPercentageDone / 10;
+            }
+        }
+        CLegacyCoins old;
+        if (!pcursor->GetValue(old)) {
+            return error("%s: cannot parse legacy coins record", __func__);
+        }
+        COutPoint outpoint(key.second, 0);
+        for (size_t i = 0; i < old.vout.size(); ++i) {
+            if (!old.vout[i].IsNull() && !old.vout[i].scriptPubKey.IsUnspendable()) {
+                outpoint.n = i;
+                batch.Write(CoinEntry(&outpoint), Coin(old.vout[i], old.nHeight, old.fCoinBase));
+                nOutputs++;
+                nBatchSize++;
+            }
+        }
+        batch.Erase(key);
+        nTransactions++;
+        nBatchSize++;
+        if (nBatchSize > UPGRADE_BATCH_RECORDS) {
+            if (!db.WriteBatch(batch))
+                return error("%s: failed to write upgraded records", __func__);
+            batch.Clear();
+            nBatchSize = 0;
+        }
+        pcursor->Next();
+    }
+    if (!db.WriteBatch(batch))
+        return error("%s: failed to write upgraded records", __func__);
+    uiInterface.ShowProgress("", 100);
+    LogPrintf("[%s]. Upgraded %u transactions (%u outputs) in %dms\n", ShutdownRequested() ? "CANCELLED" : "DONE",
+        (unsigned int)nTransactions, (unsigned int)nOutputs, (int)(GetTimeMillis() - nStart));
+    return true;
+}
+
 CBlockTreeDB::CBlockTreeDB(size_t nCacheSize, bool fMemory, bool fWipe) : CDBWrapper(GetDataDir() / "blocks" / "index", nCacheSize, fMemory, fWipe) {
 }
 
@@ -100,30 +258,35 @@ bool CCoinsViewDB::GetStats(CCoinsStats &stats) const {
        only need read operations on it, use a const-cast to get around
        that restriction.  */
     boost::scoped_ptr<CDBIterator> pcursor(const_cast<CDBWrapper*>(&db)->NewIterator());
-    pcursor->Seek(DB_COINS);
+    pcursor->Seek(DB_COIN);
 
     CHashWriter ss(SER_GETHASH, PROTOCOL_VERSION);
     stats.hashBlock = GetBestBlock();
     ss << stats.hashBlock;
     CAmount nTotalAmount = 0;
+    // Records are sorted by outpoint, so the outputs of a transaction are
+    // adjacent; hash them per transaction as the per-transaction layout did.
+    uint256 prevkey;
+    bool fFirst = true;
     while (pcursor->Valid()) {
         boost::this_thread::interruption_point();
-        std::pair<char, uint256> key;
-        CCoins coins;
-        if (pcursor->GetKey(key) && key.first == DB_COINS) {
-            if (pcursor->GetValue(coins)) {
-                stats.nTransactions++;
-                for (unsigned int i=0; i<coins.vout.size(); i++) {
-                    const CTxOut &out = coins.vout[i];
-                    if (!out.IsNull()) {
-                        stats.nTransactionOutputs++;
-                        ss << VARINT(i+1);
-                        ss << out;
-                        nTotalAmount += out.nValue;
-                    }
+        COutPoint outpoint;
+        CoinEntry entry(&outpoint);
+        Coin coin;
+        if (pcursor->GetKey(entry) && entry.key == DB_COIN) {
+            if (pcursor->GetValue(coin)) {
+                if (fFirst || outpoint.hash != prevkey) {
+                    if (!fFirst)
+                        ss << VARINT(0);
+                    stats.nTransactions++;
+                    prevkey = outpoint.hash;
+                    fFirst = false;
                 }
-                stats.nSerializedSize += 32 + pcursor->GetValueSize();
-                ss << VARINT(0);
+                stats.nTransactionOutputs++;
+                ss << VARINT(outpoint.n+1);
+                ss << coin.out;
+                nTotalAmount += coin.out.nValue;
+                stats.nSerializedSize += pcursor->GetKeySize() + pcursor->GetValueSize();
             } else {
                 return error("CCoinsViewDB::GetStats() : unable to read value");
             }
@@ -132,6 +295,8 @@ bool CCoinsViewDB::GetStats(CCoinsStats &stats) const {
         }
         pcursor->Next();
     }
+    if (!fFirst)
+        ss << VARINT(0);
     {
         LOCK(cs_main);
         stats.nHeight = mapBlockIndex.find(stats.hashBlock)->second->nHeight;
@@ -203,6 +368,8 @@ bool CBlockTreeDB::LoadBlockIndexGuts()
                 pindexNew->nNonce         = diskindex.nNonce;
                 pindexNew->nStatus        = diskindex.nStatus;
                 pindexNew->nTx            = diskindex.nTx;
+                pindexNew->nSize          = diskindex.nSize;      // HFP0 BSZ
+                pindexNew->nSigOps        = diskindex.nSigOps;    // HFP0 BSZ
 
                 // HFP0 FRK, DIF begin: replace consensusParams with computed active POW limit
                 uint256 activePowLimit = Params().GetConsensus().powLimitHistoric;
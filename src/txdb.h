@@ -36,11 +36,18 @@ protected:
 public:
     CCoinsViewDB(size_t nCacheSize, bool fMemory = false, bool fWipe = false);
 
-    bool GetCoins(const uint256 &txid, CCoins &coins) const;
-    bool HaveCoins(const uint256 &txid) const;
+    bool GetCoin(const COutPoint &outpoint, Coin &coin) const;
+    bool HaveCoin(const COutPoint &outpoint) const;
     uint256 GetBestBlock() const;
     bool BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock);
     bool GetStats(CCoinsStats &stats) const;
+
+    /**
+     * Convert the per-transaction records written by older versions to
+     * per-output records. Returns false on error. If a shutdown is requested
+     * part way, the remaining records are converted on the next start.
+     */
+    bool Upgrade();
 };
 
 /** Access to the block database (blocks/index/) */
@@ -130,6 +130,11 @@ public:
      * @note This hash is not stable between little and big endian.
      */
     uint64_t GetHash(const uint256& salt) const;
+
+    /** Salted hash of this value followed by a 32-bit extra word, e.g. an output index.
+     * @note This hash is not stable between little and big endian.
+     */
+    uint64_t GetHash(const uint256& salt, uint32_t extra) const;
 };
 
 /* uint256 from const char *.
@@ -6,65 +6,101 @@
 #ifndef BITCOIN_UNDO_H
 #define BITCOIN_UNDO_H
 
+#include "coins.h"
 #include "compressor.h" 
+#include "consensus/consensus.h"
 #include "primitives/transaction.h"
 #include "serialize.h"
+#include "version.h"
 
 /** Undo information for a CTxIn
  *
- *  Contains the prevout's CTxOut being spent, and if this was the
- *  last output of the affected transaction, its metadata as well
- *  (coinbase or not, height, transaction version)
+ *  Contains the prevout's CTxOut being spent, and its metadata as well
+ *  (coinbase or not, height). The serialization contains a dummy value of
+ *  zero. This is compatible with older versions which expect to see
+ *  the transaction version there.
  */
-class CTxInUndo
+class TxInUndoSerializer
 {
-public:
-    CTxOut txout;         // the txout data before being spent
-    bool fCoinBase;       // if the outpoint was the last unspent: whether it belonged to a coinbase
-    unsigned int nHeight; // if the outpoint was the last unspent: its height
-    int nVersion;         // if the outpoint was the last unspent: its version
-
-    CTxInUndo() : txout(), fCoinBase(false), nHeight(0), nVersion(0) {}
-    CTxInUndo(const CTxOut &txoutIn, bool fCoinBaseIn = false, unsigned int nHeightIn = 0, int nVersionIn = 0) : txout(txoutIn), fCoinBase(fCoinBaseIn), nHeight(nHeightIn), nVersion(nVersionIn) { }
+    const Coin* txout;
 
+public:
     unsigned int GetSerializeSize(int nType, int nVersion) const {
-        return ::GetSerializeSize(VARINT(nHeight*2+(fCoinBase ? 1 : 0)), nType, nVersion) +
-               (nHeight > 0 ? ::GetSerializeSize(VARINT(this->nVersion), nType, nVersion) : 0) +
-               ::GetSerializeSize(CTxOutCompressor(REF(txout)), nType, nVersion);
+        return ::GetSerializeSize(VARINT(txout->nHeight * 2 + (txout->fCoinBase ? 1 : 0)), nType, nVersion) +
+               (txout->nHeight > 0 ? ::GetSerializeSize((unsigned char)0, nType, nVersion) : 0) +
+               ::GetSerializeSize(CTxOutCompressor(REF(txout->out)), nType, nVersion);
     }
 
     template<typename Stream>
     void Serialize(Stream &s, int nType, int nVersion) const {
-        ::Serialize(s, VARINT(nHeight*2+(fCoinBase ? 1 : 0)), nType, nVersion);
-        if (nHeight > 0)
-            ::Serialize(s, VARINT(this->nVersion), nType, nVersion);
-        ::Serialize(s, CTxOutCompressor(REF(txout)), nType, nVersion);
+        ::Serialize(s, VARINT(txout->nHeight * 2 + (txout->fCoinBase ? 1 : 0)), nType, nVersion);
+        if (txout->nHeight > 0) {
+            // Required to maintain compatibility with older undo format.
+            ::Serialize(s, (unsigned char)0, nType, nVersion);
+        }
+        ::Serialize(s, CTxOutCompressor(REF(txout->out)), nType, nVersion);
     }
 
+    TxInUndoSerializer(const Coin* coin) : txout(coin) {}
+};
+
+class TxInUndoDeserializer
+{
+    Coin* txout;
+
+public:
     template<typename Stream>
     void Unserialize(Stream &s, int nType, int nVersion) {
         unsigned int nCode = 0;
         ::Unserialize(s, VARINT(nCode), nType, nVersion);
-        nHeight = nCode / 2;
-        fCoinBase = nCode & 1;
-        if (nHeight > 0)
-            ::Unserialize(s, VARINT(this->nVersion), nType, nVersion);
-        ::Unserialize(s, REF(CTxOutCompressor(REF(txout))), nType, nVersion);
+        txout->nHeight = nCode / 2;
+        txout->fCoinBase = nCode & 1;
+        if (txout->nHeight > 0) {
+            // Old versions stored the version number for the last spend of
+            // a transaction's outputs. Non-final spends were indicated with
+            // height = 0.
+            int nVersionDummy;
+            ::Unserialize(s, VARINT(nVersionDummy), nType, nVersion);
+        }
+        ::Unserialize(s, REF(CTxOutCompressor(REF(txout->out))), nType, nVersion);
     }
+
+    TxInUndoDeserializer(Coin* coin) : txout(coin) {}
 };
 
+static const size_t MAX_INPUTS_PER_BLOCK = MAX_BLOCK_SIZE / ::GetSerializeSize(CTxIn(), SER_NETWORK, PROTOCOL_VERSION);
+
 /** Undo information for a CTransaction */
 class CTxUndo
 {
 public:
     // undo information for all txins
-    std::vector<CTxInUndo> vprevout;
+    std::vector<Coin> vprevout;
 
-    ADD_SERIALIZE_METHODS;
+    unsigned int GetSerializeSize(int nType, int nVersion) const {
+        unsigned int nSize = GetSizeOfCompactSize(vprevout.size());
+        for (unsigned int i = 0; i < vprevout.size(); i++)
+            nSize += ::GetSerializeSize(TxInUndoSerializer(&vprevout[i]), nType, nVersion);
+        return nSize;
+    }
 
-    template <typename Stream, typename Operation>
-    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion) {
-        READWRITE(vprevout);
+    template<typename Stream>
+    void Serialize(Stream &s, int nType, int nVersion) const {
+        // TODO: avoid reimplementing vector serializer
+        WriteCompactSize(s, vprevout.size());
+        for (unsigned int i = 0; i < vprevout.size(); i++)
+            ::Serialize(s, REF(TxInUndoSerializer(&vprevout[i])), nType, nVersion);
+    }
+
+    template<typename Stream>
+    void Unserialize(Stream &s, int nType, int nVersion) {
+        // TODO: avoid reimplementing vector deserializer
+        uint64_t count = ReadCompactSize(s);
+        if (count > MAX_INPUTS_PER_BLOCK)
+            throw std::ios_base::failure("Too many input undo records");
+        vprevout.resize(count);
+        for (unsigned int i = 0; i < vprevout.size(); i++)
+            ::Unserialize(s, REF(TxInUndoDeserializer(&vprevout[i])), nType, nVersion);
     }
 };
 
@@ -23,6 +23,36 @@ int interruptIntervals[] = { 30,       30*12,   30*12*24,   30*12*24*30 };
 
 // BUIP010 Xtreme Thinblocks Variables
 std::map<uint256, uint64_t> mapThinBlockTimer;
+CThinBlockStats thinBlockStats;     // HFP0 XTB added
+
+// HFP0 XTB begin
+void CThinBlockStats::UpdateReconstruction(bool fComplete, int64_t nLookupMicros)
+{
+    LOCK(cs);
+    nReceived++;
+    if (fComplete)
+        nComplete++;
+    nTotalLookupMicros += nLookupMicros;
+    nLastLookupMicros = nLookupMicros;
+}
+
+void CThinBlockStats::UpdateCollision(int64_t nLookupMicros)
+{
+    LOCK(cs);
+    nReceived++;
+    nCollisions++;
+    nTotalLookupMicros += nLookupMicros;
+    nLastLookupMicros = nLookupMicros;
+}
+
+std::string CThinBlockStats::ToString()
+{
+    LOCK(cs);
+    return strprintf("%u xthin blocks received, %u reconstructed from mempool, %u short id collisions, short id lookup %.2fms average %.2fms last",
+        nReceived, nComplete, nCollisions,
+        nReceived ? 0.001 * nTotalLookupMicros / nReceived : 0.0, 0.001 * nLastLookupMicros);
+}
+// HFP0 XTB end
 
 /**
  *  BUIP010 Xtreme Thinblocks Section
@@ -36,4 +36,24 @@ extern void SendXThinBlock(CBlock &block, CNode* pfrom, const CInv &inv);
 extern bool ThinBlockMessageHandler(std::vector<CNode*>& vNodesCopy);
 extern std::map<uint256, uint64_t> mapThinBlockTimer;
 
+// HFP0 XTB begin: xthin block reconstruction statistics
+class CThinBlockStats
+{
+private:
+    CCriticalSection cs;
+    uint64_t nReceived;             //! xthin blocks received
+    uint64_t nComplete;             //! reconstructed without requesting missing transactions
+    uint64_t nCollisions;           //! short id collisions, re-requested as thin blocks
+    int64_t nTotalLookupMicros;     //! time spent matching short ids
+    int64_t nLastLookupMicros;
+
+public:
+    CThinBlockStats() : nReceived(0), nComplete(0), nCollisions(0), nTotalLookupMicros(0), nLastLookupMicros(0) {}
+    void UpdateReconstruction(bool fComplete, int64_t nLookupMicros);
+    void UpdateCollision(int64_t nLookupMicros);
+    std::string ToString();
+};
+extern CThinBlockStats thinBlockStats;
+// HFP0 XTB end
+
 #endif